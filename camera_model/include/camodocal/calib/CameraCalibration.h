@@ -49,12 +49,30 @@ public:
 
     void setVerbose(bool verbose);
 
+    // worker threads for the extrinsic estimates and the ceres solve;
+    // <= 0 uses one per hardware thread
+    void setNumThreads(int numThreads);
+
+    // fast mode: solve on at most this many evenly spaced views, then refine
+    // over all views starting from that solution; 0 solves on all views
+    void setSubsampleCount(int subsampleCount);
+
+    // solve with DENSE_SCHUR, eliminating the per-view translations; the
+    // reduced system holds the rotations (3 tangent parameters per view) and
+    // the intrinsics, 3N + K. Off leaves ceres' default linear solver, as
+    // before, for timing one against the other
+    void setSchurOrdering(bool schurOrdering);
+
 private:
     bool calibrateHelper(CameraPtr& camera,
                          std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const;
 
+    void estimateExtrinsics(const CameraPtr& camera,
+                            std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const;
+
     void optimize(CameraPtr& camera,
-                  std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const;
+                  std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs,
+                  const std::vector<int>& views, int maxIterations) const;
 
     template<typename T>
     void readData(std::ifstream& ifs, T& data) const;
@@ -74,6 +92,9 @@ private:
     Eigen::Matrix2d m_measurementCovariance;
 
     bool m_verbose;
+    int m_numThreads;
+    int m_subsampleCount;
+    bool m_schurOrdering;
 };
 
 }
@@ -1,6 +1,7 @@
 #ifndef CHESSBOARD_H
 #define CHESSBOARD_H
 
+#include <atomic>
 #include <boost/shared_ptr.hpp>
 #include <opencv2/core/core.hpp>
 
@@ -22,6 +23,10 @@ public:
     const std::vector<cv::Point2f>& getCorners(void) const;
     bool cornersFound(void) const;
 
+    // threads used to try the dilation levels; <= 0 uses one per hardware
+    // thread
+    void setNumThreads(int numThreads);
+
     const cv::Mat& getImage(void) const;
     const cv::Mat& getSketch(void) const;
 
@@ -36,6 +41,13 @@ private:
                                        std::vector<cv::Point2f>& corners,
                                        int flags);
 
+    bool findCornersAtDilation(const cv::Mat& img,
+                               const cv::Size& patternSize,
+                               int flags, int k, int dilations, int prevSqrSize,
+                               const std::atomic<int>& bestDilation,
+                               std::vector<ChessboardCornerPtr>& outputCorners,
+                               int& sqrSize);
+
     void cleanFoundConnectedQuads(std::vector<ChessboardQuadPtr>& quadGroup, cv::Size patternSize);
 
     void findConnectedQuads(std::vector<ChessboardQuadPtr>& quads,
@@ -79,6 +91,7 @@ private:
     std::vector<cv::Point2f> mCorners;
     cv::Size mBoardSize;
     bool mCornersFound;
+    int mNumThreads;
 };
 
 }
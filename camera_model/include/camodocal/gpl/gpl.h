@@ -3,6 +3,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <functional>
 #include <opencv2/core/core.hpp>
 
 namespace camodocal
@@ -106,6 +107,11 @@ void UTMtoLL(double utmNorthing, double utmEasting,
 
 long int timestampDiff(uint64_t t1, uint64_t t2);
 
+// Calls fn(i) for every i in [0, n), spread over numThreads worker threads
+// (numThreads <= 0 uses one per hardware thread). Indices are handed out one
+// at a time, so uneven work per index still balances.
+void parallelFor(int n, int numThreads, const std::function<void(int)>& fn);
+
 }
 
 #endif
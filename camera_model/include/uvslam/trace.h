@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <ros/ros.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+// Per-frame latency tracing for feature_tracker, vins_estimator and
+// pose_graph; exported by camera_model, which all three depend on.
+//
+// A span is one pipeline stage on one thread, keyed by the image stamp of the
+// frame it works on (set per thread with TraceFrame). Begin and end are wall
+// clock microseconds, so the traces of the three nodes line up on one machine
+// (scripts/trace_latency.py merges them and computes the image-to-pose
+// latency). Spans are written to a fixed ring without locks; drain() moves
+// them to a Chrome trace / Perfetto JSON file and into the per-stage samples
+// behind percentiles(). Every drain ends the file with the closing bracket and
+// the next one writes over it, so a node stopped by SIGINT, whose destructors
+// never run, still leaves valid JSON. Until enable() everything is a relaxed
+// load.
+class Tracer
+{
+  public:
+    struct Span
+    {
+        const char *name; // string literal
+        double frame;     // image stamp, 0 outside of a frame
+        int64_t begin_us;
+        int64_t dur_us;
+        uint32_t tid;
+    };
+
+    struct Stats
+    {
+        std::string name;
+        size_t count;
+        double total;              // ms, all spans
+        double p50, p90, p99, max; // ms, the last MAX_SAMPLES spans
+    };
+
+    static Tracer &instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    // capacity is rounded up to a power of two; an empty path only keeps the
+    // percentiles
+    void enable(const std::string &process_name, const std::string &path, size_t capacity = 1 << 16)
+    {
+        std::lock_guard<std::mutex> lock(m_drain);
+        if (enabled())
+            return;
+        size_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        ring.reset(new Slot[n]);
+        for (size_t i = 0; i < n; i++)
+            ring[i].seq.store(0, std::memory_order_relaxed);
+        mask = n - 1;
+        pid = getpid();
+        if (!path.empty())
+        {
+            file = fopen(path.c_str(), "w");
+            if (file)
+            {
+                fprintf(file, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+                        pid, process_name.c_str());
+                fputs(FOOTER, file);
+                fflush(file);
+            }
+            else
+                ROS_WARN("cannot write the trace to %s", path.c_str());
+        }
+        on.store(true, std::memory_order_release);
+    }
+
+    bool enabled() const { return on.load(std::memory_order_relaxed); }
+
+    static int64_t nowUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // thread-local image stamp of the frame being processed
+    static double &currentFrame()
+    {
+        static thread_local double frame = 0;
+        return frame;
+    }
+
+    void record(const char *name, double frame, int64_t begin_us, int64_t end_us)
+    {
+        if (!on.load(std::memory_order_acquire))
+            return;
+        static std::atomic<uint32_t> next_tid(1);
+        static thread_local uint32_t tid = next_tid++;
+
+        // seqlock slot: 0 while written, index + 1 once complete
+        uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+        Slot &slot = ring[index & mask];
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.span.name = name;
+        slot.span.frame = frame;
+        slot.span.begin_us = begin_us;
+        slot.span.dur_us = end_us - begin_us;
+        slot.span.tid = tid;
+        slot.seq.store(index + 1, std::memory_order_release);
+    }
+
+    // Moves the complete spans to the file and the samples. Spans the
+    // producers lapped before a drain are counted as dropped.
+    void drain()
+    {
+        std::lock_guard<std::mutex> lock(m_drain);
+        if (!enabled())
+            return;
+        uint64_t end = head.load(std::memory_order_acquire);
+        if (file)
+            fseek(file, -(long)strlen(FOOTER), SEEK_END);
+        if (end - tail > mask + 1)
+        {
+            dropped += end - tail - (mask + 1);
+            tail = end - (mask + 1);
+        }
+        for (; tail < end; tail++)
+        {
+            Slot &slot = ring[tail & mask];
+            uint64_t seq = slot.seq.load(std::memory_order_acquire);
+            if (seq < tail + 1)
+                break; // still being written, next drain
+            Span span = slot.span;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq != tail + 1 || slot.seq.load(std::memory_order_relaxed) != seq)
+            {
+                dropped++;
+                continue;
+            }
+            if (file)
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%lld,\"dur\":%lld,"
+                              "\"args\":{\"frame\":%.6f}}",
+                        span.name, pid, span.tid, (long long)span.begin_us, (long long)span.dur_us, span.frame);
+            Samples &s = samples[span.name];
+            if (s.ms.size() < MAX_SAMPLES)
+                s.ms.push_back(span.dur_us * 1e-3f);
+            else
+                s.ms[s.next] = span.dur_us * 1e-3f;
+            s.next = (s.next + 1) % MAX_SAMPLES;
+            s.count++;
+            s.total += span.dur_us * 1e-3;
+        }
+        if (file)
+        {
+            fputs(FOOTER, file);
+            fflush(file);
+        }
+    }
+
+    // per stage over its last MAX_SAMPLES spans
+    std::vector<Stats> percentiles()
+    {
+        std::lock_guard<std::mutex> lock(m_drain);
+        std::vector<Stats> stats;
+        std::vector<float> sorted;
+        for (auto &it : samples)
+        {
+            sorted = it.second.ms;
+            if (sorted.empty())
+                continue;
+            std::sort(sorted.begin(), sorted.end());
+            auto at = [&](double q) { return (double)sorted[std::min(sorted.size() - 1, (size_t)(q * sorted.size()))]; };
+            stats.push_back({it.first, it.second.count, it.second.total, at(0.5), at(0.9), at(0.99), (double)sorted.back()});
+        }
+        return stats;
+    }
+
+    uint64_t droppedSpans() const { return dropped; }
+
+    ~Tracer()
+    {
+        drain();
+        if (file)
+            fclose(file);
+    }
+
+  private:
+    static const size_t MAX_SAMPLES = 1024;
+    static constexpr const char *FOOTER = "\n]\n";
+
+    struct Slot
+    {
+        std::atomic<uint64_t> seq;
+        Span span;
+    };
+
+    struct Samples
+    {
+        std::vector<float> ms;
+        size_t next = 0;
+        size_t count = 0;
+        double total = 0;
+    };
+
+    Tracer() {}
+
+    std::atomic<bool> on{false};
+    std::unique_ptr<Slot[]> ring;
+    uint64_t mask = 0;
+    std::atomic<uint64_t> head{0};
+
+    // consumer side, under m_drain
+    std::mutex m_drain;
+    uint64_t tail = 0;
+    uint64_t dropped = 0;
+    FILE *file = nullptr;
+    int pid = 0;
+    std::map<std::string, Samples> samples;
+};
+
+// Spans recorded on this thread while it lives belong to the frame with this
+// image stamp.
+class TraceFrame
+{
+  public:
+    explicit TraceFrame(double stamp) : previous(Tracer::currentFrame()) { Tracer::currentFrame() = stamp; }
+    ~TraceFrame() { Tracer::currentFrame() = previous; }
+
+  private:
+    double previous;
+};
+
+// Times the enclosing scope, or up to stop(), as the stage name (a string
+// literal) of the current frame.
+class TraceSpan
+{
+  public:
+    explicit TraceSpan(const char *_name) : name(_name), begin_us(Tracer::instance().enabled() ? Tracer::nowUs() : -1) {}
+    ~TraceSpan() { stop(); }
+
+    void stop()
+    {
+        if (begin_us < 0)
+            return;
+        Tracer::instance().record(name, Tracer::currentFrame(), begin_us, Tracer::nowUs());
+        begin_us = -1;
+    }
+
+  private:
+    const char *name;
+    int64_t begin_us;
+};
+
+// Enables the tracer for this node, writing <dir>/<node>.json when dir is
+// set, and returns the timer that drains it every period seconds and
+// publishes the stage percentiles on /diagnostics. Keep the timer alive.
+inline ros::Timer startTracing(ros::NodeHandle &n, const std::string &node, const std::string &dir, double period)
+{
+    std::string path;
+    if (!dir.empty())
+        path = dir + (dir.back() == '/' ? "" : "/") + node + ".json";
+    Tracer::instance().enable(node, path);
+    ROS_INFO("tracing %s%s%s", node.c_str(), path.empty() ? "" : " to ", path.c_str());
+
+    ros::Publisher pub = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+    return n.createTimer(ros::Duration(period), [pub, node](const ros::TimerEvent &) {
+        Tracer &tracer = Tracer::instance();
+        tracer.drain();
+        diagnostic_msgs::DiagnosticArray msg;
+        msg.header.stamp = ros::Time::now();
+        diagnostic_msgs::DiagnosticStatus status;
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.name = node + ": stage latency";
+        status.hardware_id = node;
+        status.message = "p50 / p90 / p99 / max ms over the last spans";
+        char value[96];
+        for (const Tracer::Stats &s : tracer.percentiles())
+        {
+            diagnostic_msgs::KeyValue kv;
+            kv.key = s.name;
+            snprintf(value, sizeof(value), "%.2f / %.2f / %.2f / %.2f (%zu spans)", s.p50, s.p90, s.p99, s.max, s.count);
+            kv.value = value;
+            status.values.push_back(kv);
+        }
+        if (tracer.droppedSpans())
+        {
+            status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+            diagnostic_msgs::KeyValue kv;
+            kv.key = "dropped spans";
+            kv.value = std::to_string(tracer.droppedSpans());
+            status.values.push_back(kv);
+        }
+        msg.status.push_back(status);
+        pub.publish(msg);
+    });
+}
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <algorithm>
 #include <fstream>
+#include <thread>
 #include <opencv2/core/core.hpp>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -15,6 +16,7 @@
 #include "camodocal/sparse_graph/Transform.h"
 #include "camodocal/gpl/EigenQuaternionParameterization.h"
 #include "camodocal/gpl/EigenUtils.h"
+#include "camodocal/gpl/gpl.h"
 #include "camodocal/camera_models/CostFunctionFactory.h"
 
 #include "ceres/ceres.h"
@@ -25,6 +27,9 @@ CameraCalibration::CameraCalibration()
  : m_boardSize(cv::Size(0,0))
  , m_squareSize(0.0f)
  , m_verbose(false)
+ , m_numThreads(1)
+ , m_subsampleCount(0)
+ , m_schurOrdering(true)
 {
 
 }
@@ -37,6 +42,9 @@ CameraCalibration::CameraCalibration(const Camera::ModelType modelType,
  : m_boardSize(boardSize)
  , m_squareSize(squareSize)
  , m_verbose(false)
+ , m_numThreads(1)
+ , m_subsampleCount(0)
+ , m_schurOrdering(true)
 {
     m_camera = CameraFactory::instance()->generateCamera(modelType, cameraName, imageSize);
 }
@@ -421,6 +429,24 @@ CameraCalibration::setVerbose(bool verbose)
     m_verbose = verbose;
 }
 
+void
+CameraCalibration::setNumThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+void
+CameraCalibration::setSubsampleCount(int subsampleCount)
+{
+    m_subsampleCount = subsampleCount;
+}
+
+void
+CameraCalibration::setSchurOrdering(bool schurOrdering)
+{
+    m_schurOrdering = schurOrdering;
+}
+
 bool
 CameraCalibration::calibrateHelper(CameraPtr& camera,
                                    std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const
@@ -429,13 +455,14 @@ CameraCalibration::calibrateHelper(CameraPtr& camera,
     tvecs.assign(m_scenePoints.size(), cv::Mat());
 
     // STEP 1: Estimate intrinsics
+    double t_stage = timeInSeconds();
     camera->estimateIntrinsics(m_boardSize, m_scenePoints, m_imagePoints);
+    double t_intrinsics = timeInSeconds() - t_stage;
 
     // STEP 2: Estimate extrinsics
-    for (size_t i = 0; i < m_scenePoints.size(); ++i)
-    {
-        camera->estimateExtrinsics(m_scenePoints.at(i), m_imagePoints.at(i), rvecs.at(i), tvecs.at(i));
-    }
+    t_stage = timeInSeconds();
+    estimateExtrinsics(camera, rvecs, tvecs);
+    double t_extrinsics = timeInSeconds() - t_stage;
 
     if (m_verbose)
     {
@@ -447,7 +474,37 @@ CameraCalibration::calibrateHelper(CameraPtr& camera,
     }
 
     // STEP 3: optimization using ceres
-    optimize(camera, rvecs, tvecs);
+    int viewCount = m_scenePoints.size();
+    std::vector<int> allViews(viewCount);
+    for (int i = 0; i < viewCount; ++i)
+    {
+        allViews.at(i) = i;
+    }
+
+    double t_subsample = 0.0;
+    int refineIterations = 1000;
+    if (m_subsampleCount > 0 && viewCount > m_subsampleCount)
+    {
+        std::vector<int> views(m_subsampleCount);
+        for (int i = 0; i < m_subsampleCount; ++i)
+        {
+            views.at(i) = i * viewCount / m_subsampleCount;
+        }
+
+        t_stage = timeInSeconds();
+        optimize(camera, rvecs, tvecs, views, 1000);
+
+        // the skipped views were posed with the initial intrinsics
+        estimateExtrinsics(camera, rvecs, tvecs);
+        t_subsample = timeInSeconds() - t_stage;
+
+        // starting next to the optimum, a few iterations are enough
+        refineIterations = 50;
+    }
+
+    t_stage = timeInSeconds();
+    optimize(camera, rvecs, tvecs, allViews, refineIterations);
+    double t_refine = timeInSeconds() - t_stage;
 
     if (m_verbose)
     {
@@ -456,14 +513,31 @@ CameraCalibration::calibrateHelper(CameraPtr& camera,
                   << err << " pixels" << std::endl;
         std::cout << "[" << camera->cameraName() << "] " << "# INFO: "
                   << camera->parametersToString() << std::endl;
+        std::cout << "[" << camera->cameraName() << "] " << "# INFO: Stage timing: "
+                  << "intrinsics " << t_intrinsics << " sec, "
+                  << "extrinsics " << t_extrinsics << " sec, "
+                  << "subsample solve " << t_subsample << " sec, "
+                  << "full solve " << t_refine << " sec" << std::endl;
     }
 
     return true;
 }
 
+void
+CameraCalibration::estimateExtrinsics(const CameraPtr& camera,
+                                      std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const
+{
+    // every view is posed independently
+    parallelFor(m_scenePoints.size(), m_numThreads, [&](int i)
+    {
+        camera->estimateExtrinsics(m_scenePoints.at(i), m_imagePoints.at(i), rvecs.at(i), tvecs.at(i));
+    });
+}
+
 void
 CameraCalibration::optimize(CameraPtr& camera,
-                            std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const
+                            std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs,
+                            const std::vector<int>& views, int maxIterations) const
 {
     // Use ceres to do optimization
     ceres::Problem problem;
@@ -481,11 +555,20 @@ CameraCalibration::optimize(CameraPtr& camera,
     }
 
     std::vector<double> intrinsicCameraParams;
-    m_camera->writeParameters(intrinsicCameraParams);
+    camera->writeParameters(intrinsicCameraParams);
+
+    // eliminate the per-view translations first, so each linear solve reduces
+    // to a dense system in the rotations and the intrinsics: 3 tangent
+    // parameters per view plus the K intrinsics, 3N + K, not the intrinsics
+    // alone. Every residual touches both halves of its pose, and the
+    // eliminated group has to be an independent set, so only one of them can go
+    ceres::ParameterBlockOrdering* ordering = new ceres::ParameterBlockOrdering;
+    ordering->AddElementToGroup(intrinsicCameraParams.data(), 1);
 
     // create residuals for each observation
-    for (size_t i = 0; i < m_imagePoints.size(); ++i)
+    for (size_t k = 0; k < views.size(); ++k)
     {
+        int i = views.at(k);
         for (size_t j = 0; j < m_imagePoints.at(i).size(); ++j)
         {
             const cv::Point3f& spt = m_scenePoints.at(i).at(j);
@@ -509,12 +592,24 @@ CameraCalibration::optimize(CameraPtr& camera,
 
         problem.SetParameterization(transformVec.at(i).rotationData(),
                                     quaternionParameterization);
+
+        ordering->AddElementToGroup(transformVec.at(i).rotationData(), 1);
+        ordering->AddElementToGroup(transformVec.at(i).translationData(), 0);
     }
 
     std::cout << "begin ceres" << std::endl;
     ceres::Solver::Options options;
-    options.max_num_iterations = 1000;
-    options.num_threads = 1;
+    options.max_num_iterations = maxIterations;
+    options.num_threads = m_numThreads > 0 ? m_numThreads : std::max(1u, std::thread::hardware_concurrency());
+    if (m_schurOrdering)
+    {
+        options.linear_solver_type = ceres::DENSE_SCHUR;
+        options.linear_solver_ordering.reset(ordering);
+    }
+    else
+    {
+        delete ordering;
+    }
 
     if (m_verbose)
     {
@@ -532,8 +627,9 @@ CameraCalibration::optimize(CameraPtr& camera,
 
     camera->readParameters(intrinsicCameraParams);
 
-    for (size_t i = 0; i < rvecs.size(); ++i)
+    for (size_t k = 0; k < views.size(); ++k)
     {
+        int i = views.at(k);
         Eigen::AngleAxisd aa(transformVec.at(i).rotation());
 
         Eigen::Vector3d rvec = aa.angle() * aa.axis();
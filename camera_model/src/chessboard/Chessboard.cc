@@ -5,6 +5,7 @@
 
 #include "camodocal/chessboard/ChessboardQuad.h"
 #include "camodocal/chessboard/Spline.h"
+#include "camodocal/gpl/gpl.h"
 
 #define MAX_CONTOUR_APPROX  7
 
@@ -14,6 +15,7 @@ namespace camodocal
 Chessboard::Chessboard(cv::Size boardSize, cv::Mat& image)
  : mBoardSize(boardSize)
  , mCornersFound(false)
+ , mNumThreads(0)
 {
     if (image.channels() == 1)
     {
@@ -56,6 +58,12 @@ Chessboard::cornersFound(void) const
     return mCornersFound;
 }
 
+void
+Chessboard::setNumThreads(int numThreads)
+{
+    mNumThreads = numThreads;
+}
+
 const cv::Mat&
 Chessboard::getImage(void) const
 {
@@ -173,132 +181,53 @@ Chessboard::findChessboardCornersImproved(const cv::Mat& image,
     // Try one dilation run, but if the pattern is not found, repeat until
     // max_dilations is reached.
 
+    // The dilation levels of one round are independent, so they run in
+    // parallel. The lowest dilation that finds the board wins, as in a
+    // serial scan; attempts at higher dilations give up once one is found.
+    // With a global threshold every round would be the same, so only
+    // adaptive thresholding runs more than one.
+    const int numDilations = maxDilations - minDilations + 1;
+    const int numRounds = (flags & CV_CALIB_CB_ADAPTIVE_THRESH) ? 6 : 1;
+
     int prevSqrSize = 0;
     bool found = false;
     std::vector<ChessboardCornerPtr> outputCorners;
 
-    for (int k = 0; k < 6; ++k)
+    for (int k = 0; k < numRounds && !found; ++k)
     {
-        for (int dilations = minDilations; dilations <= maxDilations; ++dilations)
-        {
-            if (found)
-            {
-                break;
-            }
-
-            cv::Mat thresh_img;
-
-            // convert the input grayscale image to binary (black-n-white)
-            if (flags & CV_CALIB_CB_ADAPTIVE_THRESH)
-            {
-                int blockSize = lround(prevSqrSize == 0 ?
-                    std::min(img.cols,img.rows)*(k%2 == 0 ? 0.2 : 0.1): prevSqrSize*2)|1;
+        std::atomic<int> bestDilation(maxDilations + 1);
+        std::vector<std::vector<ChessboardCornerPtr> > attemptCorners(numDilations);
+        std::vector<int> attemptSqrSize(numDilations, -1);
 
-                // convert to binary
-                cv::adaptiveThreshold(img, thresh_img, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY, blockSize, (k/2)*5);
-            }
-            else
-            {
-                // empiric threshold level
-                double mean = (cv::mean(img))[0];
-                int thresh_level = lround(mean - 10);
-                thresh_level = std::max(thresh_level, 10);
-
-                cv::threshold(img, thresh_img, thresh_level, 255, CV_THRESH_BINARY);
-            }
-
-            // MARTIN's Code
-            // Use both a rectangular and a cross kernel. In this way, a more
-            // homogeneous dilation is performed, which is crucial for small,
-            // distorted checkers. Use the CROSS kernel first, since its action
-            // on the image is more subtle
-            cv::Mat kernel1 = cv::getStructuringElement(CV_SHAPE_CROSS, cv::Size(3,3), cv::Point(1,1));
-            cv::Mat kernel2 = cv::getStructuringElement(CV_SHAPE_RECT, cv::Size(3,3), cv::Point(1,1));
-
-            if (dilations >= 1)
-                cv::dilate(thresh_img, thresh_img, kernel1);
-            if (dilations >= 2)
-                cv::dilate(thresh_img, thresh_img, kernel2);
-            if (dilations >= 3)
-                cv::dilate(thresh_img, thresh_img, kernel1);
-            if (dilations >= 4)
-                cv::dilate(thresh_img, thresh_img, kernel2);
-            if (dilations >= 5)
-                cv::dilate(thresh_img, thresh_img, kernel1);
-            if (dilations >= 6)
-                cv::dilate(thresh_img, thresh_img, kernel2);
-
-            // In order to find rectangles that go to the edge, we draw a white
-            // line around the image edge. Otherwise FindContours will miss those
-            // clipped rectangle contours. The border color will be the image mean,
-            // because otherwise we risk screwing up filters like cvSmooth()
-            cv::rectangle(thresh_img, cv::Point(0,0),
-                          cv::Point(thresh_img.cols - 1, thresh_img.rows - 1),
-                          CV_RGB(255,255,255), 3, 8);
-
-            // Generate quadrangles in the following function
-            std::vector<ChessboardQuadPtr> quads;
-
-            generateQuads(quads, thresh_img, flags, dilations, true);
-            if (quads.empty())
+        parallelFor(numDilations, mNumThreads, [&](int i)
+        {
+            int dilations = minDilations + i;
+            if (findCornersAtDilation(img, patternSize, flags, k, dilations, prevSqrSize,
+                                      bestDilation, attemptCorners.at(i), attemptSqrSize.at(i)))
             {
-                continue;
+                int best = bestDilation;
+                while (dilations < best && !bestDilation.compare_exchange_weak(best, dilations))
+                {
+                }
             }
+        });
 
-            // The following function finds and assigns neighbor quads to every
-            // quadrangle in the immediate vicinity fulfilling certain
-            // prerequisites
-            findQuadNeighbors(quads, dilations);
-
-            // The connected quads will be organized in groups. The following loop
-            // increases a "group_idx" identifier.
-            // The function "findConnectedQuads assigns all connected quads
-            // a unique group ID.
-            // If more quadrangles were assigned to a given group (i.e. connected)
-            // than are expected by the input variable "patternSize", the
-            // function "cleanFoundConnectedQuads" erases the surplus
-            // quadrangles by minimizing the convex hull of the remaining pattern.
-
-            for (int group_idx = 0; ; ++group_idx)
+        if (bestDilation <= maxDilations)
+        {
+            found = true;
+            outputCorners = attemptCorners.at(bestDilation - minDilations);
+        }
+        else
+        {
+            // the next round sizes its threshold block from the highest
+            // dilation that got as far as grouping quads
+            for (int i = numDilations - 1; i >= 0; --i)
             {
-                std::vector<ChessboardQuadPtr> quadGroup;
-
-                findConnectedQuads(quads, quadGroup, group_idx, dilations);
-
-                if (quadGroup.empty())
+                if (attemptSqrSize.at(i) >= 0)
                 {
+                    prevSqrSize = attemptSqrSize.at(i);
                     break;
                 }
-
-                cleanFoundConnectedQuads(quadGroup, patternSize);
-
-                // The following function labels all corners of every quad
-                // with a row and column entry.
-                // "count" specifies the number of found quads in "quad_group"
-                // with group identifier "group_idx"
-                // The last parameter is set to "true", because this is the
-                // first function call and some initializations need to be
-                // made.
-                labelQuadGroup(quadGroup, patternSize, true);
-
-                found = checkQuadGroup(quadGroup, outputCorners, patternSize);
-
-                float sumDist = 0;
-                int total = 0;
-
-                for (int i = 0; i < (int)outputCorners.size(); ++i)
-                {
-                    int ni = 0;
-                    float avgi = outputCorners.at(i)->meanDist(ni);
-                    sumDist += avgi * ni;
-                    total += ni;
-                }
-                prevSqrSize = lround(sumDist / std::max(total, 1));
-
-                if (found && !checkBoardMonotony(outputCorners, patternSize))
-                {
-                    found = false;
-                }
             }
         }
     }
@@ -323,6 +252,143 @@ Chessboard::findChessboardCornersImproved(const cv::Mat& image,
     }
 }
 
+bool
+Chessboard::findCornersAtDilation(const cv::Mat& img,
+                                  const cv::Size& patternSize,
+                                  int flags, int k, int dilations, int prevSqrSize,
+                                  const std::atomic<int>& bestDilation,
+                                  std::vector<ChessboardCornerPtr>& outputCorners,
+                                  int& sqrSize)
+{
+    cv::Mat thresh_img;
+
+    // convert the input grayscale image to binary (black-n-white)
+    if (flags & CV_CALIB_CB_ADAPTIVE_THRESH)
+    {
+        int blockSize = lround(prevSqrSize == 0 ?
+            std::min(img.cols,img.rows)*(k%2 == 0 ? 0.2 : 0.1): prevSqrSize*2)|1;
+
+        // convert to binary
+        cv::adaptiveThreshold(img, thresh_img, 255, CV_ADAPTIVE_THRESH_MEAN_C, CV_THRESH_BINARY, blockSize, (k/2)*5);
+    }
+    else
+    {
+        // empiric threshold level
+        double mean = (cv::mean(img))[0];
+        int thresh_level = lround(mean - 10);
+        thresh_level = std::max(thresh_level, 10);
+
+        cv::threshold(img, thresh_img, thresh_level, 255, CV_THRESH_BINARY);
+    }
+
+    // MARTIN's Code
+    // Use both a rectangular and a cross kernel. In this way, a more
+    // homogeneous dilation is performed, which is crucial for small,
+    // distorted checkers. Use the CROSS kernel first, since its action
+    // on the image is more subtle
+    cv::Mat kernel1 = cv::getStructuringElement(CV_SHAPE_CROSS, cv::Size(3,3), cv::Point(1,1));
+    cv::Mat kernel2 = cv::getStructuringElement(CV_SHAPE_RECT, cv::Size(3,3), cv::Point(1,1));
+
+    if (dilations >= 1)
+        cv::dilate(thresh_img, thresh_img, kernel1);
+    if (dilations >= 2)
+        cv::dilate(thresh_img, thresh_img, kernel2);
+    if (dilations >= 3)
+        cv::dilate(thresh_img, thresh_img, kernel1);
+    if (dilations >= 4)
+        cv::dilate(thresh_img, thresh_img, kernel2);
+    if (dilations >= 5)
+        cv::dilate(thresh_img, thresh_img, kernel1);
+    if (dilations >= 6)
+        cv::dilate(thresh_img, thresh_img, kernel2);
+
+    // In order to find rectangles that go to the edge, we draw a white
+    // line around the image edge. Otherwise FindContours will miss those
+    // clipped rectangle contours. The border color will be the image mean,
+    // because otherwise we risk screwing up filters like cvSmooth()
+    cv::rectangle(thresh_img, cv::Point(0,0),
+                  cv::Point(thresh_img.cols - 1, thresh_img.rows - 1),
+                  CV_RGB(255,255,255), 3, 8);
+
+    if (bestDilation < dilations)
+    {
+        return false;
+    }
+
+    // Generate quadrangles in the following function
+    std::vector<ChessboardQuadPtr> quads;
+
+    generateQuads(quads, thresh_img, flags, dilations, true);
+    if (quads.empty())
+    {
+        return false;
+    }
+
+    // The following function finds and assigns neighbor quads to every
+    // quadrangle in the immediate vicinity fulfilling certain
+    // prerequisites
+    findQuadNeighbors(quads, dilations);
+
+    // The connected quads will be organized in groups. The following loop
+    // increases a "group_idx" identifier.
+    // The function "findConnectedQuads assigns all connected quads
+    // a unique group ID.
+    // If more quadrangles were assigned to a given group (i.e. connected)
+    // than are expected by the input variable "patternSize", the
+    // function "cleanFoundConnectedQuads" erases the surplus
+    // quadrangles by minimizing the convex hull of the remaining pattern.
+
+    bool found = false;
+    for (int group_idx = 0; ; ++group_idx)
+    {
+        if (bestDilation < dilations)
+        {
+            return false;
+        }
+
+        std::vector<ChessboardQuadPtr> quadGroup;
+
+        findConnectedQuads(quads, quadGroup, group_idx, dilations);
+
+        if (quadGroup.empty())
+        {
+            break;
+        }
+
+        cleanFoundConnectedQuads(quadGroup, patternSize);
+
+        // The following function labels all corners of every quad
+        // with a row and column entry.
+        // "count" specifies the number of found quads in "quad_group"
+        // with group identifier "group_idx"
+        // The last parameter is set to "true", because this is the
+        // first function call and some initializations need to be
+        // made.
+        labelQuadGroup(quadGroup, patternSize, true);
+
+        found = checkQuadGroup(quadGroup, outputCorners, patternSize);
+
+        float sumDist = 0;
+        int total = 0;
+
+        for (int i = 0; i < (int)outputCorners.size(); ++i)
+        {
+            int ni = 0;
+            float avgi = outputCorners.at(i)->meanDist(ni);
+            sumDist += avgi * ni;
+            total += ni;
+        }
+        sqrSize = lround(sumDist / std::max(total, 1));
+
+        if (found && !checkBoardMonotony(outputCorners, patternSize))
+        {
+            found = false;
+        }
+    }
+
+    return found;
+}
+
 //===========================================================================
 // ERASE OVERHEAD
 //===========================================================================
@@ -940,6 +1006,48 @@ Chessboard::findQuadNeighbors(std::vector<ChessboardQuadPtr>& quads, int dilatio
     const float thresh_dilation = (float)(2*dilation+3)*(2*dilation+3)*2;    // the "*2" is for the x and y component
                                                                             // the "3" is for initial corner mismatch
 
+    if (quads.empty())
+    {
+        return;
+    }
+
+    // Bucket all quad corners into a grid. A corner can only pair with one
+    // closer than sqrt(edge_len + thresh_dilation) of the current quad, so
+    // each query scans the cells within that radius instead of all quads.
+    // Unlinked corners never move, so the grid stays valid while linking.
+    std::vector<float> edgeLens(quads.size());
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    for (size_t k = 0; k < quads.size(); ++k)
+    {
+        edgeLens.at(k) = quads.at(k)->edge_len;
+        for (int j = 0; j < 4; ++j)
+        {
+            const cv::Point2f& p = quads.at(k)->corners[j]->pt;
+            minX = std::min(minX, p.x);
+            minY = std::min(minY, p.y);
+            maxX = std::max(maxX, p.x);
+            maxY = std::max(maxY, p.y);
+        }
+    }
+    std::nth_element(edgeLens.begin(), edgeLens.begin() + edgeLens.size() / 2, edgeLens.end());
+    const float cellSize = std::max(sqrtf(edgeLens.at(edgeLens.size() / 2) + thresh_dilation), 1.0f);
+    const int gridCols = static_cast<int>((maxX - minX) / cellSize) + 1;
+    const int gridRows = static_cast<int>((maxY - minY) / cellSize) + 1;
+
+    // each entry is k * 4 + j, so scanning a cell in order keeps the
+    // quad-then-corner order of an all-pairs search
+    std::vector<std::vector<int> > grid(gridCols * gridRows);
+    for (size_t k = 0; k < quads.size(); ++k)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            const cv::Point2f& p = quads.at(k)->corners[j]->pt;
+            int col = static_cast<int>((p.x - minX) / cellSize);
+            int row = static_cast<int>((p.y - minY) / cellSize);
+            grid.at(row * gridCols + col).push_back(k * 4 + j);
+        }
+    }
+
     // Find quad neighbors
     for (size_t idx = 0; idx < quads.size(); ++idx)
     {
@@ -951,6 +1059,7 @@ Chessboard::findQuadNeighbors(std::vector<ChessboardQuadPtr>& quads, int dilatio
         {
             float minDist = FLT_MAX;
             int closestCornerIdx = -1;
+            int closestEntry = -1;
             ChessboardQuadPtr closestQuad;
 
             if (curQuad->neighbors[i])
@@ -960,40 +1069,56 @@ Chessboard::findQuadNeighbors(std::vector<ChessboardQuadPtr>& quads, int dilatio
 
             cv::Point2f pt = curQuad->corners[i]->pt;
 
+            float radius = sqrtf(curQuad->edge_len + thresh_dilation) + 1.0f;
+            int col0 = std::max(static_cast<int>((pt.x - radius - minX) / cellSize), 0);
+            int col1 = std::min(static_cast<int>((pt.x + radius - minX) / cellSize), gridCols - 1);
+            int row0 = std::max(static_cast<int>((pt.y - radius - minY) / cellSize), 0);
+            int row1 = std::min(static_cast<int>((pt.y + radius - minY) / cellSize), gridRows - 1);
+
             // Find the closest corner in all other quadrangles
-            for (size_t k = 0; k < quads.size(); ++k)
+            for (int row = row0; row <= row1; ++row)
             {
-                if (k == idx)
+                for (int col = col0; col <= col1; ++col)
                 {
-                    continue;
-                }
+                    const std::vector<int>& cell = grid.at(row * gridCols + col);
+                    for (size_t c = 0; c < cell.size(); ++c)
+                    {
+                        int entry = cell.at(c);
+                        size_t k = entry / 4;
+                        int j = entry % 4;
 
-                ChessboardQuadPtr& quad = quads.at(k);
+                        if (k == idx)
+                        {
+                            continue;
+                        }
 
-                for (int j = 0; j < 4; ++j)
-                {
-                    // If it already has a neighbor
-                    if (quad->neighbors[j])
-                    {
-                        continue;
-                    }
+                        ChessboardQuadPtr& quad = quads.at(k);
 
-                    cv::Point2f dp = pt - quad->corners[j]->pt;
-                    float dist = dp.dot(dp);
+                        // If it already has a neighbor
+                        if (quad->neighbors[j])
+                        {
+                            continue;
+                        }
 
-                    // The following "if" checks, whether "dist" is the
-                    // shortest so far and smaller than the smallest
-                    // edge length of the current and target quads
-                    if (dist < minDist &&
-                        dist <= (curQuad->edge_len + thresh_dilation) &&
-                        dist <= (quad->edge_len + thresh_dilation)   )
-                    {
-                        // Check whether conditions are fulfilled
-                        if (matchCorners(curQuad, i, quad, j))
+                        cv::Point2f dp = pt - quad->corners[j]->pt;
+                        float dist = dp.dot(dp);
+
+                        // The following "if" checks, whether "dist" is the
+                        // shortest so far and smaller than the smallest
+                        // edge length of the current and target quads.
+                        // Ties go to the corner an all-pairs scan meets first.
+                        if ((dist < minDist || (dist == minDist && entry < closestEntry)) &&
+                            dist <= (curQuad->edge_len + thresh_dilation) &&
+                            dist <= (quad->edge_len + thresh_dilation)   )
                         {
-                            closestCornerIdx = j;
-                            closestQuad = quad;
-                            minDist = dist;
+                            // Check whether conditions are fulfilled
+                            if (matchCorners(curQuad, i, quad, j))
+                            {
+                                closestCornerIdx = j;
+                                closestEntry = entry;
+                                closestQuad = quad;
+                                minDist = dist;
+                            }
                         }
                     }
                 }
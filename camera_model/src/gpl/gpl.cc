@@ -1,6 +1,8 @@
 #include "camodocal/gpl/gpl.h"
 
+#include <atomic>
 #include <set>
+#include <thread>
 #ifdef _WIN32
 #include <winsock.h>
 #else
@@ -925,4 +927,40 @@ timestampDiff(uint64_t t1, uint64_t t2)
     }
 }
 
+void
+parallelFor(int n, int numThreads, const std::function<void(int)>& fn)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    numThreads = std::min(numThreads, n);
+
+    if (numThreads <= 1)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<int> next(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < numThreads; ++t)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            for (int i = next++; i < n; i = next++)
+            {
+                fn(i);
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
+    {
+        workers.at(t).join();
+    }
+}
+
 }
@@ -24,6 +24,9 @@ int main(int argc, char** argv)
     bool useOpenCV;
     bool viewResults;
     bool verbose;
+    int numThreads;
+    int subsampleCount;
+    bool noSchur;
 
     //========= Handling Program options =========
     boost::program_options::options_description desc("Allowed options");
@@ -40,6 +43,9 @@ int main(int argc, char** argv)
         ("opencv", boost::program_options::bool_switch(&useOpenCV)->default_value(true), "Use OpenCV to detect corners")
         ("view-results", boost::program_options::bool_switch(&viewResults)->default_value(false), "View results")
         ("verbose,v", boost::program_options::bool_switch(&verbose)->default_value(true), "Verbose output")
+        ("threads,t", boost::program_options::value<int>(&numThreads)->default_value(0), "Number of threads for corner detection and calibration (0: all hardware threads)")
+        ("subsample", boost::program_options::value<int>(&subsampleCount)->default_value(0), "Solve on this many views first, then refine on all views (0: disabled)")
+        ("no-schur", boost::program_options::bool_switch(&noSchur)->default_value(false), "Solve with ceres' default linear solver instead of DENSE_SCHUR, to compare the solve times")
         ;
 
     boost::program_options::positional_options_description pdesc;
@@ -153,35 +159,60 @@ int main(int argc, char** argv)
 
     camodocal::CameraCalibration calibration(modelType, cameraName, frameSize, boardSize, squareSize);
     calibration.setVerbose(verbose);
-
-    std::vector<bool> chessboardFound(imageFilenames.size(), false);
-    for (size_t i = 0; i < imageFilenames.size(); ++i)
+    calibration.setNumThreads(numThreads);
+    calibration.setSubsampleCount(subsampleCount);
+    calibration.setSchurOrdering(!noSchur);
+
+    // detect corners on all images in parallel, then add them in file order
+    double detectStartTime = camodocal::timeInSeconds();
+
+    // vector<bool> packs bits, so concurrent writes to it would race
+    std::vector<char> chessboardFound(imageFilenames.size(), false);
+    std::vector<std::vector<cv::Point2f> > chessboardCorners(imageFilenames.size());
+    std::vector<cv::Mat> sketches(imageFilenames.size());
+    camodocal::parallelFor(imageFilenames.size(), numThreads, [&](int i)
     {
-        image = cv::imread(imageFilenames.at(i), -1);
+        cv::Mat image = cv::imread(imageFilenames.at(i), -1);
 
         camodocal::Chessboard chessboard(boardSize, image);
+        // images are already spread over the threads
+        chessboard.setNumThreads(1);
 
         chessboard.findCorners(useOpenCV);
         if (chessboard.cornersFound())
+        {
+            chessboardCorners.at(i) = chessboard.getCorners();
+            sketches.at(i) = chessboard.getSketch();
+        }
+        chessboardFound.at(i) = chessboard.cornersFound();
+    });
+
+    if (verbose)
+    {
+        std::cerr << "# INFO: Corner detection took "
+                  << std::fixed << std::setprecision(3) << camodocal::timeInSeconds() - detectStartTime
+                  << " sec." << std::endl;
+    }
+
+    for (size_t i = 0; i < imageFilenames.size(); ++i)
+    {
+        if (chessboardFound.at(i))
         {
             if (verbose)
             {
                 std::cerr << "# INFO: Detected chessboard in image " << i + 1 << ", " << imageFilenames.at(i) << std::endl;
             }
 
-            calibration.addChessboardData(chessboard.getCorners());
-
-            cv::Mat sketch;
-            chessboard.getSketch().copyTo(sketch);
+            calibration.addChessboardData(chessboardCorners.at(i));
 
-            cv::imshow("Image", sketch);
+            cv::imshow("Image", sketches.at(i));
             cv::waitKey(50);
+            sketches.at(i).release();
         }
         else if (verbose)
         {
             std::cerr << "# INFO: Did not detect chessboard in image " << i + 1 << std::endl;
         }
-        chessboardFound.at(i) = chessboard.cornersFound();
     }
     cv::destroyWindow("Image");
 
@@ -0,0 +1,168 @@
+#include "frontend_replay.h"
+
+#include "../feature_tracker.h"
+#include "../line_feature_tracker.h"
+#include "../rotation_prior.h"
+#include <uvslam/trace.h>
+
+// img_callback() of feature_tracker_node.cpp, publishing into a ReplayFrame
+struct FrontEndReplay::Impl
+{
+    FeatureTracker trackerData[NUM_OF_CAM];
+    LineFeatureTracker lineTrackerData;
+    RotationPrior rotation_prior;
+
+    double first_image_time = 0;
+    int pub_count = 1;
+    bool first_image_flag = true;
+    double last_image_time = 0;
+    bool init_pub = false;
+};
+
+FrontEndReplay::FrontEndReplay(const std::string &config_file, const std::string &vins_folder) : impl(new Impl())
+{
+    readParameters(config_file, vins_folder);
+    for (int i = 0; i < NUM_OF_CAM; i++)
+    {
+        impl->trackerData[i].readIntrinsicParameter(CAM_NAMES[i]);
+        if (FISHEYE)
+            impl->trackerData[i].fisheye_mask = cv::imread(FISHEYE_MASK, 0);
+    }
+    impl->lineTrackerData.readIntrinsicParameter(CAM_NAMES[0]);
+    impl->rotation_prior.setExtrinsic(RIC);
+    // a few spans per frame, drained after each one
+    Tracer::instance().enable("feature_tracker", "", 1 << 10);
+}
+
+FrontEndReplay::~FrontEndReplay()
+{
+}
+
+bool FrontEndReplay::imuPrior() const
+{
+    return IMU_PRIOR;
+}
+
+bool FrontEndReplay::pointOnly() const
+{
+    return POINT_ONLY;
+}
+
+void FrontEndReplay::addGyro(double t, const Eigen::Vector3d &gyr)
+{
+    impl->rotation_prior.addGyro(t, gyr);
+}
+
+bool FrontEndReplay::process(const cv::Mat &gray, const cv::Mat &color, const cv::Mat &depth, double t,
+                             ReplayFrame &frame)
+{
+    Impl &s = *impl;
+    Tracer::instance().drain();
+    frame.points.clear();
+    frame.lines.clear();
+    frame.restart = false;
+    if (s.first_image_flag)
+    {
+        s.first_image_flag = false;
+        s.first_image_time = t;
+        s.last_image_time = t;
+        return false;
+    }
+    if (t - s.last_image_time > 1.0 || t < s.last_image_time)
+    {
+        ROS_WARN("image discontinue! reset the feature tracker!");
+        s.first_image_flag = true;
+        s.last_image_time = 0;
+        s.pub_count = 1;
+        frame.restart = true;
+        return false;
+    }
+
+    Eigen::Matrix3d R_c0c1;
+    if (IMU_PRIOR && s.rotation_prior.cameraRotation(s.last_image_time, t, R_c0c1))
+    {
+        for (int i = 0; i < NUM_OF_CAM; i++)
+            s.trackerData[i].setRotationPrior(R_c0c1);
+        s.lineTrackerData.setRotationPrior(R_c0c1);
+    }
+    s.last_image_time = t;
+    TraceFrame trace_frame(t);
+
+    if (round(1.0 * s.pub_count / (t - s.first_image_time)) <= FREQ)
+    {
+        PUB_THIS_FRAME = true;
+        if (std::abs(1.0 * s.pub_count / (t - s.first_image_time) - FREQ) < 0.01 * FREQ)
+        {
+            s.first_image_time = t;
+            s.pub_count = 0;
+        }
+    }
+    else
+        PUB_THIS_FRAME = false;
+
+    {
+        TraceSpan t_point_track("point_track");
+        s.trackerData[0].readImage(gray, t);
+    }
+    {
+        TraceSpan t_line_track("line_track");
+        if (ENABLE_DEPTH)
+            s.lineTrackerData.readImage4Line(gray, color, depth, t);
+        else
+            s.lineTrackerData.readImage4Line(gray, color, t);
+    }
+    for (unsigned int i = 0;; i++)
+        if (!s.trackerData[0].updateID(i))
+            break;
+    for (unsigned int i = 0;; i++)
+        if (!s.lineTrackerData.updateID(i))
+            break;
+
+    if (!PUB_THIS_FRAME)
+        return false;
+    s.pub_count++;
+    // the node skips the first published frame, it has no velocities
+    if (!s.init_pub)
+    {
+        s.init_pub = true;
+        return false;
+    }
+
+    // the values go through the float channels of the point cloud
+    TraceSpan t_publish("publish");
+    const FeatureTracker &points = s.trackerData[0];
+    for (unsigned int j = 0; j < points.ids.size(); j++)
+        if (points.track_cnt[j] > 1)
+            frame.points.push_back({points.ids[j] * NUM_OF_CAM,
+                                    {points.cur_un_pts[j].x, points.cur_un_pts[j].y, 1.0,
+                                     points.cur_pts[j].x, points.cur_pts[j].y,
+                                     points.pts_velocity[j].x, points.pts_velocity[j].y}});
+    if (!POINT_ONLY)
+    {
+        const LineFeatureTracker &lines = s.lineTrackerData;
+        for (unsigned int j = 0; j < lines.ids.size(); j++)
+            if (lines.track_cnt[j] > 1)
+                frame.lines.push_back({lines.ids[j],
+                                       {lines.curr_start_un_pts[j].x, lines.curr_start_un_pts[j].y,
+                                        lines.curr_end_un_pts[j].x, lines.curr_end_un_pts[j].y,
+                                        lines.curr_start_pts[j].x, lines.curr_start_pts[j].y,
+                                        lines.curr_end_pts[j].x, lines.curr_end_pts[j].y,
+                                        lines.start_pts_velocity[j].x, lines.start_pts_velocity[j].y,
+                                        lines.end_pts_velocity[j].x, lines.end_pts_velocity[j].y,
+                                        (float)lines.vps[j](0), (float)lines.vps[j](1), (float)lines.vps[j](2)}});
+    }
+    frame.image = s.lineTrackerData.forw_img_color.clone();
+    if (ENABLE_DEPTH)
+        frame.depth = s.lineTrackerData.forw_depth.clone();
+    return true;
+}
+
+std::vector<ReplayStage> FrontEndReplay::stages()
+{
+    Tracer &tracer = Tracer::instance();
+    tracer.drain();
+    std::vector<ReplayStage> stages;
+    for (const Tracer::Stats &s : tracer.percentiles())
+        stages.push_back({s.name, s.count, s.total, s.p50, s.p90, s.p99, s.max});
+    return stages;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <eigen3/Eigen/Dense>
+
+// The feature_tracker node without ROS, for the offline pipeline benchmark
+// (vins_estimator/src/benchmark/uvslam_bench.cpp). The front end and the
+// estimator both define globals such as ROW, COL and WINDOW_SIZE, so this is
+// built into a shared library with hidden symbols; only what is declared
+// here is exported, and it only uses plain and OpenCV / Eigen types.
+#define FRONTEND_REPLAY_API __attribute__((visibility("default")))
+
+// what the node publishes on /feature and latest_img / latest_depth
+struct ReplayFrame
+{
+    // feature id, then x y z (normalized plane) u v velocity_x velocity_y
+    std::vector<std::pair<int, std::array<double, 7>>> points;
+    // line id, then the 15 values of the line channels, in channel order
+    std::vector<std::pair<int, std::array<double, 15>>> lines;
+    cv::Mat image; // undistorted, BGR
+    cv::Mat depth; // undistorted, empty without enable_depth
+    bool restart;  // the node would have restarted the estimator
+};
+
+struct ReplayStage
+{
+    std::string name;
+    size_t count;
+    double total, p50, p90, p99, max; // ms
+};
+
+class FRONTEND_REPLAY_API FrontEndReplay
+{
+  public:
+    // reads the tracker keys of config_file like the node does
+    FrontEndReplay(const std::string &config_file, const std::string &vins_folder);
+    ~FrontEndReplay();
+
+    bool imuPrior() const;
+    bool pointOnly() const;
+    void addGyro(double t, const Eigen::Vector3d &gyr);
+
+    // Tracks one image; false when the node would not publish it (the first
+    // images, frequency control, a discontinuous stream).
+    bool process(const cv::Mat &gray, const cv::Mat &color, const cv::Mat &depth, double t, ReplayFrame &frame);
+
+    // per-stage times of the tracker, see uvslam/trace.h
+    std::vector<ReplayStage> stages();
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
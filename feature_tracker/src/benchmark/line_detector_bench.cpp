@@ -0,0 +1,143 @@
+// Detection time and repeatability of the line detector backends on a
+// directory of images (e.g. EuRoC cam0/data or a TUM rgb folder). Each image
+// is also detected after a known homography (a small rotation, scale and
+// shift); a segment is repeated when its warped copy lies on a segment found
+// in the warped image. Only segments the tracker keeps (>= min_length px)
+// are counted.
+//
+//   line_detector_bench <image_dir> [level] [max_images] [min_length]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../line_detector.h"
+#include "../tic_toc.h"
+
+static cv::Point2f warpPoint(const cv::Matx33d &H, cv::Point2f p)
+{
+    cv::Vec3d q = H * cv::Vec3d(p.x, p.y, 1.0);
+    return cv::Point2f(q[0] / q[2], q[1] / q[2]);
+}
+
+static double pointLineDistance(cv::Point2f p, cv::Point2f a, cv::Point2f b)
+{
+    cv::Point2f d = b - a;
+    return std::fabs(d.x * (p.y - a.y) - d.y * (p.x - a.x)) / std::max(1e-6, cv::norm(d));
+}
+
+// both endpoints within 2 px of b's line, within 3 deg, and half of the
+// shorter segment overlapping
+static bool sameSegment(cv::Point2f s1, cv::Point2f e1, cv::Point2f s2, cv::Point2f e2)
+{
+    cv::Point2f d1 = e1 - s1, d2 = e2 - s2;
+    double l1 = cv::norm(d1), l2 = cv::norm(d2);
+    double cos_angle = std::fabs(d1.dot(d2)) / (l1 * l2);
+    if (cos_angle < std::cos(3.0 * M_PI / 180.0))
+        return false;
+    if (pointLineDistance(s1, s2, e2) > 2.0 || pointLineDistance(e1, s2, e2) > 2.0)
+        return false;
+    double t0 = (s1 - s2).dot(d2) / l2, t1 = (e1 - s2).dot(d2) / l2;
+    double overlap = std::min(std::max(t0, t1), l2) - std::max(std::min(t0, t1), 0.0);
+    return overlap >= 0.5 * std::min(l1, l2);
+}
+
+static void keepLong(std::vector<LineKL> &keylines, double min_length)
+{
+    keylines.erase(std::remove_if(keylines.begin(), keylines.end(),
+                                  [&](const LineKL &kl) { return kl.lineLength < min_length; }),
+                   keylines.end());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("usage: %s <image_dir> [level] [max_images] [min_length]\n", argv[0]);
+        return 1;
+    }
+    int level = argc > 2 ? atoi(argv[2]) : 0;
+    int max_images = argc > 3 ? atoi(argv[3]) : 200;
+    double min_length = argc > 4 ? atof(argv[4]) : 50.0;
+
+    std::vector<cv::String> files, jpg;
+    cv::glob(std::string(argv[1]) + "/*.png", files);
+    cv::glob(std::string(argv[1]) + "/*.jpg", jpg);
+    files.insert(files.end(), jpg.begin(), jpg.end());
+    std::sort(files.begin(), files.end());
+    if ((int)files.size() > max_images)
+    {
+        // spread the sample over the whole sequence
+        std::vector<cv::String> sampled;
+        for (int i = 0; i < max_images; i++)
+            sampled.push_back(files[(size_t)i * files.size() / max_images]);
+        files.swap(sampled);
+    }
+    if (files.empty())
+    {
+        printf("no images in %s\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<cv::Mat> images;
+    for (auto &f : files)
+    {
+        cv::Mat img = cv::imread(f, cv::IMREAD_GRAYSCALE);
+        if (!img.empty())
+            images.push_back(img);
+    }
+    printf("%zu images, level %d, min length %.0f px\n", images.size(), level, min_length);
+
+    cv::Point2f center(images[0].cols / 2.0f, images[0].rows / 2.0f);
+    cv::Mat A = cv::getRotationMatrix2D(center, 5.0, 0.95);
+    cv::Matx33d H(A.at<double>(0, 0), A.at<double>(0, 1), A.at<double>(0, 2) + 4.0,
+                  A.at<double>(1, 0), A.at<double>(1, 1), A.at<double>(1, 2) - 3.0,
+                  0, 0, 1);
+
+    printf("%10s %10s %10s %10s %10s\n", "detector", "mean ms", "max ms", "lines", "repeat");
+    for (int type : {LINE_DETECTOR_EDLINES, LINE_DETECTOR_LSD, LINE_DETECTOR_ELSED})
+    {
+        std::unique_ptr<LineDetector> detector = createLineDetector(type, level);
+        std::vector<LineKL> keylines, warped_keylines;
+        double sum_ms = 0, max_ms = 0;
+        long lines = 0, visible = 0, repeated = 0;
+
+        // warm up the buffers the detector keeps between calls
+        detector->detect(images[0], keylines);
+        for (const cv::Mat &img : images)
+        {
+            TicToc t_detect;
+            detector->detect(img, keylines);
+            double ms = t_detect.toc();
+            sum_ms += ms;
+            max_ms = std::max(max_ms, ms);
+            keepLong(keylines, min_length);
+            lines += keylines.size();
+
+            cv::Mat warped;
+            cv::warpPerspective(img, warped, cv::Mat(H), img.size());
+            detector->detect(warped, warped_keylines);
+            keepLong(warped_keylines, min_length * 0.9);
+
+            cv::Rect inside(2, 2, img.cols - 4, img.rows - 4);
+            for (const LineKL &kl : keylines)
+            {
+                cv::Point2f s = warpPoint(H, kl.getStartPoint()), e = warpPoint(H, kl.getEndPoint());
+                if (!inside.contains(s) || !inside.contains(e))
+                    continue;
+                visible++;
+                for (const LineKL &wkl : warped_keylines)
+                    if (sameSegment(s, e, wkl.getStartPoint(), wkl.getEndPoint()))
+                    {
+                        repeated++;
+                        break;
+                    }
+            }
+        }
+        printf("%10s %10.2f %10.2f %10.1f %10.3f\n", detector->name(), sum_ms / images.size(), max_ms,
+               (double)lines / images.size(), visible ? (double)repeated / visible : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,287 @@
+#include "elsed.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// 8-neighbourhood in ring order, so d - 1 and d + 1 are the diagonals of d
+static const int DX[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+static const int DY[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+
+// pixels collected before the first line fit of a segment
+static const int MIN_FIT_PIXELS = 8;
+
+ElsedDetector::ElsedDetector(int level) : LineDetector(level), rows(0), cols(0)
+{
+    resetSegment();
+}
+
+void ElsedDetector::detectLevel(const cv::Mat &img, std::vector<LineKL> &keylines)
+{
+    computeGradient(img);
+    findAnchors();
+    for (int anchor : anchors)
+        drawFrom(anchor, keylines);
+}
+
+void ElsedDetector::computeGradient(const cv::Mat &img)
+{
+    cv::GaussianBlur(img, blurred, cv::Size(5, 5), 1.0);
+    if (img.rows != rows || img.cols != cols)
+    {
+        rows = img.rows;
+        cols = img.cols;
+        // the border is never written, so it stays 0 and stops every walk
+        gx.assign(rows * cols, 0);
+        gy.assign(rows * cols, 0);
+        grad.assign(rows * cols, 0);
+        vertical.assign(rows * cols, 0);
+        visited.resize(rows * cols);
+    }
+    std::fill(visited.begin(), visited.end(), 0);
+
+    for (int y = 1; y < rows - 1; y++)
+    {
+        const uchar *up = blurred.ptr<uchar>(y - 1);
+        const uchar *mid = blurred.ptr<uchar>(y);
+        const uchar *down = blurred.ptr<uchar>(y + 1);
+        int row = y * cols;
+        for (int x = 1; x < cols - 1; x++)
+        {
+            int dx = (up[x + 1] + 2 * mid[x + 1] + down[x + 1]) - (up[x - 1] + 2 * mid[x - 1] + down[x - 1]);
+            int dy = (down[x - 1] + 2 * down[x] + down[x + 1]) - (up[x - 1] + 2 * up[x] + up[x + 1]);
+            int p = row + x;
+            gx[p] = dx;
+            gy[p] = dy;
+            grad[p] = std::abs(dx) + std::abs(dy);
+            vertical[p] = std::abs(dx) >= std::abs(dy);
+        }
+    }
+}
+
+void ElsedDetector::findAnchors()
+{
+    anchors.clear();
+    for (int y = 1; y < rows - 1; y += scan_interval)
+        for (int x = 1; x < cols - 1; x += scan_interval)
+        {
+            int p = y * cols + x;
+            int g = grad[p];
+            if (g < grad_threshold)
+                continue;
+            int step = vertical[p] ? 1 : cols;
+            if (g - grad[p - step] >= anchor_threshold && g - grad[p + step] >= anchor_threshold)
+                anchors.push_back(p);
+        }
+    std::sort(anchors.begin(), anchors.end(), [this](int a, int b) { return grad[a] > grad[b]; });
+}
+
+// strongest unvisited edge pixel ahead of p in direction d, or -1
+int ElsedDetector::nextPixel(int p, int &d) const
+{
+    int best = -1, best_d = d, best_grad = grad_threshold - 1;
+    for (int k : {d, (d + 7) & 7, (d + 1) & 7})
+    {
+        int q = p + DY[k] * cols + DX[k];
+        if (!visited[q] && grad[q] > best_grad)
+        {
+            best = q;
+            best_d = k;
+            best_grad = grad[q];
+        }
+    }
+    d = best_d;
+    return best;
+}
+
+// mark p and its neighbours across the edge, so a two pixel wide ridge is
+// drawn once
+void ElsedDetector::visit(int p, int d)
+{
+    int l = (d + 2) & 7, r = (d + 6) & 7;
+    visited[p] = 1;
+    visited[p + DY[l] * cols + DX[l]] = 1;
+    visited[p + DY[r] * cols + DX[r]] = 1;
+}
+
+void ElsedDetector::trace(int p, int d, std::vector<int> &_chain)
+{
+    _chain.clear();
+    int q;
+    while ((q = nextPixel(p, d)) >= 0)
+    {
+        visit(q, d);
+        _chain.push_back(q);
+        p = q;
+    }
+}
+
+// continue a fitted segment across a gap of up to jump_length px
+bool ElsedDetector::jump(int p, int &d, int &q) const
+{
+    double tx = -segment.ny, ty = segment.nx;
+    if (tx * DX[d] + ty * DY[d] < 0)
+    {
+        tx = -tx;
+        ty = -ty;
+    }
+    bool seg_vertical = std::fabs(ty) >= std::fabs(tx);
+    int px = p % cols, py = p / cols;
+    for (int k = 2; k <= jump_length; k++)
+    {
+        int x = (int)std::lround(px + tx * k), y = (int)std::lround(py + ty * k);
+        if (x < 1 || y < 1 || x >= cols - 1 || y >= rows - 1)
+            return false;
+        int c = y * cols + x;
+        if (visited[c] || grad[c] < grad_threshold || vertical[c] != seg_vertical)
+            continue;
+        if (std::fabs(segment.nx * x + segment.ny * y + segment.c) > max_distance)
+            continue;
+        q = c;
+        d = (int)std::lround(std::atan2(ty, tx) / (M_PI / 4)) & 7;
+        return true;
+    }
+    return false;
+}
+
+void ElsedDetector::drawFrom(int anchor, std::vector<LineKL> &keylines)
+{
+    if (visited[anchor])
+        return;
+    int d_back = vertical[anchor] ? 6 : 4;
+    int d = vertical[anchor] ? 2 : 0;
+    visit(anchor, d);
+
+    // draw the far side first and feed it in order, so one segment can run
+    // through the anchor
+    trace(anchor, d_back, chain);
+    resetSegment();
+    outliers.clear();
+    for (int i = (int)chain.size() - 1; i >= 0; i--)
+        addPixel(chain[i], keylines);
+    addPixel(anchor, keylines);
+
+    int p = anchor, q;
+    while (true)
+    {
+        q = nextPixel(p, d);
+        if (q < 0 && !(segment.fitted && jump(p, d, q)))
+            break;
+        visit(q, d);
+        addPixel(q, keylines);
+        p = q;
+    }
+    emitSegment(keylines);
+}
+
+void ElsedDetector::addPixel(int p, std::vector<LineKL> &keylines)
+{
+    if (!segment.fitted)
+    {
+        segment.pixels.push_back(p);
+        accumulate(p);
+        if ((int)segment.pixels.size() >= MIN_FIT_PIXELS && !fitSegment())
+        {
+            // not a line yet: slide the window forward by one pixel
+            segment.pixels.erase(segment.pixels.begin());
+            resetSums();
+            for (int r : segment.pixels)
+                accumulate(r);
+        }
+        return;
+    }
+
+    int x = p % cols, y = p / cols;
+    if (std::fabs(segment.nx * x + segment.ny * y + segment.c) <= max_distance)
+    {
+        outliers.clear();
+        segment.pixels.push_back(p);
+        accumulate(p);
+        fitSegment();
+        return;
+    }
+
+    // a few off-line pixels are tolerated, more start the next segment
+    outliers.push_back(p);
+    if ((int)outliers.size() > max_outliers)
+    {
+        emitSegment(keylines);
+        for (int r : outliers)
+        {
+            segment.pixels.push_back(r);
+            accumulate(r);
+        }
+        outliers.clear();
+    }
+}
+
+void ElsedDetector::resetSegment()
+{
+    segment.pixels.clear();
+    resetSums();
+    segment.fitted = false;
+}
+
+void ElsedDetector::resetSums()
+{
+    segment.sx = segment.sy = segment.sxx = segment.syy = segment.sxy = 0;
+    segment.gx = segment.gy = 0;
+    segment.nx = segment.ny = segment.c = 0;
+}
+
+void ElsedDetector::accumulate(int p)
+{
+    double x = p % cols, y = p / cols;
+    segment.sx += x;
+    segment.sy += y;
+    segment.sxx += x * x;
+    segment.syy += y * y;
+    segment.sxy += x * y;
+    segment.gx += gx[p];
+    segment.gy += gy[p];
+}
+
+// total least squares line; false when the rms distance exceeds fit_error
+bool ElsedDetector::fitSegment()
+{
+    double n = segment.pixels.size();
+    double mx = segment.sx / n, my = segment.sy / n;
+    double cxx = segment.sxx / n - mx * mx;
+    double cyy = segment.syy / n - my * my;
+    double cxy = segment.sxy / n - mx * my;
+    double half_diff = 0.5 * (cxx - cyy);
+    double min_eig = 0.5 * (cxx + cyy) - std::sqrt(half_diff * half_diff + cxy * cxy);
+    if (min_eig > fit_error * fit_error)
+        return false;
+
+    double theta = 0.5 * std::atan2(2 * cxy, cxx - cyy);
+    segment.nx = -std::sin(theta);
+    segment.ny = std::cos(theta);
+    segment.c = -(segment.nx * mx + segment.ny * my);
+    segment.fitted = true;
+    return true;
+}
+
+void ElsedDetector::emitSegment(std::vector<LineKL> &keylines)
+{
+    if (segment.fitted)
+    {
+        int first = segment.pixels.front(), last = segment.pixels.back();
+        cv::Point2f s(first % cols, first / cols), e(last % cols, last / cols);
+        double ds = segment.nx * s.x + segment.ny * s.y + segment.c;
+        double de = segment.nx * e.x + segment.ny * e.y + segment.c;
+        s -= cv::Point2f(segment.nx * ds, segment.ny * ds);
+        e -= cv::Point2f(segment.nx * de, segment.ny * de);
+
+        cv::Point2f dir = e - s;
+        if (dir.dot(dir) >= min_length * min_length)
+        {
+            // keep the brighter side on the same hand, as EDLines does
+            if (dir.x * segment.gy - dir.y * segment.gx < 0)
+                std::swap(s, e);
+            keylines.push_back(MakeKeyLine(s, e, cols));
+            keylines.back().class_id = keylines.size() - 1;
+        }
+    }
+    resetSegment();
+}
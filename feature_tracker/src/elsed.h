@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "line_detector.h"
+
+// ELSED-style detector (Suárez et al., "ELSED: Enhanced Line SEgment
+// Drawing"). Edges are drawn from gradient anchors as in Edge Drawing, but
+// the chain is fitted to a line while it is drawn: a pixel that leaves the
+// current line closes the segment, and a segment that runs out of edge
+// pixels tries to jump a short gap along its own direction. Every buffer is
+// kept between calls, so a steady image size allocates nothing.
+class ElsedDetector : public LineDetector
+{
+  public:
+    explicit ElsedDetector(int level);
+    const char *name() const { return "ELSED"; }
+
+    int grad_threshold = 30;   // |gx| + |gy| of the Sobel response
+    int anchor_threshold = 8;  // margin over both neighbours across the edge
+    int scan_interval = 2;     // anchor rows / columns
+    int min_length = 15;       // px at the detection level
+    double fit_error = 1.0;    // rms px of the fit that starts a segment
+    double max_distance = 1.5; // px from the fitted line to extend it
+    int max_outliers = 3;      // consecutive off-line pixels closing a segment
+    int jump_length = 4;       // px searched beyond the end of a segment
+
+  protected:
+    void detectLevel(const cv::Mat &img, std::vector<LineKL> &keylines);
+
+  private:
+    // running least squares fit of the segment being drawn
+    struct Segment
+    {
+        std::vector<int> pixels;
+        double sx, sy, sxx, syy, sxy;
+        double gx, gy;
+        double nx, ny, c; // nx * x + ny * y + c = 0
+        bool fitted;
+    };
+
+    void computeGradient(const cv::Mat &img);
+    void findAnchors();
+    void visit(int p, int d);
+    void trace(int p, int d, std::vector<int> &chain);
+    int nextPixel(int p, int &d) const;
+    bool jump(int p, int &d, int &q) const;
+    void drawFrom(int anchor, std::vector<LineKL> &keylines);
+    void addPixel(int p, std::vector<LineKL> &keylines);
+    void resetSegment();
+    void resetSums();
+    void accumulate(int p);
+    bool fitSegment();
+    void emitSegment(std::vector<LineKL> &keylines);
+
+    int rows, cols;
+    cv::Mat blurred;
+    std::vector<int16_t> gx, gy;
+    std::vector<int16_t> grad;   // |gx| + |gy|, 0 on the border
+    std::vector<uint8_t> vertical; // edge runs vertically, |gx| >= |gy|
+    std::vector<uint8_t> visited;
+    std::vector<int> anchors;
+    std::vector<int> chain, outliers;
+    Segment segment;
+};
@@ -83,7 +83,10 @@ void FeatureTracker::readImage(const cv::Mat &_img, double _cur_time)
         TicToc t_o;
         vector<uchar> status;
         vector<float> err;
-        cv::calcOpticalFlowPyrLK(cur_img, forw_img, cur_pts, forw_pts, status, err, cv::Size(21, 21), 3);
+        vector<cv::Point2f> predicted_pts;
+        if (has_rotation_prior)
+            predictPoints(predicted_pts);
+        trackWithPrior(cur_img, forw_img, cur_pts, has_rotation_prior ? &predicted_pts : nullptr, forw_pts, status, err);
 
         // cout << "cur_pts[0] : " << cur_pts[0] << endl;
         // cout << "forw_pts[0] : " << forw_pts[0] << endl;
@@ -100,8 +103,9 @@ void FeatureTracker::readImage(const cv::Mat &_img, double _cur_time)
         util.reduceVector(ids, status);
         util.reduceVector(cur_un_pts, status);
         util.reduceVector(track_cnt, status);
-        ROS_DEBUG("temporal optical flow costs: %fms", t_o.toc());
+        ROS_DEBUG("temporal optical flow costs: %fms%s", t_o.toc(), has_rotation_prior ? " with rotation prior" : "");
     }
+    has_rotation_prior = false;
 
     for (auto &n : track_cnt)
         n++;
@@ -146,6 +150,33 @@ void FeatureTracker::readImage(const cv::Mat &_img, double _cur_time)
     prev_time = cur_time;
 }
 
+void FeatureTracker::setRotationPrior(const Eigen::Matrix3d &R_c0c1)
+{
+    rotation_prior = R_c0c1;
+    has_rotation_prior = true;
+}
+
+// cur_pts moved by the rotation prior alone
+void FeatureTracker::predictPoints(vector<cv::Point2f> &predicted_pts)
+{
+    Eigen::Matrix3d R_c1c0 = rotation_prior.transpose();
+    predicted_pts.resize(cur_pts.size());
+    for (unsigned int i = 0; i < cur_pts.size(); i++)
+    {
+        Eigen::Vector3d P;
+        Eigen::Vector2d p;
+        m_camera->liftProjective(Eigen::Vector2d(cur_pts[i].x, cur_pts[i].y), P);
+        P = R_c1c0 * P;
+        if (P.z() <= 0)
+        {
+            predicted_pts[i] = cur_pts[i];
+            continue;
+        }
+        m_camera->spaceToPlane(P, p);
+        predicted_pts[i] = cv::Point2f(p.x(), p.y());
+    }
+}
+
 void FeatureTracker::rejectWithF()
 {
     if (forw_pts.size() >= 8)
@@ -17,6 +17,7 @@
 #include "parameters.h"
 #include "tic_toc.h"
 #include "utility.h"
+#include "rotation_prior.h"
 
 using namespace std;
 using namespace camodocal;
@@ -44,6 +45,10 @@ class FeatureTracker
 
     void undistortedPoints();
 
+    // R_c0c1 from the last image to the next one, used once by readImage()
+    void setRotationPrior(const Eigen::Matrix3d &R_c0c1);
+    void predictPoints(vector<cv::Point2f> &predicted_pts);
+
     cv::Mat mask;
     cv::Mat fisheye_mask;
     cv::Mat prev_img, cur_img, forw_img;
@@ -58,6 +63,8 @@ class FeatureTracker
     camodocal::CameraPtr m_camera;
     double cur_time;
     double prev_time;
+    bool has_rotation_prior = false;
+    Eigen::Matrix3d rotation_prior;
     Utility util;
 
     static int n_id;
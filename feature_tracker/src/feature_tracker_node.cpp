@@ -4,11 +4,13 @@
 #include <sensor_msgs/PointCloud.h>
 #include <sensor_msgs/Imu.h>
 #include <std_msgs/Bool.h>
+#include <std_msgs/Int32.h>
 #include <cv_bridge/cv_bridge.h>
 #include <message_filters/subscriber.h>
 
 #include "feature_tracker.h"
 #include "line_feature_tracker.h"
+#include "rotation_prior.h"
 
 #include <chrono>
 
@@ -23,6 +25,7 @@ ros::Publisher pub_restart;
 
 FeatureTracker trackerData[NUM_OF_CAM];
 LineFeatureTracker lineTrackerData;
+RotationPrior rotation_prior;
 
 double first_image_time;
 int pub_count = 1;
@@ -54,6 +57,20 @@ void img1_callback(const sensor_msgs::ImageConstPtr &img_msg){
 }
 
 
+// lines to keep per image from the estimator's frame budget, 0: all
+void line_budget_callback(const std_msgs::Int32ConstPtr &budget_msg)
+{
+    if (budget_msg->data != lineTrackerData.max_lines)
+        ROS_INFO("line budget: %s", budget_msg->data ? std::to_string(budget_msg->data).c_str() : "all lines");
+    lineTrackerData.max_lines = budget_msg->data;
+}
+
+void imu_callback(const sensor_msgs::ImuConstPtr &imu_msg)
+{
+    rotation_prior.addGyro(imu_msg->header.stamp.toSec(),
+                           Eigen::Vector3d(imu_msg->angular_velocity.x, imu_msg->angular_velocity.y, imu_msg->angular_velocity.z));
+}
+
 void depth_callback(const sensor_msgs::ImageConstPtr &img_msg){
 
     assert(ENABLE_DEPTH);
@@ -126,7 +143,17 @@ void img_callback(const sensor_msgs::ImageConstPtr &img_msg)
         return;
     }
 
+    // seed KLT with the gyro rotation since the last image
+    Eigen::Matrix3d R_c0c1;
+    if (IMU_PRIOR && rotation_prior.cameraRotation(last_image_time, img_msg->header.stamp.toSec(), R_c0c1))
+    {
+        for (int i = 0; i < NUM_OF_CAM; i++)
+            trackerData[i].setRotationPrior(R_c0c1);
+        lineTrackerData.setRotationPrior(R_c0c1);
+    }
+
     last_image_time = img_msg->header.stamp.toSec();
+    TraceFrame frame(img_msg->header.stamp.toSec());
     // frequency control
     if (round(1.0 * pub_count / (img_msg->header.stamp.toSec() - first_image_time)) <= FREQ)
     {
@@ -182,9 +209,12 @@ void img_callback(const sensor_msgs::ImageConstPtr &img_msg)
         ROS_DEBUG("processing camera %d", i);
         if (i != 1 || !STEREO_TRACK)
         {
+            TraceSpan t_point_track("point_track");
             trackerData[i].readImage(ptr->image.rowRange(ROW * i, ROW * (i + 1)), img_msg->header.stamp.toSec());
+            t_point_track.stop();
             double t_point = t_r.toc();
             // Image undistortion and extract line
+            TraceSpan t_line_track("line_track");
             if (ENABLE_DEPTH)
                 lineTrackerData.readImage4Line(ptr->image, ptr_color->image, depth_image_local, img_msg->header.stamp.toSec());
             else
@@ -233,6 +263,7 @@ void img_callback(const sensor_msgs::ImageConstPtr &img_msg)
 
    if (PUB_THIS_FRAME)
    {
+        TraceSpan t_publish("publish");
         pub_count++;
         sensor_msgs::PointCloudPtr feature_points(new sensor_msgs::PointCloud);
         sensor_msgs::ChannelFloat32 id_of_point;
@@ -490,6 +521,14 @@ int main(int argc, char **argv)
     ros::Subscriber sub_img = n.subscribe(IMAGE_TOPIC, 100, img_callback);
     ros::Subscriber sub_depth = n.subscribe(DEPTH_TOPIC, 100, depth_callback);
     ros::Subscriber sub_img1 = n.subscribe("/cam1/image_raw", 100, img1_callback);
+    ros::Subscriber sub_line_budget = n.subscribe("/vins_estimator/line_budget", 10, line_budget_callback);
+    ros::Subscriber sub_imu;
+    if (IMU_PRIOR)
+    {
+        rotation_prior.setExtrinsic(RIC);
+        sub_imu = n.subscribe(IMU_TOPIC, 2000, imu_callback, ros::TransportHints().tcpNoDelay());
+        ROS_INFO("seeding KLT with the gyro rotation from %s", IMU_TOPIC.c_str());
+    }
 
     pub_img = n.advertise<sensor_msgs::PointCloud>("feature", 1000);
     pub_match = n.advertise<sensor_msgs::Image>("feature_img",1000);
@@ -508,6 +547,10 @@ int main(int argc, char **argv)
     if (SHOW_TRACK)
         cv::namedWindow("vis", cv::WINDOW_NORMAL);
     */
+    ros::Timer trace_timer;
+    if (TRACE_ENABLE)
+        trace_timer = startTracing(n, "feature_tracker", TRACE_PATH, TRACE_SUMMARY_PERIOD);
+
     ros::spin();
     return 0;
 }
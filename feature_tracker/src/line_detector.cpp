@@ -0,0 +1,95 @@
+#include "line_detector.h"
+#include "elsed.h"
+
+LineKL MakeKeyLine( cv::Point2f start_pts, cv::Point2f end_pts, size_t cols ){
+    LineKL keyLine;
+    //    keyLine.class_id = 0;
+    //    keyLine.numOfPixels;
+
+    // Set start point(and octave)
+    keyLine.startPointX = (int)start_pts.x;
+    keyLine.startPointY = (int)start_pts.y;
+    keyLine.sPointInOctaveX = start_pts.x;
+    keyLine.sPointInOctaveY = start_pts.y;
+
+    // Set end point(and octave)
+    keyLine.endPointX = (int)end_pts.x;
+    keyLine.endPointY = (int)end_pts.y;
+    keyLine.ePointInOctaveX = end_pts.x;
+    keyLine.ePointInOctaveY = end_pts.y;
+
+    // Set angle
+    keyLine.angle = atan2((end_pts.y-start_pts.y),(end_pts.x-start_pts.x));
+
+    // Set line length & response
+    keyLine.lineLength = keyLine.numOfPixels = cv::norm( cv::Mat(end_pts), cv::Mat(start_pts));
+    keyLine.response = cv::norm( cv::Mat(end_pts), cv::Mat(start_pts))/cols;
+
+    // Set octave
+    keyLine.octave = 0;
+
+    // Set pt(mid point)
+    keyLine.pt = (start_pts + end_pts)/2;
+
+    // Set size
+    keyLine.size = fabs((end_pts.x-start_pts.x) * (end_pts.y-start_pts.y));
+
+    return keyLine;
+}
+
+void LineDetector::detect(const cv::Mat &img, std::vector<LineKL> &keylines)
+{
+    keylines.clear();
+    if (level <= 0)
+    {
+        detectLevel(img, keylines);
+        return;
+    }
+
+    pyramid.resize(level);
+    for (int l = 0; l < level; l++)
+        cv::pyrDown(l == 0 ? img : pyramid[l - 1], pyramid[l]);
+    detectLevel(pyramid[level - 1], keylines);
+
+    float scale = (float)(1 << level);
+    for (int i = 0; i < (int)keylines.size(); i++)
+    {
+        const LineKL &kl = keylines[i];
+        keylines[i] = MakeKeyLine(cv::Point2f(kl.sPointInOctaveX, kl.sPointInOctaveY) * scale,
+                                  cv::Point2f(kl.ePointInOctaveX, kl.ePointInOctaveY) * scale, img.cols);
+        keylines[i].class_id = i;
+    }
+}
+
+EDLinesDetector::EDLinesDetector(int level)
+    : LineDetector(level), detector(LineBD::createBinaryDescriptor())
+{
+}
+
+void EDLinesDetector::detectLevel(const cv::Mat &img, std::vector<LineKL> &keylines)
+{
+    detector->detect(img, keylines);
+}
+
+LSDLineDetector::LSDLineDetector(int level)
+    : LineDetector(level), detector(cv::line_descriptor::LSDDetector::createLSDDetector())
+{
+}
+
+void LSDLineDetector::detectLevel(const cv::Mat &img, std::vector<LineKL> &keylines)
+{
+    detector->detect(img, keylines, 2, 1);
+}
+
+std::unique_ptr<LineDetector> createLineDetector(int type, int level)
+{
+    switch (type)
+    {
+    case LINE_DETECTOR_LSD:
+        return std::unique_ptr<LineDetector>(new LSDLineDetector(level));
+    case LINE_DETECTOR_ELSED:
+        return std::unique_ptr<LineDetector>(new ElsedDetector(level));
+    default:
+        return std::unique_ptr<LineDetector>(new EDLinesDetector(level));
+    }
+}
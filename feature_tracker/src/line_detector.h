@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/line_descriptor.hpp>
+
+typedef cv::line_descriptor::BinaryDescriptor LineBD;
+typedef cv::line_descriptor::KeyLine LineKL;
+
+LineKL MakeKeyLine(cv::Point2f start_pts, cv::Point2f end_pts, size_t cols);
+
+enum LineDetectorType
+{
+    LINE_DETECTOR_EDLINES = 0, // OpenCV contrib BinaryDescriptor
+    LINE_DETECTOR_LSD = 1,     // OpenCV contrib LSDDetector
+    LINE_DETECTOR_ELSED = 2    // in-tree, see elsed.h
+};
+
+// Line segment detector behind LineFeatureTracker::lineExtraction(). The
+// image is detected at pyramid level `level` and the segments are returned
+// in full-resolution coordinates as octave-0 keylines with class_id 0..n-1,
+// ready for LBD description on the full image.
+class LineDetector
+{
+  public:
+    explicit LineDetector(int _level) : level(_level) {}
+    virtual ~LineDetector() {}
+
+    void detect(const cv::Mat &img, std::vector<LineKL> &keylines);
+    virtual const char *name() const = 0;
+
+  protected:
+    virtual void detectLevel(const cv::Mat &img, std::vector<LineKL> &keylines) = 0;
+
+  private:
+    int level;
+    std::vector<cv::Mat> pyramid;
+};
+
+class EDLinesDetector : public LineDetector
+{
+  public:
+    explicit EDLinesDetector(int level);
+    const char *name() const { return "EDLines"; }
+
+  protected:
+    void detectLevel(const cv::Mat &img, std::vector<LineKL> &keylines);
+
+  private:
+    cv::Ptr<LineBD> detector;
+};
+
+class LSDLineDetector : public LineDetector
+{
+  public:
+    explicit LSDLineDetector(int level);
+    const char *name() const { return "LSD"; }
+
+  protected:
+    void detectLevel(const cv::Mat &img, std::vector<LineKL> &keylines);
+
+  private:
+    cv::Ptr<cv::line_descriptor::LSDDetector> detector;
+};
+
+std::unique_ptr<LineDetector> createLineDetector(int type, int level);
@@ -38,8 +38,10 @@ void LineFeatureTracker::readImage4Line(const Mat &_img, const Mat &_img_color,
 
     /// raw image undistortion
     Mat undistort_img, undistort_img_color, undistort_img1;
+    TraceSpan t_undistort("undistort");
     imageUndistortion(img, undistort_img);
     imageUndistortion(img_color, undistort_img_color);
+    t_undistort.stop();
     if (forw_img.empty())
     {
         prev_img = curr_img = forw_img = undistort_img.clone();
@@ -98,16 +100,12 @@ void LineFeatureTracker::readImage4Line(const Mat &_img, const Mat &_img_color,
         vector<int> local_vp_ids;
         double thAngle = 1.0 / 180.0 * CV_PI;
 
-//        TicToc t_r;
-        lineExtraction(forw_img, forw_keyLine, forw_descriptor);
-//        double t_lineextraction = t_r.toc();
-        lineMatching(curr_keyLine, forw_keyLine, curr_descriptor, forw_descriptor, good_match_vector);
-//        double t_linematching = t_r.toc() - t_lineextraction;
-        lineMergingTwoPhase( curr_img, forw_img, curr_keyLine, forw_keyLine, curr_descriptor, forw_descriptor, good_match_vector );
-//        double t_linemerging = t_r.toc() - t_linematching;
+        findLines( curr_img, forw_img, curr_keyLine, curr_descriptor, forw_keyLine, forw_descriptor, good_match_vector );
+        limitLines( forw_keyLine, forw_descriptor, good_match_vector );
 
         if(forw_keyLine.size() > 1)
         {
+            TraceSpan t_vp("vp");
             getVPHypVia2Lines(forw_keyLine, para_vector, length_vector, orientation_vector, vpHypo);
             getSphereGrids(forw_keyLine, para_vector, length_vector, orientation_vector, sphereGrid );
             getBestVpsHyp(sphereGrid, vpHypo, tmp_vps);
@@ -219,6 +217,7 @@ void LineFeatureTracker::readImage4Line(const Mat &_img, const Mat &_img_color,
 
         if(curr_keyLine.size() > 1)
         {
+            TraceSpan t_vp("vp");
             getVPHypVia2Lines(curr_keyLine, para_vector, length_vector, orientation_vector, vpHypo);
             getSphereGrids(curr_keyLine, para_vector, length_vector, orientation_vector, sphereGrid );
             getBestVpsHyp(sphereGrid, vpHypo, tmp_vps);
@@ -279,6 +278,7 @@ void LineFeatureTracker::readImage4Line(const Mat &_img, const Mat &_img_color,
     prev_end_un_pts = curr_end_un_pts;
 
     normalizePoints();
+    has_rotation_prior = false;
     int frame_index = 0;
 //    cout << t_r.toc() << endl;
 }
@@ -304,8 +304,10 @@ void LineFeatureTracker::readImage4Line(const Mat &_img, const Mat &_img_color,
 
     /// raw image undistortion
     Mat undistort_img, undistort_img_color, undistort_img1;
+    TraceSpan t_undistort("undistort");
     imageUndistortion(img, undistort_img);
     imageUndistortion(img_color, undistort_img_color);
+    t_undistort.stop();
     if (forw_img.empty())
     {
         prev_img = curr_img = forw_img = undistort_img.clone();
@@ -345,16 +347,12 @@ void LineFeatureTracker::readImage4Line(const Mat &_img, const Mat &_img_color,
         vector<int> local_vp_ids;
         double thAngle = 1.0 / 180.0 * CV_PI;
 
-//        TicToc t_r;
-        lineExtraction(forw_img, forw_keyLine, forw_descriptor);
-//        double t_lineextraction = t_r.toc();
-        lineMatching(curr_keyLine, forw_keyLine, curr_descriptor, forw_descriptor, good_match_vector);
-//        double t_linematching = t_r.toc() - t_lineextraction;
-        lineMergingTwoPhase( curr_img, forw_img, curr_keyLine, forw_keyLine, curr_descriptor, forw_descriptor, good_match_vector );
-//        double t_linemerging = t_r.toc() - t_linematching;
+        findLines( curr_img, forw_img, curr_keyLine, curr_descriptor, forw_keyLine, forw_descriptor, good_match_vector );
+        limitLines( forw_keyLine, forw_descriptor, good_match_vector );
 
         if(forw_keyLine.size() > 1)
         {
+            TraceSpan t_vp("vp");
             getVPHypVia2Lines(forw_keyLine, para_vector, length_vector, orientation_vector, vpHypo);
             getSphereGrids(forw_keyLine, para_vector, length_vector, orientation_vector, sphereGrid );
             getBestVpsHyp(sphereGrid, vpHypo, tmp_vps);
@@ -464,6 +462,7 @@ void LineFeatureTracker::readImage4Line(const Mat &_img, const Mat &_img_color,
 
         if(curr_keyLine.size() > 1)
         {
+            TraceSpan t_vp("vp");
             getVPHypVia2Lines(curr_keyLine, para_vector, length_vector, orientation_vector, vpHypo);
             getSphereGrids(curr_keyLine, para_vector, length_vector, orientation_vector, sphereGrid );
             getBestVpsHyp(sphereGrid, vpHypo, tmp_vps);
@@ -524,6 +523,7 @@ void LineFeatureTracker::readImage4Line(const Mat &_img, const Mat &_img_color,
     prev_end_un_pts = curr_end_un_pts;
 
     normalizePoints();
+    has_rotation_prior = false;
     int frame_index = 0;
 //    cout << t_r.toc() << endl;
 }
@@ -566,6 +566,7 @@ bool FindMatchedLine( LineKL query_line, LineKL train_line,
 void LineFeatureTracker::lineMatching( vector<LineKL> &_prev_keyLine, vector<LineKL> &_curr_keyLine, Mat &_prev_descriptor,
                                       Mat &_curr_descriptor, vector<DMatch> &_good_match_vector)
 {
+    TraceSpan span("line_match");
     Ptr<BinaryDescriptorMatcher> bd_match = BinaryDescriptorMatcher::createBinaryDescriptorMatcher();
     vector<vector<DMatch> > matches_vector;
     auto prev_descriptor = _prev_descriptor.clone();
@@ -654,45 +655,10 @@ void LineFeatureTracker::lineMatching( vector<LineKL> &_prev_keyLine, vector<Lin
     _good_match_vector = good_match_vector;
 }
 
-LineKL MakeKeyLine( cv::Point2f start_pts, cv::Point2f end_pts, size_t cols ){
-    LineKL keyLine;
-    //    keyLine.class_id = 0;
-    //    keyLine.numOfPixels;
-
-    // Set start point(and octave)
-    keyLine.startPointX = (int)start_pts.x;
-    keyLine.startPointY = (int)start_pts.y;
-    keyLine.sPointInOctaveX = start_pts.x;
-    keyLine.sPointInOctaveY = start_pts.y;
-
-    // Set end point(and octave)
-    keyLine.endPointX = (int)end_pts.x;
-    keyLine.endPointY = (int)end_pts.y;
-    keyLine.ePointInOctaveX = end_pts.x;
-    keyLine.ePointInOctaveY = end_pts.y;
-
-    // Set angle
-    keyLine.angle = atan2((end_pts.y-start_pts.y),(end_pts.x-start_pts.x));
-
-    // Set line length & response
-    keyLine.lineLength = keyLine.numOfPixels = norm( Mat(end_pts), Mat(start_pts));
-    keyLine.response = norm( Mat(end_pts), Mat(start_pts))/cols;
-
-    // Set octave
-    keyLine.octave = 0;
-
-    // Set pt(mid point)
-    keyLine.pt = (start_pts + end_pts)/2;
-
-    // Set size
-    keyLine.size = fabs((end_pts.x-start_pts.x) * (end_pts.y-start_pts.y));
-
-    return keyLine;
-}
-
 void LineFeatureTracker::lineMergingTwoPhase( Mat &prev_img, Mat &cur_img, vector<LineKL> &prev_keyLine, vector<LineKL> &cur_keyLine,
                                              Mat &prev_descriptor, Mat &cur_descriptor, vector<DMatch> &good_match_vector )
 {
+    TraceSpan span("line_merge");
     TicToc t_linemerging;
     int line_split = true;
     vector<uchar> temp_status;
@@ -756,7 +722,8 @@ void LineFeatureTracker::lineMergingTwoPhase( Mat &prev_img, Mat &cur_img, vecto
     }
     if (cur_pts_idx == 0) return;
 
-    cv::calcOpticalFlowPyrLK(prev_img, cur_img, cur_pts, forw_pts, status, err, cv::Size(21, 21), 3);
+    vector<Point2f> predicted_pts;
+    trackWithPrior(prev_img, cur_img, cur_pts, predictPoints(cur_pts, predicted_pts), forw_pts, status, err);
     if(line_distribution == 2)
     {
         for( int i = 0; i < forw_pts.size(); i+=2 ){
@@ -1018,17 +985,345 @@ void LineFeatureTracker::lineMergingTwoPhase( Mat &prev_img, Mat &cur_img, vecto
 //    cout << t_linemerging.toc() << endl;
 }
 
+void LineFeatureTracker::initLineDetector()
+{
+    if (line_detector)
+        return;
+    line_detector = createLineDetector(LINE_DETECTOR, LINE_DETECTOR_LEVEL);
+    line_bd = LineBD::createBinaryDescriptor();
+    ROS_INFO("line detector: %s, pyramid level %d", line_detector->name(), LINE_DETECTOR_LEVEL);
+}
+
+// Lines of cur_img for the lines tracked in prev_img, good_match_vector
+// relating them (queryIdx: prev, trainIdx: cur). With line_detect_interval
+// 1 every frame is detected and matched as a whole. Otherwise the tracked
+// lines are predicted by optical flow and verified where they land, and the
+// detector only runs on grid cells left without a line, or on the whole
+// image every line_detect_interval frames.
+void LineFeatureTracker::findLines( Mat &prev_img, Mat &cur_img, vector<LineKL> &prev_keyLine, Mat &prev_descriptor,
+                                    vector<LineKL> &cur_keyLine, Mat &cur_descriptor, vector<DMatch> &good_match_vector )
+{
+    line_frames++;
+    if (LINE_DETECT_INTERVAL <= 1)
+    {
+        lineExtraction(cur_img, cur_keyLine, cur_descriptor);
+        lineMatching(prev_keyLine, cur_keyLine, prev_descriptor, cur_descriptor, good_match_vector);
+        lineMergingTwoPhase( prev_img, cur_img, prev_keyLine, cur_keyLine, prev_descriptor, cur_descriptor, good_match_vector );
+        return;
+    }
+
+    initLineDetector();
+    TicToc t_track;
+    vector<int> tracked_idx;
+    predictLines(prev_img, cur_img, prev_keyLine, prev_descriptor, cur_keyLine, cur_descriptor, tracked_idx);
+    good_match_vector.clear();
+    for (int i = 0; i < (int)tracked_idx.size(); i++)
+        good_match_vector.push_back(DMatch(tracked_idx[i], i, 0));
+    double t_predict = t_track.toc();
+
+    int num_cells = line_grid * line_grid;
+    int cell_w = (cur_img.cols + line_grid - 1) / line_grid;
+    int cell_h = (cur_img.rows + line_grid - 1) / line_grid;
+    vector<uchar> occupied(num_cells, 0);
+    for (auto &kl : cur_keyLine)
+        occupied[min((int)kl.pt.y / cell_h, line_grid - 1) * line_grid + min((int)kl.pt.x / cell_w, line_grid - 1)] = 1;
+
+    frames_since_detection++;
+    bool full = frames_since_detection >= LINE_DETECT_INTERVAL;
+    bool too_few = (int)cur_keyLine.size() < LINE_MIN_TRACKED;
+    if (full || (int)barren_cells.size() != num_cells)
+        barren_cells.assign(num_cells, 0);
+    vector<uchar> candidate(num_cells, 0);
+    int num_candidates = 0;
+    for (int c = 0; c < num_cells; c++)
+    {
+        candidate[c] = full || (!occupied[c] && (!barren_cells[c] || too_few));
+        num_candidates += candidate[c];
+    }
+
+    if (num_candidates == 0)
+    {
+        detection_free_frames++;
+        ROS_DEBUG("line tracking costs: %fms, %lu tracked of %lu, no detection", t_predict,
+                  cur_keyLine.size(), prev_keyLine.size());
+        ROS_INFO_THROTTLE(10.0, "line front-end: %.1f%% of frames without detection", 100.0 * detectionFreeRatio());
+        return;
+    }
+    if (full)
+        frames_since_detection = 0;
+
+    vector<LineKL> new_keyLine;
+    Mat new_descriptor;
+    detectNewLines(cur_img, candidate, cur_keyLine, new_keyLine, new_descriptor);
+    for (int c = 0; c < num_cells; c++)
+        if (candidate[c])
+            barren_cells[c] = 1;
+    for (auto &kl : new_keyLine)
+        barren_cells[min((int)kl.pt.y / cell_h, line_grid - 1) * line_grid + min((int)kl.pt.x / cell_w, line_grid - 1)] = 0;
+
+    // lost tracks can come back through a newly detected line
+    vector<uchar> tracked(prev_keyLine.size(), 0);
+    for (int i : tracked_idx)
+        tracked[i] = 1;
+    vector<uchar> taken(new_keyLine.size(), 0);
+    int recovered = 0;
+    for (int i = 0; i < (int)prev_keyLine.size() && !new_keyLine.empty(); i++)
+    {
+        if (tracked[i])
+            continue;
+        int best = -1;
+        double best_dist = line_verify_distance + 1;
+        for (int j = 0; j < (int)new_keyLine.size(); j++)
+        {
+            if (taken[j])
+                continue;
+            double dist = norm(prev_descriptor.row(i), new_descriptor.row(j), NORM_HAMMING);
+            if (dist < best_dist && FindMatchedLine(prev_keyLine[i], new_keyLine[j], 20, 50, 0.2))
+            {
+                best = j;
+                best_dist = dist;
+            }
+        }
+        if (best < 0)
+            continue;
+        taken[best] = 1;
+        good_match_vector.push_back(DMatch(i, cur_keyLine.size() + best, best_dist));
+        recovered++;
+    }
+
+    for (int j = 0; j < (int)new_keyLine.size(); j++)
+    {
+        cur_keyLine.push_back(new_keyLine[j]);
+        cur_keyLine.back().class_id = cur_keyLine.size() - 1;
+        cur_descriptor.push_back(new_descriptor.row(j));
+    }
+    ROS_DEBUG("line tracking costs: %fms, %lu tracked of %lu, %lu new (%d recovered) in %d cells%s",
+              t_track.toc(), tracked_idx.size(), prev_keyLine.size(), new_keyLine.size(), recovered,
+              num_candidates, full ? ", full detection" : "");
+    ROS_INFO_THROTTLE(10.0, "line front-end: %.1f%% of frames without detection", 100.0 * detectionFreeRatio());
+}
+
+// Drops lines beyond max_lines: tracked lines by their track length first,
+// then by their length. good_match_vector is renumbered to the kept lines.
+void LineFeatureTracker::limitLines( vector<LineKL> &cur_keyLine, Mat &cur_descriptor, vector<DMatch> &good_match_vector )
+{
+    int n = cur_keyLine.size();
+    if (max_lines <= 0 || n <= max_lines)
+        return;
+    vector<int> track_length(n, 0);
+    for (auto &m : good_match_vector)
+        track_length[m.trainIdx] = track_cnt[m.queryIdx];
+    vector<int> order(n);
+    for (int i = 0; i < n; i++)
+        order[i] = i;
+    std::nth_element(order.begin(), order.begin() + max_lines, order.end(), [&](int a, int b) {
+        if (track_length[a] != track_length[b])
+            return track_length[a] > track_length[b];
+        return cur_keyLine[a].lineLength > cur_keyLine[b].lineLength;
+    });
+    order.resize(max_lines);
+    std::sort(order.begin(), order.end());
+
+    vector<int> new_index(n, -1);
+    vector<LineKL> kept_keyLine;
+    Mat kept_descriptor;
+    for (int i : order)
+    {
+        new_index[i] = kept_keyLine.size();
+        kept_keyLine.push_back(cur_keyLine[i]);
+        kept_keyLine.back().class_id = new_index[i];
+        kept_descriptor.push_back(cur_descriptor.row(i));
+    }
+    vector<DMatch> kept_match;
+    for (auto &m : good_match_vector)
+        if (new_index[m.trainIdx] >= 0)
+            kept_match.push_back(DMatch(m.queryIdx, new_index[m.trainIdx], m.distance));
+    ROS_DEBUG("line budget: %d of %d lines kept, %lu of %lu tracks", max_lines, n, kept_match.size(),
+              good_match_vector.size());
+    cur_keyLine.swap(kept_keyLine);
+    cur_descriptor = kept_descriptor;
+    good_match_vector.swap(kept_match);
+}
+
+// Optical flow prediction of prev_keyLine in cur_img, kept where the line
+// still lies on an edge and its LBD descriptor agrees with the previous one.
+// tracked_idx holds the prev index of every line in cur_keyLine.
+void LineFeatureTracker::predictLines( Mat &prev_img, Mat &cur_img, vector<LineKL> &prev_keyLine, Mat &prev_descriptor,
+                                       vector<LineKL> &cur_keyLine, Mat &cur_descriptor, vector<int> &tracked_idx )
+{
+    TraceSpan span("line_match");
+    cur_keyLine.clear();
+    cur_descriptor = Mat();
+    tracked_idx.clear();
+    if (prev_keyLine.empty())
+        return;
+
+    vector<Point2f> prev_pts, cur_pts;
+    for (auto &kl : prev_keyLine)
+    {
+        prev_pts.push_back(kl.getStartPointInOctave());
+        prev_pts.push_back(kl.getEndPointInOctave());
+    }
+    vector<uchar> status;
+    vector<float> err;
+    vector<Point2f> predicted_pts;
+    trackWithPrior(prev_img, cur_img, prev_pts, predictPoints(prev_pts, predicted_pts), cur_pts, status, err);
+
+    Rect inside(0, 0, cur_img.cols, cur_img.rows);
+    vector<LineKL> predict_keylines;
+    vector<int> predict_idx;
+    for (int i = 0; i < (int)prev_keyLine.size(); i++)
+    {
+        if (!status[2 * i] || !status[2 * i + 1] || err[2 * i] > 15 || err[2 * i + 1] > 15)
+            continue;
+        Point2f sp = cur_pts[2 * i], ep = cur_pts[2 * i + 1];
+        if (refineLine(cur_img, sp, ep) < line_min_support)
+            continue;
+        if (!inside.contains(sp) || !inside.contains(ep))
+            continue;
+        LineKL kl = MakeKeyLine(sp, ep, cur_img.cols);
+        if (kl.lineLength < 50 || !FindMatchedLine(prev_keyLine[i], kl, 20, 50, 0.17))
+            continue;
+        kl.class_id = predict_keylines.size();
+        predict_keylines.push_back(kl);
+        predict_idx.push_back(i);
+    }
+    if (predict_keylines.empty())
+        return;
+
+    Mat predict_descriptor;
+    line_bd->compute(cur_img, predict_keylines, predict_descriptor);
+    if (predict_descriptor.rows != (int)predict_keylines.size())
+        return;
+    for (int j = 0; j < (int)predict_keylines.size(); j++)
+    {
+        if (norm(prev_descriptor.row(predict_idx[j]), predict_descriptor.row(j), NORM_HAMMING) > line_verify_distance)
+            continue;
+        cur_keyLine.push_back(predict_keylines[j]);
+        cur_keyLine.back().class_id = cur_keyLine.size() - 1;
+        cur_descriptor.push_back(predict_descriptor.row(j));
+        tracked_idx.push_back(predict_idx[j]);
+    }
+}
+
+// Snaps a predicted line onto the edge under it: about every 5 px along the
+// line the strongest gradient across it within 3 px is sampled, and the line
+// is refitted through the samples. Returns the fraction of samples that
+// found an edge.
+double LineFeatureTracker::refineLine( const Mat &img, Point2f &start_pt, Point2f &end_pt )
+{
+    Point2f d = end_pt - start_pt;
+    double length = norm(d);
+    if (length < 1)
+        return 0;
+    Point2f n(-d.y / length, d.x / length);
+    int samples = std::min(40, std::max(2, (int)(length / 5)));
+
+    edge_samples.clear();
+    for (int k = 0; k < samples; k++)
+    {
+        Point2f c = start_pt + d * ((k + 0.5f) / samples);
+        double best = 0;
+        int best_offset = 0;
+        for (int o = -3; o <= 3; o++)
+        {
+            int x = cvRound(c.x + n.x * o), y = cvRound(c.y + n.y * o);
+            if (x < 1 || y < 1 || x >= img.cols - 1 || y >= img.rows - 1)
+                continue;
+            const uchar *row = img.ptr<uchar>(y);
+            double g = fabs((row[x + 1] - row[x - 1]) * n.x + (img.ptr<uchar>(y + 1)[x] - img.ptr<uchar>(y - 1)[x]) * n.y);
+            if (g > best)
+            {
+                best = g;
+                best_offset = o;
+            }
+        }
+        if (best >= 16)
+            edge_samples.push_back(c + n * best_offset);
+    }
+    double support = (double)edge_samples.size() / samples;
+    if (edge_samples.size() < 2)
+        return support;
+
+    // total least squares through the samples, keeping the endpoints' extent
+    Point2f mean(0, 0);
+    for (auto &p : edge_samples)
+        mean += p;
+    mean *= 1.0f / edge_samples.size();
+    double cxx = 0, cyy = 0, cxy = 0;
+    for (auto &p : edge_samples)
+    {
+        cxx += (p.x - mean.x) * (p.x - mean.x);
+        cyy += (p.y - mean.y) * (p.y - mean.y);
+        cxy += (p.x - mean.x) * (p.y - mean.y);
+    }
+    double theta = 0.5 * atan2(2 * cxy, cxx - cyy);
+    Point2f t(cos(theta), sin(theta));
+    start_pt = mean + t * (float)(start_pt - mean).dot(t);
+    end_pt = mean + t * (float)(end_pt - mean).dot(t);
+    return support;
+}
+
+// Detects lines on the bounding box of the candidate cells of a
+// line_grid x line_grid grid and keeps those centred in a candidate cell and
+// away from tracked_keyLine.
+void LineFeatureTracker::detectNewLines( Mat &cur_img, const vector<uchar> &candidate_cells, const vector<LineKL> &tracked_keyLine,
+                                         vector<LineKL> &new_keyLine, Mat &new_descriptor )
+{
+    TraceSpan span("line_detect");
+    int cell_w = (cur_img.cols + line_grid - 1) / line_grid;
+    int cell_h = (cur_img.rows + line_grid - 1) / line_grid;
+    int min_col = line_grid, max_col = -1, min_row = line_grid, max_row = -1;
+    for (int c = 0; c < (int)candidate_cells.size(); c++)
+        if (candidate_cells[c])
+        {
+            min_col = min(min_col, c % line_grid);
+            max_col = max(max_col, c % line_grid);
+            min_row = min(min_row, c / line_grid);
+            max_row = max(max_row, c / line_grid);
+        }
+    // let lines run half a cell past the cells they are centred in
+    Rect roi = Rect(min_col * cell_w - cell_w / 2, min_row * cell_h - cell_h / 2,
+                    (max_col - min_col + 2) * cell_w, (max_row - min_row + 2) * cell_h) &
+               Rect(0, 0, cur_img.cols, cur_img.rows);
+
+    Mat mask(cur_img.size(), CV_8UC1, Scalar(255));
+    for (auto &kl : tracked_keyLine)
+        line(mask, kl.getStartPoint(), kl.getEndPoint(), Scalar(0), 11);
+
+    TicToc t_detect;
+    vector<LineKL> detected;
+    line_detector->detect(cur_img(roi), detected);
+    Point2f offset(roi.x, roi.y);
+    for (auto &kl : detected)
+    {
+        LineKL new_kl = MakeKeyLine(kl.getStartPointInOctave() + offset, kl.getEndPointInOctave() + offset, cur_img.cols);
+        if (new_kl.lineLength < 50)
+            continue;
+        int x = min(max((int)new_kl.pt.x, 0), cur_img.cols - 1), y = min(max((int)new_kl.pt.y, 0), cur_img.rows - 1);
+        if (!candidate_cells[min(y / cell_h, line_grid - 1) * line_grid + min(x / cell_w, line_grid - 1)] || !mask.at<uchar>(y, x))
+            continue;
+        new_kl.class_id = new_keyLine.size();
+        new_keyLine.push_back(new_kl);
+    }
+    if (!new_keyLine.empty())
+        line_bd->compute(cur_img, new_keyLine, new_descriptor);
+    if (new_descriptor.rows != (int)new_keyLine.size())
+        new_keyLine.clear();
+    ROS_DEBUG("line detection costs: %fms on %dx%d, %lu new lines", t_detect.toc(), roi.width, roi.height, new_keyLine.size());
+}
+
 void LineFeatureTracker::lineExtraction( Mat &cur_img, vector<LineKL> &keyLine, Mat &descriptor)
 {
-    keyLine.clear();
-    Ptr<LineBD> lineBiDes = LineBD::createBinaryDescriptor();
-    Ptr<line_descriptor::LSDDetector> lineLSD = line_descriptor::LSDDetector::createLSDDetector();
+    TraceSpan span("line_detect");
+    initLineDetector();
     Mat keyLine_mask = Mat::ones(forw_img.size(), CV_8UC1);
 
-//    lineLSD->detect(cur_img, keyLine, 2, 2, keyLine_mask);
-    lineBiDes->detect(cur_img, keyLine);
+    TicToc t_detect;
+    line_detector->detect(cur_img, keyLine);
+    ROS_DEBUG("line detection costs: %fms, %lu lines", t_detect.toc(), keyLine.size());
     if(keyLine.size() > 0)
-       lineBiDes->compute(cur_img, keyLine, descriptor);
+       line_bd->compute(cur_img, keyLine, descriptor);
 
     // for(int row = 0; row < keyLine_mask.rows-1; row++){
     //   uchar* p = keyLine_mask.ptr<uchar>(row); //pointer p points to the first place of each row
@@ -1236,6 +1531,33 @@ void LineFeatureTracker::imageUndistortion(Mat &_img, Mat &_out_undistort_img)
     _out_undistort_img = undistorted_image;
 }
 
+void LineFeatureTracker::setRotationPrior(const Eigen::Matrix3d &R_c0c1)
+{
+    rotation_prior = R_c0c1;
+    has_rotation_prior = true;
+}
+
+// pts of the undistorted image moved by the rotation prior alone, or nullptr
+// without a prior
+const vector<Point2f> *LineFeatureTracker::predictPoints(const vector<Point2f> &pts, vector<Point2f> &predicted_pts)
+{
+    if (!has_rotation_prior)
+        return nullptr;
+    const PinholeCamera::Parameters &params = pinhole_camera->getParameters();
+    double fx = params.fx(), fy = params.fy(), cx = params.cx(), cy = params.cy();
+    Eigen::Matrix3d R_c1c0 = rotation_prior.transpose();
+    predicted_pts.resize(pts.size());
+    for (unsigned int i = 0; i < pts.size(); i++)
+    {
+        Vector3d P = R_c1c0 * Vector3d((pts[i].x - cx) / fx, (pts[i].y - cy) / fy, 1.0);
+        if (P.z() <= 0)
+            predicted_pts[i] = pts[i];
+        else
+            predicted_pts[i] = Point2f(fx * P.x() / P.z() + cx, fy * P.y() / P.z() + cy);
+    }
+    return &predicted_pts;
+}
+
 void LineFeatureTracker::readIntrinsicParameter(const string &calib_file)
 {
     ROS_INFO("reading paramerter of camera %s", calib_file.c_str());
@@ -1772,7 +2094,8 @@ void LineFeatureTracker::OpticalFlowExtraction(Mat &prev_img, Mat &cur_img,
         }
     }
 
-    cv::calcOpticalFlowPyrLK(prev_img, cur_img, cur_pts, forw_pts, status, err, cv::Size(21,21), 3);
+    vector<Point2f> predicted_pts;
+    trackWithPrior(prev_img, cur_img, cur_pts, predictPoints(cur_pts, predicted_pts), forw_pts, status, err);
 
     status_reduced.resize(status.size()/line_distribution);
 
@@ -16,6 +16,7 @@
 
 #include "parameters.h"
 #include "tic_toc.h"
+#include <uvslam/trace.h>
 
 #include <cv_bridge/cv_bridge.h>
 #include <sensor_msgs/image_encodings.h>
@@ -25,6 +26,8 @@
 
 #include "math.h"
 #include "utility.h"
+#include "line_detector.h"
+#include "rotation_prior.h"
 #include "highgui.h"
 
 using namespace std;
@@ -33,9 +36,6 @@ using namespace Eigen;
 using namespace cv;
 using namespace line_descriptor;
 
-typedef line_descriptor::BinaryDescriptor LineBD;
-typedef line_descriptor::KeyLine LineKL;
-
 class LineFeatureTracker
 {
   public:
@@ -46,8 +46,17 @@ class LineFeatureTracker
     void imageUndistortion(Mat &_img, Mat &_out_undistort_img);
     void readIntrinsicParameter(const string &calib_file);
     void lineExtraction( Mat &cur_img, vector<LineKL> &_keyLine, Mat &_descriptor );
+    void findLines( Mat &prev_img, Mat &cur_img, vector<LineKL> &prev_keyLine, Mat &prev_descriptor,
+                    vector<LineKL> &cur_keyLine, Mat &cur_descriptor, vector<DMatch> &good_match_vector );
+    void predictLines( Mat &prev_img, Mat &cur_img, vector<LineKL> &prev_keyLine, Mat &prev_descriptor,
+                       vector<LineKL> &cur_keyLine, Mat &cur_descriptor, vector<int> &tracked_idx );
+    double refineLine( const Mat &img, Point2f &start_pt, Point2f &end_pt );
+    void detectNewLines( Mat &cur_img, const vector<uchar> &candidate_cells, const vector<LineKL> &tracked_keyLine,
+                         vector<LineKL> &new_keyLine, Mat &new_descriptor );
+    double detectionFreeRatio() const { return line_frames ? (double)detection_free_frames / line_frames : 0.0; }
     void lineMergingTwoPhase( Mat &prev_img, Mat &cur_img, vector<LineKL> &prev_keyLine, vector<LineKL> &cur_keyLine, Mat &prev_descriptor, Mat &cur_descriptor, vector<DMatch> &good_match_vector );
     void lineMatching( vector<LineKL> &_prev_keyLine, vector<LineKL> &_curr_keyLine, Mat &_prev_descriptor, Mat &_curr_descriptor, vector<DMatch> &_good_match_vector);
+    void limitLines( vector<LineKL> &cur_keyLine, Mat &cur_descriptor, vector<DMatch> &good_match_vector );
     bool updateID(unsigned int i);
     void normalizePoints();
 
@@ -61,6 +70,12 @@ class LineFeatureTracker
 
     void lineRawResolution( Mat &cur_img, vector<LineKL> &predict_keyLines);
 
+    // R_c0c1 from the last image to the next one, used once by readImage4Line()
+    void setRotationPrior(const Eigen::Matrix3d &R_c0c1);
+    const vector<Point2f> *predictPoints(const vector<Point2f> &pts, vector<Point2f> &predicted_pts);
+    bool has_rotation_prior = false;
+    Eigen::Matrix3d rotation_prior;
+
     camodocal::CameraPtr m_camera;
     camodocal::PinholeCameraPtr pinhole_camera;
 
@@ -92,6 +107,24 @@ class LineFeatureTracker
 
     Utility util;
 
+    // created on first use, the tracker is constructed before readParameters()
+    void initLineDetector();
+    std::unique_ptr<LineDetector> line_detector;
+    Ptr<LineBD> line_bd;
+
+    // track-driven detection (line_detect_interval > 1)
+    int frames_since_detection = 0;
+    unsigned int line_frames = 0, detection_free_frames = 0;
+    vector<uchar> barren_cells; // searched without finding a line
+    vector<Point2f> edge_samples;
+    int line_grid = 4;
+    int line_verify_distance = 25; // LBD hamming distance to the previous frame
+    double line_min_support = 0.6; // fraction of a predicted line on an edge
+
+    // lines kept per image, the longest tracked and then the longest ones;
+    // 0: all. Set from the estimator's frame budget (/vins_estimator/line_budget).
+    int max_lines = 0;
+
 
     /// FOR KALMAN
     // States are position and velocity in X and Y directions; four states [X;Y;dX/dt;dY/dt]
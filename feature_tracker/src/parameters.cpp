@@ -1,4 +1,5 @@
 #include "parameters.h"
+#include <opencv2/core/eigen.hpp>
 
 int POINT_ONLY;
 int ENABLE_DEPTH;
@@ -33,6 +34,19 @@ double DIST_P1;
 double DIST_P2;
 
 int CANNY_DETECT;
+int LINE_DETECTOR = 0;
+int LINE_DETECTOR_LEVEL = 0;
+int LINE_DETECT_INTERVAL = 1;
+int LINE_MIN_TRACKED = 30;
+
+int IMU_PRIOR = 0;
+int KLT_PRIOR_WINDOW = 15;
+int KLT_PRIOR_LEVELS = 1;
+Eigen::Matrix3d RIC = Eigen::Matrix3d::Identity();
+
+int TRACE_ENABLE = 0;
+std::string TRACE_PATH;
+double TRACE_SUMMARY_PERIOD = 1.0;
 
 cv::Mat PROJ;
 
@@ -56,14 +70,46 @@ void readParameters(ros::NodeHandle &n)
 {
     std::string config_file;
     config_file = readParam<std::string>(n, "config_file");
+    std::string VINS_FOLDER_PATH = readParam<std::string>(n, "vins_folder");
+    readParameters(config_file, VINS_FOLDER_PATH);
+}
+
+void readParameters(const std::string &config_file, const std::string &VINS_FOLDER_PATH)
+{
     cv::FileStorage fsSettings(config_file, cv::FileStorage::READ);
     if(!fsSettings.isOpened())
     {
         std::cerr << "ERROR: Wrong path to settings" << std::endl;
     }
-    std::string VINS_FOLDER_PATH = readParam<std::string>(n, "vins_folder");
 
     CANNY_DETECT = fsSettings["canny_detect"];
+    if (!fsSettings["line_detector"].empty())
+        LINE_DETECTOR = fsSettings["line_detector"];
+    if (!fsSettings["line_detector_level"].empty())
+        LINE_DETECTOR_LEVEL = fsSettings["line_detector_level"];
+    if (!fsSettings["line_detect_interval"].empty())
+        LINE_DETECT_INTERVAL = fsSettings["line_detect_interval"];
+    if (!fsSettings["line_min_tracked"].empty())
+        LINE_MIN_TRACKED = fsSettings["line_min_tracked"];
+    if (!fsSettings["imu_prior"].empty())
+        IMU_PRIOR = fsSettings["imu_prior"];
+    if (!fsSettings["klt_prior_window"].empty())
+        KLT_PRIOR_WINDOW = fsSettings["klt_prior_window"];
+    if (!fsSettings["klt_prior_levels"].empty())
+        KLT_PRIOR_LEVELS = fsSettings["klt_prior_levels"];
+    if (IMU_PRIOR && !fsSettings["extrinsicRotation"].empty())
+    {
+        cv::Mat cv_R;
+        fsSettings["extrinsicRotation"] >> cv_R;
+        cv::cv2eigen(cv_R, RIC);
+        RIC = Eigen::Quaterniond(RIC).normalized().toRotationMatrix();
+    }
+    if (!fsSettings["trace_enable"].empty())
+        TRACE_ENABLE = fsSettings["trace_enable"];
+    if (!fsSettings["trace_path"].empty())
+        fsSettings["trace_path"] >> TRACE_PATH;
+    if (!fsSettings["trace_summary_period"].empty())
+        TRACE_SUMMARY_PERIOD = fsSettings["trace_summary_period"];
 
 
     POINT_ONLY   = fsSettings["point_only"];
@@ -1,6 +1,7 @@
 #pragma once
 #include <ros/ros.h>
 #include <opencv2/highgui/highgui.hpp>
+#include <eigen3/Eigen/Dense>
 
 extern int ROW;
 extern int COL;
@@ -27,9 +28,24 @@ extern int FISHEYE;
 extern bool PUB_THIS_FRAME;
 
 extern int CANNY_DETECT;
+extern int LINE_DETECTOR;        // LineDetectorType
+extern int LINE_DETECTOR_LEVEL;  // pyramid level lines are detected on
+extern int LINE_DETECT_INTERVAL; // frames between full line detections, 1: detect and match every frame
+extern int LINE_MIN_TRACKED;     // below this, empty cells are searched even if they were barren
+
+extern int IMU_PRIOR;            // seed KLT with the gyro rotation between frames
+extern int KLT_PRIOR_WINDOW;     // KLT window (px) when seeded by the prior
+extern int KLT_PRIOR_LEVELS;     // KLT pyramid levels when seeded by the prior
+extern Eigen::Matrix3d RIC;      // camera to IMU rotation, extrinsicRotation
+
+extern int TRACE_ENABLE;             // record per-frame stage spans, see uvslam/trace.h
+extern std::string TRACE_PATH;       // directory of the <node>.json traces, empty: percentiles only
+extern double TRACE_SUMMARY_PERIOD;  // seconds between /diagnostics percentile summaries
 
 
 void readParameters(ros::NodeHandle &n);
+// without ROS, for the offline tools; vins_folder locates the fisheye mask
+void readParameters(const std::string &config_file, const std::string &vins_folder);
 
 extern double PROJ_FX;
 extern double PROJ_FY;
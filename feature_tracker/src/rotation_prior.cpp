@@ -0,0 +1,79 @@
+#include "rotation_prior.h"
+#include "parameters.h"
+
+// gyro samples may stop this short of the image stamp
+static const double MAX_EXTRAPOLATION = 0.01;
+
+RotationPrior::RotationPrior() : ric(Eigen::Matrix3d::Identity())
+{
+}
+
+void RotationPrior::addGyro(double t, const Eigen::Vector3d &gyr)
+{
+    if (!gyro.empty() && t <= gyro.back().first)
+        return;
+    gyro.emplace_back(t, gyr);
+}
+
+bool RotationPrior::cameraRotation(double t0, double t1, Eigen::Matrix3d &R_c0c1)
+{
+    // keep the last sample before t0, it covers the start of the interval
+    while (gyro.size() > 1 && gyro[1].first <= t0)
+        gyro.pop_front();
+    if (gyro.empty() || gyro.front().first > t0 || gyro.back().first < t1 - MAX_EXTRAPOLATION)
+        return false;
+
+    Eigen::Quaterniond q_i0i1 = Eigen::Quaterniond::Identity();
+    for (size_t k = 0; k < gyro.size() && gyro[k].first < t1; k++)
+    {
+        double begin = std::max(gyro[k].first, t0);
+        double end = k + 1 < gyro.size() ? std::min(gyro[k + 1].first, t1) : t1;
+        if (end <= begin)
+            continue;
+        Eigen::Vector3d w = k + 1 < gyro.size() ? 0.5 * (gyro[k].second + gyro[k + 1].second) : gyro[k].second;
+        Eigen::Vector3d theta = w * (end - begin);
+        double angle = theta.norm();
+        if (angle > 1e-12)
+            q_i0i1 = q_i0i1 * Eigen::Quaterniond(Eigen::AngleAxisd(angle, theta / angle));
+    }
+    R_c0c1 = ric.transpose() * q_i0i1.toRotationMatrix() * ric;
+    return true;
+}
+
+void trackWithPrior(const cv::Mat &prev_img, const cv::Mat &cur_img, const std::vector<cv::Point2f> &prev_pts,
+                    const std::vector<cv::Point2f> *seeds, std::vector<cv::Point2f> &cur_pts,
+                    std::vector<uchar> &status, std::vector<float> &err)
+{
+    if (!seeds)
+    {
+        cv::calcOpticalFlowPyrLK(prev_img, cur_img, prev_pts, cur_pts, status, err, cv::Size(21, 21), 3);
+        return;
+    }
+
+    cur_pts = *seeds;
+    cv::calcOpticalFlowPyrLK(prev_img, cur_img, prev_pts, cur_pts, status, err,
+                             cv::Size(KLT_PRIOR_WINDOW, KLT_PRIOR_WINDOW), KLT_PRIOR_LEVELS,
+                             cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30, 0.01),
+                             cv::OPTFLOW_USE_INITIAL_FLOW);
+
+    std::vector<int> lost;
+    std::vector<cv::Point2f> lost_prev, lost_cur;
+    for (int i = 0; i < (int)prev_pts.size(); i++)
+        if (!status[i])
+        {
+            lost.push_back(i);
+            lost_prev.push_back(prev_pts[i]);
+        }
+    if (lost.empty())
+        return;
+
+    std::vector<uchar> lost_status;
+    std::vector<float> lost_err;
+    cv::calcOpticalFlowPyrLK(prev_img, cur_img, lost_prev, lost_cur, lost_status, lost_err, cv::Size(21, 21), 3);
+    for (int j = 0; j < (int)lost.size(); j++)
+    {
+        cur_pts[lost[j]] = lost_cur[j];
+        status[lost[j]] = lost_status[j];
+        err[lost[j]] = lost_err[j];
+    }
+}
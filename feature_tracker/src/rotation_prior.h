@@ -0,0 +1,37 @@
+#pragma once
+
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+#include <eigen3/Eigen/Dense>
+
+// Camera rotation between two image stamps integrated from the gyro. The
+// front end has no bias estimate, so this is only good as a seed for KLT;
+// the tracked positions still come from the images.
+class RotationPrior
+{
+  public:
+    RotationPrior();
+
+    void setExtrinsic(const Eigen::Matrix3d &_ric) { ric = _ric; }
+    void addGyro(double t, const Eigen::Vector3d &gyr);
+
+    // R_c0c1, the camera at t1 in the camera at t0; false when the gyro does
+    // not reach back to t0 or up to t1. Older samples are dropped.
+    bool cameraRotation(double t0, double t1, Eigen::Matrix3d &R_c0c1);
+
+  private:
+    std::deque<std::pair<double, Eigen::Vector3d>> gyro;
+    Eigen::Matrix3d ric;
+};
+
+// KLT of prev_pts from prev_img into cur_img. With seeds, the search starts
+// from them with a small window and pyramid (klt_prior_window,
+// klt_prior_levels), and points lost that way are retried from their
+// previous position with the full 21x21, 3 level search used without a
+// prior.
+void trackWithPrior(const cv::Mat &prev_img, const cv::Mat &cur_img, const std::vector<cv::Point2f> &prev_pts,
+                    const std::vector<cv::Point2f> *seeds, std::vector<cv::Point2f> &cur_pts,
+                    std::vector<uchar> &status, std::vector<float> &err);
@@ -144,6 +144,14 @@ public:
 
   void delete_entry(const EntryId entry_id);
 
+  /**
+   * Removes an entry from the inverted file given the bow vector it was
+   * added with; works without the direct index
+   * @param entry_id id of the entry
+   * @param vec bow vector of the entry
+   */
+  void delete_entry(const EntryId entry_id, const BowVector &vec);
+
   /**
    * Empties the database
    */
@@ -480,7 +488,15 @@ template<class TDescriptor, class F>
 void TemplatedDatabase<TDescriptor, F>::delete_entry(const EntryId entry_id)
 {
   BowVector v = m_dBowfile[entry_id];
+  delete_entry(entry_id, v);
+}
 
+// ---------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedDatabase<TDescriptor, F>::delete_entry(const EntryId entry_id,
+  const BowVector &v)
+{
   BowVector::const_iterator vit;
 
   for (vit = v.begin(); vit != v.end(); ++vit)
@@ -497,8 +513,10 @@ void TemplatedDatabase<TDescriptor, F>::delete_entry(const EntryId entry_id)
       }
     }
   }
-  m_dBowfile[entry_id].clear();
-  m_dfile[entry_id].clear();
+  if (entry_id < m_dBowfile.size())
+    m_dBowfile[entry_id].clear();
+  if (entry_id < m_dfile.size())
+    m_dfile[entry_id].clear();
 }
 
 
@@ -28,10 +28,60 @@
 // Added by VINS [[[
 #include "../VocabularyBinary.hpp"
 #include <boost/dynamic_bitset.hpp>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 // Added by VINS ]]]
 
 namespace DBoW2 {
 
+// Added by VINS [[[
+/// Packs a 256-bit binary descriptor into 4 words for the packed descent.
+/// Other descriptors are not packed and descend through F::distance
+template<class TDescriptor>
+inline bool packNodeDescriptor(const TDescriptor &, uint64_t *)
+{
+  return false;
+}
+
+inline bool packNodeDescriptor(const boost::dynamic_bitset<> &d, uint64_t *words)
+{
+  // to_block_range writes block_type (unsigned long) words
+  static_assert(sizeof(boost::dynamic_bitset<>::block_type) == sizeof(uint64_t),
+    "the packed descent needs 64-bit dynamic_bitset blocks");
+  if(d.size() != 256) return false;
+  boost::to_block_range(d, words);
+  return true;
+}
+
+/// Hamming distance of two packed 256-bit descriptors
+inline int packedDistance(const uint64_t *a, const uint64_t *b)
+{
+#ifdef __SSE2__
+  // per byte popcount of both halves, summed by _mm_sad_epu8
+  const __m128i m1 = _mm_set1_epi8(0x55);
+  const __m128i m2 = _mm_set1_epi8(0x33);
+  const __m128i m4 = _mm_set1_epi8(0x0f);
+  __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)a),
+    _mm_loadu_si128((const __m128i *)b));
+  __m128i y = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + 2)),
+    _mm_loadu_si128((const __m128i *)(b + 2)));
+  x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi64(x, 1), m1));
+  y = _mm_sub_epi8(y, _mm_and_si128(_mm_srli_epi64(y, 1), m1));
+  x = _mm_add_epi8(_mm_and_si128(x, m2), _mm_and_si128(_mm_srli_epi64(x, 2), m2));
+  y = _mm_add_epi8(_mm_and_si128(y, m2), _mm_and_si128(_mm_srli_epi64(y, 2), m2));
+  x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi64(x, 4)), m4);
+  y = _mm_and_si128(_mm_add_epi8(y, _mm_srli_epi64(y, 4)), m4);
+  __m128i sum = _mm_sad_epu8(_mm_add_epi8(x, y), _mm_setzero_si128());
+  return _mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4);
+#else
+  return __builtin_popcountll(a[0] ^ b[0]) + __builtin_popcountll(a[1] ^ b[1]) +
+    __builtin_popcountll(a[2] ^ b[2]) + __builtin_popcountll(a[3] ^ b[3]);
+#endif
+}
+// Added by VINS ]]]
+
 /// @param TDescriptor class of descriptor
 /// @param F class of descriptor functions
 template<class TDescriptor, class F>
@@ -348,6 +398,32 @@ protected:
    * @param id (out) word id
    */
   virtual void transform(const TDescriptor &feature, WordId &id) const;
+
+  /**
+   * Returns the word, weight and, if nids is given, node "levelsup" levels
+   * up of every feature
+   * @param features
+   * @param ids (out) word ids
+   * @param weights (out) word weights
+   * @param nids (out) if given, node ids
+   * @param levelsup
+   */
+  void transformAll(const std::vector<TDescriptor>& features,
+    std::vector<WordId> &ids, std::vector<WordValue> &weights,
+    std::vector<NodeId> *nids = NULL, int levelsup = 0) const;
+
+  /**
+   * Descends the packed tree with a packed 256-bit feature
+   * @see transform
+   */
+  void transformPacked(const uint64_t *feature, WordId &id, 
+    WordValue &weight, NodeId* nid, int levelsup) const;
+
+  /**
+   * Stores the children of every node contiguously, with their descriptors
+   * packed, if all node descriptors can be packed
+   */
+  void buildPackedTree();
       
   /**
    * Creates a level in the tree, under the parent, by running kmeans with
@@ -412,6 +488,15 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Children of node nid in the packed tree, in the order of
+  /// m_nodes[nid].children: m_child_ids[m_child_begin[nid]] to
+  /// m_child_ids[m_child_begin[nid + 1] - 1]. Empty if not packed
+  std::vector<unsigned int> m_child_begin;
+  std::vector<NodeId> m_child_ids;
+
+  /// Packed descriptors of m_child_ids, 4 words each
+  std::vector<uint64_t> m_child_descriptors;
   
 };
 
@@ -934,6 +1019,8 @@ void TemplatedVocabulary<TDescriptor,F>::createWords()
       }
     }
   }
+
+  buildPackedTree();
 }
 
 // --------------------------------------------------------------------------
@@ -1076,20 +1163,19 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
 
-  typename std::vector<TDescriptor>::const_iterator fit;
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  transformAll(features, ids, weights);
 
   if(m_weighting == TF || m_weighting == TF_IDF)
   {
-    for(fit = features.begin(); fit < features.end(); ++fit)
+    for(unsigned int i = 0; i < features.size(); ++i)
     {
-      WordId id;
-      WordValue w; 
       // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w);
+      WordValue w = weights[i];
       
       // not stopped
-      if(w > 0) v.addWeight(id, w);
+      if(w > 0) v.addWeight(ids[i], w);
     }
     
     if(!v.empty() && !must)
@@ -1103,16 +1189,13 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   }
   else // IDF || BINARY
   {
-    for(fit = features.begin(); fit < features.end(); ++fit)
+    for(unsigned int i = 0; i < features.size(); ++i)
     {
-      WordId id;
-      WordValue w;
       // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w);
+      WordValue w = weights[i];
       
       // not stopped
-      if(w > 0) v.addIfNotExist(id, w);
+      if(w > 0) v.addIfNotExist(ids[i], w);
       
     } // if add_features
   } // if m_weighting == ...
@@ -1139,24 +1222,22 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
   
-  typename std::vector<TDescriptor>::const_iterator fit;
+  std::vector<WordId> ids;
+  std::vector<WordValue> weights;
+  std::vector<NodeId> nids;
+  transformAll(features, ids, weights, &nids, levelsup);
   
   if(m_weighting == TF || m_weighting == TF_IDF)
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    for(unsigned int i_feature = 0; i_feature < features.size(); ++i_feature)
     {
-      WordId id;
-      NodeId nid;
-      WordValue w; 
       // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w, &nid, levelsup);
+      WordValue w = weights[i_feature];
       
       if(w > 0) // not stopped
       { 
-        v.addWeight(id, w);
-        fv.addFeature(nid, i_feature);
+        v.addWeight(ids[i_feature], w);
+        fv.addFeature(nids[i_feature], i_feature);
       }
     }
     
@@ -1171,20 +1252,15 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   }
   else // IDF || BINARY
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    for(unsigned int i_feature = 0; i_feature < features.size(); ++i_feature)
     {
-      WordId id;
-      NodeId nid;
-      WordValue w;
       // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w, &nid, levelsup);
+      WordValue w = weights[i_feature];
       
       if(w > 0) // not stopped
       {
-        v.addIfNotExist(id, w);
-        fv.addFeature(nid, i_feature);
+        v.addIfNotExist(ids[i_feature], w);
+        fv.addFeature(nids[i_feature], i_feature);
       }
     }
   } // if m_weighting == ...
@@ -1217,8 +1293,14 @@ template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature, 
   WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
 { 
+  uint64_t packed[4];
+  if(!m_child_ids.empty() && packNodeDescriptor(feature, packed))
+  {
+    transformPacked(packed, word_id, weight, nid, levelsup);
+    return;
+  }
+
   // propagate the feature down the tree
-  std::vector<NodeId> nodes;
   typename std::vector<NodeId>::const_iterator nit;
 
   // level at which the node must be stored in nid, if given
@@ -1231,7 +1313,7 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
   do
   {
     ++current_level;
-    nodes = m_nodes[final_id].children;
+    const std::vector<NodeId> &nodes = m_nodes[final_id].children;
     final_id = nodes[0];
  
     double best_d = F::distance(feature, m_nodes[final_id].descriptor);
@@ -1259,6 +1341,106 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transformPacked(const uint64_t *feature,
+  WordId &word_id, WordValue &weight, NodeId *nid, int levelsup) const
+{
+  // level at which the node must be stored in nid, if given
+  const int nid_level = m_L - levelsup;
+  if(nid_level <= 0 && nid != NULL) *nid = 0; // root
+
+  NodeId final_id = 0; // root
+  int current_level = 0;
+
+  do
+  {
+    ++current_level;
+
+    // the children and their descriptors are contiguous, the first of the
+    // closest ones wins as in transform
+    const unsigned int begin = m_child_begin[final_id];
+    const unsigned int end = m_child_begin[final_id + 1];
+    const uint64_t *d = &m_child_descriptors[4 * begin];
+    unsigned int best = begin;
+    int best_d = packedDistance(feature, d);
+    d += 4;
+    for(unsigned int c = begin + 1; c < end; ++c, d += 4)
+    {
+      int dist = packedDistance(feature, d);
+      if(dist < best_d)
+      {
+        best_d = dist;
+        best = c;
+      }
+    }
+    final_id = m_child_ids[best];
+
+    if(nid != NULL && current_level == nid_level)
+      *nid = final_id;
+
+  } while( m_child_begin[final_id] != m_child_begin[final_id + 1] );
+
+  // turn node id into word id
+  word_id = m_nodes[final_id].word_id;
+  weight = m_nodes[final_id].weight;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transformAll(
+  const std::vector<TDescriptor>& features, std::vector<WordId> &ids,
+  std::vector<WordValue> &weights, std::vector<NodeId> *nids,
+  int levelsup) const
+{
+  const int n = features.size();
+  ids.resize(n);
+  weights.resize(n);
+  if(nids) nids->resize(n);
+
+  // one thread: the packed descent of a whole keyframe takes well under a
+  // millisecond, less than starting and joining threads for every query
+  for(int i = 0; i < n; ++i)
+    transform(features[i], ids[i], weights[i],
+      nids ? &(*nids)[i] : NULL, levelsup);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::buildPackedTree()
+{
+  m_child_begin.clear();
+  m_child_ids.clear();
+  m_child_descriptors.clear();
+  if(m_nodes.empty()) return;
+
+  m_child_begin.reserve(m_nodes.size() + 1);
+  m_child_ids.reserve(m_nodes.size());
+  m_child_descriptors.resize(4 * m_nodes.size());
+  for(const Node &node : m_nodes)
+  {
+    m_child_begin.push_back(m_child_ids.size());
+    for(NodeId child : node.children)
+    {
+      uint64_t *d = &m_child_descriptors[4 * m_child_ids.size()];
+      if(!packNodeDescriptor(m_nodes[child].descriptor, d))
+      {
+        // not a 256-bit binary vocabulary: F::distance descent
+        m_child_begin.clear();
+        m_child_ids.clear();
+        m_child_descriptors.clear();
+        return;
+      }
+      m_child_ids.push_back(child);
+    }
+  }
+  m_child_begin.push_back(m_child_ids.size());
+  m_child_descriptors.resize(4 * m_child_ids.size());
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 NodeId TemplatedVocabulary<TDescriptor,F>::getParentNode
   (WordId wid, int levelsup) const
@@ -1502,6 +1684,8 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  buildPackedTree();
 }
     
 // Added by VINS [[[
@@ -1558,6 +1742,8 @@ void TemplatedVocabulary<TDescriptor,F>::loadBin(const std::string &filename) {
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  buildPackedTree();
 }
     
 // Added by VINS ]]]
@@ -14,6 +14,11 @@
 #include "../DUtils/DUtils.h"
 #include <boost/dynamic_bitset.hpp>
 #include <vector>
+#include <algorithm>
+#include <cstdlib>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 using namespace DVision;
@@ -36,68 +41,148 @@ BRIEF::~BRIEF()
 
 // ---------------------------------------------------------------------------
 
+void BRIEF::treatImage(const cv::Mat &image, cv::Mat &im) const
+{
+  const float sigma = 2.f;
+  const cv::Size ksize(9, 9);
+
+  cv::Mat aux;
+  if(image.depth() == 3)
+  {
+    cv::cvtColor(image, aux, CV_RGB2GRAY);
+  }
+  else
+  {
+    aux = image;
+  }
+
+  cv::GaussianBlur(aux, im, ksize, sigma, sigma);
+}
+
+// ---------------------------------------------------------------------------
+
 void BRIEF::compute(const cv::Mat &image, 
     const std::vector<cv::KeyPoint> &points,
     vector<bitset> &descriptors,
     bool treat_image) const
 {
-  const float sigma = 2.f;
-  const cv::Size ksize(9, 9);
-  
-  cv::Mat im;
-  if(treat_image)
+  vector<word> packed;
+  computePacked(image, points, packed, treat_image);
+
+  const int nwords = getDescriptorLengthInWords();
+  descriptors.resize(points.size());
+  for(unsigned int k = 0; k < points.size(); ++k)
   {
-    cv::Mat aux;
-    if(image.depth() == 3)
-    {
-      cv::cvtColor(image, aux, CV_RGB2GRAY);
-    }
-    else
-    {
-      aux = image;
-    }
+    unpack(&packed[k * nwords], m_bit_length, descriptors[k]);
+  }
+}
 
-    cv::GaussianBlur(aux, im, ksize, sigma, sigma);
-    
+// ---------------------------------------------------------------------------
+
+void BRIEF::unpack(const word *words, int nbits, bitset &descriptor)
+{
+  descriptor.clear();
+  descriptor.append(words, words + (nbits + 63) / 64);
+  descriptor.resize(nbits);
+}
+
+// ---------------------------------------------------------------------------
+
+/// Sets bit i of d for every i < n with a[i] < b[i]
+static void packLess(const unsigned char *a, const unsigned char *b, int n,
+  BRIEF::word *d)
+{
+  int i = 0;
+#ifdef __SSE2__
+  // unsigned comparison through the signed one with the sign bits flipped
+  const __m128i sign = _mm_set1_epi8((char)0x80);
+  for(; i + 16 <= n; i += 16)
+  {
+    __m128i va = _mm_xor_si128(
+      _mm_loadu_si128((const __m128i *)(a + i)), sign);
+    __m128i vb = _mm_xor_si128(
+      _mm_loadu_si128((const __m128i *)(b + i)), sign);
+    BRIEF::word mask = (unsigned int)_mm_movemask_epi8(_mm_cmplt_epi8(va, vb));
+    d[i >> 6] |= mask << (i & 63);
   }
-  else
+#endif
+  for(; i < n; ++i)
   {
-    im = image;
+    if(a[i] < b[i]) d[i >> 6] |= (BRIEF::word)1 << (i & 63);
   }
+}
+
+// ---------------------------------------------------------------------------
+
+void BRIEF::computePacked(const cv::Mat &image,
+    const std::vector<cv::KeyPoint> &points,
+    vector<word> &descriptors,
+    bool treat_image) const
+{
+  cv::Mat im;
+  if(treat_image)
+    treatImage(image, im);
+  else
+    im = image;
   
   assert(im.type() == CV_8UC1);
-  assert(im.isContinuous());
   
   // use im now
   const int W = im.cols;
   const int H = im.rows;
-  
-  descriptors.resize(points.size());
-  std::vector<bitset>::iterator dit;
+  const int n = m_x1.size();
+  const int nwords = getDescriptorLengthInWords();
 
-  std::vector<cv::KeyPoint>::const_iterator kit;
-  
+  descriptors.assign(points.size() * nwords, 0);
+
+  // the pattern as offsets for this image stride, and its extent
+  const int step = (int)im.step;
+  vector<int> off1(n), off2(n);
+  int r = 0;
+  for(int i = 0; i < n; ++i)
+  {
+    off1[i] = m_y1[i] * step + m_x1[i];
+    off2[i] = m_y2[i] * step + m_x2[i];
+    r = std::max(r, std::max(std::max(abs(m_x1[i]), abs(m_y1[i])),
+      std::max(abs(m_x2[i]), abs(m_y2[i]))));
+  }
+
+  vector<unsigned char> v1(n), v2(n);
   int x1, y1, x2, y2;
-  
-  dit = descriptors.begin();
-  for(kit = points.begin(); kit != points.end(); ++kit, ++dit)
+
+  for(unsigned int k = 0; k < points.size(); ++k)
   {
-    dit->resize(m_bit_length);
-    dit->reset();
+    const cv::KeyPoint &kp = points[k];
+    word *d = &descriptors[k * nwords];
+
+    // with the whole patch inside, (int)(x + dx) == (int)x + dx
+    if(kp.pt.x >= r && kp.pt.y >= r && 
+      (int)kp.pt.x + r < W && (int)kp.pt.y + r < H)
+    {
+      const unsigned char *center = 
+        im.ptr<unsigned char>((int)kp.pt.y) + (int)kp.pt.x;
+      for(int i = 0; i < n; ++i)
+      {
+        v1[i] = center[off1[i]];
+        v2[i] = center[off2[i]];
+      }
+      packLess(v1.data(), v2.data(), n, d);
+      continue;
+    }
 
-    for(unsigned int i = 0; i < m_x1.size(); ++i)
+    for(int i = 0; i < n; ++i)
     {
-      x1 = (int)(kit->pt.x + m_x1[i]);
-      y1 = (int)(kit->pt.y + m_y1[i]);
-      x2 = (int)(kit->pt.x + m_x2[i]);
-      y2 = (int)(kit->pt.y + m_y2[i]);
+      x1 = (int)(kp.pt.x + m_x1[i]);
+      y1 = (int)(kp.pt.y + m_y1[i]);
+      x2 = (int)(kp.pt.x + m_x2[i]);
+      y2 = (int)(kp.pt.y + m_y2[i]);
       
       if(x1 >= 0 && x1 < W && y1 >= 0 && y1 < H 
         && x2 >= 0 && x2 < W && y2 >= 0 && y2 < H)
       {
         if( im.ptr<unsigned char>(y1)[x1] < im.ptr<unsigned char>(y2)[x2] )
         {
-          dit->set(i);
+          d[i >> 6] |= (word)1 << (i & 63);
         }        
       } // if (x,y)_1 and (x,y)_2 are in the image
             
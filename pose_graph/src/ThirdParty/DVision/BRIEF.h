@@ -31,6 +31,7 @@
 
 #include <opencv2/opencv.hpp>
 #include <vector>
+#include <stdint.h>
 #include <boost/dynamic_bitset.hpp>
 
 namespace DVision {
@@ -43,6 +44,10 @@ public:
   /// Bitset type
   typedef boost::dynamic_bitset<> bitset;
 
+  /// Word of a packed descriptor. Bit i of a descriptor is bit i % 64 of
+  /// its word i / 64, as in bitset
+  typedef uint64_t word;
+
   /// Type of pairs
   enum Type
   {
@@ -70,6 +75,14 @@ public:
     return m_bit_length;
   }
   
+  /**
+   * Returns the descriptor length in packed words
+   */
+  inline int getDescriptorLengthInWords() const
+  {
+    return (m_bit_length + 63) / 64;
+  }
+
   /**
    * Returns the type of classifier
    */
@@ -113,11 +126,36 @@ public:
    *   grayscale if needed and smoothed. If not, it is assumed the image has
    *   been treated by the user
    * @note this function is similar to BRIEF::operator()
+   * @note the descriptors are computed by computePacked and converted
    */ 
   void compute(const cv::Mat &image,
     const std::vector<cv::KeyPoint> &points,
     std::vector<bitset> &descriptors,
     bool treat_image = true) const;
+
+  /**
+   * Returns the BRIEF descriptors of the given keypoints packed into words,
+   * getDescriptorLengthInWords() consecutive words per keypoint. The bits
+   * are the same as those of compute. Keypoints whose patch lies inside the
+   * image are tested through pixel offsets without bounds checks, and the
+   * comparisons are done 16 at a time with SSE2 when it is available
+   * @param image
+   * @param points
+   * @param descriptors
+   * @param treat_image (default: true) see compute
+   */
+  void computePacked(const cv::Mat &image,
+    const std::vector<cv::KeyPoint> &points,
+    std::vector<word> &descriptors,
+    bool treat_image = true) const;
+
+  /**
+   * Converts a packed descriptor into a bitset
+   * @param words getDescriptorLengthInWords() words of a descriptor
+   * @param nbits descriptor length in bits
+   * @param descriptor
+   */
+  static void unpack(const word *words, int nbits, bitset &descriptor);
   
   /**
    * Exports the test pattern
@@ -166,6 +204,11 @@ public:
 
 protected:
 
+  /**
+   * Converts the image to grayscale if needed and smooths it
+   */
+  void treatImage(const cv::Mat &image, cv::Mat &im) const;
+
   /**
    * Generates random points in the patch coordinates, according to 
    * m_patch_size and m_bit_length
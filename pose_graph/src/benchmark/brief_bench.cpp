@@ -0,0 +1,120 @@
+// BRIEF extraction time of the packed extractor against the per-bit
+// implementation it replaced, on a directory of images (e.g. EuRoC
+// cam0/data). Keypoints are FAST corners as in KeyFrame::computeBRIEFPoint;
+// every descriptor of both extractors is compared bit by bit. The blur is
+// done once per image and not timed.
+//
+//   brief_bench <brief_pattern.yml> <image_dir> [max_images]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "../ThirdParty/DVision/BRIEF.h"
+#include "../utility/tic_toc.h"
+
+using namespace DVision;
+
+// BRIEF::compute before the packed extractor: a bounds check and a
+// dynamic_bitset::set per test
+static void computeReference(const cv::Mat &im, const std::vector<cv::KeyPoint> &points,
+                             const std::vector<int> &m_x1, const std::vector<int> &m_y1,
+                             const std::vector<int> &m_x2, const std::vector<int> &m_y2,
+                             std::vector<BRIEF::bitset> &descriptors)
+{
+    const int W = im.cols;
+    const int H = im.rows;
+    descriptors.resize(points.size());
+    for (size_t k = 0; k < points.size(); k++)
+    {
+        descriptors[k].resize(m_x1.size());
+        descriptors[k].reset();
+        for (unsigned int i = 0; i < m_x1.size(); ++i)
+        {
+            int x1 = (int)(points[k].pt.x + m_x1[i]);
+            int y1 = (int)(points[k].pt.y + m_y1[i]);
+            int x2 = (int)(points[k].pt.x + m_x2[i]);
+            int y2 = (int)(points[k].pt.y + m_y2[i]);
+            if (x1 >= 0 && x1 < W && y1 >= 0 && y1 < H && x2 >= 0 && x2 < W && y2 >= 0 && y2 < H)
+            {
+                if (im.ptr<unsigned char>(y1)[x1] < im.ptr<unsigned char>(y2)[x2])
+                    descriptors[k].set(i);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: %s <brief_pattern.yml> <image_dir> [max_images]\n", argv[0]);
+        return 1;
+    }
+    int max_images = argc > 3 ? atoi(argv[3]) : 200;
+
+    cv::FileStorage fs(argv[1], cv::FileStorage::READ);
+    if (!fs.isOpened())
+    {
+        printf("could not open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<int> x1, y1, x2, y2;
+    fs["x1"] >> x1;
+    fs["x2"] >> x2;
+    fs["y1"] >> y1;
+    fs["y2"] >> y2;
+    BRIEF brief;
+    brief.importPairs(x1, y1, x2, y2);
+
+    std::vector<cv::String> files;
+    cv::glob(std::string(argv[2]) + "/*.png", files);
+    std::sort(files.begin(), files.end());
+    if ((int)files.size() > max_images)
+        files.resize(max_images);
+    if (files.empty())
+    {
+        printf("no images in %s\n", argv[2]);
+        return 1;
+    }
+
+    double reference_ms = 0, compat_ms = 0, packed_ms = 0;
+    long keypoints = 0, mismatches = 0;
+    std::vector<cv::KeyPoint> points;
+    std::vector<BRIEF::bitset> reference, compat;
+    std::vector<BRIEF::word> packed;
+    for (auto &f : files)
+    {
+        cv::Mat img = cv::imread(f, cv::IMREAD_GRAYSCALE), blurred;
+        if (img.empty())
+            continue;
+        cv::FAST(img, points, 20, true);
+        cv::GaussianBlur(img, blurred, cv::Size(9, 9), 2, 2);
+        keypoints += points.size();
+
+        TicToc t_reference;
+        computeReference(blurred, points, x1, y1, x2, y2, reference);
+        reference_ms += t_reference.toc();
+
+        TicToc t_compat;
+        brief.compute(blurred, points, compat, false);
+        compat_ms += t_compat.toc();
+
+        TicToc t_packed;
+        brief.computePacked(blurred, points, packed, false);
+        packed_ms += t_packed.toc();
+
+        for (size_t k = 0; k < points.size(); k++)
+            if (reference[k] != compat[k])
+                mismatches++;
+    }
+
+    printf("%zu images, %.1f keypoints per image, %ld mismatching descriptors\n", files.size(),
+           (double)keypoints / files.size(), mismatches);
+    printf("%12s %12s %12s\n", "extractor", "ms / image", "us / point");
+    printf("%12s %12.3f %12.3f\n", "reference", reference_ms / files.size(), 1e3 * reference_ms / keypoints);
+    printf("%12s %12.3f %12.3f\n", "bitset", compat_ms / files.size(), 1e3 * compat_ms / keypoints);
+    printf("%12s %12.3f %12.3f\n", "packed", packed_ms / files.size(), 1e3 * packed_ms / keypoints);
+    return mismatches ? 2 : 0;
+}
@@ -0,0 +1,186 @@
+#include "pose_graph_replay.h"
+
+#include <algorithm>
+#include <fstream>
+
+#include "../keyframe.h"
+#include "../parameters.h"
+#include "../pose_graph.h"
+#include <uvslam/trace.h>
+
+#define SKIP_FIRST_CNT 10
+
+// the globals of pose_graph_node.cpp
+camodocal::CameraPtr m_camera;
+Eigen::Vector3d tic;
+Eigen::Matrix3d qic;
+ros::Publisher pub_match_img;
+ros::Publisher pub_match_points;
+int VISUALIZATION_SHIFT_X = 0;
+int VISUALIZATION_SHIFT_Y = 0;
+std::string BRIEF_PATTERN_FILE;
+std::string POSE_GRAPH_SAVE_PATH;
+int ROW;
+int COL;
+std::string VINS_RESULT_PATH;
+int DEBUG_IMAGE = 0;
+int FAST_RELOCALIZATION = 0;
+int MAX_RESIDENT_KEYFRAMES;
+std::string KEYFRAME_CACHE_PATH;
+int KEYFRAME_CULLING;
+double CULL_DISTANCE;
+double CULL_YAW;
+double CULL_SCORE;
+
+// process() and new_sequence() of pose_graph_node.cpp, with skip_cnt and
+// skip_dis at the 0 of the launch files
+struct PoseGraphReplay::Impl
+{
+    Impl() : posegraph(false), last_t(-100, -100, -100) {}
+
+    PoseGraph posegraph;
+    bool loop_closure = false;
+    int frame_index = 0;
+    int sequence = 1;
+    int skip_first_cnt = 0;
+    int optimizations = 0;
+    Eigen::Vector3d last_t;
+};
+
+PoseGraphReplay::PoseGraphReplay(const std::string &config_file, const std::string &support_files_dir)
+    : impl(new Impl())
+{
+    cv::FileStorage fsSettings(config_file, cv::FileStorage::READ);
+    if (!fsSettings.isOpened())
+    {
+        ROS_WARN("cannot open %s", config_file.c_str());
+        return;
+    }
+    impl->loop_closure = (int)fsSettings["loop_closure"];
+    if (!impl->loop_closure)
+        return;
+
+    ROW = fsSettings["image_height"];
+    COL = fsSettings["image_width"];
+    impl->posegraph.loadVocabulary(support_files_dir + "/brief_k10L6.bin");
+    BRIEF_PATTERN_FILE = support_files_dir + "/brief_pattern.yml";
+    m_camera = camodocal::CameraFactory::instance()->generateCameraFromYamlFile(config_file.c_str());
+
+    fsSettings["pose_graph_save_path"] >> POSE_GRAPH_SAVE_PATH;
+    fsSettings["output_path"] >> VINS_RESULT_PATH;
+    MAX_RESIDENT_KEYFRAMES = fsSettings["max_resident_keyframes"];
+    fsSettings["keyframe_cache_path"] >> KEYFRAME_CACHE_PATH;
+    if (KEYFRAME_CACHE_PATH.empty())
+        KEYFRAME_CACHE_PATH = POSE_GRAPH_SAVE_PATH;
+    KEYFRAME_CULLING = fsSettings["keyframe_culling"];
+    CULL_DISTANCE = fsSettings["cull_distance"].empty() ? 0.3 : (double)fsSettings["cull_distance"];
+    CULL_YAW = fsSettings["cull_yaw"].empty() ? 15.0 : (double)fsSettings["cull_yaw"];
+    CULL_SCORE = fsSettings["cull_score"].empty() ? 0.05 : (double)fsSettings["cull_score"];
+    VINS_RESULT_PATH = VINS_RESULT_PATH + "/vins_result_loop.csv";
+    std::ofstream fout(VINS_RESULT_PATH, std::ios::out);
+    fout.close();
+    fsSettings.release();
+
+    // one span per keyframe and stage, drained after each one
+    Tracer::instance().enable("pose_graph", "", 1 << 10);
+}
+
+PoseGraphReplay::~PoseGraphReplay()
+{
+}
+
+bool PoseGraphReplay::enabled() const
+{
+    return impl->loop_closure;
+}
+
+void PoseGraphReplay::newSequence()
+{
+    if (!impl->loop_closure)
+        return;
+    impl->sequence++;
+    if (impl->sequence > 5)
+    {
+        ROS_WARN("only support 5 sequences since it's boring to copy code for more sequences.");
+        ROS_BREAK();
+    }
+    impl->posegraph.posegraph_visualization->reset();
+}
+
+void PoseGraphReplay::addKeyFrame(const ReplayKeyFrame &kf, const cv::Mat &image, const Eigen::Vector3d &_tic,
+                                  const Eigen::Matrix3d &ric)
+{
+    Impl &s = *impl;
+    if (!s.loop_closure)
+        return;
+    Tracer::instance().drain();
+    tic = _tic;
+    qic = ric;
+    if (s.skip_first_cnt < SKIP_FIRST_CNT)
+    {
+        s.skip_first_cnt++;
+        return;
+    }
+    if ((kf.P - s.last_t).norm() <= 0)
+        return;
+
+    TraceFrame frame(kf.t);
+    vector<cv::Point3f> point_3d;
+    vector<cv::Point2f> point_2d_uv;
+    vector<cv::Point2f> point_2d_normal;
+    vector<double> point_id;
+    for (const std::array<double, 8> &p : kf.points)
+    {
+        point_3d.push_back(cv::Point3f(p[0], p[1], p[2]));
+        point_2d_normal.push_back(cv::Point2f(p[3], p[4]));
+        point_2d_uv.push_back(cv::Point2f(p[5], p[6]));
+        point_id.push_back(p[7]);
+    }
+    Vector3d T = kf.P;
+    Matrix3d R = kf.R;
+    cv::Mat keyframe_image = image.clone();
+
+    TraceSpan t_keyframe("keyframe");
+    KeyFrame *keyframe = new KeyFrame(kf.t, s.frame_index, T, R, keyframe_image, point_3d, point_2d_uv,
+                                      point_2d_normal, point_id, s.sequence);
+    t_keyframe.stop();
+    s.posegraph.addKeyFrame(keyframe, 1);
+    s.frame_index++;
+    s.last_t = T;
+    // the node's optimization thread picks the loop up within 2 s
+    if (s.posegraph.optimize4DoFStep())
+        s.optimizations++;
+}
+
+int PoseGraphReplay::keyFrames() const
+{
+    return impl->frame_index;
+}
+
+int PoseGraphReplay::optimizations() const
+{
+    return impl->optimizations;
+}
+
+std::vector<ReplayPose> PoseGraphReplay::trajectory() const
+{
+    std::vector<ReplayPose> poses;
+    for (const nav_msgs::Path &path : impl->posegraph.path)
+        for (const geometry_msgs::PoseStamped &p : path.poses)
+            poses.push_back({p.header.stamp.toSec(),
+                             Eigen::Vector3d(p.pose.position.x, p.pose.position.y, p.pose.position.z),
+                             Eigen::Quaterniond(p.pose.orientation.w, p.pose.orientation.x, p.pose.orientation.y,
+                                                p.pose.orientation.z)});
+    std::sort(poses.begin(), poses.end(), [](const ReplayPose &a, const ReplayPose &b) { return a.t < b.t; });
+    return poses;
+}
+
+std::vector<ReplayStage> PoseGraphReplay::stages()
+{
+    Tracer &tracer = Tracer::instance();
+    tracer.drain();
+    std::vector<ReplayStage> stages;
+    for (const Tracer::Stats &s : tracer.percentiles())
+        stages.push_back({s.name, s.count, s.total, s.p50, s.p90, s.p99, s.max});
+    return stages;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <eigen3/Eigen/Dense>
+
+#include "../../../feature_tracker/src/benchmark/frontend_replay.h"
+
+// The pose_graph node without ROS, for the offline pipeline benchmark
+// (vins_estimator/src/benchmark/uvslam_bench.cpp). Like FrontEndReplay it is
+// built into a shared library with hidden symbols, because the node's globals
+// (ROW, COL, tic, ...) clash with the estimator's. Keyframes are added and
+// the 4DoF optimization is run on the caller's thread, so runs stay
+// deterministic; fast relocalization and the debug images are off.
+#define POSE_GRAPH_REPLAY_API __attribute__((visibility("default")))
+
+// what the estimator publishes on keyframe_pose and keyframe_point
+struct ReplayKeyFrame
+{
+    double t;
+    Eigen::Vector3d P; // body in the VIO world
+    Eigen::Matrix3d R;
+    // world x y z, normalized x y, u v, feature id
+    std::vector<std::array<double, 8>> points;
+};
+
+struct ReplayPose
+{
+    double t;
+    Eigen::Vector3d P;
+    Eigen::Quaterniond Q;
+};
+
+class POSE_GRAPH_REPLAY_API PoseGraphReplay
+{
+  public:
+    // reads the loop closure keys of config_file like the node does, the
+    // vocabulary and the BRIEF pattern from support_files_dir
+    PoseGraphReplay(const std::string &config_file, const std::string &support_files_dir);
+    ~PoseGraphReplay();
+
+    // loop_closure in the config
+    bool enabled() const;
+
+    // the image discontinued, the next keyframes start a new sequence
+    void newSequence();
+
+    // process() of pose_graph_node.cpp for one keyframe: image is the raw gray
+    // image of the image topic at kf.t, tic / ric the estimator's extrinsic
+    void addKeyFrame(const ReplayKeyFrame &kf, const cv::Mat &image, const Eigen::Vector3d &tic,
+                     const Eigen::Matrix3d &ric);
+
+    // keyframes added and 4DoF optimizations run so far
+    int keyFrames() const;
+    int optimizations() const;
+
+    // the loop closed keyframe poses, body in world, in time order
+    std::vector<ReplayPose> trajectory() const;
+
+    // per-stage times of the pose graph, see uvslam/trace.h
+    std::vector<ReplayStage> stages();
+
+  private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
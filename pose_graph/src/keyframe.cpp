@@ -1,4 +1,5 @@
 #include "keyframe.h"
+#include <cstring>
 
 template <typename Derived>
 static void reduceVector(vector<Derived> &v, vector<uchar> status)
@@ -10,6 +11,52 @@ static void reduceVector(vector<Derived> &v, vector<uchar> status)
     v.resize(j);
 }
 
+// buckets keypoints on the normalized plane so a search window only visits
+// the cells it overlaps
+class FeatureGrid
+{
+  public:
+    FeatureGrid(const PackedFeatures &features, float _cell) : cell(_cell), min_x(0), min_y(0), cols(0), rows(0)
+    {
+        if (features.size() == 0)
+            return;
+        float max_x = features.norm(0).x, max_y = features.norm(0).y;
+        min_x = max_x;
+        min_y = max_y;
+        for (int i = 1; i < features.size(); i++)
+        {
+            cv::Point2f p = features.norm(i);
+            min_x = min(min_x, p.x);
+            min_y = min(min_y, p.y);
+            max_x = max(max_x, p.x);
+            max_y = max(max_y, p.y);
+        }
+        cols = (int)((max_x - min_x) / cell) + 1;
+        rows = (int)((max_y - min_y) / cell) + 1;
+        cells.resize(cols * rows);
+        for (int i = 0; i < features.size(); i++)
+        {
+            cv::Point2f p = features.norm(i);
+            cells[(int)((p.y - min_y) / cell) * cols + (int)((p.x - min_x) / cell)].push_back(i);
+        }
+    }
+
+    void query(const cv::Point2f &p, vector<int> &indices) const
+    {
+        indices.clear();
+        int cx = (int)floor((p.x - min_x) / cell), cy = (int)floor((p.y - min_y) / cell);
+        for (int y = max(cy - 1, 0); y <= min(cy + 1, rows - 1); y++)
+            for (int x = max(cx - 1, 0); x <= min(cx + 1, cols - 1); x++)
+                indices.insert(indices.end(), cells[y * cols + x].begin(), cells[y * cols + x].end());
+    }
+
+  private:
+    float cell;
+    float min_x, min_y;
+    int cols, rows;
+    vector<vector<int>> cells;
+};
+
 // create keyframe online
 KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i, cv::Mat &_image,
 		           vector<cv::Point3f> &_point_3d, vector<cv::Point2f> &_point_2d_uv, vector<cv::Point2f> &_point_2d_norm,
@@ -24,7 +71,6 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	origin_vio_T = vio_T_w_i;		
 	origin_vio_R = vio_R_w_i;
 	image = _image.clone();
-	cv::resize(image, thumbnail, cv::Size(80, 60));
 	point_3d = _point_3d;
 	point_2d_uv = _point_2d_uv;
 	point_2d_norm = _point_2d_norm;
@@ -54,10 +100,7 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	T_w_i = _T_w_i;
 	R_w_i = _R_w_i;
 	if (DEBUG_IMAGE)
-	{
 		image = _image.clone();
-		cv::resize(image, thumbnail, cv::Size(80, 60));
-	}
 	if (_loop_index != -1)
 		has_loop = true;
 	else
@@ -66,28 +109,49 @@ KeyFrame::KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3
 	loop_info = _loop_info;
 	has_fast_point = false;
 	sequence = 0;
-	keypoints = _keypoints;
-	keypoints_norm = _keypoints_norm;
 	brief_descriptors = _brief_descriptors;
+	features.pack(brief_descriptors, _keypoints, _keypoints_norm);
+}
+
+
+// the pattern file is read once, the extractor is never modified afterwards
+static const BriefExtractor &briefExtractor()
+{
+	static const BriefExtractor extractor(BRIEF_PATTERN_FILE.c_str());
+	return extractor;
 }
 
+// packed 256-bit descriptors of keypoints
+static void computePackedBRIEF(const cv::Mat &image, const vector<cv::KeyPoint> &keypoints,
+                               vector<PackedDescriptor> &descriptors)
+{
+	static_assert(sizeof(PackedDescriptor) == 4 * sizeof(BRIEF::word), "PackedDescriptor holds 256 bits");
+	const BRIEF &brief = briefExtractor().m_brief;
+	assert(brief.getDescriptorLengthInBits() == 256);
+	vector<BRIEF::word> words;
+	brief.computePacked(image, keypoints, words);
+	descriptors.resize(keypoints.size());
+	if (!words.empty())
+		memcpy(descriptors.data(), words.data(), words.size() * sizeof(BRIEF::word));
+}
 
 void KeyFrame::computeWindowBRIEFPoint()
 {
-	BriefExtractor extractor(BRIEF_PATTERN_FILE.c_str());
+	vector<cv::KeyPoint> window_keypoints;
 	for(int i = 0; i < (int)point_2d_uv.size(); i++)
 	{
 	    cv::KeyPoint key;
 	    key.pt = point_2d_uv[i];
 	    window_keypoints.push_back(key);
 	}
-	extractor(image, window_keypoints, window_brief_descriptors);
+	computePackedBRIEF(image, window_keypoints, window_brief_descriptors);
 }
 
 void KeyFrame::computeBRIEFPoint()
 {
-	BriefExtractor extractor(BRIEF_PATTERN_FILE.c_str());
 	const int fast_th = 20; // corner detector response threshold
+	vector<cv::KeyPoint> keypoints;
+	vector<cv::KeyPoint> keypoints_norm;
 	if(1)
 		cv::FAST(image, keypoints, fast_th, true);
 	else
@@ -101,7 +165,12 @@ void KeyFrame::computeBRIEFPoint()
 		    keypoints.push_back(key);
 		}
 	}
-	extractor(image, keypoints, brief_descriptors);
+	vector<PackedDescriptor> packed_descriptors;
+	computePackedBRIEF(image, keypoints, packed_descriptors);
+	// the vocabulary still works on bitsets
+	brief_descriptors.resize(packed_descriptors.size());
+	for (int i = 0; i < (int)packed_descriptors.size(); i++)
+		BRIEF::unpack(packed_descriptors[i].bits, 256, brief_descriptors[i]);
 	for (int i = 0; i < (int)keypoints.size(); i++)
 	{
 		Eigen::Vector3d tmp_p;
@@ -110,6 +179,7 @@ void KeyFrame::computeBRIEFPoint()
 		tmp_norm.pt = cv::Point2f(tmp_p.x()/tmp_p.z(), tmp_p.y()/tmp_p.z());
 		keypoints_norm.push_back(tmp_norm);
 	}
+	features.pack(packed_descriptors, keypoints, keypoints_norm);
 }
 
 void BriefExtractor::operator() (const cv::Mat &im, vector<cv::KeyPoint> &keys, vector<BRIEF::bitset> &descriptors) const
@@ -118,20 +188,18 @@ void BriefExtractor::operator() (const cv::Mat &im, vector<cv::KeyPoint> &keys,
 }
 
 
-bool KeyFrame::searchInAera(const BRIEF::bitset window_descriptor,
-                            const std::vector<BRIEF::bitset> &descriptors_old,
-                            const std::vector<cv::KeyPoint> &keypoints_old,
-                            const std::vector<cv::KeyPoint> &keypoints_old_norm,
+bool KeyFrame::searchInAera(const PackedDescriptor &window_descriptor,
+                            const PackedFeatures &features_old,
                             cv::Point2f &best_match,
                             cv::Point2f &best_match_norm)
 {
     cv::Point2f best_pt;
     int bestDist = 128;
     int bestIndex = -1;
-    for(int i = 0; i < (int)descriptors_old.size(); i++)
+    for(int i = 0; i < features_old.size(); i++)
     {
 
-        int dis = HammingDis(window_descriptor, descriptors_old[i]);
+        int dis = HammingDis(window_descriptor, features_old.descriptor(i));
         if(dis < bestDist)
         {
             bestDist = dis;
@@ -141,8 +209,8 @@ bool KeyFrame::searchInAera(const BRIEF::bitset window_descriptor,
     //printf("best dist %d", bestDist);
     if (bestIndex != -1 && bestDist < 80)
     {
-      best_match = keypoints_old[bestIndex].pt;
-      best_match_norm = keypoints_old_norm[bestIndex].pt;
+      best_match = features_old.uv(bestIndex);
+      best_match_norm = features_old.norm(bestIndex);
       return true;
     }
     else
@@ -152,15 +220,13 @@ bool KeyFrame::searchInAera(const BRIEF::bitset window_descriptor,
 void KeyFrame::searchByBRIEFDes(std::vector<cv::Point2f> &matched_2d_old,
 								std::vector<cv::Point2f> &matched_2d_old_norm,
                                 std::vector<uchar> &status,
-                                const std::vector<BRIEF::bitset> &descriptors_old,
-                                const std::vector<cv::KeyPoint> &keypoints_old,
-                                const std::vector<cv::KeyPoint> &keypoints_old_norm)
+                                const PackedFeatures &features_old)
 {
     for(int i = 0; i < (int)window_brief_descriptors.size(); i++)
     {
         cv::Point2f pt(0.f, 0.f);
         cv::Point2f pt_norm(0.f, 0.f);
-        if (searchInAera(window_brief_descriptors[i], descriptors_old, keypoints_old, keypoints_old_norm, pt, pt_norm))
+        if (searchInAera(window_brief_descriptors[i], features_old, pt, pt_norm))
           status.push_back(1);
         else
           status.push_back(0);
@@ -171,6 +237,82 @@ void KeyFrame::searchByBRIEFDes(std::vector<cv::Point2f> &matched_2d_old,
 }
 
 
+bool KeyFrame::passQuickCheck(const PackedFeatures &features_old)
+{
+    int matched = 0;
+    cv::Point2f pt, pt_norm;
+    for (int i = 0; i < (int)window_brief_descriptors.size(); i += QUICK_CHECK_STEP)
+        if (searchInAera(window_brief_descriptors[i], features_old, pt, pt_norm))
+            matched++;
+    return matched * QUICK_CHECK_STEP > MIN_LOOP_NUM / 2;
+}
+
+// project the window points into the old camera with the current pose prior
+bool KeyFrame::predictInOldFrame(const KeyFrame* old_kf, const Eigen::Vector3d &prior_T_w_i, const Eigen::Matrix3d &prior_R_w_i,
+                                 std::vector<cv::Point2f> &predicted_norm, std::vector<uchar> &predicted)
+{
+    int n = (int)point_3d.size();
+    predicted_norm.resize(n);
+    predicted.assign(n, 0);
+    int cnt = 0;
+    for (int i = 0; i < n; i++)
+    {
+        Vector3d p(point_3d[i].x, point_3d[i].y, point_3d[i].z);
+        Vector3d p_w = prior_R_w_i * (origin_vio_R.transpose() * (p - origin_vio_T)) + prior_T_w_i;
+        Vector3d p_c = qic.transpose() * (old_kf->R_w_i.transpose() * (p_w - old_kf->T_w_i) - tic);
+        if (p_c.z() < 0.1)
+            continue;
+        predicted_norm[i] = cv::Point2f(p_c.x() / p_c.z(), p_c.y() / p_c.z());
+        predicted[i] = 1;
+        cnt++;
+    }
+    return cnt > MIN_LOOP_NUM;
+}
+
+void KeyFrame::searchInWindow(std::vector<cv::Point2f> &matched_2d_old,
+                              std::vector<cv::Point2f> &matched_2d_old_norm,
+                              std::vector<uchar> &status,
+                              const PackedFeatures &features_old,
+                              const std::vector<cv::Point2f> &predicted_norm,
+                              const std::vector<uchar> &predicted)
+{
+    FeatureGrid grid(features_old, LOOP_SEARCH_RADIUS);
+    vector<int> indices;
+    const float r2 = LOOP_SEARCH_RADIUS * LOOP_SEARCH_RADIUS;
+    for (int i = 0; i < (int)window_brief_descriptors.size(); i++)
+    {
+        cv::Point2f pt(0.f, 0.f);
+        cv::Point2f pt_norm(0.f, 0.f);
+        int bestDist = 80;
+        int bestIndex = -1;
+        if (predicted[i])
+        {
+            grid.query(predicted_norm[i], indices);
+            for (int j : indices)
+            {
+                cv::Point2f d = features_old.norm(j) - predicted_norm[i];
+                if (d.x * d.x + d.y * d.y > r2)
+                    continue;
+                int dis = HammingDis(window_brief_descriptors[i], features_old.descriptor(j));
+                if (dis < bestDist)
+                {
+                    bestDist = dis;
+                    bestIndex = j;
+                }
+            }
+        }
+        if (bestIndex != -1)
+        {
+            pt = features_old.uv(bestIndex);
+            pt_norm = features_old.norm(bestIndex);
+        }
+        status.push_back(bestIndex != -1);
+        matched_2d_old.push_back(pt);
+        matched_2d_old_norm.push_back(pt_norm);
+    }
+}
+
+
 void KeyFrame::FundmantalMatrixRANSAC(const std::vector<cv::Point2f> &matched_2d_cur_norm,
                                       const std::vector<cv::Point2f> &matched_2d_old_norm,
                                       vector<uchar> &status)
@@ -197,6 +339,32 @@ void KeyFrame::FundmantalMatrixRANSAC(const std::vector<cv::Point2f> &matched_2d
     }
 }
 
+static int countPnPInliers(const std::vector<cv::Point3f> &pts_3d, const std::vector<cv::Point2f> &pts_2d,
+                           const cv::Mat &rvec, const cv::Mat &t, double threshold, std::vector<uchar> *status)
+{
+    cv::Mat r;
+    cv::Rodrigues(rvec, r);
+    Matrix3d R;
+    Vector3d T;
+    cv::cv2eigen(r, R);
+    cv::cv2eigen(t, T);
+    int cnt = 0;
+    for (int i = 0; i < (int)pts_3d.size(); i++)
+    {
+        Vector3d p = R * Vector3d(pts_3d[i].x, pts_3d[i].y, pts_3d[i].z) + T;
+        bool inlier = false;
+        if (p.z() > 0)
+        {
+            double du = p.x() / p.z() - pts_2d[i].x, dv = p.y() / p.z() - pts_2d[i].y;
+            inlier = du * du + dv * dv < threshold * threshold;
+        }
+        if (status)
+            (*status)[i] = inlier;
+        cnt += inlier;
+    }
+    return cnt;
+}
+
 void KeyFrame::PnPRANSAC(const vector<cv::Point2f> &matched_2d_old_norm,
                          const std::vector<cv::Point3f> &matched_3d,
                          std::vector<uchar> &status,
@@ -219,28 +387,76 @@ void KeyFrame::PnPRANSAC(const vector<cv::Point2f> &matched_2d_old_norm,
     cv::Rodrigues(tmp_r, rvec);
     cv::eigen2cv(P_inital, t);
 
-    cv::Mat inliers;
     TicToc t_pnp_ransac;
-
-    if (CV_MAJOR_VERSION < 3)
-        solvePnPRansac(matched_3d, matched_2d_old_norm, K, D, rvec, t, true, 100, 10.0 / 460.0, 100, inliers);
-    else
+    int n = (int)matched_3d.size();
+    status.assign(n, 0);
+
+    // minimal P3P hypotheses; the iteration bound shrinks with the best
+    // inlier ratio and sampling stops early once most matches agree
+    const double threshold = 10.0 / 460.0;
+#if CV_MAJOR_VERSION < 3
+    const int p3p_flag = CV_P3P;
+#else
+    const int p3p_flag = cv::SOLVEPNP_P3P;
+#endif
+    cv::RNG rng(index);
+    int max_iterations = 100;
+    int best_cnt = 0;
+    cv::Mat best_rvec = rvec.clone(), best_t = t.clone();
+    vector<cv::Point3f> sample_3d(4);
+    vector<cv::Point2f> sample_2d(4);
+    for (int it = 0; it < max_iterations && n >= 4; it++)
     {
-        if (CV_MINOR_VERSION < 2)
-            solvePnPRansac(matched_3d, matched_2d_old_norm, K, D, rvec, t, true, 100, sqrt(10.0 / 460.0), 0.99, inliers);
-        else
-            solvePnPRansac(matched_3d, matched_2d_old_norm, K, D, rvec, t, true, 100, 10.0 / 460.0, 0.99, inliers);
-
+        int idx[4];
+        for (int k = 0; k < 4; k++)
+        {
+            bool unique;
+            do
+            {
+                idx[k] = rng.uniform(0, n);
+                unique = true;
+                for (int l = 0; l < k; l++)
+                    unique = unique && idx[l] != idx[k];
+            } while (!unique);
+            sample_3d[k] = matched_3d[idx[k]];
+            sample_2d[k] = matched_2d_old_norm[idx[k]];
+        }
+        cv::Mat sample_rvec, sample_t;
+        if (!cv::solvePnP(sample_3d, sample_2d, K, D, sample_rvec, sample_t, false, p3p_flag))
+            continue;
+        int cnt = countPnPInliers(matched_3d, matched_2d_old_norm, sample_rvec, sample_t, threshold, NULL);
+        if (cnt > best_cnt)
+        {
+            best_cnt = cnt;
+            best_rvec = sample_rvec;
+            best_t = sample_t;
+            double w = (double)cnt / n;
+            if (w >= PNP_EARLY_INLIER_RATIO)
+                break;
+            double log_miss = log(1 - pow(w, 4));
+            if (log_miss < 0)
+                max_iterations = (int)min((double)max_iterations, ceil(log(1 - 0.99) / log_miss));
+        }
     }
 
-    for (int i = 0; i < (int)matched_2d_old_norm.size(); i++)
-        status.push_back(0);
-
-    for( int i = 0; i < inliers.rows; i++)
+    rvec = best_rvec;
+    t = best_t;
+    if (best_cnt >= 4)
     {
-        int n = inliers.at<int>(i);
-        status[n] = 1;
+        // refine on the consensus set
+        countPnPInliers(matched_3d, matched_2d_old_norm, rvec, t, threshold, &status);
+        vector<cv::Point3f> inlier_3d;
+        vector<cv::Point2f> inlier_2d;
+        for (int i = 0; i < n; i++)
+            if (status[i])
+            {
+                inlier_3d.push_back(matched_3d[i]);
+                inlier_2d.push_back(matched_2d_old_norm[i]);
+            }
+        cv::solvePnP(inlier_3d, inlier_2d, K, D, rvec, t, true);
+        countPnPInliers(matched_3d, matched_2d_old_norm, rvec, t, threshold, &status);
     }
+    //printf("pnp ransac %d / %d inliers, %f ms\n", best_cnt, n, t_pnp_ransac.toc());
 
     cv::Rodrigues(rvec, r);
     Matrix3d R_pnp, R_w_c_old;
@@ -256,7 +472,7 @@ void KeyFrame::PnPRANSAC(const vector<cv::Point2f> &matched_2d_old_norm,
 }
 
 
-bool KeyFrame::findConnection(KeyFrame* old_kf)
+bool KeyFrame::findConnection(KeyFrame* old_kf, const Eigen::Vector3d &prior_T_w_i, const Eigen::Matrix3d &prior_R_w_i)
 {
 	TicToc tmp_t;
 	//printf("find Connection\n");
@@ -284,9 +500,9 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	            cv::Point2f cur_pt = point_2d_uv[i];
 	            cv::circle(loop_match_img, cur_pt, 5, cv::Scalar(0, 255, 0));
 	        }
-	        for(int i = 0; i< (int)old_kf->keypoints.size(); i++)
+	        for(int i = 0; i< old_kf->features.size(); i++)
 	        {
-	            cv::Point2f old_pt = old_kf->keypoints[i].pt;
+	            cv::Point2f old_pt = old_kf->features.uv(i);
 	            old_pt.x += COL;
 	            cv::circle(loop_match_img, old_pt, 5, cv::Scalar(0, 255, 0));
 	        }
@@ -298,7 +514,20 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	    }
 	#endif
 	//printf("search by des\n");
-	searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, old_kf->brief_descriptors, old_kf->keypoints, old_kf->keypoints_norm);
+	if (!passQuickCheck(old_kf->features))
+		return false;
+	vector<cv::Point2f> predicted_norm;
+	vector<uchar> predicted;
+	if (predictInOldFrame(old_kf, prior_T_w_i, prior_R_w_i, predicted_norm, predicted))
+		searchInWindow(matched_2d_old, matched_2d_old_norm, status, old_kf->features, predicted_norm, predicted);
+	if (count(status.begin(), status.end(), 1) <= MIN_LOOP_NUM)
+	{
+		// the prior is off by more than the window; match against everything
+		matched_2d_old.clear();
+		matched_2d_old_norm.clear();
+		status.clear();
+		searchByBRIEFDes(matched_2d_old, matched_2d_old_norm, status, old_kf->features);
+	}
 	reduceVector(matched_2d_cur, status);
 	reduceVector(matched_2d_old, status);
 	reduceVector(matched_2d_cur_norm, status);
@@ -414,7 +643,7 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 	    reduceVector(matched_3d, status);
 	    reduceVector(matched_id, status);
 	    #if 1
-	    	if (DEBUG_IMAGE)
+	    	if (DEBUG_IMAGE && (int)matched_2d_cur.size() > MIN_LOOP_NUM)
 	        {
 	        	int gap = 10;
 	        	cv::Mat gap_image(ROW, gap, CV_8UC1, cv::Scalar(255, 255, 255));
@@ -520,11 +749,9 @@ bool KeyFrame::findConnection(KeyFrame* old_kf)
 }
 
 
-int KeyFrame::HammingDis(const BRIEF::bitset &a, const BRIEF::bitset &b)
+int KeyFrame::HammingDis(const PackedDescriptor &a, const PackedDescriptor &b)
 {
-    BRIEF::bitset xor_of_bitset = a ^ b;
-    int dis = xor_of_bitset.count();
-    return dis;
+    return PackedFeatures::distance(a, b);
 }
 
 void KeyFrame::getVioPose(Eigen::Vector3d &_T_w_i, Eigen::Matrix3d &_R_w_i)
@@ -577,6 +804,31 @@ void KeyFrame::updateLoop(Eigen::Matrix<double, 8, 1 > &_loop_info)
 	}
 }
 
+void KeyFrame::releaseWindowFeatures()
+{
+	vector<cv::Point3f>().swap(point_3d);
+	vector<cv::Point2f>().swap(point_2d_uv);
+	vector<cv::Point2f>().swap(point_2d_norm);
+	vector<double>().swap(point_id);
+	vector<PackedDescriptor>().swap(window_brief_descriptors);
+	vector<BRIEF::bitset>().swap(brief_descriptors);
+}
+
+size_t KeyFrame::memoryUsage() const
+{
+	size_t bytes = sizeof(KeyFrame) + features.memoryUsage();
+	bytes += point_3d.capacity() * sizeof(cv::Point3f);
+	bytes += (point_2d_uv.capacity() + point_2d_norm.capacity()) * sizeof(cv::Point2f);
+	bytes += point_id.capacity() * sizeof(double);
+	bytes += window_brief_descriptors.capacity() * sizeof(PackedDescriptor);
+	for (const BRIEF::bitset &des : brief_descriptors)
+		bytes += sizeof(BRIEF::bitset) + des.num_blocks() * sizeof(BRIEF::bitset::block_type);
+	bytes += bow_vector.size() * (sizeof(DBoW2::WordId) + sizeof(DBoW2::WordValue) + 4 * sizeof(void *));
+	if (!image.empty())
+		bytes += image.total() * image.elemSize();
+	return bytes;
+}
+
 BriefExtractor::BriefExtractor(const std::string &pattern_file)
 {
   // The DVision::BRIEF extractor computes a random pattern by default when
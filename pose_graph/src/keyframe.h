@@ -12,8 +12,15 @@
 #include "parameters.h"
 #include "ThirdParty/DBoW/DBoW2.h"
 #include "ThirdParty/DVision/DVision.h"
+#include "keyframe_features.h"
 
 #define MIN_LOOP_NUM 25
+// every QUICK_CHECK_STEP-th window point is matched before full matching
+#define QUICK_CHECK_STEP 4
+// radius of the projected search window on the normalized plane
+#define LOOP_SEARCH_RADIUS (40.0 / 460.0)
+// P3P RANSAC stops once this fraction of matches are inliers
+#define PNP_EARLY_INLIER_RATIO 0.8
 
 using namespace Eigen;
 using namespace std;
@@ -38,23 +45,28 @@ public:
 	KeyFrame(double _time_stamp, int _index, Vector3d &_vio_T_w_i, Matrix3d &_vio_R_w_i, Vector3d &_T_w_i, Matrix3d &_R_w_i,
 			 cv::Mat &_image, int _loop_index, Eigen::Matrix<double, 8, 1 > &_loop_info,
 			 vector<cv::KeyPoint> &_keypoints, vector<cv::KeyPoint> &_keypoints_norm, vector<BRIEF::bitset> &_brief_descriptors);
-	bool findConnection(KeyFrame* old_kf);
+	bool findConnection(KeyFrame* old_kf, const Eigen::Vector3d &prior_T_w_i, const Eigen::Matrix3d &prior_R_w_i);
 	void computeWindowBRIEFPoint();
 	void computeBRIEFPoint();
 	//void extractBrief();
-	int HammingDis(const BRIEF::bitset &a, const BRIEF::bitset &b);
-	bool searchInAera(const BRIEF::bitset window_descriptor,
-	                  const std::vector<BRIEF::bitset> &descriptors_old,
-	                  const std::vector<cv::KeyPoint> &keypoints_old,
-	                  const std::vector<cv::KeyPoint> &keypoints_old_norm,
+	int HammingDis(const PackedDescriptor &a, const PackedDescriptor &b);
+	bool searchInAera(const PackedDescriptor &window_descriptor,
+	                  const PackedFeatures &features_old,
 	                  cv::Point2f &best_match,
 	                  cv::Point2f &best_match_norm);
 	void searchByBRIEFDes(std::vector<cv::Point2f> &matched_2d_old,
 						  std::vector<cv::Point2f> &matched_2d_old_norm,
                           std::vector<uchar> &status,
-                          const std::vector<BRIEF::bitset> &descriptors_old,
-                          const std::vector<cv::KeyPoint> &keypoints_old,
-                          const std::vector<cv::KeyPoint> &keypoints_old_norm);
+                          const PackedFeatures &features_old);
+	bool passQuickCheck(const PackedFeatures &features_old);
+	bool predictInOldFrame(const KeyFrame* old_kf, const Eigen::Vector3d &prior_T_w_i, const Eigen::Matrix3d &prior_R_w_i,
+	                       std::vector<cv::Point2f> &predicted_norm, std::vector<uchar> &predicted);
+	void searchInWindow(std::vector<cv::Point2f> &matched_2d_old,
+	                    std::vector<cv::Point2f> &matched_2d_old_norm,
+	                    std::vector<uchar> &status,
+	                    const PackedFeatures &features_old,
+	                    const std::vector<cv::Point2f> &predicted_norm,
+	                    const std::vector<uchar> &predicted);
 	void FundmantalMatrixRANSAC(const std::vector<cv::Point2f> &matched_2d_cur_norm,
                                 const std::vector<cv::Point2f> &matched_2d_old_norm,
                                 vector<uchar> &status);
@@ -67,6 +79,8 @@ public:
 	void updatePose(const Eigen::Vector3d &_T_w_i, const Eigen::Matrix3d &_R_w_i);
 	void updateVioPose(const Eigen::Vector3d &_T_w_i, const Eigen::Matrix3d &_R_w_i);
 	void updateLoop(Eigen::Matrix<double, 8, 1 > &_loop_info);
+	void releaseWindowFeatures();
+	size_t memoryUsage() const;
 
 	Eigen::Vector3d getLoopRelativeT();
 	double getLoopRelativeYaw();
@@ -84,16 +98,18 @@ public:
 	Eigen::Vector3d origin_vio_T;		
 	Eigen::Matrix3d origin_vio_R;
 	cv::Mat image;
-	cv::Mat thumbnail;
+	// tracked window features, only needed while this keyframe searches for a loop
 	vector<cv::Point3f> point_3d; 
 	vector<cv::Point2f> point_2d_uv;
 	vector<cv::Point2f> point_2d_norm;
 	vector<double> point_id;
-	vector<cv::KeyPoint> keypoints;
-	vector<cv::KeyPoint> keypoints_norm;
-	vector<cv::KeyPoint> window_keypoints;
+	vector<PackedDescriptor> window_brief_descriptors;
+	// handed to the BoW database once, then released
 	vector<BRIEF::bitset> brief_descriptors;
-	vector<BRIEF::bitset> window_brief_descriptors;
+	// what is kept for the lifetime of the pose graph; culling scores
+	// neighbours by bow_vector instead of transforming their features again
+	DBoW2::BowVector bow_vector;
+	PackedFeatures features;
 	bool has_fast_point;
 	int sequence;
 
@@ -0,0 +1,143 @@
+#include "keyframe_features.h"
+#include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+static const float UV_SCALE = 16.0f;
+
+template <typename T>
+static T quantize(float value, float scale)
+{
+    float q = std::round(value * scale);
+    q = std::max(q, (float)std::numeric_limits<T>::min());
+    q = std::min(q, (float)std::numeric_limits<T>::max());
+    return (T)q;
+}
+
+PackedFeatures::PackedFeatures() : n(0), cached(false)
+{
+}
+
+PackedFeatures::~PackedFeatures()
+{
+    if (cached)
+        std::remove(cache_path.c_str());
+}
+
+void PackedFeatures::packDescriptor(const BRIEF::bitset &in, PackedDescriptor &out)
+{
+    out.bits[0] = out.bits[1] = out.bits[2] = out.bits[3] = 0;
+    for (size_t i = in.find_first(); i != BRIEF::bitset::npos && i < 256; i = in.find_next(i))
+        out.bits[i >> 6] |= 1ull << (i & 63);
+}
+
+void PackedFeatures::pack(const std::vector<BRIEF::bitset> &brief_descriptors,
+                          const std::vector<cv::KeyPoint> &_keypoints,
+                          const std::vector<cv::KeyPoint> &_keypoints_norm)
+{
+    n = (int)brief_descriptors.size();
+    descriptors.resize(n);
+    for (int i = 0; i < n; i++)
+        packDescriptor(brief_descriptors[i], descriptors[i]);
+    packKeypoints(_keypoints, _keypoints_norm);
+}
+
+void PackedFeatures::pack(const std::vector<PackedDescriptor> &packed_descriptors,
+                          const std::vector<cv::KeyPoint> &_keypoints,
+                          const std::vector<cv::KeyPoint> &_keypoints_norm)
+{
+    n = (int)packed_descriptors.size();
+    descriptors = packed_descriptors;
+    packKeypoints(_keypoints, _keypoints_norm);
+}
+
+void PackedFeatures::packKeypoints(const std::vector<cv::KeyPoint> &_keypoints,
+                                   const std::vector<cv::KeyPoint> &_keypoints_norm)
+{
+    keypoints.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        keypoints[i].u = quantize<uint16_t>(_keypoints[i].pt.x, UV_SCALE);
+        keypoints[i].v = quantize<uint16_t>(_keypoints[i].pt.y, UV_SCALE);
+        keypoints[i].x = _keypoints_norm[i].pt.x;
+        keypoints[i].y = _keypoints_norm[i].pt.y;
+    }
+}
+
+void PackedFeatures::unpack(std::vector<BRIEF::bitset> &brief_descriptors,
+                            std::vector<cv::Point2f> &_keypoints,
+                            std::vector<cv::Point2f> &_keypoints_norm) const
+{
+    brief_descriptors.assign(n, BRIEF::bitset(256));
+    _keypoints.resize(n);
+    _keypoints_norm.resize(n);
+    for (int i = 0; i < n; i++)
+    {
+        for (int j = 0; j < 256; j++)
+            if (descriptors[i].bits[j >> 6] >> (j & 63) & 1)
+                brief_descriptors[i].set(j);
+        _keypoints[i] = uv(i);
+        _keypoints_norm[i] = norm(i);
+    }
+}
+
+cv::Point2f PackedFeatures::uv(int i) const
+{
+    return cv::Point2f(keypoints[i].u / UV_SCALE, keypoints[i].v / UV_SCALE);
+}
+
+cv::Point2f PackedFeatures::norm(int i) const
+{
+    return cv::Point2f(keypoints[i].x, keypoints[i].y);
+}
+
+bool PackedFeatures::spill(const std::string &path)
+{
+    if (!resident() || n == 0)
+        return true;
+    if (!cached)
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write((const char *)&n, sizeof(n));
+        file.write((const char *)descriptors.data(), n * sizeof(PackedDescriptor));
+        file.write((const char *)keypoints.data(), n * sizeof(PackedKeypoint));
+        if (!file)
+            return false;
+        cache_path = path;
+        cached = true;
+    }
+    std::vector<PackedDescriptor>().swap(descriptors);
+    std::vector<PackedKeypoint>().swap(keypoints);
+    return true;
+}
+
+bool PackedFeatures::restore()
+{
+    if (resident())
+        return true;
+    std::ifstream file(cache_path, std::ios::binary);
+    int file_n = 0;
+    file.read((char *)&file_n, sizeof(file_n));
+    if (!file || file_n != n)
+        return false;
+    descriptors.resize(n);
+    keypoints.resize(n);
+    file.read((char *)descriptors.data(), n * sizeof(PackedDescriptor));
+    file.read((char *)keypoints.data(), n * sizeof(PackedKeypoint));
+    if (!file)
+    {
+        std::vector<PackedDescriptor>().swap(descriptors);
+        std::vector<PackedKeypoint>().swap(keypoints);
+        return false;
+    }
+    return true;
+}
+
+size_t PackedFeatures::memoryUsage() const
+{
+    return descriptors.capacity() * sizeof(PackedDescriptor) +
+           keypoints.capacity() * sizeof(PackedKeypoint) +
+           cache_path.capacity();
+}
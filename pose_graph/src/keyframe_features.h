@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <opencv2/core/core.hpp>
+#include "ThirdParty/DVision/DVision.h"
+
+using namespace DVision;
+
+// 256-bit BRIEF descriptor stored inline instead of in a dynamic_bitset
+struct PackedDescriptor
+{
+    uint64_t bits[4];
+};
+
+// keypoint quantized to 1/16 px in the image (images up to 4096 px wide);
+// the normalized plane keeps full floats, as wide-angle and fisheye cameras
+// reach far beyond any fixed-point range worth its bits there
+struct PackedKeypoint
+{
+    uint16_t u, v;
+    float x, y;
+};
+
+// Loop-closure features of one keyframe: its BRIEF descriptors with the pixel
+// and normalized keypoints, packed into two flat arrays. A cold keyframe can
+// spill the arrays to a cache file and restore them when it becomes a loop
+// candidate; the features never change, so the file is written only once.
+class PackedFeatures
+{
+  public:
+    PackedFeatures();
+    ~PackedFeatures();
+    PackedFeatures(const PackedFeatures &) = delete;
+    PackedFeatures &operator=(const PackedFeatures &) = delete;
+
+    void pack(const std::vector<BRIEF::bitset> &brief_descriptors,
+              const std::vector<cv::KeyPoint> &keypoints,
+              const std::vector<cv::KeyPoint> &keypoints_norm);
+    void pack(const std::vector<PackedDescriptor> &packed_descriptors,
+              const std::vector<cv::KeyPoint> &keypoints,
+              const std::vector<cv::KeyPoint> &keypoints_norm);
+    void unpack(std::vector<BRIEF::bitset> &brief_descriptors,
+                std::vector<cv::Point2f> &keypoints,
+                std::vector<cv::Point2f> &keypoints_norm) const;
+
+    int size() const { return n; }
+    const PackedDescriptor &descriptor(int i) const { return descriptors[i]; }
+    cv::Point2f uv(int i) const;
+    cv::Point2f norm(int i) const;
+
+    bool spill(const std::string &path);
+    bool restore();
+    bool resident() const { return n == 0 || !descriptors.empty(); }
+    size_t memoryUsage() const;
+
+    static void packDescriptor(const BRIEF::bitset &in, PackedDescriptor &out);
+    static int distance(const PackedDescriptor &a, const PackedDescriptor &b)
+    {
+        return __builtin_popcountll(a.bits[0] ^ b.bits[0]) + __builtin_popcountll(a.bits[1] ^ b.bits[1]) +
+               __builtin_popcountll(a.bits[2] ^ b.bits[2]) + __builtin_popcountll(a.bits[3] ^ b.bits[3]);
+    }
+
+  private:
+    void packKeypoints(const std::vector<cv::KeyPoint> &keypoints,
+                       const std::vector<cv::KeyPoint> &keypoints_norm);
+
+    int n;
+    std::vector<PackedDescriptor> descriptors;
+    std::vector<PackedKeypoint> keypoints;
+    std::string cache_path;
+    bool cached;
+};
@@ -24,5 +24,13 @@ extern int COL;
 extern std::string VINS_RESULT_PATH;
 extern int DEBUG_IMAGE;
 extern int FAST_RELOCALIZATION;
+// keyframes whose features stay in memory; older ones spill to KEYFRAME_CACHE_PATH (0 keeps all)
+extern int MAX_RESIDENT_KEYFRAMES;
+extern std::string KEYFRAME_CACHE_PATH;
+// drop a new keyframe whose view an older one already covers
+extern int KEYFRAME_CULLING;
+extern double CULL_DISTANCE;
+extern double CULL_YAW;
+extern double CULL_SCORE;
 
 
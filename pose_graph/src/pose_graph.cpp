@@ -1,11 +1,12 @@
 #include "pose_graph.h"
 
-PoseGraph::PoseGraph()
+PoseGraph::PoseGraph(bool optimization_thread)
 {
     posegraph_visualization = new CameraPoseVisualization(1.0, 0.0, 1.0, 1.0);
     posegraph_visualization->setScale(0.1);
     posegraph_visualization->setLineWidth(0.01);
-	t_optimization = std::thread(&PoseGraph::optimize4DoF, this);
+    if (optimization_thread)
+        t_optimization = std::thread(&PoseGraph::optimize4DoF, this);
     earliest_loop_index = -1;
     t_drift = Eigen::Vector3d(0, 0, 0);
     yaw_drift = 0;
@@ -16,12 +17,14 @@ PoseGraph::PoseGraph()
     sequence_cnt = 0;
     sequence_loop.push_back(0);
     base_sequence = 1;
+    culled_cnt = 0;
 
 }
 
 PoseGraph::~PoseGraph()
 {
-	t_optimization.join();
+    if (t_optimization.joinable())
+        t_optimization.join();
 }
 
 void PoseGraph::registerPub(ros::NodeHandle &n)
@@ -29,6 +32,7 @@ void PoseGraph::registerPub(ros::NodeHandle &n)
     pub_pg_path = n.advertise<nav_msgs::Path>("pose_graph_path", 1000);
     pub_base_path = n.advertise<nav_msgs::Path>("base_path", 1000);
     pub_pose_graph = n.advertise<visualization_msgs::MarkerArray>("pose_graph", 1000);
+    pub_keyframe_memory = n.advertise<std_msgs::Float32>("keyframe_memory", 1000);
     for (int i = 1; i < 10; i++)
         pub_path[i] = n.advertise<nav_msgs::Path>("path_" + to_string(i), 1000);
 }
@@ -66,7 +70,13 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     if (flag_detect_loop)
     {
         TicToc tmp_t;
-        loop_index = detectLoop(cur_kf, cur_kf->index);
+        vector<int> loop_candidates;
+        detectLoop(cur_kf, cur_kf->index, loop_candidates);
+        m_drift.lock();
+        Vector3d prior_P = r_drift * vio_P_cur + t_drift;
+        Matrix3d prior_R = r_drift * vio_R_cur;
+        m_drift.unlock();
+        loop_index = verifyLoopCandidates(cur_kf, loop_candidates, prior_P, prior_R);
     }
     else
     {
@@ -76,56 +86,52 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
 	{
         //printf(" %d detect loop with %d \n", cur_kf->index, loop_index);
         KeyFrame* old_kf = getKeyFrame(loop_index);
+        if (earliest_loop_index > loop_index || earliest_loop_index == -1)
+            earliest_loop_index = loop_index;
 
-        if (cur_kf->findConnection(old_kf))
-        {
-            if (earliest_loop_index > loop_index || earliest_loop_index == -1)
-                earliest_loop_index = loop_index;
-
-            Vector3d w_P_old, w_P_cur, vio_P_cur;
-            Matrix3d w_R_old, w_R_cur, vio_R_cur;
-            old_kf->getVioPose(w_P_old, w_R_old);
-            cur_kf->getVioPose(vio_P_cur, vio_R_cur);
+        Vector3d w_P_old, w_P_cur, vio_P_cur;
+        Matrix3d w_R_old, w_R_cur, vio_R_cur;
+        old_kf->getVioPose(w_P_old, w_R_old);
+        cur_kf->getVioPose(vio_P_cur, vio_R_cur);
 
-            Vector3d relative_t;
-            Quaterniond relative_q;
-            relative_t = cur_kf->getLoopRelativeT();
-            relative_q = (cur_kf->getLoopRelativeQ()).toRotationMatrix();
-            w_P_cur = w_R_old * relative_t + w_P_old;
-            w_R_cur = w_R_old * relative_q;
-            double shift_yaw;
-            Matrix3d shift_r;
-            Vector3d shift_t; 
-            shift_yaw = Utility::R2ypr(w_R_cur).x() - Utility::R2ypr(vio_R_cur).x();
-            shift_r = Utility::ypr2R(Vector3d(shift_yaw, 0, 0));
-            shift_t = w_P_cur - w_R_cur * vio_R_cur.transpose() * vio_P_cur; 
-            // shift vio pose of whole sequence to the world frame
-            if (old_kf->sequence != cur_kf->sequence && sequence_loop[cur_kf->sequence] == 0)
-            {  
-                w_r_vio = shift_r;
-                w_t_vio = shift_t;
-                vio_P_cur = w_r_vio * vio_P_cur + w_t_vio;
-                vio_R_cur = w_r_vio *  vio_R_cur;
-                cur_kf->updateVioPose(vio_P_cur, vio_R_cur);
-                list<KeyFrame*>::iterator it = keyframelist.begin();
-                for (; it != keyframelist.end(); it++)   
+        Vector3d relative_t;
+        Quaterniond relative_q;
+        relative_t = cur_kf->getLoopRelativeT();
+        relative_q = (cur_kf->getLoopRelativeQ()).toRotationMatrix();
+        w_P_cur = w_R_old * relative_t + w_P_old;
+        w_R_cur = w_R_old * relative_q;
+        double shift_yaw;
+        Matrix3d shift_r;
+        Vector3d shift_t; 
+        shift_yaw = Utility::R2ypr(w_R_cur).x() - Utility::R2ypr(vio_R_cur).x();
+        shift_r = Utility::ypr2R(Vector3d(shift_yaw, 0, 0));
+        shift_t = w_P_cur - w_R_cur * vio_R_cur.transpose() * vio_P_cur; 
+        // shift vio pose of whole sequence to the world frame
+        if (old_kf->sequence != cur_kf->sequence && sequence_loop[cur_kf->sequence] == 0)
+        {  
+            w_r_vio = shift_r;
+            w_t_vio = shift_t;
+            vio_P_cur = w_r_vio * vio_P_cur + w_t_vio;
+            vio_R_cur = w_r_vio *  vio_R_cur;
+            cur_kf->updateVioPose(vio_P_cur, vio_R_cur);
+            list<KeyFrame*>::iterator it = keyframelist.begin();
+            for (; it != keyframelist.end(); it++)   
+            {
+                if((*it)->sequence == cur_kf->sequence)
                 {
-                    if((*it)->sequence == cur_kf->sequence)
-                    {
-                        Vector3d vio_P_cur;
-                        Matrix3d vio_R_cur;
-                        (*it)->getVioPose(vio_P_cur, vio_R_cur);
-                        vio_P_cur = w_r_vio * vio_P_cur + w_t_vio;
-                        vio_R_cur = w_r_vio *  vio_R_cur;
-                        (*it)->updateVioPose(vio_P_cur, vio_R_cur);
-                    }
+                    Vector3d vio_P_cur;
+                    Matrix3d vio_R_cur;
+                    (*it)->getVioPose(vio_P_cur, vio_R_cur);
+                    vio_P_cur = w_r_vio * vio_P_cur + w_t_vio;
+                    vio_R_cur = w_r_vio *  vio_R_cur;
+                    (*it)->updateVioPose(vio_P_cur, vio_R_cur);
                 }
-                sequence_loop[cur_kf->sequence] = 1;
             }
-            m_optimize_buf.lock();
-            optimize_buf.push(cur_kf->index);
-            m_optimize_buf.unlock();
+            sequence_loop[cur_kf->sequence] = 1;
         }
+        m_optimize_buf.lock();
+        optimize_buf.push(cur_kf->index);
+        m_optimize_buf.unlock();
 	}
 	m_keyframelist.lock();
     Vector3d P;
@@ -134,6 +140,14 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     P = r_drift * P + t_drift;
     R = r_drift * R;
     cur_kf->updatePose(P, R);
+    keyframelist.push_back(cur_kf);
+    // a culled keyframe never reaches the path or the result file
+    if (KEYFRAME_CULLING && cullKeyFrame(cur_kf))
+    {
+        publish();
+        m_keyframelist.unlock();
+        return;
+    }
     Quaterniond Q{R};
     geometry_msgs::PoseStamped pose_stamped;
     pose_stamped.header.stamp = ros::Time(cur_kf->time_stamp);
@@ -168,7 +182,8 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     //draw local connection
     if (SHOW_S_EDGE)
     {
-        list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
+        // cur_kf is already the last one
+        list<KeyFrame*>::reverse_iterator rit = ++keyframelist.rbegin();
         for (int i = 0; i < 4; i++)
         {
             if (rit == keyframelist.rend())
@@ -204,7 +219,10 @@ void PoseGraph::addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     }
     //posegraph_visualization->add_pose(P + Vector3d(VISUALIZATION_SHIFT_X, VISUALIZATION_SHIFT_Y, 0), Q);
 
-	keyframelist.push_back(cur_kf);
+    cur_kf->releaseWindowFeatures();
+    touchKeyFrame(cur_kf);
+    spillColdKeyFrames();
+    publishMemoryUsage(cur_kf);
     publish();
 	m_keyframelist.unlock();
 }
@@ -216,7 +234,11 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     global_index++;
     int loop_index = -1;
     if (flag_detect_loop)
-       loop_index = detectLoop(cur_kf, cur_kf->index);
+    {
+        vector<int> loop_candidates;
+        detectLoop(cur_kf, cur_kf->index, loop_candidates);
+        loop_index = verifyLoopCandidates(cur_kf, loop_candidates, cur_kf->T_w_i, cur_kf->R_w_i);
+    }
     else
     {
         addKeyFrameIntoVoc(cur_kf);
@@ -224,16 +246,13 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     if (loop_index != -1)
     {
         printf(" %d detect loop with %d \n", cur_kf->index, loop_index);
-        KeyFrame* old_kf = getKeyFrame(loop_index);
-        if (cur_kf->findConnection(old_kf))
-        {
-            if (earliest_loop_index > loop_index || earliest_loop_index == -1)
-                earliest_loop_index = loop_index;
-            m_optimize_buf.lock();
-            optimize_buf.push(cur_kf->index);
-            m_optimize_buf.unlock();
-        }
+        if (earliest_loop_index > loop_index || earliest_loop_index == -1)
+            earliest_loop_index = loop_index;
+        m_optimize_buf.lock();
+        optimize_buf.push(cur_kf->index);
+        m_optimize_buf.unlock();
     }
+    cur_kf->releaseWindowFeatures();
     m_keyframelist.lock();
     Vector3d P;
     Matrix3d R;
@@ -282,10 +301,140 @@ void PoseGraph::loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop)
     */
 
     keyframelist.push_back(cur_kf);
+    touchKeyFrame(cur_kf);
+    spillColdKeyFrames();
     //publish();
     m_keyframelist.unlock();
 }
 
+void PoseGraph::touchKeyFrame(KeyFrame* keyframe)
+{
+    if (!keyframe->features.restore())
+        ROS_WARN("keyframe %d: failed to restore features from the cache", keyframe->index);
+    if (MAX_RESIDENT_KEYFRAMES <= 0)
+        return;
+    resident_keyframes.remove(keyframe);
+    resident_keyframes.push_back(keyframe);
+}
+
+void PoseGraph::spillColdKeyFrames()
+{
+    while (MAX_RESIDENT_KEYFRAMES > 0 && (int)resident_keyframes.size() > MAX_RESIDENT_KEYFRAMES)
+    {
+        KeyFrame* keyframe = resident_keyframes.front();
+        if (!keyframe->features.spill(KEYFRAME_CACHE_PATH + to_string(keyframe->index) + "_features.bin"))
+        {
+            ROS_WARN("keyframe cache %s is not writable, keeping all keyframes in memory", KEYFRAME_CACHE_PATH.c_str());
+            MAX_RESIDENT_KEYFRAMES = 0;
+            resident_keyframes.clear();
+            return;
+        }
+        resident_keyframes.pop_front();
+    }
+}
+
+void PoseGraph::publishMemoryUsage(KeyFrame* keyframe)
+{
+    size_t total = 0;
+    for (KeyFrame* kf : keyframelist)
+        total += kf->memoryUsage();
+    for (auto &it : image_pool)
+        total += it.second.total() * it.second.elemSize();
+    ROS_DEBUG("keyframe %d uses %lu bytes, %lu keyframes use %.1f KB (%lu resident)", keyframe->index,
+              keyframe->memoryUsage(), keyframelist.size(), total / 1024.0,
+              MAX_RESIDENT_KEYFRAMES > 0 ? resident_keyframes.size() : keyframelist.size());
+    if (!pub_keyframe_memory)
+        return;
+    std_msgs::Float32 msg;
+    msg.data = total / 1024.0;
+    pub_keyframe_memory.publish(msg);
+}
+
+// Drops cur_kf when an older keyframe already covers its view: close in
+// position and yaw, with a high BoW similarity. Sequential edges are rebuilt
+// from the VIO poses of list neighbours, so they re-link on their own; a loop
+// edge is re-expressed from the previous keyframe of the same sequence.
+bool PoseGraph::cullKeyFrame(KeyFrame* cur_kf)
+{
+    TicToc t_cull;
+    if (keyframelist.size() < 2 || (cur_kf->has_loop && FAST_RELOCALIZATION))
+        return false;
+    list<KeyFrame*>::reverse_iterator rit = keyframelist.rbegin();
+    rit++;
+    KeyFrame* prev_kf = *rit;
+    if (prev_kf->sequence != cur_kf->sequence || (cur_kf->has_loop && prev_kf->has_loop))
+        return false;
+
+    Vector3d P_cur;
+    Matrix3d R_cur;
+    cur_kf->getPose(P_cur, R_cur);
+    double yaw_cur = Utility::R2ypr(R_cur).x();
+    vector<pair<double, KeyFrame*>> candidates;
+    for (KeyFrame* kf : keyframelist)
+    {
+        if (kf == cur_kf)
+            continue;
+        Vector3d P;
+        Matrix3d R;
+        kf->getPose(P, R);
+        double dis = (P - P_cur).norm();
+        if (dis < CULL_DISTANCE && fabs(Utility::normalizeAngle(Utility::R2ypr(R).x() - yaw_cur)) < CULL_YAW)
+            candidates.push_back(make_pair(dis, kf));
+    }
+    if (candidates.empty())
+        return false;
+    sort(candidates.begin(), candidates.end());
+
+    KeyFrame* cover_kf = NULL;
+    double cover_score = 0;
+    for (int i = 0; i < min(2, (int)candidates.size()) && !cover_kf; i++)
+    {
+        KeyFrame* kf = candidates[i].second;
+        double score = voc->score(cur_kf->bow_vector, kf->bow_vector);
+        if (score > CULL_SCORE)
+        {
+            cover_kf = kf;
+            cover_score = score;
+        }
+    }
+    if (!cover_kf)
+        return false;
+
+    if (cur_kf->has_loop)
+    {
+        // loop_info is cur expressed in the old frame; chain prev into it
+        Vector3d P_prev, P_vio_cur;
+        Matrix3d R_prev, R_vio_cur;
+        prev_kf->getVioPose(P_prev, R_prev);
+        cur_kf->getVioPose(P_vio_cur, R_vio_cur);
+        Matrix3d R_cur_prev = R_vio_cur.transpose() * R_prev;
+        Vector3d t_cur_prev = R_vio_cur.transpose() * (P_prev - P_vio_cur);
+        Quaterniond q_old_cur = cur_kf->getLoopRelativeQ();
+        Vector3d t_old_prev = cur_kf->getLoopRelativeT() + q_old_cur * t_cur_prev;
+        Quaterniond q_old_prev(q_old_cur.toRotationMatrix() * R_cur_prev);
+        double yaw_old_prev = Utility::normalizeAngle(cur_kf->getLoopRelativeYaw() +
+                                                      Utility::R2ypr(R_prev).x() - Utility::R2ypr(R_vio_cur).x());
+        prev_kf->has_loop = true;
+        prev_kf->loop_index = cur_kf->loop_index;
+        prev_kf->loop_info << t_old_prev.x(), t_old_prev.y(), t_old_prev.z(),
+                              q_old_prev.w(), q_old_prev.x(), q_old_prev.y(), q_old_prev.z(),
+                              yaw_old_prev;
+        m_optimize_buf.lock();
+        optimize_buf.push(prev_kf->index);
+        m_optimize_buf.unlock();
+    }
+
+    db.delete_entry(cur_kf->index, cur_kf->bow_vector);
+    image_pool.erase(cur_kf->index);
+    resident_keyframes.remove(cur_kf);
+    keyframelist.pop_back();
+    culled_cnt++;
+    ROS_DEBUG("cull keyframe %d, covered by %d (score %f), %d culled in total, %f ms", cur_kf->index,
+              cover_kf->index, cover_score, culled_cnt, t_cull.toc());
+    delete cur_kf;
+    return true;
+}
+
 KeyFrame* PoseGraph::getKeyFrame(int index)
 {
 //    unique_lock<mutex> lock(m_keyframelist);
@@ -301,27 +450,29 @@ KeyFrame* PoseGraph::getKeyFrame(int index)
         return NULL;
 }
 
-int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)
+void PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index, vector<int> &loop_candidates)
 {
     // put image into image_pool; for visualization
     cv::Mat compressed_image;
     if (DEBUG_IMAGE)
     {
-        int feature_num = keyframe->keypoints.size();
+        int feature_num = keyframe->features.size();
         cv::resize(keyframe->image, compressed_image, cv::Size(376, 240));
         putText(compressed_image, "feature_num:" + to_string(feature_num), cv::Point2f(10, 10), CV_FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255));
         image_pool[frame_index] = compressed_image;
     }
+    TraceSpan span("loop_detect");
     TicToc tmp_t;
     //first query; then add this frame into database!
     QueryResults ret;
     TicToc t_query;
-    db.query(keyframe->brief_descriptors, ret, 4, frame_index - 50);
+    voc->transform(keyframe->brief_descriptors, keyframe->bow_vector);
+    db.query(keyframe->bow_vector, ret, 4, frame_index - 50);
     //printf("query time: %f", t_query.toc());
     //cout << "Searching for Image " << frame_index << ". " << ret << endl;
 
     TicToc t_add;
-    db.add(keyframe->brief_descriptors);
+    db.add(keyframe->bow_vector);
     //printf("add feature time: %f", t_add.toc());
     // ret[0] is the nearest neighbour's score. threshold change with neighour score
     bool find_loop = false;
@@ -370,19 +521,40 @@ int PoseGraph::detectLoop(KeyFrame* keyframe, int frame_index)
         cv::waitKey(20);
     }
 */
+    // oldest candidate first, as the earliest revisit anchors the most drift
+    loop_candidates.clear();
     if (find_loop && frame_index > 50)
     {
-        int min_index = -1;
-        for (unsigned int i = 0; i < ret.size(); i++)
+        for (unsigned int i = 0; i < ret.size() && (int)loop_candidates.size() < MAX_LOOP_CANDIDATES; i++)
         {
-            if (min_index == -1 || (ret[i].Id < min_index && ret[i].Score > 0.015))
-                min_index = ret[i].Id;
+            if (i == 0 || ret[i].Score > 0.015)
+                loop_candidates.push_back(ret[i].Id);
         }
-        return min_index;
+        sort(loop_candidates.begin(), loop_candidates.end());
     }
-    else
-        return -1;
+}
 
+// geometric check of the candidates in order; the first one that passes is
+// the loop, the rest are never matched
+int PoseGraph::verifyLoopCandidates(KeyFrame* cur_kf, const vector<int> &loop_candidates,
+                                    const Vector3d &prior_P, const Matrix3d &prior_R)
+{
+    TraceSpan span("loop_verify");
+    for (int candidate : loop_candidates)
+    {
+        // savePoseGraph() spills and restores the same features from the keyboard thread
+        unique_lock<mutex> lock(m_keyframelist);
+        KeyFrame* old_kf = getKeyFrame(candidate);
+        if (!old_kf)
+            continue;
+        touchKeyFrame(old_kf);
+        TicToc t_verify;
+        bool connected = cur_kf->findConnection(old_kf, prior_P, prior_R);
+        ROS_DEBUG("verify loop %d -> %d: %s, %f ms", cur_kf->index, candidate, connected ? "pass" : "reject", t_verify.toc());
+        if (connected)
+            return candidate;
+    }
+    return -1;
 }
 
 void PoseGraph::addKeyFrameIntoVoc(KeyFrame* keyframe)
@@ -391,191 +563,206 @@ void PoseGraph::addKeyFrameIntoVoc(KeyFrame* keyframe)
     cv::Mat compressed_image;
     if (DEBUG_IMAGE)
     {
-        int feature_num = keyframe->keypoints.size();
+        int feature_num = keyframe->features.size();
         cv::resize(keyframe->image, compressed_image, cv::Size(376, 240));
         putText(compressed_image, "feature_num:" + to_string(feature_num), cv::Point2f(10, 10), CV_FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(255));
         image_pool[keyframe->index] = compressed_image;
     }
 
-    db.add(keyframe->brief_descriptors);
+    voc->transform(keyframe->brief_descriptors, keyframe->bow_vector);
+    db.add(keyframe->bow_vector);
 }
 
 void PoseGraph::optimize4DoF()
 {
     while(true)
     {
-        int cur_index = -1;
-        int first_looped_index = -1;
-        m_optimize_buf.lock();
-        while(!optimize_buf.empty())
-        {
-            cur_index = optimize_buf.front();
-            first_looped_index = earliest_loop_index;
-            optimize_buf.pop();
-        }
-        m_optimize_buf.unlock();
-        if (cur_index != -1)
-        {
-            printf("optimize pose graph \n");
-            TicToc tmp_t;
-            m_keyframelist.lock();
-            KeyFrame* cur_kf = getKeyFrame(cur_index);
-
-            int max_length = cur_index + 1;
-
-            // w^t_i   w^q_i
-            double t_array[max_length][3];
-            Quaterniond q_array[max_length];
-            double euler_array[max_length][3];
-            double sequence_array[max_length];
-
-            ceres::Problem problem;
-            ceres::Solver::Options options;
-            options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
-            //options.minimizer_progress_to_stdout = true;
-            //options.max_solver_time_in_seconds = SOLVER_TIME * 3;
-            options.max_num_iterations = 5;
-            ceres::Solver::Summary summary;
-            ceres::LossFunction *loss_function;
-            loss_function = new ceres::HuberLoss(0.1);
-            //loss_function = new ceres::CauchyLoss(1.0);
-            ceres::LocalParameterization* angle_local_parameterization =
-                AngleLocalParameterization::Create();
-
-            list<KeyFrame*>::iterator it;
-
-            int i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
-            {
-                if ((*it)->index < first_looped_index)
-                    continue;
-                (*it)->local_index = i;
-                Quaterniond tmp_q;
-                Matrix3d tmp_r;
-                Vector3d tmp_t;
-                (*it)->getVioPose(tmp_t, tmp_r);
-                tmp_q = tmp_r;
-                t_array[i][0] = tmp_t(0);
-                t_array[i][1] = tmp_t(1);
-                t_array[i][2] = tmp_t(2);
-                q_array[i] = tmp_q;
-
-                Vector3d euler_angle = Utility::R2ypr(tmp_q.toRotationMatrix());
-                euler_array[i][0] = euler_angle.x();
-                euler_array[i][1] = euler_angle.y();
-                euler_array[i][2] = euler_angle.z();
-
-                sequence_array[i] = (*it)->sequence;
-
-                problem.AddParameterBlock(euler_array[i], 1, angle_local_parameterization);
-                problem.AddParameterBlock(t_array[i], 3);
-
-                if ((*it)->index == first_looped_index || (*it)->sequence == 0)
-                {   
-                    problem.SetParameterBlockConstant(euler_array[i]);
-                    problem.SetParameterBlockConstant(t_array[i]);
-                }
+        optimize4DoFStep();
+        std::chrono::milliseconds dura(2000);
+        std::this_thread::sleep_for(dura);
+    }
+}
 
-                //add edge
-                for (int j = 1; j < 5; j++)
-                {
-                  if (i - j >= 0 && sequence_array[i] == sequence_array[i-j])
-                  {
-                    Vector3d euler_conncected = Utility::R2ypr(q_array[i-j].toRotationMatrix());
-                    Vector3d relative_t(t_array[i][0] - t_array[i-j][0], t_array[i][1] - t_array[i-j][1], t_array[i][2] - t_array[i-j][2]);
-                    relative_t = q_array[i-j].inverse() * relative_t;
-                    double relative_yaw = euler_array[i][0] - euler_array[i-j][0];
-                    ceres::CostFunction* cost_function = FourDOFError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
-                                                   relative_yaw, euler_conncected.y(), euler_conncected.z());
-                    problem.AddResidualBlock(cost_function, NULL, euler_array[i-j], 
-                                            t_array[i-j], 
-                                            euler_array[i], 
-                                            t_array[i]);
-                  }
-                }
+// the 4DoF optimization up to the latest queued loop, false when none is queued
+bool PoseGraph::optimize4DoFStep()
+{
+    int cur_index = -1;
+    int first_looped_index = -1;
+    m_optimize_buf.lock();
+    while(!optimize_buf.empty())
+    {
+        cur_index = optimize_buf.front();
+        first_looped_index = earliest_loop_index;
+        optimize_buf.pop();
+    }
+    m_optimize_buf.unlock();
+    if (cur_index == -1)
+        return false;
 
-                //add loop edge
-                
-                if((*it)->has_loop)
-                {
-                    assert((*it)->loop_index >= first_looped_index);
-                    int connected_index = getKeyFrame((*it)->loop_index)->local_index;
-                    Vector3d euler_conncected = Utility::R2ypr(q_array[connected_index].toRotationMatrix());
-                    Vector3d relative_t;
-                    relative_t = (*it)->getLoopRelativeT();
-                    double relative_yaw = (*it)->getLoopRelativeYaw();
-                    ceres::CostFunction* cost_function = FourDOFWeightError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
-                                                                               relative_yaw, euler_conncected.y(), euler_conncected.z());
-                    problem.AddResidualBlock(cost_function, loss_function, euler_array[connected_index], 
-                                                                  t_array[connected_index], 
-                                                                  euler_array[i], 
-                                                                  t_array[i]);
-                    
-                }
-                
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
-            }
-            m_keyframelist.unlock();
+    printf("optimize pose graph \n");
+    TicToc tmp_t;
+    m_keyframelist.lock();
+    KeyFrame* cur_kf = getKeyFrame(cur_index);
+    if (!cur_kf)
+    {
+        // culled after it was queued; its loop moved to a queued neighbour
+        m_keyframelist.unlock();
+        return false;
+    }
+    TraceFrame frame(cur_kf->time_stamp);
+    TraceSpan span("optimize4dof");
 
-            ceres::Solve(options, &problem, &summary);
-            //std::cout << summary.BriefReport() << "\n";
-            
-            //printf("pose optimization time: %f \n", tmp_t.toc());
-            /*
-            for (int j = 0 ; j < i; j++)
-            {
-                printf("optimize i: %d p: %f, %f, %f\n", j, t_array[j][0], t_array[j][1], t_array[j][2] );
-            }
-            */
-            m_keyframelist.lock();
-            i = 0;
-            for (it = keyframelist.begin(); it != keyframelist.end(); it++)
-            {
-                if ((*it)->index < first_looped_index)
-                    continue;
-                Quaterniond tmp_q;
-                tmp_q = Utility::ypr2R(Vector3d(euler_array[i][0], euler_array[i][1], euler_array[i][2]));
-                Vector3d tmp_t = Vector3d(t_array[i][0], t_array[i][1], t_array[i][2]);
-                Matrix3d tmp_r = tmp_q.toRotationMatrix();
-                (*it)-> updatePose(tmp_t, tmp_r);
-
-                if ((*it)->index == cur_index)
-                    break;
-                i++;
-            }
+    int max_length = cur_index + 1;
 
-            Vector3d cur_t, vio_t;
-            Matrix3d cur_r, vio_r;
-            cur_kf->getPose(cur_t, cur_r);
-            cur_kf->getVioPose(vio_t, vio_r);
-            m_drift.lock();
-            yaw_drift = Utility::R2ypr(cur_r).x() - Utility::R2ypr(vio_r).x();
-            r_drift = Utility::ypr2R(Vector3d(yaw_drift, 0, 0));
-            t_drift = cur_t - r_drift * vio_t;
-            m_drift.unlock();
-            //cout << "t_drift " << t_drift.transpose() << endl;
-            //cout << "r_drift " << Utility::R2ypr(r_drift).transpose() << endl;
-            //cout << "yaw drift " << yaw_drift << endl;
+    // w^t_i   w^q_i
+    double t_array[max_length][3];
+    Quaterniond q_array[max_length];
+    double euler_array[max_length][3];
+    double sequence_array[max_length];
 
-            it++;
-            for (; it != keyframelist.end(); it++)
-            {
-                Vector3d P;
-                Matrix3d R;
-                (*it)->getVioPose(P, R);
-                P = r_drift * P + t_drift;
-                R = r_drift * R;
-                (*it)->updatePose(P, R);
-            }
-            m_keyframelist.unlock();
-            updatePath();
+    ceres::Problem problem;
+    ceres::Solver::Options options;
+    options.linear_solver_type = ceres::SPARSE_NORMAL_CHOLESKY;
+    //options.minimizer_progress_to_stdout = true;
+    //options.max_solver_time_in_seconds = SOLVER_TIME * 3;
+    options.max_num_iterations = 5;
+    ceres::Solver::Summary summary;
+    ceres::LossFunction *loss_function;
+    loss_function = new ceres::HuberLoss(0.1);
+    //loss_function = new ceres::CauchyLoss(1.0);
+    ceres::LocalParameterization* angle_local_parameterization =
+        AngleLocalParameterization::Create();
+
+    list<KeyFrame*>::iterator it;
+
+    int i = 0;
+    for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+    {
+        if ((*it)->index < first_looped_index)
+            continue;
+        (*it)->local_index = i;
+        Quaterniond tmp_q;
+        Matrix3d tmp_r;
+        Vector3d tmp_t;
+        (*it)->getVioPose(tmp_t, tmp_r);
+        tmp_q = tmp_r;
+        t_array[i][0] = tmp_t(0);
+        t_array[i][1] = tmp_t(1);
+        t_array[i][2] = tmp_t(2);
+        q_array[i] = tmp_q;
+
+        Vector3d euler_angle = Utility::R2ypr(tmp_q.toRotationMatrix());
+        euler_array[i][0] = euler_angle.x();
+        euler_array[i][1] = euler_angle.y();
+        euler_array[i][2] = euler_angle.z();
+
+        sequence_array[i] = (*it)->sequence;
+
+        problem.AddParameterBlock(euler_array[i], 1, angle_local_parameterization);
+        problem.AddParameterBlock(t_array[i], 3);
+
+        if ((*it)->index == first_looped_index || (*it)->sequence == 0)
+        {   
+            problem.SetParameterBlockConstant(euler_array[i]);
+            problem.SetParameterBlockConstant(t_array[i]);
         }
 
-        std::chrono::milliseconds dura(2000);
-        std::this_thread::sleep_for(dura);
+        //add edge
+        for (int j = 1; j < 5; j++)
+        {
+          if (i - j >= 0 && sequence_array[i] == sequence_array[i-j])
+          {
+            Vector3d euler_conncected = Utility::R2ypr(q_array[i-j].toRotationMatrix());
+            Vector3d relative_t(t_array[i][0] - t_array[i-j][0], t_array[i][1] - t_array[i-j][1], t_array[i][2] - t_array[i-j][2]);
+            relative_t = q_array[i-j].inverse() * relative_t;
+            double relative_yaw = euler_array[i][0] - euler_array[i-j][0];
+            ceres::CostFunction* cost_function = FourDOFError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
+                                           relative_yaw, euler_conncected.y(), euler_conncected.z());
+            problem.AddResidualBlock(cost_function, NULL, euler_array[i-j], 
+                                    t_array[i-j], 
+                                    euler_array[i], 
+                                    t_array[i]);
+          }
+        }
+
+        //add loop edge
+        
+        if((*it)->has_loop)
+        {
+            assert((*it)->loop_index >= first_looped_index);
+            int connected_index = getKeyFrame((*it)->loop_index)->local_index;
+            Vector3d euler_conncected = Utility::R2ypr(q_array[connected_index].toRotationMatrix());
+            Vector3d relative_t;
+            relative_t = (*it)->getLoopRelativeT();
+            double relative_yaw = (*it)->getLoopRelativeYaw();
+            ceres::CostFunction* cost_function = FourDOFWeightError::Create( relative_t.x(), relative_t.y(), relative_t.z(),
+                                                                       relative_yaw, euler_conncected.y(), euler_conncected.z());
+            problem.AddResidualBlock(cost_function, loss_function, euler_array[connected_index], 
+                                                          t_array[connected_index], 
+                                                          euler_array[i], 
+                                                          t_array[i]);
+            
+        }
+        
+        if ((*it)->index == cur_index)
+            break;
+        i++;
     }
+    m_keyframelist.unlock();
+
+    ceres::Solve(options, &problem, &summary);
+    //std::cout << summary.BriefReport() << "\n";
+    
+    //printf("pose optimization time: %f \n", tmp_t.toc());
+    /*
+    for (int j = 0 ; j < i; j++)
+    {
+        printf("optimize i: %d p: %f, %f, %f\n", j, t_array[j][0], t_array[j][1], t_array[j][2] );
+    }
+    */
+    m_keyframelist.lock();
+    i = 0;
+    for (it = keyframelist.begin(); it != keyframelist.end(); it++)
+    {
+        if ((*it)->index < first_looped_index)
+            continue;
+        Quaterniond tmp_q;
+        tmp_q = Utility::ypr2R(Vector3d(euler_array[i][0], euler_array[i][1], euler_array[i][2]));
+        Vector3d tmp_t = Vector3d(t_array[i][0], t_array[i][1], t_array[i][2]);
+        Matrix3d tmp_r = tmp_q.toRotationMatrix();
+        (*it)-> updatePose(tmp_t, tmp_r);
+
+        if ((*it)->index == cur_index)
+            break;
+        i++;
+    }
+
+    Vector3d cur_t, vio_t;
+    Matrix3d cur_r, vio_r;
+    cur_kf->getPose(cur_t, cur_r);
+    cur_kf->getVioPose(vio_t, vio_r);
+    m_drift.lock();
+    yaw_drift = Utility::R2ypr(cur_r).x() - Utility::R2ypr(vio_r).x();
+    r_drift = Utility::ypr2R(Vector3d(yaw_drift, 0, 0));
+    t_drift = cur_t - r_drift * vio_t;
+    m_drift.unlock();
+    //cout << "t_drift " << t_drift.transpose() << endl;
+    //cout << "r_drift " << Utility::R2ypr(r_drift).transpose() << endl;
+    //cout << "yaw drift " << yaw_drift << endl;
+
+    it++;
+    for (; it != keyframelist.end(); it++)
+    {
+        Vector3d P;
+        Matrix3d R;
+        (*it)->getVioPose(P, R);
+        P = r_drift * P + t_drift;
+        R = r_drift * R;
+        (*it)->updatePose(P, R);
+    }
+    m_keyframelist.unlock();
+    updatePath();
+    return true;
 }
 
 void PoseGraph::updatePath()
@@ -726,20 +913,24 @@ void PoseGraph::savePoseGraph()
                                     (*it)->loop_index, 
                                     (*it)->loop_info(0), (*it)->loop_info(1), (*it)->loop_info(2), (*it)->loop_info(3),
                                     (*it)->loop_info(4), (*it)->loop_info(5), (*it)->loop_info(6), (*it)->loop_info(7),
-                                    (int)(*it)->keypoints.size());
+                                    (*it)->features.size());
 
-        // write keypoints, brief_descriptors   vector<cv::KeyPoint> keypoints vector<BRIEF::bitset> brief_descriptors;
-        assert((*it)->keypoints.size() == (*it)->brief_descriptors.size());
+        // write keypoints, brief_descriptors
+        touchKeyFrame(*it);
+        vector<BRIEF::bitset> brief_descriptors;
+        vector<cv::Point2f> keypoints, keypoints_norm;
+        (*it)->features.unpack(brief_descriptors, keypoints, keypoints_norm);
+        spillColdKeyFrames();
         brief_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_briefdes.dat";
         std::ofstream brief_file(brief_path, std::ios::binary);
         keypoints_path = POSE_GRAPH_SAVE_PATH + to_string((*it)->index) + "_keypoints.txt";
         FILE *keypoints_file;
         keypoints_file = fopen(keypoints_path.c_str(), "w");
-        for (int i = 0; i < (int)(*it)->keypoints.size(); i++)
+        for (int i = 0; i < (int)keypoints.size(); i++)
         {
-            brief_file << (*it)->brief_descriptors[i] << endl;
-            fprintf(keypoints_file, "%f %f %f %f\n", (*it)->keypoints[i].pt.x, (*it)->keypoints[i].pt.y, 
-                                                     (*it)->keypoints_norm[i].pt.x, (*it)->keypoints_norm[i].pt.y);
+            brief_file << brief_descriptors[i] << endl;
+            fprintf(keypoints_file, "%f %f %f %f\n", keypoints[i].x, keypoints[i].y, 
+                                                     keypoints_norm[i].x, keypoints_norm[i].y);
         }
         brief_file.close();
         fclose(keypoints_file);
@@ -871,6 +1062,9 @@ void PoseGraph::loadPoseGraph()
 
 void PoseGraph::publish()
 {
+    // without registerPub() (the offline benchmark) nobody listens
+    if (!pub_pg_path)
+        return;
     for (int i = 1; i <= sequence_cnt; i++)
     {
         //if (sequence_loop[i] == true || i == base_sequence)
@@ -888,6 +1082,8 @@ void PoseGraph::publish()
 void PoseGraph::updateKeyFrameLoop(int index, Eigen::Matrix<double, 8, 1 > &_loop_info)
 {
     KeyFrame* kf = getKeyFrame(index);
+    if (!kf)
+        return;
     kf->updateLoop(_loop_info);
     if (abs(_loop_info(7)) < 30.0 && Vector3d(_loop_info(0), _loop_info(1), _loop_info(2)).norm() < 20.0)
     {
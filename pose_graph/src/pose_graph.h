@@ -12,10 +12,12 @@
 #include <nav_msgs/Path.h>
 #include <geometry_msgs/PointStamped.h>
 #include <nav_msgs/Odometry.h>
+#include <std_msgs/Float32.h>
 #include <stdio.h>
 #include <ros/ros.h>
 #include "keyframe.h"
 #include "utility/tic_toc.h"
+#include <uvslam/trace.h>
 #include "utility/utility.h"
 #include "utility/CameraPoseVisualization.h"
 #include "utility/tic_toc.h"
@@ -28,6 +30,7 @@
 #define SHOW_S_EDGE false
 #define SHOW_L_EDGE true
 #define SAVE_LOOP_PATH true
+#define MAX_LOOP_CANDIDATES 4
 
 using namespace DVision;
 using namespace DBoW2;
@@ -35,13 +38,15 @@ using namespace DBoW2;
 class PoseGraph
 {
 public:
-	PoseGraph();
+	// without the optimization thread, call optimize4DoFStep() after addKeyFrame()
+	explicit PoseGraph(bool optimization_thread = true);
 	~PoseGraph();
 	void registerPub(ros::NodeHandle &n);
 	void addKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop);
 	void loadKeyFrame(KeyFrame* cur_kf, bool flag_detect_loop);
 	void loadVocabulary(std::string voc_path);
 	void updateKeyFrameLoop(int index, Eigen::Matrix<double, 8, 1 > &_loop_info);
+	bool optimize4DoFStep();
 	KeyFrame* getKeyFrame(int index);
 	nav_msgs::Path path[10];
 	nav_msgs::Path base_path;
@@ -58,11 +63,19 @@ public:
 
 
 private:
-	int detectLoop(KeyFrame* keyframe, int frame_index);
+	void detectLoop(KeyFrame* keyframe, int frame_index, vector<int> &loop_candidates);
+	int verifyLoopCandidates(KeyFrame* cur_kf, const vector<int> &loop_candidates,
+	                         const Vector3d &prior_P, const Matrix3d &prior_R);
 	void addKeyFrameIntoVoc(KeyFrame* keyframe);
 	void optimize4DoF();
 	void updatePath();
+	bool cullKeyFrame(KeyFrame* cur_kf);
+	void touchKeyFrame(KeyFrame* keyframe);
+	void spillColdKeyFrames();
+	void publishMemoryUsage(KeyFrame* keyframe);
 	list<KeyFrame*> keyframelist;
+	// keyframes whose features are in memory, least recently used first
+	list<KeyFrame*> resident_keyframes;
 	std::mutex m_keyframelist;
 	std::mutex m_optimize_buf;
 	std::mutex m_path;
@@ -75,6 +88,7 @@ private:
 	vector<bool> sequence_loop;
 	map<int, cv::Mat> image_pool;
 	int earliest_loop_index;
+	int culled_cnt;
 	int base_sequence;
 
 	BriefDatabase db;
@@ -83,6 +97,7 @@ private:
 	ros::Publisher pub_pg_path;
 	ros::Publisher pub_base_path;
 	ros::Publisher pub_pose_graph;
+	ros::Publisher pub_keyframe_memory;
 	ros::Publisher pub_path[10];
 };
 
@@ -18,6 +18,7 @@
 #include <opencv2/core/eigen.hpp>
 #include "keyframe.h"
 #include "utility/tic_toc.h"
+#include <uvslam/trace.h>
 #include "pose_graph.h"
 #include "utility/CameraPoseVisualization.h"
 #include "parameters.h"
@@ -48,6 +49,11 @@ int DEBUG_IMAGE;
 int VISUALIZE_IMU_FORWARD;
 int LOOP_CLOSURE;
 int FAST_RELOCALIZATION;
+int MAX_RESIDENT_KEYFRAMES;
+int KEYFRAME_CULLING;
+double CULL_DISTANCE;
+double CULL_YAW;
+double CULL_SCORE;
 
 camodocal::CameraPtr m_camera;
 Eigen::Vector3d tic;
@@ -61,6 +67,7 @@ nav_msgs::Path no_loop_path;
 
 std::string BRIEF_PATTERN_FILE;
 std::string POSE_GRAPH_SAVE_PATH;
+std::string KEYFRAME_CACHE_PATH;
 std::string VINS_RESULT_PATH;
 std::string GT_RESULT_PATH;
 CameraPoseVisualization cameraposevisual(1, 0, 0, 1);
@@ -385,6 +392,7 @@ void process()
                                      pose_msg->pose.pose.orientation.z).toRotationMatrix();
             if((T - last_t).norm() > SKIP_DIS)
             {
+                TraceFrame frame(pose_msg->header.stamp.toSec());
                 vector<cv::Point3f> point_3d; 
                 vector<cv::Point2f> point_2d_uv; 
                 vector<cv::Point2f> point_2d_normal;
@@ -412,8 +420,10 @@ void process()
                     //printf("u %f, v %f \n", p_2d_uv.x, p_2d_uv.y);
                 }
 
+                TraceSpan t_keyframe("keyframe");
                 KeyFrame* keyframe = new KeyFrame(pose_msg->header.stamp.toSec(), frame_index, T, R, image,
                                    point_3d, point_2d_uv, point_2d_normal, point_id, sequence);   
+                t_keyframe.stop();
                 m_process.lock();
                 start_flag = 1;
                 posegraph.addKeyFrame(keyframe, 1);
@@ -475,6 +485,11 @@ int main(int argc, char **argv)
     cameraposevisual.setScale(camera_visual_size);
     cameraposevisual.setLineWidth(camera_visual_size / 10.0);
 
+    int TRACE_ENABLE = fsSettings["trace_enable"];
+    std::string TRACE_PATH;
+    fsSettings["trace_path"] >> TRACE_PATH;
+    double TRACE_SUMMARY_PERIOD = fsSettings["trace_summary_period"].empty() ? 1.0 : (double)fsSettings["trace_summary_period"];
+
 
     LOOP_CLOSURE = fsSettings["loop_closure"];
     std::string IMAGE_TOPIC;
@@ -499,6 +514,14 @@ int main(int argc, char **argv)
         VISUALIZE_IMU_FORWARD = fsSettings["visualize_imu_forward"];
         LOAD_PREVIOUS_POSE_GRAPH = fsSettings["load_previous_pose_graph"];
         FAST_RELOCALIZATION = fsSettings["fast_relocalization"];
+        MAX_RESIDENT_KEYFRAMES = fsSettings["max_resident_keyframes"];
+        fsSettings["keyframe_cache_path"] >> KEYFRAME_CACHE_PATH;
+        if (KEYFRAME_CACHE_PATH.empty())
+            KEYFRAME_CACHE_PATH = POSE_GRAPH_SAVE_PATH;
+        KEYFRAME_CULLING = fsSettings["keyframe_culling"];
+        CULL_DISTANCE = fsSettings["cull_distance"].empty() ? 0.3 : (double)fsSettings["cull_distance"];
+        CULL_YAW = fsSettings["cull_yaw"].empty() ? 15.0 : (double)fsSettings["cull_yaw"];
+        CULL_SCORE = fsSettings["cull_score"].empty() ? 0.05 : (double)fsSettings["cull_score"];
         VINS_RESULT_PATH = VINS_RESULT_PATH + "/vins_result_loop.csv";
         std::ofstream fout(VINS_RESULT_PATH, std::ios::out);
         fout.close();
@@ -542,6 +565,9 @@ int main(int argc, char **argv)
     measurement_process = std::thread(process);
     keyboard_command_process = std::thread(command);
 
+    ros::Timer trace_timer;
+    if (TRACE_ENABLE)
+        trace_timer = startTracing(n, "pose_graph", TRACE_PATH, TRACE_SUMMARY_PERIOD);
 
     ros::spin();
 
@@ -0,0 +1,120 @@
+#!/usr/bin/env python
+"""Compare residual selection settings on one sequence with uvslam_bench.
+
+For every max_selected_points x max_selected_lines pair a copy of the config
+is written with the two keys (and output_path) overridden and the sequence is
+replayed offline by uvslam_bench (BUILD_BENCHMARKS), which is deterministic,
+so one run per setting is enough. Reported per setting:
+
+  * solve       ceres time per solve, mean / p90 ms (the "solve" span)
+  * select      time spent picking the residuals, mean ms (the "select" span)
+  * estimator   ms per frame
+  * accuracy    ATE RMSE after a rigid alignment, RPE over 1 s
+
+The first setting is the reference the others are compared with; 0 keeps
+every residual.
+
+example:
+  rosrun uv_slam residual_selection.py --bench devel/lib/uv_slam/uvslam_bench \\
+      --config config/euroc/euroc_config.yaml --sequence MH_01_easy \\
+      --points 0 400 200 100 --lines 0
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+
+def override(config_text, key, value):
+    line = '%s: %s' % (key, value)
+    pattern = re.compile(r'^%s:[^\n]*$' % key, re.M)
+    if pattern.search(config_text):
+        return pattern.sub(line, config_text)
+    return config_text.rstrip('\n') + '\n' + line + '\n'
+
+
+STAGE = re.compile(r'^vins_estimator\s+(\S+)\s+(\d+)\s+([\d.]+)\s+([\d.]+)\s+([\d.]+)\s+([\d.]+)\s+([\d.]+)\s+([\d.]+)')
+ATE = re.compile(r'^ATE ([\d.]+) m over \d+ poses, RPE \([\d.]+ s\) ([\d.na]+) m ([\d.na]+) deg')
+FRAME = re.compile(r'estimator ([\d.]+) ms / frame')
+
+
+def run_once(args, points, lines, run_dir):
+    if not os.path.isdir(run_dir):
+        os.makedirs(run_dir)
+    with open(args.config) as f:
+        text = f.read()
+    text = override(text, 'max_selected_points', points)
+    text = override(text, 'max_selected_lines', lines)
+    text = override(text, 'output_path', '"%s"' % run_dir)
+    config = os.path.join(run_dir, 'config.yaml')
+    with open(config, 'w') as f:
+        f.write(text)
+
+    command = [args.bench, config, args.sequence, str(args.max_frames), os.path.join(run_dir, 'trajectory.txt')]
+    output = subprocess.check_output(command, stderr=subprocess.STDOUT).decode()
+    with open(os.path.join(run_dir, 'bench.log'), 'w') as f:
+        f.write(output)
+
+    result = {'points': points, 'lines': lines, 'solve': float('nan'), 'solve_p90': float('nan'),
+              'select': float('nan'), 'frame': float('nan'), 'ate': float('nan'), 'rpe_t': float('nan'),
+              'rpe_r': float('nan')}
+    for line in output.splitlines():
+        m = STAGE.match(line)
+        if m and int(m.group(2)):
+            mean = float(m.group(3)) / int(m.group(2))
+            if m.group(1) == 'solve':
+                result['solve'], result['solve_p90'] = mean, float(m.group(6))
+            elif m.group(1) == 'select':
+                result['select'] = mean
+        m = ATE.match(line)
+        if m:
+            result['ate'], result['rpe_t'], result['rpe_r'] = (float(v) for v in m.groups())
+        m = FRAME.search(line)
+        if m:
+            result['frame'] = float(m.group(1))
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--bench', default='uvslam_bench')
+    parser.add_argument('--config', required=True)
+    parser.add_argument('--sequence', required=True, help='ASL folder, see uvslam_bench')
+    parser.add_argument('--points', type=int, nargs='+', default=[0, 400, 200, 100])
+    parser.add_argument('--lines', type=int, nargs='+', default=[0])
+    parser.add_argument('--max-frames', type=int, default=0)
+    parser.add_argument('--out', default='/tmp/residual_selection')
+    args = parser.parse_args()
+    args.config = os.path.abspath(args.config)
+
+    results = []
+    for points in args.points:
+        for lines in args.lines:
+            run_dir = os.path.join(args.out, 'p%d_l%d' % (points, lines))
+            results.append(run_once(args, points, lines, run_dir))
+            r = results[-1]
+            sys.stdout.write('points %4d lines %4d: solve %.2f ms, ATE %.4f m\n'
+                             % (points, lines, r['solve'], r['ate']))
+
+    keys = ['points', 'lines', 'solve', 'solve_p90', 'select', 'frame', 'ate', 'rpe_t', 'rpe_r']
+    with open(os.path.join(args.out, 'selection.csv'), 'w') as f:
+        f.write(','.join(keys) + '\n')
+        for r in results:
+            f.write(','.join(str(r[k]) for k in keys) + '\n')
+
+    base = results[0]
+    print('%6s %6s %9s %9s %9s %9s %8s %8s %9s %8s %8s' % ('points', 'lines', 'solve ms', 'p90 ms', 'select',
+                                                           'frame ms', 'speedup', 'ATE m', 'ATE diff', 'RPE m',
+                                                           'RPE deg'))
+    for r in results:
+        print('%6d %6d %9.2f %9.2f %9.3f %9.2f %7.2fx %8.4f %+8.1f%% %8.4f %8.3f'
+              % (r['points'], r['lines'], r['solve'], r['solve_p90'], r['select'], r['frame'],
+                 base['solve'] / r['solve'] if r['solve'] else float('nan'), r['ate'],
+                 100.0 * (r['ate'] - base['ate']) / base['ate'] if base['ate'] else float('nan'),
+                 r['rpe_t'], r['rpe_r']))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,108 @@
+#!/usr/bin/env python
+"""Merge the per node latency traces and report the image-to-pose latency.
+
+With trace_enable: 1 and trace_path set, feature_tracker, vins_estimator and
+pose_graph each write <trace_path>/<node>.json, a Chrome trace of complete
+("X") events whose args.frame is the image stamp the span worked on. This
+script
+
+  * writes one merged trace to open in chrome://tracing or ui.perfetto.dev
+  * prints p50 / p90 / p99 / max of every stage, per node
+  * prints the image-to-pose latency of every frame the estimator published:
+    from the first feature_tracker span of the frame to the end of the
+    estimator's publish span (both wall clock, so the nodes must run on one
+    machine), and the same up to the end of pose_graph's spans of the frame
+    for keyframes
+
+example:
+  rosrun uv_slam trace_latency.py /tmp/trace --out /tmp/trace/merged.json
+"""
+
+import argparse
+import json
+import os
+import sys
+
+import numpy as np
+
+NODES = ['feature_tracker', 'vins_estimator', 'pose_graph']
+
+
+def load_trace(path):
+    with open(path) as f:
+        text = f.read().rstrip().rstrip(',')
+    # every drain closes the array, only a node killed in the middle of one
+    # leaves it open
+    if not text.endswith(']'):
+        text += '\n]'
+    return json.loads(text)
+
+
+def percentiles(values):
+    values = np.asarray(values)
+    return (np.percentile(values, 50), np.percentile(values, 90), np.percentile(values, 99), values.max())
+
+
+def print_table(title, rows):
+    print('\n%s' % title)
+    print('%-32s %8s %9s %9s %9s %9s' % ('', 'count', 'p50 ms', 'p90 ms', 'p99 ms', 'max ms'))
+    for name, values in rows:
+        if len(values):
+            print('%-32s %8d %9.2f %9.2f %9.2f %9.2f' % ((name, len(values)) + percentiles(values)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('trace_dir', help='trace_path of the config')
+    parser.add_argument('--out', help='merged Chrome trace, default <trace_dir>/merged.json')
+    args = parser.parse_args()
+
+    events = []
+    node_of_pid = {}
+    for node in NODES:
+        path = os.path.join(args.trace_dir, node + '.json')
+        if not os.path.exists(path):
+            print('no trace of %s' % node)
+            continue
+        for e in load_trace(path):
+            node_of_pid[e['pid']] = node
+            events.append(e)
+    if not events:
+        sys.exit('no traces in %s' % args.trace_dir)
+
+    out = args.out or os.path.join(args.trace_dir, 'merged.json')
+    with open(out, 'w') as f:
+        json.dump(events, f)
+    print('merged %d events into %s' % (len(events), out))
+
+    spans = [e for e in events if e.get('ph') == 'X']
+    stages = {}
+    for e in spans:
+        stages.setdefault((node_of_pid[e['pid']], e['name']), []).append(e['dur'] * 1e-3)
+    print_table('stage durations', [('%s/%s' % key, stages[key]) for key in sorted(stages)])
+
+    # per frame: tracker start, estimator publish end, pose graph end
+    start, published, looped = {}, {}, {}
+    for e in spans:
+        frame = e['args'].get('frame', 0)
+        if not frame:
+            continue
+        node = node_of_pid[e['pid']]
+        end = e['ts'] + e['dur']
+        if node == 'feature_tracker':
+            start[frame] = min(start.get(frame, e['ts']), e['ts'])
+        elif node == 'vins_estimator' and e['name'] == 'publish':
+            published[frame] = end
+        elif node == 'pose_graph' and e['name'] != 'optimize4dof':
+            looped[frame] = max(looped.get(frame, end), end)
+
+    to_pose = [(published[t] - start[t]) * 1e-3 for t in published if t in start]
+    to_keyframe = [(looped[t] - start[t]) * 1e-3 for t in looped if t in start]
+    print_table('end-to-end latency', [('image -> pose', to_pose),
+                                       ('image -> pose graph', to_keyframe)])
+    if not to_pose:
+        print('no frame has both a feature_tracker span and a vins_estimator publish span')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,141 @@
+#!/usr/bin/env python
+"""Sweep window_size x max_point_features over a recorded sequence.
+
+For every combination a copy of the config is written with the two keys (and
+output_path) overridden, the launch file is started, the bag is played and the
+estimator output is scored:
+
+  * solve time   mean / 90th percentile of solve_time.txt (ms per frame)
+  * accuracy     ATE RMSE of stamped_traj_estimate.txt against the ground truth
+                 after a rigid (SE3) alignment
+
+Ground truth is either EuRoC's state_groundtruth_estimate0/data.csv
+(ns timestamps) or a TUM style "t x y z qx qy qz qw" file.
+
+example:
+  rosrun uv_slam window_sweep.py --config config/euroc/euroc_config.yaml \\
+      --bag MH_01_easy.bag --gt MH_01_easy/mav0/state_groundtruth_estimate0/data.csv
+"""
+
+import argparse
+import os
+import re
+import signal
+import subprocess
+import sys
+import time
+
+import numpy as np
+
+
+def override(config_text, key, value):
+    line = '%s: %s' % (key, value)
+    pattern = re.compile(r'^%s:[^\n]*$' % key, re.M)
+    if pattern.search(config_text):
+        return pattern.sub(line, config_text)
+    return config_text.rstrip('\n') + '\n' + line + '\n'
+
+
+def load_estimate(path):
+    data = np.loadtxt(path, ndmin=2)
+    return data[:, 0], data[:, 1:4]
+
+
+def load_ground_truth(path):
+    if path.endswith('.csv'):
+        data = np.loadtxt(path, delimiter=',', comments='#', ndmin=2)
+        return data[:, 0] * 1e-9, data[:, 1:4]
+    data = np.loadtxt(path, ndmin=2)
+    return data[:, 0], data[:, 1:4]
+
+
+def associate(t_est, t_gt, max_dt=0.02):
+    idx = np.clip(np.searchsorted(t_gt, t_est), 1, len(t_gt) - 1)
+    prev_closer = np.abs(t_est - t_gt[idx - 1]) < np.abs(t_est - t_gt[idx])
+    idx = np.where(prev_closer, idx - 1, idx)
+    ok = np.abs(t_est - t_gt[idx]) < max_dt
+    return np.nonzero(ok)[0], idx[ok]
+
+
+def ate_rmse(p_est, p_gt):
+    # Umeyama without scale
+    mu_est, mu_gt = p_est.mean(0), p_gt.mean(0)
+    u, _, vt = np.linalg.svd((p_gt - mu_gt).T.dot(p_est - mu_est))
+    s = np.eye(3)
+    s[2, 2] = np.sign(np.linalg.det(u.dot(vt)))
+    r = u.dot(s).dot(vt)
+    aligned = (r.dot((p_est - mu_est).T)).T + mu_gt
+    return np.sqrt(np.mean(np.sum((aligned - p_gt) ** 2, axis=1)))
+
+
+def run_once(args, window, cap, run_dir):
+    if not os.path.isdir(run_dir):
+        os.makedirs(run_dir)
+    with open(args.config) as f:
+        text = f.read()
+    text = override(text, 'window_size', window)
+    text = override(text, 'max_point_features', cap)
+    text = override(text, 'output_path', '"%s"' % run_dir)
+    config = os.path.join(run_dir, 'config.yaml')
+    with open(config, 'w') as f:
+        f.write(text)
+
+    with open(os.path.join(run_dir, 'launch.log'), 'w') as log:
+        launch = subprocess.Popen(['roslaunch', args.package, args.launch, 'config_path:=' + config],
+                                  stdout=log, stderr=subprocess.STDOUT)
+        time.sleep(args.startup)
+        subprocess.check_call(['rosbag', 'play', '-q', '-r', str(args.rate), args.bag])
+        time.sleep(2.0)
+        launch.send_signal(signal.SIGINT)
+        launch.wait()
+
+    t_est, p_est = load_estimate(os.path.join(run_dir, 'stamped_traj_estimate.txt'))
+    t_gt, p_gt = load_ground_truth(args.gt)
+    i_est, i_gt = associate(t_est, t_gt)
+    solve = np.loadtxt(os.path.join(run_dir, 'solve_time.txt'), ndmin=2)[:, 1]
+    return {
+        'window': window,
+        'cap': cap,
+        'frames': len(solve),
+        'solve_mean': solve.mean(),
+        'solve_p90': np.percentile(solve, 90),
+        'ate': ate_rmse(p_est[i_est], p_gt[i_gt]) if len(i_est) > 2 else float('nan'),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--config', required=True)
+    parser.add_argument('--bag', required=True)
+    parser.add_argument('--gt', required=True)
+    parser.add_argument('--windows', type=int, nargs='+', default=[5, 10, 15, 20])
+    parser.add_argument('--caps', type=int, nargs='+', default=[250, 500, 1000])
+    parser.add_argument('--package', default='uv_slam')
+    parser.add_argument('--launch', default='euroc.launch')
+    parser.add_argument('--rate', type=float, default=1.0)
+    parser.add_argument('--startup', type=float, default=5.0, help='seconds to wait for the nodes')
+    parser.add_argument('--out', default='/tmp/window_sweep')
+    args = parser.parse_args()
+    args.config = os.path.abspath(args.config)
+
+    results = []
+    for window in args.windows:
+        for cap in args.caps:
+            run_dir = os.path.join(args.out, 'w%d_f%d' % (window, cap))
+            results.append(run_once(args, window, cap, run_dir))
+            r = results[-1]
+            sys.stdout.write('window %2d cap %5d: solve %.2f ms (p90 %.2f), ATE %.4f m\n'
+                             % (window, cap, r['solve_mean'], r['solve_p90'], r['ate']))
+
+    keys = ['window', 'cap', 'frames', 'solve_mean', 'solve_p90', 'ate']
+    with open(os.path.join(args.out, 'sweep.csv'), 'w') as f:
+        f.write(','.join(keys) + '\n')
+        for r in results:
+            f.write(','.join(str(r[k]) for k in keys) + '\n')
+    print('%6s %6s %7s %10s %10s %8s' % ('window', 'cap', 'frames', 'solve ms', 'p90 ms', 'ATE m'))
+    for r in results:
+        print('%6d %6d %7d %10.2f %10.2f %8.4f' % (r['window'], r['cap'], r['frames'], r['solve_mean'], r['solve_p90'], r['ate']))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,234 @@
+// Initialization benchmark on a recorded track log (see utility/track_log.h;
+// the node writes one when track_log_path is set). The log is replayed into a
+// fresh Estimator from a series of start offsets, up to the end of
+// initialStructure(), without images and without a ROS master. For every
+// offset it reports whether and how fast the estimator initialized and, when
+// the log carries ground truth, the scale and gravity error of the result.
+//
+//   init_bench <config.yaml> <tracks.log> [offset_step_s] [num_offsets] [max_init_s]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "../estimator.h"
+#include "../parameters.h"
+#include "../utility/tic_toc.h"
+#include "../utility/track_log.h"
+
+struct InitResult
+{
+    double offset;
+    bool success;
+    double data_time; // seconds of log consumed until initialized
+    double wall_ms;   // time spent inside processIMU()/addFrame()
+    int attempts;
+    double scale_err;
+    double grav_err;  // degrees
+};
+
+// nearest ground-truth pose within 20 ms of t
+static bool lookupGT(const std::map<double, TrackLogRecord> &gt, double t, TrackLogRecord &out)
+{
+    auto it = gt.lower_bound(t);
+    double best = 0.02;
+    bool found = false;
+    if (it != gt.end() && it->first - t <= best)
+    {
+        best = it->first - t;
+        out = it->second;
+        found = true;
+    }
+    if (it != gt.begin() && t - std::prev(it)->first <= best)
+    {
+        out = std::prev(it)->second;
+        found = true;
+    }
+    return found;
+}
+
+// Scale error of the window trajectory against ground truth, from the spread
+// of the centered positions so no alignment is needed, and the angle between
+// the estimated and true gravity in the first body frame.
+static void evaluate(const Estimator &estimator, const std::map<double, TrackLogRecord> &gt,
+                     double &scale_err, double &grav_err)
+{
+    scale_err = grav_err = std::numeric_limits<double>::quiet_NaN();
+    std::vector<Vector3d> est, ref;
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+    {
+        TrackLogRecord r;
+        if (!lookupGT(gt, estimator.Headers[i].stamp.toSec(), r))
+            continue;
+        if (est.empty())
+        {
+            Vector3d g_body = estimator.Rs[i].transpose() * estimator.g;
+            Vector3d g_ref = r.q.toRotationMatrix().transpose() * Vector3d(0, 0, 1);
+            double c = std::max(-1.0, std::min(1.0, g_body.normalized().dot(g_ref)));
+            grav_err = std::acos(c) * 180.0 / M_PI;
+        }
+        est.push_back(estimator.Ps[i]);
+        ref.push_back(r.p);
+    }
+    if (est.size() < 3)
+        return;
+
+    Vector3d est_mean = Vector3d::Zero(), ref_mean = Vector3d::Zero();
+    for (size_t i = 0; i < est.size(); i++)
+    {
+        est_mean += est[i];
+        ref_mean += ref[i];
+    }
+    est_mean /= est.size();
+    ref_mean /= ref.size();
+    double num = 0, den = 0;
+    for (size_t i = 0; i < est.size(); i++)
+    {
+        num += (ref[i] - ref_mean).squaredNorm();
+        den += (est[i] - est_mean).squaredNorm();
+    }
+    if (den > 1e-12)
+        scale_err = std::fabs(1.0 - std::sqrt(num / den));
+}
+
+static InitResult run(const std::vector<TrackLogRecord> &log, const std::map<double, TrackLogRecord> &gt,
+                      double t_begin, double offset, double max_init_s)
+{
+    InitResult result{offset, false, 0, 0, 0,
+                      std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN()};
+
+    std::unique_ptr<Estimator> estimator(new Estimator());
+    estimator->setParameter();
+
+    // start on a frame so the first IMU interval belongs to it
+    size_t i = 0;
+    while (i < log.size() && !(log[i].type == TrackLogRecord::FRAME && log[i].t >= t_begin + offset))
+        i++;
+    if (i == log.size())
+        return result;
+    double t_start = log[i].t;
+    bool first = true;
+
+    double wall_ms = 0;
+    for (; i < log.size(); i++)
+    {
+        const TrackLogRecord &r = log[i];
+        if (r.t - t_start > max_init_s)
+            break;
+        if (r.type == TrackLogRecord::IMU)
+        {
+            if (first)
+                continue;
+            TicToc t_imu;
+            estimator->processIMU(r.dt, r.acc, r.gyr);
+            wall_ms += t_imu.toc();
+        }
+        else if (r.type == TrackLogRecord::FRAME)
+        {
+            first = false;
+            std_msgs::Header header;
+            header.stamp = ros::Time(r.t);
+            header.frame_id = "world";
+            TicToc t_frame;
+            bool initialized = estimator->addFrame(r.points, r.lines, header);
+            wall_ms += t_frame.toc();
+            if (initialized)
+            {
+                result.success = true;
+                result.data_time = r.t - t_start;
+                evaluate(*estimator, gt, result.scale_err, result.grav_err);
+                break;
+            }
+            // still INITIAL, so this only grows or slides the window
+            estimator->processFrame(false, header);
+        }
+    }
+    result.wall_ms = wall_ms;
+    result.attempts = estimator->init_attempts;
+    return result;
+}
+
+static double mean(const std::vector<double> &v)
+{
+    double sum = 0;
+    int n = 0;
+    for (double x : v)
+        if (!std::isnan(x))
+        {
+            sum += x;
+            n++;
+        }
+    return n ? sum / n : std::numeric_limits<double>::quiet_NaN();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: %s <config.yaml> <tracks.log> [offset_step_s] [num_offsets] [max_init_s]\n", argv[0]);
+        return 1;
+    }
+    double offset_step = argc > 3 ? atof(argv[3]) : 1.0;
+    int num_offsets = argc > 4 ? atoi(argv[4]) : 20;
+    double max_init_s = argc > 5 ? atof(argv[5]) : 10.0;
+
+    readParameters(std::string(argv[1]));
+
+    TrackLogReader reader;
+    if (!reader.open(argv[2]))
+    {
+        printf("cannot open %s\n", argv[2]);
+        return 1;
+    }
+    std::vector<TrackLogRecord> log;
+    std::map<double, TrackLogRecord> gt;
+    TrackLogRecord record;
+    while (reader.next(record))
+    {
+        if (record.type == TrackLogRecord::GT)
+            gt[record.t] = record;
+        else
+            log.push_back(record);
+    }
+    if (log.empty())
+    {
+        printf("no records in %s\n", argv[2]);
+        return 1;
+    }
+    printf("%zu records, %zu ground truth poses, %.1f s\n", log.size(), gt.size(), log.back().t - log.front().t);
+
+    std::vector<InitResult> results;
+    printf("%8s %8s %10s %10s %9s %10s %10s\n", "offset", "success", "data s", "wall ms", "attempts", "scale err", "grav deg");
+    for (int k = 0; k < num_offsets; k++)
+    {
+        InitResult r = run(log, gt, log.front().t, k * offset_step, max_init_s);
+        printf("%8.2f %8d %10.2f %10.2f %9d %10.4f %10.3f\n", r.offset, (int)r.success, r.data_time, r.wall_ms,
+               r.attempts, r.scale_err, r.grav_err);
+        results.push_back(r);
+    }
+
+    std::vector<double> wall, data_time, scale_err, grav_err;
+    for (const InitResult &r : results)
+    {
+        if (!r.success)
+            continue;
+        wall.push_back(r.wall_ms);
+        data_time.push_back(r.data_time);
+        scale_err.push_back(r.scale_err);
+        grav_err.push_back(r.grav_err);
+    }
+    double median_wall = std::numeric_limits<double>::quiet_NaN();
+    if (!wall.empty())
+    {
+        std::vector<double> sorted = wall;
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        median_wall = sorted[sorted.size() / 2];
+    }
+    printf("success %zu/%zu, data %.2f s, wall mean %.2f ms median %.2f ms, scale err %.4f, gravity err %.3f deg\n",
+           wall.size(), results.size(), mean(data_time), mean(wall), median_wall, mean(scale_err), mean(grav_err));
+    return 0;
+}
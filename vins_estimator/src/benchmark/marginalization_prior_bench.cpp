@@ -0,0 +1,164 @@
+// Per-iteration cost of MarginalizationFactor::Evaluate against the prior
+// dimension. The prior is synthetic: a window of poses/speed-biases plus a
+// growing number of kept line (4) and point (1) blocks. The old dense
+// evaluation is kept here as the reference it is compared against.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../factor/marginalization_factor.h"
+#include "../utility/tic_toc.h"
+
+static void evaluateDense(const MarginalizationInfo &info, const Eigen::MatrixXd &J, const Eigen::VectorXd &r0,
+                          double const *const *parameters, double *residuals, double **jacobians)
+{
+    int n = info.n;
+    Eigen::VectorXd dx(n);
+    for (int i = 0; i < static_cast<int>(info.keep_block_size.size()); i++)
+    {
+        int size = info.keep_block_size[i];
+        int idx = info.keep_block_idx[i] - info.m;
+        Eigen::VectorXd x = Eigen::Map<const Eigen::VectorXd>(parameters[i], size);
+        Eigen::VectorXd x0 = Eigen::Map<const Eigen::VectorXd>(info.keep_block_data[i], size);
+        if (size != 7)
+            dx.segment(idx, size) = x - x0;
+        else
+        {
+            Eigen::Quaterniond dq = Eigen::Quaterniond(x0(6), x0(3), x0(4), x0(5)).inverse() * Eigen::Quaterniond(x(6), x(3), x(4), x(5));
+            dx.segment<3>(idx + 0) = x.head<3>() - x0.head<3>();
+            dx.segment<3>(idx + 3) = dq.w() >= 0 ? 2.0 * dq.vec() : -2.0 * dq.vec();
+        }
+    }
+    Eigen::Map<Eigen::VectorXd>(residuals, n) = r0 + J * dx;
+    for (int i = 0; i < static_cast<int>(info.keep_block_size.size()); i++)
+    {
+        int size = info.keep_block_size[i], local_size = info.localSize(size);
+        int idx = info.keep_block_idx[i] - info.m;
+        Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobian(jacobians[i], n, size);
+        jacobian.setZero();
+        jacobian.leftCols(local_size) = J.middleCols(idx, local_size);
+    }
+}
+
+static Eigen::Quaterniond randomRotation()
+{
+    return Eigen::Quaterniond(Eigen::Vector4d::Random()).normalized();
+}
+
+static void run(int window, int num_lines, int num_points, int iterations)
+{
+    MarginalizationInfo info;
+    std::vector<std::vector<double>> x0, x;
+
+    auto add_block = [&](int size) {
+        Eigen::VectorXd v = Eigen::VectorXd::Random(size);
+        x0.emplace_back(v.data(), v.data() + size);
+        if (size == 7)
+        {
+            Eigen::Quaterniond q = randomRotation();
+            x0.back()[3] = q.x(); x0.back()[4] = q.y(); x0.back()[5] = q.z(); x0.back()[6] = q.w();
+        }
+        x.push_back(x0.back());
+        for (int k = 0; k < size; k++)
+            x.back()[k] += 1e-2 * (rand() / (double)RAND_MAX - 0.5);
+        if (size == 7)
+        {
+            Eigen::Quaterniond q = Eigen::Quaterniond(x.back()[6], x.back()[3], x.back()[4], x.back()[5]).normalized();
+            x.back()[3] = q.x(); x.back()[4] = q.y(); x.back()[5] = q.z(); x.back()[6] = q.w();
+        }
+        info.keep_block_size.push_back(size);
+    };
+    for (int i = 0; i < window; i++)
+    {
+        add_block(7);
+        add_block(9);
+    }
+    for (int i = 0; i < num_lines; i++)
+        add_block(4);
+    for (int i = 0; i < num_points; i++)
+        add_block(1);
+
+    // scatter the blocks over the prior the way the unordered_map order does
+    std::vector<int> order(info.keep_block_size.size());
+    for (int i = 0; i < (int)order.size(); i++)
+        order[i] = i;
+    std::random_shuffle(order.begin(), order.end());
+    info.m = 0;
+    info.keep_block_idx.resize(order.size());
+    int n = 0;
+    for (int i : order)
+    {
+        info.keep_block_idx[i] = n;
+        n += info.localSize(info.keep_block_size[i]);
+    }
+    info.n = n;
+    for (auto &it : x0)
+        info.keep_block_data.push_back(it.data());
+
+    // rank deficient square-root information, as produced by marginalize()
+    Eigen::MatrixXd H = Eigen::MatrixXd::Random(n, n);
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> saes(H * H.transpose());
+    Eigen::VectorXd S = saes.eigenvalues();
+    S.head(std::min(n / 10, 6)).setZero();
+    info.linearized_jacobians = S.cwiseSqrt().asDiagonal() * saes.eigenvectors().transpose();
+    info.linearized_residuals = Eigen::VectorXd::Random(n);
+    info.linearized_residuals.head(std::min(n / 10, 6)).setZero();
+    Eigen::MatrixXd J = info.linearized_jacobians;
+    Eigen::VectorXd r0 = info.linearized_residuals;
+
+    info.compactPrior();
+    MarginalizationFactor factor(&info);
+
+    std::vector<double *> parameters;
+    std::vector<std::vector<double>> jac_dense, jac_compact;
+    std::vector<double *> jac_dense_ptr, jac_compact_ptr;
+    for (int i = 0; i < (int)x.size(); i++)
+    {
+        parameters.push_back(x[i].data());
+        jac_dense.emplace_back(n * info.keep_block_size[i]);
+        jac_compact.emplace_back(info.prior_rows * info.keep_block_size[i]);
+    }
+    for (int i = 0; i < (int)x.size(); i++)
+    {
+        jac_dense_ptr.push_back(jac_dense[i].data());
+        jac_compact_ptr.push_back(jac_compact[i].data());
+    }
+    std::vector<double> res_dense(n), res_compact(info.prior_rows);
+
+    TicToc t_dense;
+    for (int it = 0; it < iterations; it++)
+        evaluateDense(info, J, r0, parameters.data(), res_dense.data(), jac_dense_ptr.data());
+    double dense_ms = t_dense.toc() / iterations;
+
+    TicToc t_compact;
+    for (int it = 0; it < iterations; it++)
+        factor.Evaluate(parameters.data(), res_compact.data(), jac_compact_ptr.data());
+    double compact_ms = t_compact.toc() / iterations;
+
+    // same cost and gradient: J^T r is invariant to dropping the zero rows
+    Eigen::Map<Eigen::VectorXd> rd(res_dense.data(), n), rc(res_compact.data(), info.prior_rows);
+    double cost_err = std::abs(rd.squaredNorm() - rc.squaredNorm());
+    double grad_err = 0;
+    for (int i = 0; i < (int)x.size(); i++)
+    {
+        int size = info.keep_block_size[i];
+        Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jd(jac_dense[i].data(), n, size);
+        Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jc(jac_compact[i].data(), info.prior_rows, size);
+        grad_err = std::max(grad_err, (jd.transpose() * rd - jc.transpose() * rc).cwiseAbs().maxCoeff());
+    }
+
+    printf("%6d %6d %10.4f %10.4f %8.2fx %10.2e %10.2e\n", n, info.prior_rows, dense_ms, compact_ms,
+           dense_ms / compact_ms, cost_err, grad_err);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    srand(0);
+    printf("%6s %6s %10s %10s %9s %10s %10s\n", "dim", "rows", "dense ms", "compact ms", "speedup", "cost err", "grad err");
+    const int kept[][2] = {{0, 0}, {10, 20}, {30, 60}, {60, 120}, {100, 200}, {150, 300}};
+    for (auto &k : kept)
+        run(10, k[0], k[1], iterations);
+    return 0;
+}
@@ -0,0 +1,543 @@
+// Offline replay of the feature tracker, the estimator and, with loop_closure,
+// the pose graph on an ASL folder (EuRoC, TUM-VI: mav0/cam0, mav0/imu0 and the
+// ground truth), in process and without a ROS master. Every image is tracked
+// and estimated as fast as it can be, in the order the nodes would see it, on
+// one thread; keyframes go to the pose graph and its 4DoF optimization runs
+// right after a loop is found. The solver time limit is lifted (unless
+// keep_solver_time is 1) so that two runs of the same build produce the same
+// trajectory, whose digest is printed for bisecting.
+//
+// Reports the per-stage times of the nodes (the trace.h spans), frames per
+// second of tracking + estimation, peak RSS, and ATE / RPE of the body
+// trajectory, and of the loop closed keyframe trajectory, against
+// state_groundtruth_estimate0, mocap0 or a TUM format groundtruth.txt in the
+// sequence folder. With enable_depth the depth images are read from
+// mav0/depth0. Built with -DCOUNT_ALLOCATIONS=ON it also reports the heap
+// allocations per optimization() call.
+//
+//   uvslam_bench <config.yaml> <sequence_dir> [max_frames] [trajectory.txt] [keep_solver_time]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "../estimator.h"
+#include "../parameters.h"
+#include "../utility/alloc_counter.h"
+#include "../utility/tic_toc.h"
+#include <uvslam/trace.h>
+#include "../../../feature_tracker/src/benchmark/frontend_replay.h"
+#include "../../../pose_graph/src/benchmark/pose_graph_replay.h"
+
+// relative pose error over this much sequence time
+static const double RPE_DELTA = 1.0;
+
+struct StampedFile
+{
+    double t;
+    std::string path;
+};
+
+struct ImuSample
+{
+    double t;
+    Vector3d acc, gyr;
+};
+
+struct Pose
+{
+    Vector3d p;
+    Quaterniond q;
+};
+
+static bool exists(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+// rows of an ASL data.csv, timestamps in ns, '#' comments
+static std::vector<std::vector<std::string>> readCsv(const std::string &path)
+{
+    std::vector<std::vector<std::string>> rows;
+    std::ifstream fin(path);
+    std::string line;
+    while (std::getline(fin, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::vector<std::string> row;
+        std::stringstream ss(line);
+        std::string cell;
+        while (std::getline(ss, cell, ','))
+            row.push_back(cell);
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+static std::vector<StampedFile> readImageList(const std::string &dir)
+{
+    std::vector<StampedFile> files;
+    for (auto &row : readCsv(dir + "/data.csv"))
+        if (row.size() >= 2)
+            files.push_back({std::stod(row[0]) * 1e-9, dir + "/data/" + row[1]});
+    return files;
+}
+
+// state_groundtruth_estimate0 / mocap0 (ns, p, q wxyz), else a TUM format
+// groundtruth.txt (s, p, q xyzw)
+static std::map<double, Pose> readGroundTruth(const std::string &root, const std::string &sequence)
+{
+    std::map<double, Pose> gt;
+    for (const char *dir : {"/state_groundtruth_estimate0", "/mocap0"})
+    {
+        for (auto &row : readCsv(root + dir + "/data.csv"))
+            if (row.size() >= 8)
+                gt[std::stod(row[0]) * 1e-9] = {Vector3d(std::stod(row[1]), std::stod(row[2]), std::stod(row[3])),
+                                                Quaterniond(std::stod(row[4]), std::stod(row[5]), std::stod(row[6]), std::stod(row[7]))};
+        if (!gt.empty())
+            return gt;
+    }
+    std::ifstream fin(sequence + "/groundtruth.txt");
+    std::string line;
+    while (std::getline(fin, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        double t, px, py, pz, qx, qy, qz, qw;
+        if (sscanf(line.c_str(), "%lf %lf %lf %lf %lf %lf %lf %lf", &t, &px, &py, &pz, &qx, &qy, &qz, &qw) == 8)
+            gt[t] = {Vector3d(px, py, pz), Quaterniond(qw, qx, qy, qz)};
+    }
+    return gt;
+}
+
+// nearest ground-truth pose within 20 ms of t
+static bool lookupGT(const std::map<double, Pose> &gt, double t, Pose &out)
+{
+    auto it = gt.lower_bound(t);
+    double best = 0.02;
+    bool found = false;
+    if (it != gt.end() && it->first - t <= best)
+    {
+        best = it->first - t;
+        out = it->second;
+        found = true;
+    }
+    if (it != gt.begin() && t - std::prev(it)->first <= best)
+    {
+        out = std::prev(it)->second;
+        found = true;
+    }
+    return found;
+}
+
+// RMSE of the positions after the rigid alignment of est onto ref (Umeyama,
+// no scale: the estimate is metric)
+static double absoluteTrajectoryError(const std::vector<Vector3d> &est, const std::vector<Vector3d> &ref)
+{
+    Vector3d est_mean = Vector3d::Zero(), ref_mean = Vector3d::Zero();
+    for (size_t i = 0; i < est.size(); i++)
+    {
+        est_mean += est[i];
+        ref_mean += ref[i];
+    }
+    est_mean /= est.size();
+    ref_mean /= ref.size();
+    Matrix3d W = Matrix3d::Zero();
+    for (size_t i = 0; i < est.size(); i++)
+        W += (ref[i] - ref_mean) * (est[i] - est_mean).transpose();
+    Eigen::JacobiSVD<Matrix3d> svd(W, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Matrix3d S = Matrix3d::Identity();
+    if ((svd.matrixU() * svd.matrixV().transpose()).determinant() < 0)
+        S(2, 2) = -1;
+    Matrix3d R = svd.matrixU() * S * svd.matrixV().transpose();
+    double sum = 0;
+    for (size_t i = 0; i < est.size(); i++)
+        sum += (R * (est[i] - est_mean) + ref_mean - ref[i]).squaredNorm();
+    return std::sqrt(sum / est.size());
+}
+
+// RMSE of the translation (m) and rotation (deg) of the relative motion
+// over RPE_DELTA against the ground truth's
+static void relativePoseError(const std::vector<double> &t, const std::vector<Pose> &est, const std::vector<Pose> &ref,
+                              double &rpe_t, double &rpe_r)
+{
+    double sum_t = 0, sum_r = 0;
+    int n = 0;
+    size_t j = 0;
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        while (j < t.size() && t[j] < t[i] + RPE_DELTA)
+            j++;
+        if (j == t.size())
+            break;
+        Quaterniond dq_est = est[i].q.inverse() * est[j].q, dq_ref = ref[i].q.inverse() * ref[j].q;
+        Vector3d dp_est = est[i].q.inverse() * (est[j].p - est[i].p), dp_ref = ref[i].q.inverse() * (ref[j].p - ref[i].p);
+        Quaterniond dq_err = dq_ref.inverse() * dq_est;
+        Vector3d dp_err = dq_ref.inverse() * (dp_est - dp_ref);
+        sum_t += dp_err.squaredNorm();
+        double angle = 2.0 * std::atan2(dq_err.vec().norm(), std::fabs(dq_err.w())) * 180.0 / M_PI;
+        sum_r += angle * angle;
+        n++;
+    }
+    rpe_t = n ? std::sqrt(sum_t / n) : std::numeric_limits<double>::quiet_NaN();
+    rpe_r = n ? std::sqrt(sum_r / n) : std::numeric_limits<double>::quiet_NaN();
+}
+
+// ATE / RPE of the poses that have a ground truth pose
+static void printAccuracy(const char *prefix, const std::vector<double> &t, const std::vector<Pose> &est,
+                          const std::map<double, Pose> &gt)
+{
+    std::vector<double> t_matched;
+    std::vector<Pose> est_matched, gt_matched;
+    std::vector<Vector3d> p_est, p_gt;
+    for (size_t i = 0; i < est.size(); i++)
+    {
+        Pose ref;
+        if (!lookupGT(gt, t[i], ref))
+            continue;
+        t_matched.push_back(t[i]);
+        est_matched.push_back(est[i]);
+        gt_matched.push_back(ref);
+        p_est.push_back(est[i].p);
+        p_gt.push_back(ref.p);
+    }
+    if (p_est.size() > 2)
+    {
+        double rpe_t, rpe_r;
+        relativePoseError(t_matched, est_matched, gt_matched, rpe_t, rpe_r);
+        printf("%sATE %.4f m over %zu poses, RPE (%.1f s) %.4f m %.3f deg\n", prefix,
+               absoluteTrajectoryError(p_est, p_gt), p_est.size(), RPE_DELTA, rpe_t, rpe_r);
+    }
+    else
+        printf("no ground truth for the %sposes\n", prefix);
+}
+
+// what pubKeyframe() publishes to the pose graph: the pose of the second
+// newest frame and the solved points it sees
+static void keyFrame(const Estimator &estimator, ReplayKeyFrame &kf)
+{
+    const int i = WINDOW_SIZE - 2;
+    kf.t = estimator.Headers[i].stamp.toSec();
+    kf.P = estimator.Ps[i];
+    kf.R = estimator.Rs[i];
+    kf.points.clear();
+    for (auto &it_per_id : estimator.f_manager.feature)
+    {
+        int frame_size = it_per_id.feature_per_frame.size();
+        if (it_per_id.startFrame() < i && it_per_id.startFrame() + frame_size - 1 >= i && it_per_id.solve_flag == 1)
+        {
+            int imu_i = it_per_id.startFrame();
+            Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
+            Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0]) + estimator.Ps[imu_i];
+            const FeaturePerFrame &obs = it_per_id.feature_per_frame[i - imu_i];
+            kf.points.push_back({w_pts_i.x(), w_pts_i.y(), w_pts_i.z(), obs.point.x(), obs.point.y(), obs.uv.x(),
+                                 obs.uv.y(), (double)it_per_id.feature_id});
+        }
+    }
+}
+
+// FNV-1a over the raw bytes, equal for bit-identical trajectories
+static void digest(uint64_t &h, const double *v, int n)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(v);
+    for (size_t i = 0; i < n * sizeof(double); i++)
+    {
+        h ^= bytes[i];
+        h *= 1099511628211ull;
+    }
+}
+
+static void printStages(const char *node, const std::vector<ReplayStage> &stages, int frames)
+{
+    for (const ReplayStage &s : stages)
+        printf("%-16s %-16s %8zu %10.1f %9.3f %9.3f %9.3f %9.3f %9.3f\n", node, s.name.c_str(), s.count, s.total,
+               s.total / std::max(frames, 1), s.p50, s.p90, s.p99, s.max);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: %s <config.yaml> <sequence_dir> [max_frames] [trajectory.txt] [keep_solver_time]\n", argv[0]);
+        return 1;
+    }
+    std::string sequence = argv[2];
+    int max_frames = argc > 3 ? atoi(argv[3]) : 0;
+    std::string trajectory_path = argc > 4 ? argv[4] : "";
+    bool keep_solver_time = argc > 5 && atoi(argv[5]);
+
+    FrontEndReplay frontend(argv[1], "");
+    PoseGraphReplay posegraph(argv[1], SUPPORT_FILES_DIR);
+    readParameters(std::string(argv[1]));
+    if (!keep_solver_time)
+        SOLVER_TIME = 1e6;
+    Tracer::instance().enable("vins_estimator", "", 1 << 10);
+
+    std::string root = exists(sequence + "/mav0") ? sequence + "/mav0" : sequence;
+    std::vector<StampedFile> images = readImageList(root + "/cam0"), depths;
+    if (ENABLE_DEPTH)
+        depths = readImageList(root + "/depth0");
+    std::vector<ImuSample> imu;
+    for (auto &row : readCsv(root + "/imu0/data.csv"))
+        if (row.size() >= 7)
+            imu.push_back({std::stod(row[0]) * 1e-9, Vector3d(std::stod(row[4]), std::stod(row[5]), std::stod(row[6])),
+                           Vector3d(std::stod(row[1]), std::stod(row[2]), std::stod(row[3]))});
+    std::map<double, Pose> gt = readGroundTruth(root, sequence);
+    if (images.empty() || imu.empty())
+    {
+        printf("no cam0 images or imu0 samples in %s\n", root.c_str());
+        return 1;
+    }
+    if (ENABLE_DEPTH && depths.size() != images.size())
+    {
+        printf("enable_depth needs one depth0 image per cam0 image (%zu, %zu)\n", depths.size(), images.size());
+        return 1;
+    }
+    if (max_frames > 0 && (int)images.size() > max_frames)
+        images.resize(max_frames);
+    printf("%zu images, %zu imu samples, %zu ground truth poses, solver time limit %s, loop closure %s\n",
+           images.size(), imu.size(), gt.size(), keep_solver_time ? "kept" : "lifted", posegraph.enabled() ? "on" : "off");
+
+    std::unique_ptr<Estimator> estimator(new Estimator());
+    estimator->setParameter();
+
+    ReplayFrame frame;
+    size_t gyro_next = 0, imu_next = 0;
+    double current_time = -1;
+    double frontend_ms = 0, estimator_ms = 0, posegraph_ms = 0;
+    // the raw images of the window, for the keyframes of the pose graph
+    std::map<double, cv::Mat> window_images;
+    ReplayKeyFrame kf;
+    int tracked = 0, estimated = 0;
+    std::vector<double> t_est;
+    std::vector<Pose> est;
+    uint64_t hash = 14695981039346656037ull;
+    TicToc t_wall;
+    for (size_t k = 0; k < images.size(); k++)
+    {
+        double t = images[k].t;
+        cv::Mat raw = cv::imread(images[k].path, cv::IMREAD_UNCHANGED), gray, color, depth;
+        if (raw.empty())
+        {
+            printf("cannot read %s\n", images[k].path.c_str());
+            continue;
+        }
+        if (raw.channels() == 1)
+        {
+            gray = raw;
+            cv::cvtColor(raw, color, cv::COLOR_GRAY2BGR);
+        }
+        else
+        {
+            color = raw;
+            cv::cvtColor(raw, gray, cv::COLOR_BGR2GRAY);
+        }
+        if (ENABLE_DEPTH)
+            depth = cv::imread(depths[k].path, cv::IMREAD_UNCHANGED);
+
+        // the gyro up to the first sample past the image, as it would have
+        // arrived at the node
+        while (gyro_next < imu.size() && (gyro_next == 0 || imu[gyro_next - 1].t <= t))
+        {
+            if (frontend.imuPrior())
+                frontend.addGyro(imu[gyro_next].t, imu[gyro_next].gyr);
+            gyro_next++;
+        }
+
+        TicToc t_frontend;
+        bool publish = frontend.process(gray, color, depth, t, frame);
+        frontend_ms += t_frontend.toc();
+        tracked++;
+        if (frame.restart)
+        {
+            estimator->clearState();
+            estimator->setParameter();
+            current_time = -1;
+            posegraph.newSequence();
+            window_images.clear();
+        }
+        if (!publish)
+            continue;
+
+        // estimator_node's getMeasurements(): images before the IMU are
+        // thrown away, the last one needs a sample past it
+        double img_t = t + estimator->td;
+        if (img_t <= imu.front().t)
+            continue;
+        if (img_t >= imu.back().t)
+            break;
+
+        if (posegraph.enabled())
+            window_images[t] = gray;
+
+        TicToc t_estimator;
+        TraceFrame trace_frame(t);
+        // process(): integrate up to the image, the last sample interpolated
+        for (; imu_next < imu.size(); imu_next++)
+        {
+            const ImuSample &s = imu[imu_next];
+            if (s.t <= img_t)
+            {
+                if (current_time < 0)
+                    current_time = s.t;
+                double dt = s.t - current_time;
+                current_time = s.t;
+                estimator->processIMU(dt, s.acc, s.gyr);
+            }
+            else
+            {
+                const ImuSample &prev = imu[imu_next - 1];
+                if (current_time < 0)
+                    current_time = prev.t;
+                double dt_1 = img_t - current_time;
+                double dt_2 = s.t - img_t;
+                current_time = img_t;
+                double w1 = dt_2 / (dt_1 + dt_2);
+                double w2 = dt_1 / (dt_1 + dt_2);
+                estimator->processIMU(dt_1, w1 * prev.acc + w2 * s.acc, w1 * prev.gyr + w2 * s.gyr);
+                break;
+            }
+        }
+
+        TraceSpan t_ingest("ingest");
+        auto points = make_shared<ImagePoints>();
+        for (auto &p : frame.points)
+        {
+            Eigen::Matrix<double, 7, 1> xyz_uv_velocity;
+            for (int i = 0; i < 7; i++)
+                xyz_uv_velocity(i) = p.second[i];
+            (*points)[p.first / NUM_OF_CAM].emplace_back(p.first % NUM_OF_CAM, xyz_uv_velocity);
+        }
+        auto lines = make_shared<ImageLines>();
+        for (auto &l : frame.lines)
+        {
+            Eigen::Matrix<double, 15, 1> line_uv_velocity;
+            for (int i = 0; i < 15; i++)
+                line_uv_velocity(i) = l.second[i];
+            (*lines)[l.first].emplace_back(line_uv_velocity);
+        }
+        t_ingest.stop();
+
+        std_msgs::Header header;
+        header.stamp = ros::Time(t);
+        header.frame_id = "world";
+        if (ENABLE_DEPTH)
+            estimator->processImage(points, lines, header, frame.image, frame.depth);
+        else
+        {
+            geometry_msgs::TransformStamped gt_msg;
+            Pose pose{Vector3d::Zero(), Quaterniond::Identity()};
+            lookupGT(gt, t, pose);
+            gt_msg.transform.translation.x = pose.p.x();
+            gt_msg.transform.translation.y = pose.p.y();
+            gt_msg.transform.translation.z = pose.p.z();
+            gt_msg.transform.rotation.w = pose.q.w();
+            gt_msg.transform.rotation.x = pose.q.x();
+            gt_msg.transform.rotation.y = pose.q.y();
+            gt_msg.transform.rotation.z = pose.q.z();
+            estimator->processImage(points, lines, header, frame.image, gt_msg);
+        }
+        estimator_ms += t_estimator.toc();
+        estimated++;
+        Tracer::instance().drain();
+
+        if (posegraph.enabled() && estimator->solver_flag == Estimator::SolverFlag::NON_LINEAR &&
+            estimator->marginalization_flag == Estimator::MarginalizationFlag::MARGIN_OLD)
+        {
+            keyFrame(*estimator, kf);
+            // the header stamp went through ros::Time, within a nanosecond of t
+            auto image = window_images.lower_bound(kf.t - 1e-6);
+            if (image != window_images.end() && image->first - kf.t < 1e-6)
+            {
+                TicToc t_posegraph;
+                posegraph.addKeyFrame(kf, image->second, estimator->tic[0], estimator->ric[0]);
+                posegraph_ms += t_posegraph.toc();
+            }
+        }
+        if (posegraph.enabled())
+            window_images.erase(window_images.begin(), window_images.lower_bound(estimator->Headers[0].stamp.toSec()));
+
+        if (estimator->solver_flag == Estimator::SolverFlag::NON_LINEAR)
+        {
+            Pose pose{estimator->Ps[WINDOW_SIZE], Quaterniond(estimator->Rs[WINDOW_SIZE])};
+            double v[8] = {t, pose.p.x(), pose.p.y(), pose.p.z(), pose.q.w(), pose.q.x(), pose.q.y(), pose.q.z()};
+            digest(hash, v, 8);
+            t_est.push_back(t);
+            est.push_back(pose);
+        }
+    }
+    double wall_ms = t_wall.toc();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("\n%d images tracked, %d estimated, %zu poses; wall %.1f s (with image decoding)\n", tracked, estimated,
+           est.size(), wall_ms * 1e-3);
+    printf("front end %.2f ms / image, estimator %.2f ms / frame, %.1f frames per second, peak RSS %.1f MB\n",
+           frontend_ms / std::max(tracked, 1), estimator_ms / std::max(estimated, 1),
+           estimated / std::max((frontend_ms + estimator_ms) * 1e-3, 1e-9), usage.ru_maxrss / 1024.0);
+    if (AllocCounter::enabled())
+        printf("heap allocations per optimization() over %d calls: %.0f (problem + solve %.0f, marginalization %.0f)\n",
+               estimator->alloc_calls,
+               (estimator->alloc_problem + estimator->alloc_marginalization) / (double)std::max(estimator->alloc_calls, 1),
+               estimator->alloc_problem / (double)std::max(estimator->alloc_calls, 1),
+               estimator->alloc_marginalization / (double)std::max(estimator->alloc_calls, 1));
+    if (posegraph.enabled())
+        printf("pose graph %.2f ms / keyframe over %d keyframes, %d loop optimizations\n",
+               posegraph_ms / std::max(posegraph.keyFrames(), 1), posegraph.keyFrames(), posegraph.optimizations());
+
+    printf("\n%-16s %-16s %8s %10s %9s %9s %9s %9s %9s\n", "node", "stage", "count", "total ms", "ms/frame", "p50",
+           "p90", "p99", "max");
+    printStages("feature_tracker", frontend.stages(), tracked);
+    std::vector<ReplayStage> stages;
+    for (const Tracer::Stats &s : Tracer::instance().percentiles())
+        stages.push_back({s.name, s.count, s.total, s.p50, s.p90, s.p99, s.max});
+    printStages("vins_estimator", stages, estimated);
+    if (posegraph.enabled())
+        printStages("pose_graph", posegraph.stages(), posegraph.keyFrames());
+
+    printf("\n");
+    printAccuracy("", t_est, est, gt);
+    if (posegraph.enabled())
+    {
+        std::vector<double> t_loop;
+        std::vector<Pose> loop;
+        for (const ReplayPose &p : posegraph.trajectory())
+        {
+            t_loop.push_back(p.t);
+            loop.push_back({p.P, p.Q});
+        }
+        printAccuracy("loop closed ", t_loop, loop, gt);
+    }
+    printf("trajectory digest %016llx\n", (unsigned long long)hash);
+
+    if (!trajectory_path.empty())
+    {
+        // TUM format, body in world
+        FILE *f = fopen(trajectory_path.c_str(), "w");
+        if (!f)
+        {
+            printf("cannot write %s\n", trajectory_path.c_str());
+            return 1;
+        }
+        for (size_t i = 0; i < est.size(); i++)
+            fprintf(f, "%.9f %.6f %.6f %.6f %.9f %.9f %.9f %.9f\n", t_est[i], est[i].p.x(), est[i].p.y(), est[i].p.z(),
+                    est[i].q.x(), est[i].q.y(), est[i].q.z(), est[i].q.w());
+        fclose(f);
+    }
+    return 0;
+}
@@ -1,13 +1,42 @@
 #include "estimator.h"
 
-Estimator::Estimator(): f_manager{Rs}
+#include <functional>
+#include <limits>
+
+Estimator::Estimator()
+    : Ps(WINDOW_SIZE + 1), Vs(WINDOW_SIZE + 1), Rs(WINDOW_SIZE + 1), Bas(WINDOW_SIZE + 1), Bgs(WINDOW_SIZE + 1),
+      Headers(WINDOW_SIZE + 1), pre_integrations(WINDOW_SIZE + 1),
+      dt_buf(WINDOW_SIZE + 1), linear_acceleration_buf(WINDOW_SIZE + 1), angular_velocity_buf(WINDOW_SIZE + 1),
+      f_manager{Rs}
 {
     ROS_INFO("init begins");
+    loss_function = new ceres::CauchyLoss(1.0);
+    line_loss_function = new ceres::CauchyLoss(0.1);
+#ifdef UNIT_SPHERE_LOSS
+    vp_loss_function = new ceres::ArctanLoss(0.1);
+#else
+    vp_loss_function = new ceres::CauchyLoss(0.1);
+#endif
+    pose_local_parameterization = new PoseLocalParameterization();
+    last_marginalization_factor = nullptr;
+    alloc_calls = 0;
+    alloc_problem = alloc_marginalization = 0;
     clearState();
+    resizeWindow();
+}
+
+Estimator::~Estimator()
+{
+    delete last_marginalization_factor;
+    delete loss_function;
+    delete line_loss_function;
+    delete vp_loss_function;
+    delete pose_local_parameterization;
 }
 
 void Estimator::setParameter()
 {
+    resizeWindow();
     for (int i = 0; i < NUM_OF_CAM; i++)
     {
         tic[i] = TIC[i];
@@ -17,6 +46,66 @@ void Estimator::setParameter()
     ProjectionFactor::sqrt_info = FOCAL_LENGTH / 1.6 * Matrix2d::Identity(); //0.003; //0.005;  //1.0; 0.003;
     ProjectionTdFactor::sqrt_info = FOCAL_LENGTH / 1.6 * Matrix2d::Identity(); //0.003; //0.005; //1.0; 0.003;
     td = TD;
+    budget = {0, 1.0, 1.0, true, NUM_ITERATIONS, SOLVER_TIME, 0};
+    solver_cost = 0;
+}
+
+// residual selection scores, see pointScore() and lineScore()
+static const double SELECTION_PARALLAX = 10.0;    // px of track parallax that tell all about a point
+static const double SELECTION_DEPTH = 5.0;        // m, points within are fully trusted in depth
+static const double SELECTION_LINE_LENGTH = 100.0; // px
+
+// Flags the longest fraction of the tracks, ties going to the older landmark.
+static void keepLongestTracks(const vector<int> &lengths, double fraction, vector<int> &sorted, vector<uchar> &keep)
+{
+    int n = lengths.size();
+    int k = min(n, (int)ceil(fraction * n));
+    keep.assign(n, 1);
+    if (k == n)
+        return;
+    sorted = lengths;
+    nth_element(sorted.begin(), sorted.begin() + max(k - 1, 0), sorted.end(), greater<int>());
+    int shortest = k > 0 ? sorted[k - 1] : numeric_limits<int>::max();
+    int ties = k;
+    for (int length : lengths)
+        ties -= length > shortest;
+    for (int i = 0; i < n; i++)
+        keep[i] = lengths[i] > shortest || (lengths[i] == shortest && ties-- > 0);
+}
+
+// match the window buffers and parameter arenas to WINDOW_SIZE, NUM_OF_F and NUM_OF_LF
+void Estimator::resizeWindow()
+{
+    bool window_changed = Ps.size() != WINDOW_SIZE + 1;
+    if (window_changed)
+    {
+        // releases the pre-integrations and the prior while the buffers still have their old size
+        clearState();
+        Ps.resize(WINDOW_SIZE + 1);
+        Vs.resize(WINDOW_SIZE + 1);
+        Rs.resize(WINDOW_SIZE + 1);
+        Bas.resize(WINDOW_SIZE + 1);
+        Bgs.resize(WINDOW_SIZE + 1);
+        Headers.resize(WINDOW_SIZE + 1);
+        pre_integrations.resize(WINDOW_SIZE + 1);
+        dt_buf.resize(WINDOW_SIZE + 1);
+        linear_acceleration_buf.resize(WINDOW_SIZE + 1);
+        angular_velocity_buf.resize(WINDOW_SIZE + 1);
+    }
+    if (para_Pose.size() != WINDOW_SIZE + 1)
+    {
+        para_Pose.resize(WINDOW_SIZE + 1);
+        para_SpeedBias.resize(WINDOW_SIZE + 1);
+    }
+    if (para_Feature.size() != NUM_OF_F)
+    {
+        para_Feature.resize(NUM_OF_F);
+        para_Depth.resize(NUM_OF_F);
+    }
+    if (para_Ortho_plucker.size() != NUM_OF_LF)
+        para_Ortho_plucker.resize(NUM_OF_LF);
+    if (window_changed)
+        clearState();
 }
 
 void Estimator::clearState()
@@ -24,8 +113,11 @@ void Estimator::clearState()
 
     cdt_lines_vis.clear();
     cdt_points.clear();
+    point_selector.reset();
+    line_selector.reset();
 
-    for (int i = 0; i < WINDOW_SIZE + 1; i++)
+    // the buffers, not WINDOW_SIZE: resizeWindow() clears them before they follow a new window size
+    for (int i = 0; i < (int)Ps.size(); i++)
     {
         Rs[i].setIdentity();
         Ps[i].setZero();
@@ -63,6 +155,10 @@ void Estimator::clearState()
     frame_count = 0;
     solver_flag = INITIAL;
     initial_timestamp = 0;
+    init_first_stamp = -1;
+    init_attempts = 0;
+    init_cost = 0;
+    sfm_cache.clear();
     all_image_frame.clear();
     td = TD;
 
@@ -71,9 +167,12 @@ void Estimator::clearState()
         delete tmp_pre_integration;
     if (last_marginalization_info != nullptr)
         delete last_marginalization_info;
+    if (last_marginalization_factor != nullptr)
+        delete last_marginalization_factor;
 
     tmp_pre_integration = nullptr;
     last_marginalization_info = nullptr;
+    last_marginalization_factor = nullptr;
     last_marginalization_parameter_blocks.clear();
 
     f_manager.clearState();
@@ -121,23 +220,24 @@ void Estimator::processIMU(double dt, const Vector3d &linear_acceleration, const
     gyr_0 = angular_velocity;
 }
 
-// with depth
-void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image,
-                             const map<int, vector<Eigen::Matrix<double, 15, 1>>> &image_line,
-                             const std_msgs::Header &header,
-                             const Mat latest_image,
-                             const Mat latest_depth_input)
+// Window bookkeeping shared by both processImage() variants. While
+// INITIAL it also attempts initialization once the window is full, and
+// returns true when that attempt succeeded; the caller then starts the
+// odometry. Needs no images, so the offline tools drive it directly.
+bool Estimator::addFrame(const shared_ptr<const ImagePoints> &image,
+                         const shared_ptr<const ImageLines> &image_line,
+                         const std_msgs::Header &header)
 {
-    latest_img = latest_image.clone();
-    latest_depth = latest_depth_input.clone();
     ROS_DEBUG("new image coming ------------------------------------------");
-    ROS_DEBUG("Adding feature points %lu", image.size());
-    if (f_manager.addFeatureCheckParallax(frame_count, image, image_line, td)){
+    ROS_DEBUG("Adding feature points %lu", image->size());
+    TraceSpan t_features("features");
+    if (f_manager.addFeatureCheckParallax(frame_count, *image, *image_line, td)){
         marginalization_flag = MARGIN_OLD;
 
     }
     else
         marginalization_flag = MARGIN_SECOND_NEW;
+    t_features.stop();
 
 
 
@@ -146,8 +246,12 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     ROS_DEBUG("Solving %d", frame_count);
     ROS_DEBUG("number of feature: %d", f_manager.getFeatureCount());
     Headers[frame_count] = header;
+    if (solver_flag == INITIAL && init_first_stamp < 0)
+        init_first_stamp = header.stamp.toSec();
 
     ImageFrame imageframe(image, image_line, header.stamp.toSec());
+    if (solver_flag == NON_LINEAR)
+        imageframe.releaseFeatures();
     imageframe.pre_integration = tmp_pre_integration;
     all_image_frame.insert(make_pair(header.stamp.toSec(), imageframe));
     tmp_pre_integration = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]};
@@ -170,19 +274,29 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
         }
     }
 
+    bool result = false;
+    if (solver_flag == INITIAL && frame_count == WINDOW_SIZE)
+    {
+        if( ESTIMATE_EXTRINSIC != 2 && (header.stamp.toSec() - initial_timestamp) > 0.1)
+        {
+            result = initialStructure();
+            initial_timestamp = header.stamp.toSec();
+        }
+    }
+    return result;
+}
+
+void Estimator::processFrame(bool initialized, const std_msgs::Header &header)
+{
     if (solver_flag == INITIAL)
     {
         if (frame_count == WINDOW_SIZE)
         {
-            bool result = false;
-            if( ESTIMATE_EXTRINSIC != 2 && (header.stamp.toSec() - initial_timestamp) > 0.1)
-            {
-                result = initialStructure();
-                initial_timestamp = header.stamp.toSec();
-            }
-            if(result)
+            if(initialized)
             {
                 solver_flag = NON_LINEAR;
+                for (auto &frame : all_image_frame)
+                    frame.second.releaseFeatures();
                 double header_t = double(header.stamp.sec) + double(header.stamp.nsec)*1e-9;
                 solveOdometry(header_t);
                 slideWindow();
@@ -238,38 +352,28 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
     }
 }
 
-
-
-
-
+// with depth
+void Estimator::processImage(const shared_ptr<const ImagePoints> &image,
+                             const shared_ptr<const ImageLines> &image_line,
+                             const std_msgs::Header &header,
+                             const Mat &latest_image,
+                             const Mat &latest_depth_input)
+{
+    // images are never written in place, so the estimator shares the buffers
+    latest_img = latest_image;
+    latest_depth = latest_depth_input;
+    bool initialized = addFrame(image, image_line, header);
+    processFrame(initialized, header);
+}
 
 // without depth
-void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image,
-                             const map<int, vector<Eigen::Matrix<double, 15, 1>>> &image_line,
+void Estimator::processImage(const shared_ptr<const ImagePoints> &image,
+                             const shared_ptr<const ImageLines> &image_line,
                              const std_msgs::Header &header,
-                             const Mat latest_image,
+                             const Mat &latest_image,
                              const geometry_msgs::TransformStamped latestGT_msg)
 {
-    latest_img = latest_image.clone();
-    ROS_DEBUG("new image coming ------------------------------------------");
-    ROS_DEBUG("Adding feature points %lu", image.size());
-    if (f_manager.addFeatureCheckParallax(frame_count, image, image_line, td)){
-        marginalization_flag = MARGIN_OLD;
-
-    }
-    else
-        marginalization_flag = MARGIN_SECOND_NEW;
-
-
-
-    ROS_DEBUG("this frame is--------------------%s", marginalization_flag ? "reject" : "accept");
-    ROS_DEBUG("%s", marginalization_flag ? "Non-keyframe" : "Keyframe");
-    ROS_DEBUG("Solving %d", frame_count);
-    ROS_DEBUG("number of feature: %d", f_manager.getFeatureCount());
-
-
-    // 할당
-    Headers[frame_count] = header;
+    latest_img = latest_image;
 
     q_gt = Quaterniond(latestGT_msg.transform.rotation.w,
                        latestGT_msg.transform.rotation.x,
@@ -281,118 +385,28 @@ void Estimator::processImage(const map<int, vector<pair<int, Eigen::Matrix<doubl
 
 //    cout << "gt t: " << t_gt.transpose() << endl;
 
-    ImageFrame imageframe(image, image_line, header.stamp.toSec());
-    imageframe.pre_integration = tmp_pre_integration;
-    all_image_frame.insert(make_pair(header.stamp.toSec(), imageframe));
-    tmp_pre_integration = new IntegrationBase{acc_0, gyr_0, Bas[frame_count], Bgs[frame_count]};
-
-    if(ESTIMATE_EXTRINSIC == 2)
-    {
-        ROS_INFO("calibrating extrinsic param, rotation movement is needed");
-        if (frame_count != 0)
-        {
-            vector<pair<Vector3d, Vector3d>> corres = f_manager.getCorresponding(frame_count - 1, frame_count);
-            Matrix3d calib_ric;
-            if (initial_ex_rotation.CalibrationExRotation(corres, pre_integrations[frame_count]->delta_q, calib_ric))
-            {
-                ROS_WARN("initial extrinsic rotation calib success");
-                ROS_WARN_STREAM("initial extrinsic rotation: " << endl << calib_ric);
-                ric[0] = calib_ric;
-                RIC[0] = calib_ric;
-                ESTIMATE_EXTRINSIC = 1;
-            }
-        }
-    }
-
-    if (solver_flag == INITIAL)
-    {
-        if (frame_count == WINDOW_SIZE)
-        {
-            bool result = false;
-            if( ESTIMATE_EXTRINSIC != 2 && (header.stamp.toSec() - initial_timestamp) > 0.1)
-            {
-                result = initialStructure();
-                initial_timestamp = header.stamp.toSec();
-            }
-            if(result)
-            {
-                solver_flag = NON_LINEAR;
-                double header_t = double(header.stamp.sec) + double(header.stamp.nsec)*1e-9;
-                solveOdometry(header_t);
-                slideWindow();
-                f_manager.removeFailures();
-                if (!POINT_ONLY)
-                    f_manager.removeLineFailures();
-                ROS_INFO("Initialization finish!");
-                last_R = Rs[WINDOW_SIZE];
-                last_P = Ps[WINDOW_SIZE];
-                last_R0 = Rs[0];
-                last_P0 = Ps[0];
-
-            }
-            else
-                slideWindow();
-        }
-        else
-            frame_count++;
-    }
-    else
-    {
-
-        TicToc t_solve;
-        double header_t = double(header.stamp.sec) + double(header.stamp.nsec)*1e-9;
-        solveOdometry(header_t);
-        ROS_DEBUG("solver costs: %fms", t_solve.toc());
-
-        if (failureDetection())
-        {
-            ROS_WARN("failure detection!");
-            failure_occur = 1;
-            clearState();
-            setParameter();
-            ROS_WARN("system reboot!");
-            return;
-        }
-
-        TicToc t_margin;
-        slideWindow();
-        f_manager.removeFailures();
-        if (!POINT_ONLY)
-            f_manager.removeLineFailures();
-        ROS_DEBUG("marginalization costs: %fms", t_margin.toc());
-        // prepare output of VINS
-        key_poses.clear();
-        for (int i = 0; i <= WINDOW_SIZE; i++)
-            key_poses.push_back(Ps[i]);
-
-        last_R = Rs[WINDOW_SIZE];
-        last_P = Ps[WINDOW_SIZE];
-        last_R0 = Rs[0];
-        last_P0 = Ps[0];
-    }
+    bool initialized = addFrame(image, image_line, header);
+    processFrame(initialized, header);
 }
 
-
-
-
-
-
 bool Estimator::initialStructure()
 {
-    TicToc t_sfm;
+    TicToc t_init;
+    init_attempts++;
+
     //check imu observibility
+    Vector3d aver_g;
+    double var = 0;
     {
         map<double, ImageFrame>::iterator frame_it;
-        Vector3d sum_g;
+        Vector3d sum_g = Vector3d::Zero();
         for (frame_it = all_image_frame.begin(), frame_it++; frame_it != all_image_frame.end(); frame_it++)
         {
             double dt = frame_it->second.pre_integration->sum_dt;
             Vector3d tmp_g = frame_it->second.pre_integration->delta_v / dt;
             sum_g += tmp_g;
         }
-        Vector3d aver_g;
         aver_g = sum_g * 1.0 / ((int)all_image_frame.size() - 1);
-        double var = 0;
         for (frame_it = all_image_frame.begin(), frame_it++; frame_it != all_image_frame.end(); frame_it++)
         {
             double dt = frame_it->second.pre_integration->sum_dt;
@@ -408,41 +422,79 @@ bool Estimator::initialStructure()
             //return false;
         }
     }
+
+    bool result = buildInitialStructure(var < 0.25);
+    if (!result && INIT_IMU_FALLBACK && var < 0.25)
+        result = imuOnlyInitialize(aver_g);
+
+    double cost = t_init.toc();
+    init_cost += cost;
+    ROS_DEBUG("initialization attempt %d costs %fms", init_attempts, cost);
+    if (result)
+    {
+        ROS_INFO("first valid state %.3fs after the first frame, %d attempts, %.1fms spent initializing",
+                 Headers[frame_count].stamp.toSec() - init_first_stamp, init_attempts, init_cost);
+        sfm_cache.clear();
+    }
+    return result;
+}
+
+bool Estimator::buildInitialStructure(bool imu_static)
+{
     // global sfm
     Quaterniond Q[frame_count + 1];
     Vector3d T[frame_count + 1];
     map<int, Vector3d> sfm_tracked_points;
-    vector<SFMFeature> sfm_f;
-    for (auto &it_per_id : f_manager.feature)
+
+    // a retry after a failed alignment usually sees the same window plus a
+    // new frame, so register the new frames against the last structure
+    // instead of redoing the 5-point and bundle adjustment
+    bool from_cache = structureFromCache(Q, T, sfm_tracked_points);
+    if (!from_cache)
     {
-        int imu_j = it_per_id.start_frame - 1;
-        SFMFeature tmp_feature;
-        tmp_feature.state = false;
-        tmp_feature.id = it_per_id.feature_id;
-        for (auto &it_per_frame : it_per_id.feature_per_frame)
+        sfm_cache.clear();
+        vector<SFMFeature> sfm_f;
+        for (auto &it_per_id : f_manager.feature)
         {
-            imu_j++;
-            Vector3d pts_j = it_per_frame.point;
-            tmp_feature.observation.push_back(make_pair(imu_j, Eigen::Vector2d{pts_j.x(), pts_j.y()}));
+            int imu_j = it_per_id.startFrame() - 1;
+            SFMFeature tmp_feature;
+            tmp_feature.state = false;
+            tmp_feature.id = it_per_id.feature_id;
+            for (auto &it_per_frame : it_per_id.feature_per_frame)
+            {
+                imu_j++;
+                Vector3d pts_j = it_per_frame.point;
+                tmp_feature.observation.push_back(make_pair(imu_j, Eigen::Vector2d{pts_j.x(), pts_j.y()}));
+            }
+            sfm_f.push_back(tmp_feature);
         }
-        sfm_f.push_back(tmp_feature);
-    }
-    Matrix3d relative_R;
-    Vector3d relative_T;
-    int l;
-    if (!relativePose(relative_R, relative_T, l))
-    {
-        ROS_INFO("Not enough features or parallax; Move device around");
-        return false;
-    }
-    GlobalSFM sfm;
-    if(!sfm.construct(frame_count + 1, Q, T, l,
-                       relative_R, relative_T,
-                       sfm_f, sfm_tracked_points))
-    {
-        ROS_DEBUG("global SFM failed!");
-        marginalization_flag = MARGIN_OLD;
-        return false;
+        Matrix3d relative_R;
+        Vector3d relative_T;
+        int l;
+        if (!relativePose(relative_R, relative_T, l))
+        {
+            // with few point tracks the line endpoints can still fix the
+            // relative pose the point structure is built from
+            if (POINT_ONLY || !relativePoseForLine(relative_R, relative_T, l))
+            {
+                if (!imu_static)
+                    ROS_INFO("Not enough features or parallax; Move device around");
+                return false;
+            }
+            ROS_DEBUG("relative pose from line features");
+        }
+        GlobalSFM sfm;
+        if(!sfm.construct(frame_count + 1, Q, T, l,
+                           relative_R, relative_T,
+                           sfm_f, sfm_tracked_points))
+        {
+            ROS_DEBUG("global SFM failed!");
+            marginalization_flag = MARGIN_OLD;
+            return false;
+        }
+        sfm_cache.points = sfm_tracked_points;
+        for (int i = 0; i <= frame_count; i++)
+            sfm_cache.poses[Headers[i].stamp.toSec()] = make_pair(Q[i].toRotationMatrix(), T[i]);
     }
 
     //solve pnp for all frame
@@ -465,16 +517,26 @@ bool Estimator::initialStructure()
         {
             i++;
         }
+        frame_it->second.is_key_frame = false;
+
+        // solved by an earlier attempt in the same gauge
+        auto cached = sfm_cache.poses.find(frame_it->first);
+        if (cached != sfm_cache.poses.end())
+        {
+            frame_it->second.R = cached->second.first * RIC[0].transpose();
+            frame_it->second.T = cached->second.second;
+            continue;
+        }
+
         Matrix3d R_inital = (Q[i].inverse()).toRotationMatrix();
         Vector3d P_inital = - R_inital * T[i];
         cv::eigen2cv(R_inital, tmp_r);
         cv::Rodrigues(tmp_r, rvec);
         cv::eigen2cv(P_inital, t);
 
-        frame_it->second.is_key_frame = false;
         vector<cv::Point3f> pts_3_vector;
         vector<cv::Point2f> pts_2_vector;
-        for (auto &id_pts : frame_it->second.points)
+        for (auto &id_pts : *frame_it->second.points)
         {
             int feature_id = id_pts.first;
             for (auto &i_p : id_pts.second)
@@ -512,6 +574,7 @@ bool Estimator::initialStructure()
         T_pnp = R_pnp * (-T_pnp);
         frame_it->second.R = R_pnp * RIC[0].transpose();
         frame_it->second.T = T_pnp;
+        sfm_cache.poses[frame_it->first] = make_pair(Matrix3d(R_pnp), Vector3d(T_pnp));
     }
     if (visualInitialAlign())
         return true;
@@ -523,6 +586,150 @@ bool Estimator::initialStructure()
 
 }
 
+bool Estimator::structureFromCache(Quaterniond *Q, Vector3d *T, map<int, Vector3d> &sfm_tracked_points)
+{
+    if (sfm_cache.points.empty() || sfm_cache.reuse >= INIT_CACHE_REUSE)
+        return false;
+
+    vector<bool> known(frame_count + 1, false);
+    int missing = 0;
+    for (int i = 0; i <= frame_count; i++)
+    {
+        auto it = sfm_cache.poses.find(Headers[i].stamp.toSec());
+        if (it == sfm_cache.poses.end())
+        {
+            missing++;
+            continue;
+        }
+        Q[i] = Quaterniond(it->second.first);
+        T[i] = it->second.second;
+        known[i] = true;
+    }
+    // a window that moved on too far has too few cached points in view
+    if (missing > 2)
+        return false;
+
+    TicToc t_cache;
+    cv::Mat K = (cv::Mat_<double>(3, 3) << 1, 0, 0, 0, 1, 0, 0, 0, 1);
+    for (int i = 0; i <= frame_count; i++)
+    {
+        if (known[i])
+            continue;
+
+        vector<cv::Point3f> pts_3_vector;
+        vector<cv::Point2f> pts_2_vector;
+        for (auto &it_per_id : f_manager.feature)
+        {
+            int idx = i - it_per_id.startFrame();
+            if (idx < 0 || idx >= (int)it_per_id.feature_per_frame.size())
+                continue;
+            auto it = sfm_cache.points.find(it_per_id.feature_id);
+            if (it == sfm_cache.points.end())
+                continue;
+            const Vector3d &pts_j = it_per_id.feature_per_frame[idx].point;
+            pts_3_vector.push_back(cv::Point3f(it->second(0), it->second(1), it->second(2)));
+            pts_2_vector.push_back(cv::Point2f(pts_j.x(), pts_j.y()));
+        }
+        if (pts_3_vector.size() < 15)
+            return false;
+
+        // start from the nearest registered frame
+        int j = i;
+        for (int k = 1; k <= frame_count && j == i; k++)
+        {
+            if (i - k >= 0 && known[i - k])
+                j = i - k;
+            else if (i + k <= frame_count && known[i + k])
+                j = i + k;
+        }
+        if (j == i)
+            return false;
+
+        cv::Mat r, rvec, t, D, tmp_r;
+        Matrix3d R_inital = (Q[j].inverse()).toRotationMatrix();
+        Vector3d P_inital = - R_inital * T[j];
+        cv::eigen2cv(R_inital, tmp_r);
+        cv::Rodrigues(tmp_r, rvec);
+        cv::eigen2cv(P_inital, t);
+        if (!cv::solvePnP(pts_3_vector, pts_2_vector, K, D, rvec, t, 1))
+            return false;
+
+        cv::Rodrigues(rvec, r);
+        Matrix3d R_cw;
+        Vector3d t_cw;
+        cv::cv2eigen(r, R_cw);
+        cv::cv2eigen(t, t_cw);
+
+        // reject a registration that does not explain the cached points
+        double err = 0;
+        for (unsigned int k = 0; k < pts_3_vector.size(); k++)
+        {
+            Vector3d p_c = R_cw * Vector3d(pts_3_vector[k].x, pts_3_vector[k].y, pts_3_vector[k].z) + t_cw;
+            if (p_c.z() <= 0)
+                return false;
+            err += (Vector2d(p_c.x() / p_c.z(), p_c.y() / p_c.z()) - Vector2d(pts_2_vector[k].x, pts_2_vector[k].y)).norm();
+        }
+        if (err / pts_3_vector.size() * FOCAL_LENGTH > 3.0)
+            return false;
+
+        Q[i] = Quaterniond(R_cw.transpose());
+        T[i] = -R_cw.transpose() * t_cw;
+        known[i] = true;
+        sfm_cache.poses[Headers[i].stamp.toSec()] = make_pair(Matrix3d(R_cw.transpose()), T[i]);
+    }
+
+    sfm_tracked_points = sfm_cache.points;
+    sfm_cache.reuse++;
+    ROS_DEBUG("structure from cache (reuse %d, %d new frames) costs %fms", sfm_cache.reuse, missing, t_cache.toc());
+    return true;
+}
+
+// Static start: there is no parallax to build a structure from, but while
+// the device holds still the mean specific force is gravity and the mean
+// angular rate is the gyro bias. Place the window at the origin with zero
+// velocity, attitude from gravity and the bias-corrected gyro, and features
+// at INIT_DEPTH; the scale is recovered once it moves. Lines are not
+// triangulated here: without a baseline FeatureManager::triangulateLine()
+// leaves them, and the solve skips them, until the device has moved.
+bool Estimator::imuOnlyInitialize(const Vector3d &aver_g)
+{
+    if (aver_g.norm() < 0.5 * G.norm() || aver_g.norm() > 1.5 * G.norm())
+        return false;
+
+    Matrix3d R0 = Utility::g2R(aver_g);
+    double yaw = Utility::R2ypr(R0).x();
+    R0 = Utility::ypr2R(Eigen::Vector3d{-yaw, 0, 0}) * R0;
+
+    // holding still, every frame has the same attitude
+    for (auto &frame : all_image_frame)
+        frame.second.R = R0;
+    solveGyroscopeBias(all_image_frame, Bgs);
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+        pre_integrations[i]->repropagate(Vector3d::Zero(), Bgs[i]);
+
+    Rs[0] = R0;
+    for (int i = 0; i <= frame_count; i++)
+    {
+        if (i > 0)
+            Rs[i] = Rs[i - 1] * pre_integrations[i]->delta_q.toRotationMatrix();
+        Ps[i].setZero();
+        Vs[i].setZero();
+        all_image_frame[Headers[i].stamp.toSec()].is_key_frame = true;
+    }
+    g = G;
+
+    for (auto &it_per_id : f_manager.feature)
+    {
+        it_per_id.used_num = it_per_id.feature_per_frame.size();
+        it_per_id.estimated_depth = INIT_DEPTH;
+    }
+    ric[0] = RIC[0];
+    f_manager.setRic(ric);
+
+    ROS_WARN("IMU-only initialization, scale is unobserved until the device moves");
+    return true;
+}
+
 bool Estimator::visualInitialAlign()
 {
     TicToc t_g;
@@ -578,7 +785,7 @@ bool Estimator::visualInitialAlign()
     for (auto &it_per_id : f_manager.feature)
     {
         it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+        if (!(it_per_id.used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
             continue;
         it_per_id.estimated_depth *= s;
     }
@@ -674,19 +881,22 @@ void Estimator::solveOdometry(double header_t)
     if (solver_flag == NON_LINEAR)
     {
         TicToc t_tri;
+        TraceSpan t_triangulation("triangulation");
         f_manager.triangulate(Ps, tic, ric);
         if (!POINT_ONLY)
             f_manager.triangulateLine(Ps, Rs, tic, ric, latest_img);
+        t_triangulation.stop();
 
         ROS_DEBUG("triangulation costs %f", t_tri.toc());
         optimization();
 
+        TraceSpan t_cdt("cdt");
         CDT::Triangulation<double> cdt = CDT::Triangulation<double>(CDT::VertexInsertionOrder::AsProvided);
         std::vector<CDT::V2d<double>> cdt_points, cdt_lines;
         std::vector<CDT::Edge> cdt_edges;
-        Mat img = latest_img.clone();
-        Mat depth = latest_depth.clone();
-        Mat depth_vis = latest_depth.clone();
+        Mat img = latest_img;
+        Mat depth = latest_depth;
+        Mat depth_vis = latest_depth;
         Mat features = Mat::zeros(img.size(), CV_16UC1);
         Mat validity = Mat::zeros(img.size(), CV_8UC1);
 
@@ -753,7 +963,7 @@ void Estimator::solveOdometry(double header_t)
 
                     double scale = 1.0;
 
-                    int imu_i = it_per_id.start_frame + it_per_id.used_num - 1;
+                    int imu_i = it_per_id.startFrame() + it_per_id.used_num - 1;
                     Matrix3d R_wc = Rs[imu_i] * ric[0];
                     Vector3d t_wc = Rs[imu_i] * tic[0] + Ps[imu_i];
 
@@ -1098,7 +1308,10 @@ void Estimator::vector2double()
     }
 
     VectorXd dep = f_manager.getDepthVector();
-    for (int i = 0; i < f_manager.getFeatureCount(); i++)
+    int feature_count = f_manager.getFeatureCount();
+    if (feature_count > NUM_OF_F)
+        ROS_WARN_THROTTLE(1.0, "%d point features, only max_point_features %d are optimized", feature_count, NUM_OF_F);
+    for (int i = 0; i < std::min(feature_count, NUM_OF_F); i++)
     {
         para_Feature[i][0] = dep(i);
         para_Depth[i][0]   = 1/dep(i);
@@ -1112,7 +1325,10 @@ void Estimator::vector2double()
     vector<Vector4d> get_lineOrtho = f_manager.getLineOrthonormal();
 
 //    cout << "vector2double: " << f_manager.getLineFeatureCount() << endl;
-    for(int i = 0; i < f_manager.getLineFeatureCount(); i++)
+    int line_feature_count = f_manager.getLineFeatureCount();
+    if (line_feature_count > NUM_OF_LF)
+        ROS_WARN_THROTTLE(1.0, "%d line features, only max_line_features %d are optimized", line_feature_count, NUM_OF_LF);
+    for(int i = 0; i < std::min(line_feature_count, NUM_OF_LF); i++)
     {
         para_Ortho_plucker[i][0] = get_lineOrtho.at(i)[0];
         para_Ortho_plucker[i][1] = get_lineOrtho.at(i)[1];
@@ -1194,7 +1410,7 @@ void Estimator::double2vector()
                 para_Ex_Pose[i][5]).toRotationMatrix();
     }
     VectorXd dep = f_manager.getDepthVector();
-    for (int i = 0; i < f_manager.getFeatureCount(); i++)
+    for (int i = 0; i < std::min(f_manager.getFeatureCount(), NUM_OF_F); i++)
     {
         dep(i) = para_Feature[i][0];
     }
@@ -1230,7 +1446,7 @@ void Estimator::double2vector()
 
 
     vector<Vector4d> get_lineOrtho = f_manager.getLineOrthonormal();
-    for(int i =0; i < f_manager.getLineFeatureCount(); i++)
+    for(int i =0; i < std::min(f_manager.getLineFeatureCount(), NUM_OF_LF); i++)
     {
         get_lineOrtho.at(i)[0] = para_Ortho_plucker[i][0];
         get_lineOrtho.at(i)[1] = para_Ortho_plucker[i][1];
@@ -1294,33 +1510,130 @@ bool Estimator::failureDetection()
     return false;
 }
 
+// Score of a point for the residual selection, in [0, 1]: the parallax its
+// track spans, rotation compensated (what it adds about the motion), the
+// track length, and the depth (inverse depth noise grows quadratically in
+// depth).
+float Estimator::pointScore(const FeaturePerId &it_per_id) const
+{
+    int imu_i = it_per_id.startFrame(), imu_j = imu_i + it_per_id.feature_per_frame.size() - 1;
+    Vector3d first = Rs[imu_i] * ric[0] * it_per_id.feature_per_frame.front().point;
+    Vector3d last = Rs[imu_j] * ric[0] * it_per_id.feature_per_frame.back().point;
+    double parallax = FOCAL_LENGTH * atan2(first.cross(last).norm(), first.dot(last));
+    double information = min(parallax / SELECTION_PARALLAX, 1.0);
+    double length = (double)(it_per_id.feature_per_frame.size() - 1) / WINDOW_SIZE;
+    double depth = it_per_id.estimated_depth > 0 ? min(SELECTION_DEPTH / it_per_id.estimated_depth, 1.0) : 0.0;
+    return 0.45 * information + 0.35 * length + 0.2 * depth;
+}
+
+// Score of a line, in [0, 1]: track length, image length and whether it
+// has a vanishing point.
+float Estimator::lineScore(const LineFeaturePerId &it_per_id) const
+{
+    const LineFeaturePerFrame &last = it_per_id.line_feature_per_frame.back();
+    double length = (double)it_per_id.line_feature_per_frame.size() / (WINDOW_SIZE + 1);
+    double extent = min((last.end_uv - last.start_uv).norm() / SELECTION_LINE_LENGTH, 1.0);
+    return 0.5 * length + 0.35 * extent + 0.15 * (last.vp(2) == 1);
+}
+
+// Flags the landmarks of the next solve in keep_point / keep_line, indexed
+// like para_Feature / para_Ortho_plucker in vector2double(). The frame budget
+// caps their share; with max_selected_points / max_selected_lines the
+// selector picks them by score over the image, otherwise the longest tracks
+// are kept.
+void Estimator::selectResiduals()
+{
+    vector<int> &lengths = track_lengths;
+    lengths.clear();
+    selection_candidates.clear();
+    for (auto &it_per_id : f_manager.feature)
+    {
+        int used_num = it_per_id.feature_per_frame.size();
+        if (!(used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
+            continue;
+        if ((int)lengths.size() >= NUM_OF_F)
+            break;
+        lengths.push_back(used_num);
+        if (MAX_SELECTED_POINTS > 0)
+        {
+            const Vector2d &uv = it_per_id.feature_per_frame.back().uv;
+            selection_candidates.push_back({it_per_id.feature_id, pointScore(it_per_id),
+                                            point_selector.cell(uv.x(), uv.y(), COL, ROW)});
+        }
+    }
+    int num_points = lengths.size();
+    if (MAX_SELECTED_POINTS > 0)
+        point_selector.select(selection_candidates,
+                              min(MAX_SELECTED_POINTS, (int)ceil(budget.point_fraction * num_points)), keep_point);
+    else
+        keepLongestTracks(lengths, budget.point_fraction, sorted_lengths, keep_point);
+
+    lengths.clear();
+    selection_candidates.clear();
+    line_slots.clear();
+    int num_lines = 0;
+    for (auto &it_per_id : f_manager.line_feature)
+    {
+        int used_num = it_per_id.line_feature_per_frame.size();
+        if (used_num < LINE_WINDOW)
+            continue;
+        if (num_lines >= NUM_OF_LF)
+            break;
+        num_lines++;
+        // still waiting for a baseline to be triangulated: no residuals, and
+        // no share of the line budget or the selector's cache
+        if (it_per_id.orthonormal_vec(3) == 0)
+            continue;
+        line_slots.push_back(num_lines - 1);
+        lengths.push_back(used_num);
+        if (MAX_SELECTED_LINES > 0)
+        {
+            const LineFeaturePerFrame &last = it_per_id.line_feature_per_frame.back();
+            Vector2d mid = 0.5 * (last.start_uv + last.end_uv);
+            selection_candidates.push_back({it_per_id.feature_id, lineScore(it_per_id),
+                                            line_selector.cell(mid.x(), mid.y(), COL, ROW)});
+        }
+    }
+    if (MAX_SELECTED_LINES > 0)
+        line_selector.select(selection_candidates,
+                             min(MAX_SELECTED_LINES, (int)ceil(budget.line_fraction * lengths.size())),
+                             keep_triangulated);
+    else
+        keepLongestTracks(lengths, budget.line_fraction, sorted_lengths, keep_triangulated);
+    keep_line.assign(num_lines, 0);
+    for (size_t i = 0; i < line_slots.size(); i++)
+        keep_line[line_slots[i]] = keep_triangulated[i];
+
+    ROS_DEBUG("residuals of %ld / %d points (%d reused), %ld / %d lines (%d reused)",
+              count(keep_point.begin(), keep_point.end(), 1), num_points, point_selector.reused(),
+              count(keep_line.begin(), keep_line.end(), 1), num_lines, line_selector.reused());
+}
+
 void Estimator::optimization()
 {
-    ceres::Problem problem;
-    ceres::LossFunction *loss_function;
-    loss_function = new ceres::CauchyLoss(1.0);
+    long alloc_start = AllocCounter::allocations();
 
-    ceres::LossFunction *line_loss_function;
-    line_loss_function = new ceres::CauchyLoss(0.1);
+    ceres::Problem::Options problem_options;
+    problem_options.cost_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problem_options.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    ceres::Problem problem(problem_options);
 
-    ceres::LossFunction *vp_loss_function;
-#ifdef UNIT_SPHERE_LOSS
-    vp_loss_function = new ceres::ArctanLoss(0.1);
-#else
-    vp_loss_function = new ceres::CauchyLoss(0.1);
-#endif
+    imu_factor_pool.reset();
+    projection_factor_pool.reset();
+    projection_td_factor_pool.reset();
+    line_factor_pool.reset();
+    vp_factor_pool.reset();
 
     for (int i = 0; i < WINDOW_SIZE + 1; i++)
     {
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization();
-        problem.AddParameterBlock(para_Pose[i], SIZE_POSE, local_parameterization);
+        problem.AddParameterBlock(para_Pose[i], SIZE_POSE, pose_local_parameterization);
         problem.AddParameterBlock(para_SpeedBias[i], SIZE_SPEEDBIAS);
     }
 
     for (int i = 0; i < NUM_OF_CAM; i++)
     {
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization();
-        problem.AddParameterBlock(para_Ex_Pose[i], SIZE_POSE, local_parameterization);
+        problem.AddParameterBlock(para_Ex_Pose[i], SIZE_POSE, pose_local_parameterization);
 
         if (!ESTIMATE_EXTRINSIC)
         {
@@ -1341,9 +1654,10 @@ void Estimator::optimization()
 
     if (last_marginalization_info)
     {
-        // construct new marginlization_factor
-        MarginalizationFactor *marginalization_factor = new MarginalizationFactor(last_marginalization_info);
-        problem.AddResidualBlock(marginalization_factor, NULL,
+        // the prior only changes when last_marginalization_info is replaced
+        if (!last_marginalization_factor)
+            last_marginalization_factor = new MarginalizationFactor(last_marginalization_info);
+        problem.AddResidualBlock(last_marginalization_factor, NULL,
                                  last_marginalization_parameter_blocks);
     }
 
@@ -1352,22 +1666,30 @@ void Estimator::optimization()
         int j = i + 1;
         if (pre_integrations[j]->sum_dt > 10.0)
             continue;
-        IMUFactor* imu_factor = new IMUFactor(pre_integrations[j]);
+        IMUFactor* imu_factor = imu_factor_pool.acquire(pre_integrations[j]);
         problem.AddResidualBlock(imu_factor, NULL, para_Pose[i], para_SpeedBias[i], para_Pose[j], para_SpeedBias[j]);
     }
 
+    TraceSpan t_select("select");
+    selectResiduals();
+    t_select.stop();
+
     int f_m_cnt = 0;
     int feature_index = -1;
 
     for (auto &it_per_id : f_manager.feature)
     {
         it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+        if (!(it_per_id.used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
             continue;
 
         ++feature_index;
+        if (feature_index >= NUM_OF_F)
+            break;
+        if (!keep_point[feature_index])
+            continue;
 
-        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+        int imu_i = it_per_id.startFrame(), imu_j = imu_i - 1;
         Vector3d pts_i = it_per_id.feature_per_frame[0].point;
 
         //std::cout << "--initial point--" <<std::endl;
@@ -1387,9 +1709,9 @@ void Estimator::optimization()
 
             if (ESTIMATE_TD)
             {
-                ProjectionTdFactor *f_td = new ProjectionTdFactor(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
-                                                                  it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td,
-                                                                  it_per_id.feature_per_frame[0].uv.y(), it_per_frame.uv.y());
+                ProjectionTdFactor *f_td = projection_td_factor_pool.acquire(pts_i, pts_j, it_per_id.feature_per_frame[0].velocity, it_per_frame.velocity,
+                                                                             it_per_id.feature_per_frame[0].cur_td, it_per_frame.cur_td,
+                                                                             it_per_id.feature_per_frame[0].uv.y(), it_per_frame.uv.y());
 
                 problem.AddResidualBlock(f_td, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index], para_Td[0]);
             }
@@ -1397,7 +1719,7 @@ void Estimator::optimization()
             {
                 //std::cout << "==compared point==" <<std::endl;
                 //std::cout << "pts_j: " << pts_j << std::endl;
-                ProjectionFactor *f = new ProjectionFactor(pts_i, pts_j);
+                ProjectionFactor *f = projection_factor_pool.acquire(pts_i, pts_j);
                 problem.AddResidualBlock(f, loss_function, para_Pose[imu_i], para_Pose[imu_j], para_Ex_Pose[0], para_Feature[feature_index]);
             }
 
@@ -1424,8 +1746,12 @@ void Estimator::optimization()
 //            continue;
 
         ++line_feature_index;
+        if (line_feature_index >= NUM_OF_LF)
+            break;
+        if (!keep_line[line_feature_index])
+            continue;
 
-        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+        int imu_i = it_per_id.startFrame(), imu_j = imu_i - 1;
         for (auto &it_per_frame : it_per_id.line_feature_per_frame)
         {
             imu_j++;
@@ -1461,15 +1787,13 @@ void Estimator::optimization()
             Vector3d n_c = l_c.block<3,1>(0,0);
             Vector3d d_c = l_c.block<3,1>(3,0);
 
-            ceres::CostFunction* cost_function = new ceres::AutoDiffCostFunction<LineProjectionFactor, 2, 7, 4>
-                (new LineProjectionFactor(ric[0], tic[0], it_per_frame.start_point, it_per_frame.end_point));
+            ceres::CostFunction* cost_function = line_factor_pool.acquire(ric[0], tic[0], it_per_frame.start_point, it_per_frame.end_point);
             problem.AddResidualBlock(cost_function, line_loss_function, para_Pose[imu_j], para_Ortho_plucker[line_feature_index]);
 
-            if(it_per_frame.vp(2) == 1)
+            if(budget.vp_factors && it_per_frame.vp(2) == 1)
             {
 //                cout << it_per_frame.vp(2) << endl;
-                ceres::CostFunction* cost_function = new ceres::AutoDiffCostFunction<VPProjectionFactor, 2, 7, 4>
-                        (new VPProjectionFactor(ric[0], tic[0], it_per_frame.start_point, it_per_frame.end_point, it_per_frame.vp));
+                ceres::CostFunction* cost_function = vp_factor_pool.acquire(ric[0], tic[0], it_per_frame.start_point, it_per_frame.end_point, it_per_frame.vp);
                 problem.AddResidualBlock(cost_function, vp_loss_function, para_Pose[imu_j], para_Ortho_plucker[line_feature_index]);
 
 //                cout << "---------------" << endl;
@@ -1492,17 +1816,20 @@ void Estimator::optimization()
     if(relocalization_info)
     {
         //printf("set relocalization factor! \n");
-        ceres::LocalParameterization *local_parameterization = new PoseLocalParameterization();
-        problem.AddParameterBlock(relo_Pose, SIZE_POSE, local_parameterization);
+        problem.AddParameterBlock(relo_Pose, SIZE_POSE, pose_local_parameterization);
         int retrive_feature_index = 0;
         int feature_index = -1;
         for (auto &it_per_id : f_manager.feature)
         {
             it_per_id.used_num = it_per_id.feature_per_frame.size();
-            if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+            if (!(it_per_id.used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
                 continue;
             ++feature_index;
-            int start = it_per_id.start_frame;
+            if (feature_index >= NUM_OF_F)
+                break;
+            if (!keep_point[feature_index])
+                continue;
+            int start = it_per_id.startFrame();
             if(start <= relo_frame_local_index)
             {
                 while((int)match_points[retrive_feature_index].z() < it_per_id.feature_id)
@@ -1514,7 +1841,7 @@ void Estimator::optimization()
                     Vector3d pts_j = Vector3d(match_points[retrive_feature_index].x(), match_points[retrive_feature_index].y(), 1.0);
                     Vector3d pts_i = it_per_id.feature_per_frame[0].point;
 
-                    ProjectionFactor *f = new ProjectionFactor(pts_i, pts_j);
+                    ProjectionFactor *f = projection_factor_pool.acquire(pts_i, pts_j);
                     problem.AddResidualBlock(f, loss_function, para_Pose[start], relo_Pose, para_Ex_Pose[0], para_Feature[feature_index]);
                     retrive_feature_index++;
                 }
@@ -1532,23 +1859,28 @@ void Estimator::optimization()
     options.linear_solver_type = ceres::SPARSE_SCHUR;  //ceres::ITERATIVE_SCHUR; //
     // options.num_threads = 2;
     options.trust_region_strategy_type = ceres::LEVENBERG_MARQUARDT; //ceres::LEVENBERG_MARQUARDT; //ceres::DOGLEG;
-    options.max_num_iterations = NUM_ITERATIONS;
+    options.max_num_iterations = budget.num_iterations;
     if (marginalization_flag == MARGIN_OLD)
-        options.max_solver_time_in_seconds = SOLVER_TIME * 4.0 / 5.0;
+        options.max_solver_time_in_seconds = budget.solver_time * 4.0 / 5.0;
     else
-        options.max_solver_time_in_seconds = SOLVER_TIME;
+        options.max_solver_time_in_seconds = budget.solver_time;
     TicToc t_solver;
     ceres::Solver::Summary summary;
+    TraceSpan t_solve("solve");
     ceres::Solve(options, &problem, &summary);
+    t_solve.stop();
 //    cout << summary.FullReport() << endl;
     ROS_DEBUG("Iterations : %d", static_cast<int>(summary.iterations.size()));
-    ROS_DEBUG("solver costs: %f", t_solver.toc());
+    solver_cost = t_solver.toc();
+    ROS_DEBUG("solver costs: %f", solver_cost);
+    long alloc_solve = AllocCounter::allocations();
 
     double2vector();
 
 
 
     TicToc t_whole_marginalization;
+    TraceSpan t_marginalization("marginalization");
     if (marginalization_flag == MARGIN_OLD)
     {
         MarginalizationInfo *marginalization_info = new MarginalizationInfo();
@@ -1588,12 +1920,14 @@ void Estimator::optimization()
             for (auto &it_per_id : f_manager.feature)
             {
                 it_per_id.used_num = it_per_id.feature_per_frame.size();
-                if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+                if (!(it_per_id.used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
                     continue;
 
                 ++feature_index;
+                if (feature_index >= NUM_OF_F)
+                    break;
 
-                int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+                int imu_i = it_per_id.startFrame(), imu_j = imu_i - 1;
                 if (imu_i != 0)
                     continue;
 
@@ -1639,8 +1973,10 @@ void Estimator::optimization()
 //                    continue;
 
                 ++line_feature_index;
-                int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
-                if(imu_i != 0)
+                if (line_feature_index >= NUM_OF_LF)
+                    break;
+                int imu_i = it_per_id.startFrame(), imu_j = imu_i - 1;
+                if(imu_i != 0 || it_per_id.orthonormal_vec(3) == 0)
                     continue;
 
                 for (auto &it_per_frame : it_per_id.line_feature_per_frame)
@@ -1678,8 +2014,11 @@ void Estimator::optimization()
         }
 
         TicToc t_pre_margin;
-        marginalization_info->preMarginalize();
-        ROS_DEBUG("pre marginalization %f ms", t_pre_margin.toc());
+        TraceSpan t_pre_marginalization("pre_marginalization");
+        marginalization_info->preMarginalize(marginalization_workspace);
+        t_pre_marginalization.stop();
+        ROS_DEBUG("pre marginalization of %d residual blocks %f ms", (int)marginalization_info->factors.size(),
+                  t_pre_margin.toc());
 
         TicToc t_margin;
         marginalization_info->marginalize();
@@ -1703,6 +2042,8 @@ void Estimator::optimization()
 
         if (last_marginalization_info)
             delete last_marginalization_info;
+        delete last_marginalization_factor;
+        last_marginalization_factor = nullptr;
         last_marginalization_info = marginalization_info;
         last_marginalization_parameter_blocks = parameter_blocks;
     }
@@ -1734,7 +2075,9 @@ void Estimator::optimization()
 
             TicToc t_pre_margin;
             ROS_DEBUG("begin marginalization");
-            marginalization_info->preMarginalize();
+            TraceSpan t_pre_marginalization("pre_marginalization");
+            marginalization_info->preMarginalize(marginalization_workspace);
+            t_pre_marginalization.stop();
             ROS_DEBUG("end pre marginalization, %f ms", t_pre_margin.toc());
 
             TicToc t_margin;
@@ -1770,6 +2113,8 @@ void Estimator::optimization()
             vector<double *> parameter_blocks = marginalization_info->getParameterBlocks(addr_shift);
             if (last_marginalization_info)
                 delete last_marginalization_info;
+            delete last_marginalization_factor;
+            last_marginalization_factor = nullptr;
             last_marginalization_info = marginalization_info;
             last_marginalization_parameter_blocks = parameter_blocks;
 
@@ -1778,11 +2123,21 @@ void Estimator::optimization()
 
     ROS_DEBUG("whole marginalization costs: %f", t_whole_marginalization.toc());
 
-    ROS_DEBUG("whole time for ceres: %f", t_whole.toc());
+    solve_cost = t_whole.toc();
+    ROS_DEBUG("whole time for ceres: %f", solve_cost);
+    if (AllocCounter::enabled())
+    {
+        alloc_calls++;
+        alloc_problem += alloc_solve - alloc_start;
+        alloc_marginalization += AllocCounter::allocations() - alloc_solve;
+        ROS_DEBUG("heap allocations: %ld (problem + solve %ld, marginalization %ld)",
+                  AllocCounter::allocations() - alloc_start, alloc_solve - alloc_start, AllocCounter::allocations() - alloc_solve);
+    }
 }
 
 void Estimator::slideWindow()
 {
+    TraceSpan span("slide_window");
     TicToc t_margin;
     if (marginalization_flag == MARGIN_OLD)
     {
@@ -1791,22 +2146,18 @@ void Estimator::slideWindow()
         back_P0 = Ps[0];
         if (frame_count == WINDOW_SIZE)
         {
-            for (int i = 0; i < WINDOW_SIZE; i++)
-            {
-                Rs[i].swap(Rs[i + 1]);
-
-                std::swap(pre_integrations[i], pre_integrations[i + 1]);
+            // the oldest slot becomes the newest one, nothing is moved
+            Rs.rotate();
+            pre_integrations.rotate();
+            dt_buf.rotate();
+            linear_acceleration_buf.rotate();
+            angular_velocity_buf.rotate();
+            Headers.rotate();
+            Ps.rotate();
+            Vs.rotate();
+            Bas.rotate();
+            Bgs.rotate();
 
-                dt_buf[i].swap(dt_buf[i + 1]);
-                linear_acceleration_buf[i].swap(linear_acceleration_buf[i + 1]);
-                angular_velocity_buf[i].swap(angular_velocity_buf[i + 1]);
-
-                Headers[i] = Headers[i + 1];
-                Ps[i].swap(Ps[i + 1]);
-                Vs[i].swap(Vs[i + 1]);
-                Bas[i].swap(Bas[i + 1]);
-                Bgs[i].swap(Bgs[i + 1]);
-            }
             Headers[WINDOW_SIZE] = Headers[WINDOW_SIZE - 1];
             Ps[WINDOW_SIZE] = Ps[WINDOW_SIZE - 1];
             Vs[WINDOW_SIZE] = Vs[WINDOW_SIZE - 1];
@@ -1905,6 +2256,7 @@ void Estimator::slideWindowOld()
         f_manager.removeBack();
 
     f_manager.removeLineBack();
+    f_manager.advanceWindow();
 }
 
 void Estimator::setReloFrame(double _frame_stamp, int _frame_index, vector<Vector3d> &_match_points, Vector3d _relo_t, Matrix3d _relo_r)
@@ -1,9 +1,14 @@
 #pragma once
 
 #include "parameters.h"
+#include "frame_budget.h"
+#include "residual_selector.h"
 #include "feature_manager.h"
 #include "utility/utility.h"
 #include "utility/tic_toc.h"
+#include <uvslam/trace.h>
+#include "utility/window_buffer.h"
+#include "utility/parameter_arena.h"
 #include "initial/solve_5pts.h"
 #include "initial/initial_sfm.h"
 #include "initial/initial_alignment.h"
@@ -22,6 +27,8 @@
 #include "factor/marginalization_factor.h"
 #include "factor/line_projection_factor.h"
 #include "factor/vp_projection_factor.h"
+#include "factor/factor_pool.h"
+#include "utility/alloc_counter.h"
 #include <unordered_map>
 #include <queue>
 #include <opencv2/core/eigen.hpp>
@@ -36,27 +43,36 @@ class Estimator
 {
   public:
     Estimator();
+    ~Estimator();
 
     void setParameter();
+    void resizeWindow();
 
     // interface
     void processIMU(double t, const Vector3d &linear_acceleration, const Vector3d &angular_velocity);
     // todo
-    void processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image,
-                      const map<int, vector<Eigen::Matrix<double, 15, 1>>> &image_line,
+    void processImage(const shared_ptr<const ImagePoints> &image,
+                      const shared_ptr<const ImageLines> &image_line,
                       const std_msgs::Header &header,
-                      const Mat latest_image,
-                      const Mat latest_depth);
-    void processImage(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> &image,
-                      const map<int, vector<Eigen::Matrix<double, 15, 1>>> &image_line,
+                      const Mat &latest_image,
+                      const Mat &latest_depth);
+    void processImage(const shared_ptr<const ImagePoints> &image,
+                      const shared_ptr<const ImageLines> &image_line,
                       const std_msgs::Header &header,
-                      const Mat latest_image,
+                      const Mat &latest_image,
                       const geometry_msgs::TransformStamped latestGT_msg);
+    bool addFrame(const shared_ptr<const ImagePoints> &image,
+                  const shared_ptr<const ImageLines> &image_line,
+                  const std_msgs::Header &header);
+    void processFrame(bool initialized, const std_msgs::Header &header);
     void setReloFrame(double _frame_stamp, int _frame_index, vector<Vector3d> &_match_points, Vector3d _relo_t, Matrix3d _relo_r);
 
     // internal
     void clearState();
     bool initialStructure();
+    bool buildInitialStructure(bool imu_static);
+    bool structureFromCache(Quaterniond *Q, Vector3d *T, map<int, Vector3d> &sfm_tracked_points);
+    bool imuOnlyInitialize(const Vector3d &aver_g);
     bool visualInitialAlign();
     bool relativePose(Matrix3d &relative_R, Vector3d &relative_T, int &l);
     bool relativePoseForLine(Matrix3d &relative_R, Vector3d &relative_T, int &l);
@@ -65,6 +81,9 @@ class Estimator
     void slideWindowNew();
     void slideWindowOld();
     void optimization();
+    void selectResiduals();
+    float pointScore(const FeaturePerId &it_per_id) const;
+    float lineScore(const LineFeaturePerId &it_per_id) const;
     void vector2double();
     void double2vector();
     bool failureDetection();
@@ -93,11 +112,12 @@ class Estimator
     Matrix3d ric[NUM_OF_CAM];
     Vector3d tic[NUM_OF_CAM];
 
-    Vector3d Ps[(WINDOW_SIZE + 1)];
-    Vector3d Vs[(WINDOW_SIZE + 1)];
-    Matrix3d Rs[(WINDOW_SIZE + 1)];
-    Vector3d Bas[(WINDOW_SIZE + 1)];
-    Vector3d Bgs[(WINDOW_SIZE + 1)];
+    // indexed by window slot, MARGIN_OLD rotates them instead of shifting
+    WindowBuffer<Vector3d> Ps;
+    WindowBuffer<Vector3d> Vs;
+    WindowBuffer<Matrix3d> Rs;
+    WindowBuffer<Vector3d> Bas;
+    WindowBuffer<Vector3d> Bgs;
     double td;
 
     Quaterniond q_gt;
@@ -105,14 +125,14 @@ class Estimator
 
     Matrix3d back_R0, last_R, last_R0;
     Vector3d back_P0, last_P, last_P0;
-    std_msgs::Header Headers[(WINDOW_SIZE + 1)];
+    WindowBuffer<std_msgs::Header> Headers;
 
-    IntegrationBase *pre_integrations[(WINDOW_SIZE + 1)];
+    WindowBuffer<IntegrationBase *> pre_integrations;
     Vector3d acc_0, gyr_0;
 
-    vector<double> dt_buf[(WINDOW_SIZE + 1)];
-    vector<Vector3d> linear_acceleration_buf[(WINDOW_SIZE + 1)];
-    vector<Vector3d> angular_velocity_buf[(WINDOW_SIZE + 1)];
+    WindowBuffer<vector<double>> dt_buf;
+    WindowBuffer<vector<Vector3d>> linear_acceleration_buf;
+    WindowBuffer<vector<Vector3d>> angular_velocity_buf;
 
     int frame_count;
     int sum_of_outlier, sum_of_back, sum_of_front, sum_of_invalid;
@@ -129,26 +149,59 @@ class Estimator
     vector<Vector3d> margin_cloud;
     vector<Vector3d> key_poses;
     double initial_timestamp;
+    double init_first_stamp; // first frame since the last reset
+    int init_attempts;
+    double init_cost;        // ms spent in initialStructure() so far
+    SFMCache sfm_cache;
 
     vector<pair<Vector3d, Vector3d>> cdt_lines_vis;
     vector<Vector3d> cdt_points;
 
 
 
-    double para_Pose[WINDOW_SIZE + 1][SIZE_POSE];
-    double para_SpeedBias[WINDOW_SIZE + 1][SIZE_SPEEDBIAS];
-    double para_Feature[NUM_OF_F][SIZE_FEATURE]; // INVERSE DEPTH
-    double para_Depth[NUM_OF_F][SIZE_FEATURE]; // DEPTH
+    // sized from WINDOW_SIZE / NUM_OF_F / NUM_OF_LF by resizeWindow()
+    ParameterArena<SIZE_POSE> para_Pose;
+    ParameterArena<SIZE_SPEEDBIAS> para_SpeedBias;
+    ParameterArena<SIZE_FEATURE> para_Feature; // INVERSE DEPTH
+    ParameterArena<SIZE_FEATURE> para_Depth; // DEPTH
     double para_Ex_Pose[NUM_OF_CAM][SIZE_POSE];
     double para_Retrive_Pose[SIZE_POSE];
     double para_Td[1][1];
     double para_Tr[1][1];
-    double para_Ortho_plucker[NUM_OF_LF][SIZE_LINE_FEATURE];
+    ParameterArena<SIZE_LINE_FEATURE> para_Ortho_plucker;
 
     int loop_window_index;
+    double solve_cost; // ms spent in the last optimization(), marginalization included
+    double solver_cost; // ms of it in ceres::Solve()
+    // heap allocations of the optimization() calls so far, with COUNT_ALLOCATIONS
+    int alloc_calls;
+    long alloc_problem, alloc_marginalization;
+
+    // limits of the next optimization() calls, full unless frame_deadline is set
+    FrameBudget budget;
+    // landmarks of the solve, flagged in para_Feature / para_Ortho_plucker order
+    vector<int> track_lengths, sorted_lengths;
+    vector<uchar> keep_point, keep_line;
+    vector<int> line_slots; // keep_line index of each triangulated line
+    vector<uchar> keep_triangulated;
+    vector<SelectionCandidate> selection_candidates;
+    ResidualSelector point_selector, line_selector; // max_selected_points / max_selected_lines
 
     MarginalizationInfo *last_marginalization_info;
+    MarginalizationWorkspace marginalization_workspace; // threads and jacobian storage of preMarginalize()
     vector<double *> last_marginalization_parameter_blocks;
+    MarginalizationFactor *last_marginalization_factor;
+
+    // objects reused by every optimization() call; the problem does not own them
+    ceres::LossFunction *loss_function;
+    ceres::LossFunction *line_loss_function;
+    ceres::LossFunction *vp_loss_function;
+    ceres::LocalParameterization *pose_local_parameterization;
+    FactorPool<IMUFactor> imu_factor_pool;
+    FactorPool<ProjectionFactor> projection_factor_pool;
+    FactorPool<ProjectionTdFactor> projection_td_factor_pool;
+    FactorPool<LineProjectionCostFunction> line_factor_pool;
+    FactorPool<VPProjectionCostFunction> vp_factor_pool;
 
     map<double, ImageFrame> all_image_frame;
     IntegrationBase *tmp_pre_integration;
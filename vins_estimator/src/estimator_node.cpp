@@ -4,50 +4,56 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include <ros/ros.h>
 #include <cv_bridge/cv_bridge.h>
 #include <opencv2/opencv.hpp>
 #include <tuple>
 
 #include "estimator.h"
+#include "frame_budget.h"
 #include "parameters.h"
 #include "utility/visualization.h"
+#include "utility/spsc_queue.h"
+#include "utility/track_log.h"
+#include <uvslam/trace.h>
+#include "imu_propagator.h"
 
 #include <message_filters/subscriber.h>
+#include <std_msgs/Int32.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <message_filters/time_synchronizer.h>
 #include <nav_msgs/Path.h>
 #include <geometry_msgs/PoseArray.h>
 
 
 Estimator estimator;
+TrackLogWriter track_log; // open when track_log_path is set
+ImuPropagator propagator;
+BudgetController budget_controller; // active when frame_deadline is set
+ros::Publisher pub_line_budget, pub_diagnostics;
 
 std::condition_variable con;
 double current_time = -1;
-queue<sensor_msgs::ImuConstPtr> imu_buf;
-queue<sensor_msgs::PointCloudConstPtr> feature_buf;
-queue<sensor_msgs::PointCloudConstPtr> relo_buf;
+// filled by the ROS callback thread, drained by the process thread
+SPSCQueue<sensor_msgs::ImuConstPtr> imu_buf(4096); // resized from imu_rate in main()
+std::atomic<unsigned long> imu_dropped(0);          // samples lost to a full imu_buf
+const double IMU_QUEUE_SECONDS = 10.0;              // of imu_rate the process thread may fall behind
+SPSCQueue<sensor_msgs::PointCloudConstPtr> feature_buf(256);
+SPSCQueue<sensor_msgs::PointCloudConstPtr> relo_buf(64);
+SPSCQueue<sensor_msgs::ImageConstPtr> img_buf(256);
+SPSCQueue<sensor_msgs::ImageConstPtr> depth_buf(256);
 queue<geometry_msgs::TransformStamped> gt_buf;
-queue<sensor_msgs::ImageConstPtr> img_buf;
-queue<sensor_msgs::ImageConstPtr> depth_buf;
 int sum_of_wait = 0;
+std::atomic<bool> restart_flag(false);
 
-std::mutex m_buf;
-std::mutex m_state;
+std::mutex m_buf; // only used to sleep on con
 std::mutex i_buf;
 std::mutex m_estimator;
 
-double latest_time;
-Eigen::Vector3d tmp_P;
-Eigen::Quaterniond tmp_Q;
-Eigen::Vector3d tmp_V;
-Eigen::Vector3d tmp_Ba;
-Eigen::Vector3d tmp_Bg;
-Eigen::Vector3d acc_0;
-Eigen::Vector3d gyr_0;
 bool init_feature = 0;
 bool init_img = 0;
 bool init_depth = 0;
-bool init_imu = 1;
 double last_imu_t = 0;
 
 ros::Publisher pub_sync_gt_vins;
@@ -167,60 +173,21 @@ void compare_callback(const nav_msgs::PathConstPtr &gt_path, const nav_msgs::Pat
   }
 }
 
-void predict(const sensor_msgs::ImuConstPtr &imu_msg)
-{
-    double t = imu_msg->header.stamp.toSec();
-    if (init_imu)
-    {
-        latest_time = t;
-        init_imu = 0;
-        return;
-    }
-    double dt = t - latest_time;
-    latest_time = t;
-
-    double dx = imu_msg->linear_acceleration.x;
-    double dy = imu_msg->linear_acceleration.y;
-    double dz = imu_msg->linear_acceleration.z;
-    Eigen::Vector3d linear_acceleration{dx, dy, dz};
-
-    double rx = imu_msg->angular_velocity.x;
-    double ry = imu_msg->angular_velocity.y;
-    double rz = imu_msg->angular_velocity.z;
-    Eigen::Vector3d angular_velocity{rx, ry, rz};
-
-    Eigen::Vector3d un_acc_0 = tmp_Q * (acc_0 - tmp_Ba) - estimator.g;
-
-    Eigen::Vector3d un_gyr = 0.5 * (gyr_0 + angular_velocity) - tmp_Bg;
-    tmp_Q = tmp_Q * Utility::deltaQ(un_gyr * dt);
-
-    Eigen::Vector3d un_acc_1 = tmp_Q * (linear_acceleration - tmp_Ba) - estimator.g;
-
-    Eigen::Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
-
-    tmp_P = tmp_P + dt * tmp_V + 0.5 * dt * dt * un_acc;
-    tmp_V = tmp_V + dt * un_acc;
-
-    acc_0 = linear_acceleration;
-    gyr_0 = angular_velocity;
-}
-
+// hand the newest window state to the imu-rate propagator
 void update()
 {
-    TicToc t_predict;
-    latest_time = current_time;
-    tmp_P = estimator.Ps[WINDOW_SIZE];
-    tmp_Q = estimator.Rs[WINDOW_SIZE];
-    tmp_V = estimator.Vs[WINDOW_SIZE];
-    tmp_Ba = estimator.Bas[WINDOW_SIZE];
-    tmp_Bg = estimator.Bgs[WINDOW_SIZE];
-    acc_0 = estimator.acc_0;
-    gyr_0 = estimator.gyr_0;
-
-    queue<sensor_msgs::ImuConstPtr> tmp_imu_buf = imu_buf;
-    for (sensor_msgs::ImuConstPtr tmp_imu_msg; !tmp_imu_buf.empty(); tmp_imu_buf.pop())
-        predict(tmp_imu_buf.front());
-
+    PropagatorState state;
+    state.valid = estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR;
+    state.t = current_time;
+    state.P = estimator.Ps[WINDOW_SIZE];
+    state.Q = estimator.Rs[WINDOW_SIZE];
+    state.V = estimator.Vs[WINDOW_SIZE];
+    state.Ba = estimator.Bas[WINDOW_SIZE];
+    state.Bg = estimator.Bgs[WINDOW_SIZE];
+    state.acc_0 = estimator.acc_0;
+    state.gyr_0 = estimator.gyr_0;
+    state.g = estimator.g;
+    propagator.setState(state);
 }
 
 // with depth
@@ -250,17 +217,18 @@ getMeasurements()
             continue;
         }
 
-        sensor_msgs::PointCloudConstPtr img_msg = feature_buf.front();
+        sensor_msgs::PointCloudConstPtr img_msg = std::move(feature_buf.front());
         feature_buf.pop();
-        sensor_msgs::ImageConstPtr latestImg_msg = img_buf.front();
+        sensor_msgs::ImageConstPtr latestImg_msg = std::move(img_buf.front());
         img_buf.pop();
-        sensor_msgs::ImageConstPtr latestDepth_msg = depth_buf.front();
+        sensor_msgs::ImageConstPtr latestDepth_msg = std::move(depth_buf.front());
         depth_buf.pop();
 
         std::vector<sensor_msgs::ImuConstPtr> IMUs;
+        IMUs.reserve(imu_buf.size());
         while (imu_buf.front()->header.stamp.toSec() < img_msg->header.stamp.toSec() + estimator.td)
         {
-            IMUs.emplace_back(imu_buf.front());
+            IMUs.emplace_back(std::move(imu_buf.front()));
             imu_buf.pop();
         }
         IMUs.emplace_back(imu_buf.front());
@@ -304,15 +272,16 @@ getMeasurementsGT()
             continue;
         }
 
-        sensor_msgs::PointCloudConstPtr img_msg = feature_buf.front();
+        sensor_msgs::PointCloudConstPtr img_msg = std::move(feature_buf.front());
         feature_buf.pop();
-        sensor_msgs::ImageConstPtr latestImg_msg = img_buf.front();
+        sensor_msgs::ImageConstPtr latestImg_msg = std::move(img_buf.front());
         img_buf.pop();
 
         std::vector<sensor_msgs::ImuConstPtr> IMUs;
+        IMUs.reserve(imu_buf.size());
         while (imu_buf.front()->header.stamp.toSec() < img_msg->header.stamp.toSec() + estimator.td)
         {
-            IMUs.emplace_back(imu_buf.front());
+            IMUs.emplace_back(std::move(imu_buf.front()));
             imu_buf.pop();
         }
         IMUs.emplace_back(imu_buf.front());
@@ -361,21 +330,17 @@ void imu_callback(const sensor_msgs::ImuConstPtr &imu_msg)
     }
     last_imu_t = imu_msg->header.stamp.toSec();
 
-    m_buf.lock();
-    imu_buf.push(imu_msg);
-    m_buf.unlock();
-    con.notify_one();
-
-    last_imu_t = imu_msg->header.stamp.toSec();
-
+    if (!imu_buf.push(imu_msg))
     {
-        std::lock_guard<std::mutex> lg(m_state);
-        predict(imu_msg);
-        std_msgs::Header header = imu_msg->header;
-        header.frame_id = "world";
-        if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR)
-            pubLatestOdometry(tmp_P, tmp_Q, tmp_V, header);
+        // a lost sample coarsens the preintegration of its frame
+        unsigned long dropped = ++imu_dropped;
+        ROS_WARN_THROTTLE(1.0, "imu buffer full (%zu samples), %lu imu messages dropped so far",
+                          imu_buf.capacity(), dropped);
     }
+    con.notify_one();
+
+    // the pose at imu rate is published from the propagator thread
+    propagator.inputImu(imu_msg);
 }
 
 
@@ -387,9 +352,8 @@ void feature_callback(const sensor_msgs::PointCloudConstPtr &feature_msg)
         init_feature = 1;
         return;
     }
-    m_buf.lock();
-    feature_buf.push(feature_msg);
-    m_buf.unlock();
+    if (!feature_buf.push(feature_msg))
+        ROS_WARN("feature buffer full, drop feature message");
     con.notify_one();
 }
 
@@ -398,18 +362,10 @@ void restart_callback(const std_msgs::BoolConstPtr &restart_msg)
     if (restart_msg->data == true)
     {
         ROS_WARN("restart the estimator!");
-        m_buf.lock();
-        while(!feature_buf.empty())
-            feature_buf.pop();
-        while(!imu_buf.empty())
-            imu_buf.pop();
-        m_buf.unlock();
-        m_estimator.lock();
-        estimator.clearState();
-        estimator.setParameter();
-        m_estimator.unlock();
-        current_time = -1;
+        // the buffers are drained by their consumer, the process thread
+        restart_flag = true;
         last_imu_t = 0;
+        con.notify_one();
     }
     return;
 }
@@ -417,9 +373,8 @@ void restart_callback(const std_msgs::BoolConstPtr &restart_msg)
 void relocalization_callback(const sensor_msgs::PointCloudConstPtr &points_msg)
 {
     //printf("relocalization callback! \n");
-    m_buf.lock();
-    relo_buf.push(points_msg);
-    m_buf.unlock();
+    if (!relo_buf.push(points_msg))
+        ROS_WARN("relocalization buffer full, drop match points");
 }
 
 void latest_depth_callback(const sensor_msgs::ImagePtr &depth_msg)
@@ -431,9 +386,8 @@ void latest_depth_callback(const sensor_msgs::ImagePtr &depth_msg)
         init_depth = 1;
         return;
     }
-    m_buf.lock();
-    depth_buf.push(depth_msg);
-    m_buf.unlock();
+    if (!depth_buf.push(depth_msg))
+        ROS_WARN("depth buffer full, drop depth image");
 }
 
 void latest_callback(const sensor_msgs::ImagePtr &img_msg)
@@ -444,35 +398,137 @@ void latest_callback(const sensor_msgs::ImagePtr &img_msg)
         init_img = 1;
         return;
     }
-    m_buf.lock();
-    cv_bridge::CvImagePtr ptr = cv_bridge::toCvCopy(img_msg, sensor_msgs::image_encodings::BGR8);
-    img_buf.push(img_msg);
-    m_buf.unlock();
+    if (!img_buf.push(img_msg))
+        ROS_WARN("image buffer full, drop image");
 }
 
 
 
 
 // thread: visual-inertial odometry
+void feedIMU(double t, double dt, const Vector3d &acc, const Vector3d &gyr)
+{
+    if (track_log.isOpen())
+        track_log.imu(t, dt, acc, gyr);
+    estimator.processIMU(dt, acc, gyr);
+}
+
+void logFrame(const std_msgs::Header &header, const ImagePoints &image, const ImageLines &image_line)
+{
+    if (track_log.isOpen())
+        track_log.frame(header.stamp.toSec(), image, image_line);
+}
+
+// Adapts the next frame's budget to this one and hands the tracker its line
+// budget; the level and the limits go to /diagnostics on every change and
+// once a second.
+void updateBudget(double frame_ms, int lines)
+{
+    if (!budget_controller.active())
+        return;
+    static int published_lines = 0, published_level = 0;
+    static double published_time = 0;
+    budget_controller.update(frame_ms, estimator.solver_cost, lines, feature_buf.size());
+    estimator.solver_cost = 0;
+    const FrameBudget &budget = budget_controller.budget();
+    estimator.budget = budget;
+
+    if (budget.tracker_lines != published_lines)
+    {
+        std_msgs::Int32 msg;
+        msg.data = budget.tracker_lines;
+        pub_line_budget.publish(msg);
+        published_lines = budget.tracker_lines;
+    }
+    double now = ros::Time::now().toSec();
+    if (budget.level == published_level && now - published_time < 1.0)
+        return;
+    published_level = budget.level;
+    published_time = now;
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+    diagnostic_msgs::DiagnosticStatus status;
+    status.level = budget.level ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+    status.name = "vins_estimator: frame budget";
+    status.hardware_id = "vins_estimator";
+    status.message = budget_controller.describe();
+    char value[32];
+    snprintf(value, sizeof(value), "%.1f / %.1f", budget_controller.frameMs(), FRAME_DEADLINE);
+    diagnostic_msgs::KeyValue kv;
+    kv.key = "frame ms / deadline";
+    kv.value = value;
+    status.values.push_back(kv);
+    kv.key = "degradation level";
+    kv.value = std::to_string(budget.level) + " / " + std::to_string(BudgetController::MAX_LEVEL);
+    status.values.push_back(kv);
+    kv.key = "queued frames";
+    kv.value = std::to_string(feature_buf.size());
+    status.values.push_back(kv);
+    msg.status.push_back(status);
+    pub_diagnostics.publish(msg);
+}
+
+// IMU queue health on /diagnostics, once a second; a warning while samples
+// are being dropped
+void publishImuQueue(const ros::TimerEvent &)
+{
+    static unsigned long published_dropped = 0;
+    unsigned long dropped = imu_dropped.load();
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+    diagnostic_msgs::DiagnosticStatus status;
+    status.level = dropped > published_dropped ? diagnostic_msgs::DiagnosticStatus::WARN
+                                               : diagnostic_msgs::DiagnosticStatus::OK;
+    status.name = "vins_estimator: imu queue";
+    status.hardware_id = "vins_estimator";
+    status.message = dropped > published_dropped ? "dropping imu messages" : "ok";
+    diagnostic_msgs::KeyValue kv;
+    kv.key = "dropped imu messages";
+    kv.value = std::to_string(dropped);
+    status.values.push_back(kv);
+    kv.key = "queued / capacity";
+    kv.value = std::to_string(imu_buf.size()) + " / " + std::to_string(imu_buf.capacity());
+    status.values.push_back(kv);
+    kv.key = "dropped by the propagator";
+    kv.value = std::to_string(propagator.droppedImu());
+    status.values.push_back(kv);
+    msg.status.push_back(status);
+    pub_diagnostics.publish(msg);
+    published_dropped = dropped;
+}
+
 void process()
 {
     while (true)
     {
         TicToc t_process;
 
+        if (restart_flag.exchange(false))
+        {
+            feature_buf.clear();
+            imu_buf.clear();
+            m_estimator.lock();
+            estimator.clearState();
+            estimator.setParameter();
+            m_estimator.unlock();
+            budget_controller.reset();
+            current_time = -1;
+            update();
+        }
+
         std::unique_lock<std::mutex> lk(m_buf);
         if (ENABLE_DEPTH)
         {
             std::vector<std::tuple<std::vector<sensor_msgs::ImuConstPtr>, sensor_msgs::PointCloudConstPtr, sensor_msgs::ImageConstPtr, sensor_msgs::ImageConstPtr>> measurements;
-            con.wait(lk, [&]
-                     {
-                return (measurements = getMeasurements()).size() != 0;
-                     });
+            // producers notify without holding m_buf, so never sleep unbounded
+            while ((measurements = getMeasurements()).empty() && !restart_flag)
+                con.wait_for(lk, std::chrono::milliseconds(5));
             lk.unlock();
 
             for (auto &measurement : measurements)
             {
                 auto img_msg = get<1>(measurement);
+                TraceFrame frame(img_msg->header.stamp.toSec());
                 double dx = 0, dy = 0, dz = 0, rx = 0, ry = 0, rz = 0;
                 for (auto &imu_msg : get<0>(measurement))
                 {
@@ -491,7 +547,7 @@ void process()
                         rx = imu_msg->angular_velocity.x;
                         ry = imu_msg->angular_velocity.y;
                         rz = imu_msg->angular_velocity.z;
-                        estimator.processIMU(dt, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
+                        feedIMU(t, dt, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
                         //printf("imu: dt:%f a: %f %f %f w: %f %f %f\n",dt, dx, dy, dz, rx, ry, rz);
 
                     }
@@ -511,7 +567,7 @@ void process()
                         rx = w1 * rx + w2 * imu_msg->angular_velocity.x;
                         ry = w1 * ry + w2 * imu_msg->angular_velocity.y;
                         rz = w1 * rz + w2 * imu_msg->angular_velocity.z;
-                        estimator.processIMU(dt_1, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
+                        feedIMU(img_t, dt_1, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
                         //printf("dimu: dt:%f a: %f %f %f w: %f %f %f\n",dt_1, dx, dy, dz, rx, ry, rz);
                     }
                 }
@@ -546,6 +602,7 @@ void process()
                 // image
                 // TODO!
                 TicToc t_s;
+                TraceSpan t_ingest("ingest");
                 //points
                 map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> image;
 
@@ -603,6 +660,7 @@ void process()
                     }
                 }
 
+                t_ingest.stop();
                 TicToc t_r;
                 Mat latest_img_, latest_depth_;
 
@@ -613,12 +671,15 @@ void process()
     //            cout << "\n" << endl;
 
                 cv_bridge::CvImagePtr ptr = cv_bridge::toCvCopy(get<2>(measurement), sensor_msgs::image_encodings::BGR8);
-                latest_img_ = ptr->image.clone();
+                latest_img_ = ptr->image;
 
 
                 cv_bridge::CvImagePtr ptr2 = cv_bridge::toCvCopy(get<3>(measurement), sensor_msgs::image_encodings::MONO16);
-                latest_depth_ = ptr2->image.clone();
-                estimator.processImage(image, image_line, img_msg->header, latest_img_, latest_depth_);
+                latest_depth_ = ptr2->image;
+                int num_lines = image_line.size();
+                logFrame(img_msg->header, image, image_line);
+                estimator.processImage(make_shared<const ImagePoints>(std::move(image)),
+                                       make_shared<const ImageLines>(std::move(image_line)), img_msg->header, latest_img_, latest_depth_);
 
 
                 double t_processImage = t_r.toc();
@@ -635,6 +696,7 @@ void process()
                 std_msgs::Header header = img_msg->header;
                 header.frame_id = "world";
 
+                TraceSpan t_publish("publish");
                 pubDepthCompletion(estimator, header);
                 pubOdometry(estimator, header);
                 pubKeyPoses(estimator, header);
@@ -645,21 +707,23 @@ void process()
                 pubKeyframe(estimator);
                 if (relo_msg != NULL)
                     pubRelocalization(estimator);
+                t_publish.stop();
+                updateBudget(t_s.toc(), num_lines);
                 //ROS_ERROR("end: %f, at %f", img_msg->header.stamp.toSec(), ros::Time::now().toSec());
             }
         }
         else
         {
             std::vector<std::tuple<std::vector<sensor_msgs::ImuConstPtr>, sensor_msgs::PointCloudConstPtr, sensor_msgs::ImageConstPtr, geometry_msgs::TransformStamped>> measurements;
-            con.wait(lk, [&]
-                     {
-                return (measurements = getMeasurementsGT()).size() != 0;
-                     });
+            // producers notify without holding m_buf, so never sleep unbounded
+            while ((measurements = getMeasurementsGT()).empty() && !restart_flag)
+                con.wait_for(lk, std::chrono::milliseconds(5));
             lk.unlock();
 
             for (auto &measurement : measurements)
             {
                 auto img_msg = get<1>(measurement);
+                TraceFrame frame(img_msg->header.stamp.toSec());
                 double dx = 0, dy = 0, dz = 0, rx = 0, ry = 0, rz = 0;
                 for (auto &imu_msg : get<0>(measurement))
                 {
@@ -678,7 +742,7 @@ void process()
                         rx = imu_msg->angular_velocity.x;
                         ry = imu_msg->angular_velocity.y;
                         rz = imu_msg->angular_velocity.z;
-                        estimator.processIMU(dt, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
+                        feedIMU(t, dt, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
                         //printf("imu: dt:%f a: %f %f %f w: %f %f %f\n",dt, dx, dy, dz, rx, ry, rz);
 
                     }
@@ -698,7 +762,7 @@ void process()
                         rx = w1 * rx + w2 * imu_msg->angular_velocity.x;
                         ry = w1 * ry + w2 * imu_msg->angular_velocity.y;
                         rz = w1 * rz + w2 * imu_msg->angular_velocity.z;
-                        estimator.processIMU(dt_1, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
+                        feedIMU(img_t, dt_1, Vector3d(dx, dy, dz), Vector3d(rx, ry, rz));
                         //printf("dimu: dt:%f a: %f %f %f w: %f %f %f\n",dt_1, dx, dy, dz, rx, ry, rz);
                     }
                 }
@@ -733,6 +797,7 @@ void process()
                 // image
                 // TODO!
                 TicToc t_s;
+                TraceSpan t_ingest("ingest");
                 //points
                 map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> image;
 
@@ -790,6 +855,7 @@ void process()
                     }
                 }
 
+                t_ingest.stop();
                 TicToc t_r;
                 Mat latest_img_, latest_depth_;
 
@@ -800,10 +866,20 @@ void process()
     //            cout << "\n" << endl;
 
                 cv_bridge::CvImagePtr ptr = cv_bridge::toCvCopy(get<2>(measurement), sensor_msgs::image_encodings::BGR8);
-                latest_img_ = ptr->image.clone();
-
+                latest_img_ = ptr->image;
 
-                estimator.processImage(image, image_line, img_msg->header, latest_img_, get<3>(measurement));
+                if (track_log.isOpen())
+                {
+                    const geometry_msgs::TransformStamped &gt_msg = get<3>(measurement);
+                    track_log.groundTruth(img_msg->header.stamp.toSec(),
+                                          Vector3d(gt_msg.transform.translation.x, gt_msg.transform.translation.y, gt_msg.transform.translation.z),
+                                          Quaterniond(gt_msg.transform.rotation.w, gt_msg.transform.rotation.x,
+                                                      gt_msg.transform.rotation.y, gt_msg.transform.rotation.z));
+                }
+                int num_lines = image_line.size();
+                logFrame(img_msg->header, image, image_line);
+                estimator.processImage(make_shared<const ImagePoints>(std::move(image)),
+                                       make_shared<const ImageLines>(std::move(image_line)), img_msg->header, latest_img_, get<3>(measurement));
 
 
                 double t_processImage = t_r.toc();
@@ -820,6 +896,7 @@ void process()
                 std_msgs::Header header = img_msg->header;
                 header.frame_id = "world";
 
+                TraceSpan t_publish("publish");
                 pubDepthCompletion(estimator, header);
                 pubOdometry(estimator, header);
                 pubKeyPoses(estimator, header);
@@ -830,20 +907,14 @@ void process()
                 pubKeyframe(estimator);
                 if (relo_msg != NULL)
                     pubRelocalization(estimator);
+                t_publish.stop();
+                updateBudget(t_s.toc(), num_lines);
                 //ROS_ERROR("end: %f, at %f", img_msg->header.stamp.toSec(), ros::Time::now().toSec());
             }
         }
 
 
-        m_estimator.lock();
-
-        m_estimator.unlock();
-        m_buf.lock();
-        m_state.lock();
-        if (estimator.solver_flag == Estimator::SolverFlag::NON_LINEAR)
-            update();
-        m_state.unlock();
-        m_buf.unlock();
+        update();
     }
 }
 
@@ -854,12 +925,25 @@ int main(int argc, char **argv)
     ros::console::set_logger_level(ROSCONSOLE_DEFAULT_NAME, ros::console::levels::Info);
     readParameters(n);
     estimator.setParameter();
+    if (!TRACK_LOG_PATH.empty() && !track_log.open(TRACK_LOG_PATH))
+        ROS_WARN("cannot open track log %s", TRACK_LOG_PATH.c_str());
 #ifdef EIGEN_DONT_PARALLELIZE
     ROS_DEBUG("EIGEN_DONT_PARALLELIZE");
 #endif
     ROS_WARN("waiting for image and imu...");
 
     registerPub(n);
+    // IMU_QUEUE_SECONDS of samples before the callback has to drop any
+    imu_buf.resize((size_t)std::max(1.0, IMU_RATE * IMU_QUEUE_SECONDS));
+    ROS_INFO("imu queue of %zu samples for %.0f Hz", imu_buf.capacity(), IMU_RATE);
+    pub_diagnostics = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+    ros::Timer imu_queue_timer = n.createTimer(ros::Duration(1.0), publishImuQueue);
+    budget_controller.setDeadline(FRAME_DEADLINE);
+    if (budget_controller.active())
+    {
+        ROS_INFO("frame deadline %.1f ms", FRAME_DEADLINE);
+        pub_line_budget = n.advertise<std_msgs::Int32>("line_budget", 10, true);
+    }
 
     ros::Subscriber sub_imu = n.subscribe(IMU_TOPIC, 2000, imu_callback, ros::TransportHints().tcpNoDelay());
     ros::Subscriber sub_image = n.subscribe("/feature_tracker/feature", 2000, feature_callback);
@@ -935,8 +1019,14 @@ int main(int argc, char **argv)
 
 
 
+    ros::Timer trace_timer;
+    if (TRACE_ENABLE)
+        trace_timer = startTracing(n, "vins_estimator", TRACE_PATH, TRACE_SUMMARY_PERIOD);
+
+    propagator.start(n);
     std::thread measurement_process{process};
     ros::spin();
+    propagator.stop();
 
     return 0;
 }
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+
+// Keeps cost functions alive across optimization calls. acquire() hands out
+// the next pooled factor re-targeted through Factor::set(), and only
+// allocates when the pool has to grow. The ceres::Problem using these
+// factors must not take ownership of them.
+template <typename Factor>
+class FactorPool
+{
+  public:
+    FactorPool() : used(0) {}
+    FactorPool(const FactorPool &) = delete;
+    FactorPool &operator=(const FactorPool &) = delete;
+
+    ~FactorPool()
+    {
+        for (auto f : factors)
+            delete f;
+    }
+
+    // call once per problem, before the first acquire()
+    void reset()
+    {
+        used = 0;
+    }
+
+    template <typename... Args>
+    Factor *acquire(Args &&... args)
+    {
+        if (used == factors.size())
+            factors.push_back(new Factor(std::forward<Args>(args)...));
+        else
+            factors[used]->set(std::forward<Args>(args)...);
+        return factors[used++];
+    }
+
+    int size() const
+    {
+        return used;
+    }
+
+    int capacity() const
+    {
+        return factors.size();
+    }
+
+  private:
+    std::vector<Factor *> factors;
+    size_t used;
+};
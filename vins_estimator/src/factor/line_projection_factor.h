@@ -1,3 +1,5 @@
+#pragma once
+
 #include <ros/assert.h>
 #include <ceres/ceres.h>
 #include <Eigen/Dense>
@@ -13,6 +15,14 @@ struct LineProjectionFactor
     LineProjectionFactor(Matrix3d _ric, Vector3d _tic, Vector3d _sp, Vector3d _ep)
         : ric(_ric), tic(_tic), sp(_sp), ep(_ep){}
 
+    void set(const Matrix3d &_ric, const Vector3d &_tic, const Vector3d &_sp, const Vector3d &_ep)
+    {
+        ric = _ric;
+        tic = _tic;
+        sp = _sp;
+        ep = _ep;
+    }
+
     template <typename T>
     bool operator()(const T* const pose, //7 rotation translation
                     const T* const line, //4 orthonormal direction
@@ -68,3 +78,23 @@ private:
 };
 
 
+
+// AutoDiff wrapper which keeps a handle on its functor, so a pooled
+// cost function can be re-targeted without reallocating
+class LineProjectionCostFunction : public ceres::AutoDiffCostFunction<LineProjectionFactor, 2, 7, 4>
+{
+  public:
+    LineProjectionCostFunction(const Matrix3d &_ric, const Vector3d &_tic, const Vector3d &_sp, const Vector3d &_ep)
+        : LineProjectionCostFunction(new LineProjectionFactor(_ric, _tic, _sp, _ep)) {}
+
+    void set(const Matrix3d &_ric, const Vector3d &_tic, const Vector3d &_sp, const Vector3d &_ep)
+    {
+        functor->set(_ric, _tic, _sp, _ep);
+    }
+
+  private:
+    explicit LineProjectionCostFunction(LineProjectionFactor *_functor)
+        : ceres::AutoDiffCostFunction<LineProjectionFactor, 2, 7, 4>(_functor), functor(_functor) {}
+
+    LineProjectionFactor *functor;
+};
@@ -1,20 +1,27 @@
 #include "marginalization_factor.h"
 
-void ResidualBlockInfo::Evaluate()
-{
-    residuals.resize(cost_function->num_residuals());
+static const int EVALUATE_CHUNK = 16; // residual blocks a thread takes at a time
 
-    std::vector<int> block_sizes = cost_function->parameter_block_sizes();
-    raw_jacobians = new double *[block_sizes.size()];
-    jacobians.resize(block_sizes.size());
+int ResidualBlockInfo::evaluationSize() const
+{
+    const std::vector<int> &block_sizes = cost_function->parameter_block_sizes();
+    return cost_function->num_residuals() * (1 + std::accumulate(block_sizes.begin(), block_sizes.end(), 0));
+}
 
+void ResidualBlockInfo::Evaluate(double *values, double **jacobian_ptrs)
+{
+    int num_residuals = cost_function->num_residuals();
+    const std::vector<int> &block_sizes = cost_function->parameter_block_sizes();
+    raw_residuals = values;
+    raw_jacobians = jacobian_ptrs;
+    values += num_residuals;
     for (int i = 0; i < static_cast<int>(block_sizes.size()); i++)
     {
-        jacobians[i].resize(cost_function->num_residuals(), block_sizes[i]);
-        raw_jacobians[i] = jacobians[i].data();
+        raw_jacobians[i] = values;
+        values += num_residuals * block_sizes[i];
         //dim += block_sizes[i] == 7 ? 6 : block_sizes[i];
     }
-    cost_function->Evaluate(parameter_blocks.data(), residuals.data(), raw_jacobians);
+    cost_function->Evaluate(parameter_blocks.data(), raw_residuals, raw_jacobians);
 
     //std::vector<int> tmp_idx(block_sizes.size());
     //Eigen::MatrixXd tmp(dim, dim);
@@ -36,6 +43,7 @@ void ResidualBlockInfo::Evaluate()
 
     if (loss_function)
     {
+        Eigen::Map<Eigen::VectorXd> residuals = this->residuals();
         double residual_scaling_, alpha_sq_norm_;
 
         double sq_norm, rho[3];
@@ -59,9 +67,14 @@ void ResidualBlockInfo::Evaluate()
             alpha_sq_norm_ = alpha / sq_norm;
         }
 
+        // in place, the widest block (speed and biases) has 9 columns
+        Eigen::Matrix<double, 1, Eigen::Dynamic, Eigen::RowMajor, 1, 9> residual_jacobian;
         for (int i = 0; i < static_cast<int>(parameter_blocks.size()); i++)
         {
-            jacobians[i] = sqrt_rho1_ * (jacobians[i] - alpha_sq_norm_ * residuals * (residuals.transpose() * jacobians[i]));
+            JacobianMap jacobian_i = jacobian(i);
+            residual_jacobian.noalias() = residuals.transpose() * jacobian_i;
+            jacobian_i.noalias() -= (alpha_sq_norm_ * residuals) * residual_jacobian;
+            jacobian_i *= sqrt_rho1_;
         }
 
         residuals *= residual_scaling_;
@@ -71,15 +84,9 @@ void ResidualBlockInfo::Evaluate()
 MarginalizationInfo::~MarginalizationInfo()
 {
     //ROS_WARN("release marginlizationinfo");
-    
-    for (auto it = parameter_block_data.begin(); it != parameter_block_data.end(); ++it)
-        delete[] it->second;
 
     for (int i = 0; i < (int)factors.size(); i++)
     {
-
-        delete[] factors[i]->raw_jacobians;
-        
         delete factors[i]->cost_function;
 
         delete factors[i];
@@ -107,24 +114,44 @@ void MarginalizationInfo::addResidualBlockInfo(ResidualBlockInfo *residual_block
     }
 }
 
-void MarginalizationInfo::preMarginalize()
+void MarginalizationInfo::preMarginalize(MarginalizationWorkspace &workspace)
 {
-    for (auto it : factors)
+    // lay every block out in the workspace first, so that the evaluation
+    // itself neither allocates nor shares anything between threads
+    int num_factors = factors.size();
+    workspace.value_offset.resize(num_factors);
+    workspace.jacobian_offset.resize(num_factors);
+    int num_values = 0, num_jacobians = 0;
+    for (int i = 0; i < num_factors; i++)
     {
-        it->Evaluate();
+        workspace.value_offset[i] = num_values;
+        workspace.jacobian_offset[i] = num_jacobians;
+        num_values += factors[i]->evaluationSize();
+        num_jacobians += factors[i]->parameter_blocks.size();
+    }
+    if ((int)workspace.values.size() < num_values)
+        workspace.values.resize(num_values);
+    if ((int)workspace.jacobian_ptrs.size() < num_jacobians)
+        workspace.jacobian_ptrs.resize(num_jacobians);
 
-        std::vector<int> block_sizes = it->cost_function->parameter_block_sizes();
-        for (int i = 0; i < static_cast<int>(block_sizes.size()); i++)
-        {
-            long addr = reinterpret_cast<long>(it->parameter_blocks[i]);
-            int size = block_sizes[i];
-            if (parameter_block_data.find(addr) == parameter_block_data.end())
-            {
-                double *data = new double[size];
-                memcpy(data, it->parameter_blocks[i], sizeof(double) * size);
-                parameter_block_data[addr] = data;
-            }
-        }
+    workspace.pool.parallelFor(num_factors, EVALUATE_CHUNK, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; i++)
+            factors[i]->Evaluate(workspace.values.data() + workspace.value_offset[i],
+                                 workspace.jacobian_ptrs.data() + workspace.jacobian_offset[i]);
+    });
+
+    // every block of a factor was sized by addResidualBlockInfo()
+    int num_data = 0;
+    for (const auto &it : parameter_block_size)
+        num_data += it.second;
+    parameter_block_storage.resize(num_data);
+    double *data = parameter_block_storage.data();
+    for (const auto &it : parameter_block_size)
+    {
+        memcpy(data, reinterpret_cast<const double *>(it.first), sizeof(double) * it.second);
+        parameter_block_data[it.first] = data;
+        data += it.second;
     }
 }
 
@@ -149,14 +176,14 @@ void* ThreadsConstructA(void* threadsstruct)
             int size_i = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])];
             if (size_i == 7)
                 size_i = 6;
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
+            Eigen::MatrixXd jacobian_i = it->jacobian(i).leftCols(size_i);
             for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
             {
                 int idx_j = p->parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
                 int size_j = p->parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])];
                 if (size_j == 7)
                     size_j = 6;
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
+                Eigen::MatrixXd jacobian_j = it->jacobian(j).leftCols(size_j);
                 if (i == j)
                     p->A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
                 else
@@ -165,7 +192,7 @@ void* ThreadsConstructA(void* threadsstruct)
                     p->A.block(idx_j, idx_i, size_j, size_i) = p->A.block(idx_i, idx_j, size_i, size_j).transpose();
                 }
             }
-            p->b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;
+            p->b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals();
         }
     }
     return threadsstruct;
@@ -207,12 +234,12 @@ void MarginalizationInfo::marginalize()
         {
             int idx_i = parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[i])];
             int size_i = localSize(parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[i])]);
-            Eigen::MatrixXd jacobian_i = it->jacobians[i].leftCols(size_i);
+            Eigen::MatrixXd jacobian_i = it->jacobian(i).leftCols(size_i);
             for (int j = i; j < static_cast<int>(it->parameter_blocks.size()); j++)
             {
                 int idx_j = parameter_block_idx[reinterpret_cast<long>(it->parameter_blocks[j])];
                 int size_j = localSize(parameter_block_size[reinterpret_cast<long>(it->parameter_blocks[j])]);
-                Eigen::MatrixXd jacobian_j = it->jacobians[j].leftCols(size_j);
+                Eigen::MatrixXd jacobian_j = it->jacobian(j).leftCols(size_j);
                 if (i == j)
                     A.block(idx_i, idx_j, size_i, size_j) += jacobian_i.transpose() * jacobian_j;
                 else
@@ -221,7 +248,7 @@ void MarginalizationInfo::marginalize()
                     A.block(idx_j, idx_i, size_j, size_i) = A.block(idx_i, idx_j, size_i, size_j).transpose();
                 }
             }
-            b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals;
+            b.segment(idx_i, size_i) += jacobian_i.transpose() * it->residuals();
         }
     }
     ROS_INFO("summing up costs %f ms", t_summing.toc());
@@ -315,9 +342,52 @@ std::vector<double *> MarginalizationInfo::getParameterBlocks(std::unordered_map
     }
     sum_block_size = std::accumulate(std::begin(keep_block_size), std::end(keep_block_size), 0);
 
+    compactPrior();
     return keep_block_addr;
 }
 
+void MarginalizationInfo::compactPrior()
+{
+    TicToc t_compact;
+
+    // rows whose eigenvalue fell below eps are all zero, in the jacobian and the residual
+    std::vector<int> rows;
+    for (int r = 0; r < linearized_jacobians.rows(); r++)
+        if (linearized_jacobians.row(r).squaredNorm() > 0)
+            rows.push_back(r);
+    if (rows.empty())
+        rows.push_back(0);
+    prior_rows = rows.size();
+
+    int num_blocks = keep_block_size.size();
+    keep_block_offset.resize(num_blocks);
+    keep_block_q0_inv.resize(num_blocks);
+    prior_sqrt_info.setZero(prior_rows * std::accumulate(keep_block_size.begin(), keep_block_size.end(), 0));
+    for (int i = 0, offset = 0; i < num_blocks; i++)
+    {
+        int size = keep_block_size[i];
+        int idx = keep_block_idx[i] - m;
+        keep_block_offset[i] = offset;
+        Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> panel(prior_sqrt_info.data() + offset, prior_rows, size);
+        for (int r = 0; r < prior_rows; r++)
+            panel.row(r).head(localSize(size)) = linearized_jacobians.row(rows[r]).segment(idx, localSize(size));
+        offset += prior_rows * size;
+        if (size == 7)
+        {
+            const double *x0 = keep_block_data[i];
+            keep_block_q0_inv[i] = Eigen::Quaterniond(x0[6], x0[3], x0[4], x0[5]).inverse();
+        }
+    }
+    prior_residual.resize(prior_rows);
+    for (int r = 0; r < prior_rows; r++)
+        prior_residual(r) = linearized_residuals(rows[r]);
+
+    // the dense copies are not needed once the compact prior exists
+    linearized_jacobians.resize(0, 0);
+    linearized_residuals.resize(0);
+    ROS_DEBUG("compact prior %d x %d from %d x %d, %f ms", prior_rows, n, n, n, t_compact.toc());
+}
+
 MarginalizationFactor::MarginalizationFactor(MarginalizationInfo* _marginalization_info):marginalization_info(_marginalization_info)
 {
     int cnt = 0;
@@ -327,55 +397,43 @@ MarginalizationFactor::MarginalizationFactor(MarginalizationInfo* _marginalizati
         cnt += it;
     }
     //printf("residual size: %d, %d\n", cnt, n);
-    set_num_residuals(marginalization_info->n);
+    set_num_residuals(marginalization_info->prior_rows);
 };
 
 bool MarginalizationFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
 {
-    //printf("internal addr,%d, %d\n", (int)parameter_block_sizes().size(), num_residuals());
-    //for (int i = 0; i < static_cast<int>(keep_block_size.size()); i++)
-    //{
-    //    //printf("unsigned %x\n", reinterpret_cast<unsigned long>(parameters[i]));
-    //    //printf("signed %x\n", reinterpret_cast<long>(parameters[i]));
-    //printf("jacobian %x\n", reinterpret_cast<long>(jacobians));
-    //printf("residual %x\n", reinterpret_cast<long>(residuals));
-    //}
-    int n = marginalization_info->n;
-    int m = marginalization_info->m;
-    Eigen::VectorXd dx(n);
-    for (int i = 0; i < static_cast<int>(marginalization_info->keep_block_size.size()); i++)
+    const MarginalizationInfo *info = marginalization_info;
+    int rows = info->prior_rows;
+    Eigen::Map<Eigen::VectorXd> residual(residuals, rows);
+    residual = info->prior_residual;
+
+    // one pass over the packed panels: delta, residual contribution and jacobian copy per block
+    for (int i = 0; i < static_cast<int>(info->keep_block_size.size()); i++)
     {
-        int size = marginalization_info->keep_block_size[i];
-        int idx = marginalization_info->keep_block_idx[i] - m;
-        Eigen::VectorXd x = Eigen::Map<const Eigen::VectorXd>(parameters[i], size);
-        Eigen::VectorXd x0 = Eigen::Map<const Eigen::VectorXd>(marginalization_info->keep_block_data[i], size);
+        int size = info->keep_block_size[i];
+        const double *x = parameters[i];
+        const double *x0 = info->keep_block_data[i];
+        const double *panel = info->prior_sqrt_info.data() + info->keep_block_offset[i];
+
+        Eigen::Matrix<double, Eigen::Dynamic, 1, 0, 9, 1> dx(size);
         if (size != 7)
-            dx.segment(idx, size) = x - x0;
-        else
         {
-            dx.segment<3>(idx + 0) = x.head<3>() - x0.head<3>();
-            dx.segment<3>(idx + 3) = 2.0 * Utility::positify(Eigen::Quaterniond(x0(6), x0(3), x0(4), x0(5)).inverse() * Eigen::Quaterniond(x(6), x(3), x(4), x(5))).vec();
-            if (!((Eigen::Quaterniond(x0(6), x0(3), x0(4), x0(5)).inverse() * Eigen::Quaterniond(x(6), x(3), x(4), x(5))).w() >= 0))
-            {
-                dx.segment<3>(idx + 3) = 2.0 * -Utility::positify(Eigen::Quaterniond(x0(6), x0(3), x0(4), x0(5)).inverse() * Eigen::Quaterniond(x(6), x(3), x(4), x(5))).vec();
-            }
+            for (int k = 0; k < size; k++)
+                dx(k) = x[k] - x0[k];
         }
-    }
-    Eigen::Map<Eigen::VectorXd>(residuals, n) = marginalization_info->linearized_residuals + marginalization_info->linearized_jacobians * dx;
-    if (jacobians)
-    {
-
-        for (int i = 0; i < static_cast<int>(marginalization_info->keep_block_size.size()); i++)
+        else
         {
-            if (jacobians[i])
-            {
-                int size = marginalization_info->keep_block_size[i], local_size = marginalization_info->localSize(size);
-                int idx = marginalization_info->keep_block_idx[i] - m;
-                Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobian(jacobians[i], n, size);
-                jacobian.setZero();
-                jacobian.leftCols(local_size) = marginalization_info->linearized_jacobians.middleCols(idx, local_size);
-            }
+            dx(0) = x[0] - x0[0];
+            dx(1) = x[1] - x0[1];
+            dx(2) = x[2] - x0[2];
+            Eigen::Quaterniond dq = info->keep_block_q0_inv[i] * Eigen::Quaterniond(x[6], x[3], x[4], x[5]);
+            dx.segment<3>(3) = dq.w() >= 0 ? 2.0 * dq.vec() : -2.0 * dq.vec();
+            dx(6) = 0;
         }
+        residual.noalias() += Eigen::Map<const Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>>(panel, rows, size) * dx;
+
+        if (jacobians && jacobians[i])
+            memcpy(jacobians[i], panel, sizeof(double) * rows * size);
     }
     return true;
 }
@@ -6,27 +6,44 @@
 #include <pthread.h>
 #include <ceres/ceres.h>
 #include <unordered_map>
+#include <numeric>
 
 #include "../utility/utility.h"
 #include "../utility/tic_toc.h"
+#include "../utility/worker_pool.h"
 
 const int NUM_THREADS = 4;
 
 struct ResidualBlockInfo
 {
+    typedef Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> JacobianMap;
+
     ResidualBlockInfo(ceres::CostFunction *_cost_function, ceres::LossFunction *_loss_function, std::vector<double *> _parameter_blocks, std::vector<int> _drop_set)
         : cost_function(_cost_function), loss_function(_loss_function), parameter_blocks(_parameter_blocks), drop_set(_drop_set) {}
 
-    void Evaluate();
+    // doubles written by Evaluate(): the residuals, then the jacobian of each parameter block
+    int evaluationSize() const;
+    // values holds evaluationSize() doubles, jacobian_ptrs one pointer per parameter block
+    void Evaluate(double *values, double **jacobian_ptrs);
 
     ceres::CostFunction *cost_function;
     ceres::LossFunction *loss_function;
     std::vector<double *> parameter_blocks;
     std::vector<int> drop_set;
 
+    // into the MarginalizationWorkspace, valid until its next preMarginalize()
+    double *raw_residuals;
     double **raw_jacobians;
-    std::vector<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>> jacobians;
-    Eigen::VectorXd residuals;
+
+    Eigen::Map<Eigen::VectorXd> residuals() const
+    {
+        return Eigen::Map<Eigen::VectorXd>(raw_residuals, cost_function->num_residuals());
+    }
+
+    JacobianMap jacobian(int i) const
+    {
+        return JacobianMap(raw_jacobians[i], cost_function->num_residuals(), cost_function->parameter_block_sizes()[i]);
+    }
 
     int localSize(int size)
     {
@@ -34,6 +51,20 @@ struct ResidualBlockInfo
     }
 };
 
+// Scratch shared by successive marginalizations: the threads that evaluate
+// the residual blocks in preMarginalize() and the storage their residuals and
+// jacobians go to. The storage only grows, so after the first keyframes
+// preMarginalize() no longer allocates for it.
+struct MarginalizationWorkspace
+{
+    MarginalizationWorkspace() : pool(NUM_THREADS - 1) {}
+
+    WorkerPool pool; // the calling thread is the NUM_THREADS-th
+    std::vector<double> values;
+    std::vector<double *> jacobian_ptrs;
+    std::vector<int> value_offset, jacobian_offset; // per factor
+};
+
 struct ThreadsStruct
 {
     std::vector<ResidualBlockInfo *> sub_factors;
@@ -50,16 +81,18 @@ class MarginalizationInfo
     int localSize(int size) const;
     int globalSize(int size) const;
     void addResidualBlockInfo(ResidualBlockInfo *residual_block_info);
-    void preMarginalize();
+    void preMarginalize(MarginalizationWorkspace &workspace);
     void marginalize();
     std::vector<double *> getParameterBlocks(std::unordered_map<long, double *> &addr_shift);
+    void compactPrior();
 
     std::vector<ResidualBlockInfo *> factors;
     int m, n;
     std::unordered_map<long, int> parameter_block_size; //global size
     int sum_block_size;
     std::unordered_map<long, int> parameter_block_idx; //local size
-    std::unordered_map<long, double *> parameter_block_data;
+    std::unordered_map<long, double *> parameter_block_data; // into parameter_block_storage
+    std::vector<double> parameter_block_storage;
 
     std::vector<int> keep_block_size; //global size
     std::vector<int> keep_block_idx;  //local size
@@ -69,6 +102,15 @@ class MarginalizationInfo
     Eigen::VectorXd linearized_residuals;
     const double eps = 1e-8;
 
+    // compact prior built from linearized_* by compactPrior(): only the rows of the
+    // square-root information with non-zero weight, stored per kept block as a
+    // row-major panel in ceres jacobian layout (zero column for the quaternion w)
+    int prior_rows;
+    Eigen::VectorXd prior_sqrt_info;
+    Eigen::VectorXd prior_residual;
+    std::vector<int> keep_block_offset; // start of each kept block's panel in prior_sqrt_info
+    std::vector<Eigen::Quaterniond, Eigen::aligned_allocator<Eigen::Quaterniond>> keep_block_q0_inv;
+
 };
 
 class MarginalizationFactor : public ceres::CostFunction
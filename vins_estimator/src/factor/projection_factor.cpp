@@ -1,11 +1,18 @@
 #include "projection_factor.h"
 
 Eigen::Matrix2d ProjectionFactor::sqrt_info;
-double ProjectionFactor::sum_t;
 
 //ProjectionFactor::ProjectionFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j, const Eigen::VectorXd &_pose_i) : pts_i(_pts_i), pts_j(_pts_j), pose_i(_pose_i)
-ProjectionFactor::ProjectionFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j) : pts_i(_pts_i), pts_j(_pts_j)
+ProjectionFactor::ProjectionFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j)
 {
+    set(_pts_i, _pts_j);
+};
+
+// re-targets a pooled factor to a new observation pair
+void ProjectionFactor::set(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j)
+{
+    pts_i = _pts_i;
+    pts_j = _pts_j;
 #ifdef UNIT_SPHERE_ERROR
     Eigen::Vector3d b1, b2;
     Eigen::Vector3d a = pts_j.normalized();
@@ -21,8 +28,6 @@ ProjectionFactor::ProjectionFactor(const Eigen::Vector3d &_pts_i, const Eigen::V
 
 bool ProjectionFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
 {
-    TicToc tic_toc;
-
     Eigen::Vector3d Pi(parameters[0][0], parameters[0][1], parameters[0][2]);
     Eigen::Quaterniond Qi(parameters[0][6], parameters[0][3], parameters[0][4], parameters[0][5]);
     Eigen::Vector3d Pj(parameters[1][0], parameters[1][1], parameters[1][2]);
@@ -169,7 +174,6 @@ bool ProjectionFactor::Evaluate(double const *const *parameters, double *residua
 #endif
         }
     }
-    sum_t += tic_toc.toc();
 
     return true;
 }
@@ -14,6 +14,7 @@ class ProjectionFactor : public ceres::SizedCostFunction<2, 7, 7, 7, 1>
   public:
     //ProjectionFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j, const Eigen::VectorXd &_pose_i);
     ProjectionFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j);
+    void set(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j);
     virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
     void check(double **parameters);
 
@@ -21,5 +22,4 @@ class ProjectionFactor : public ceres::SizedCostFunction<2, 7, 7, 7, 1>
     Eigen::VectorXd pose_i;
     Eigen::Matrix<double, 2, 3> tangent_base;
     static Eigen::Matrix2d sqrt_info;
-    static double sum_t;
 };
@@ -1,14 +1,23 @@
 #include "projection_td_factor.h"
 
 Eigen::Matrix2d ProjectionTdFactor::sqrt_info;
-double ProjectionTdFactor::sum_t;
 
 ProjectionTdFactor::ProjectionTdFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j, 
                                        const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
-                                       const double _td_i, const double _td_j, const double _row_i, const double _row_j) : 
-                                       pts_i(_pts_i), pts_j(_pts_j), 
-                                       td_i(_td_i), td_j(_td_j)
+                                       const double _td_i, const double _td_j, const double _row_i, const double _row_j)
 {
+    set(_pts_i, _pts_j, _velocity_i, _velocity_j, _td_i, _td_j, _row_i, _row_j);
+};
+
+// re-targets a pooled factor to a new observation pair
+void ProjectionTdFactor::set(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
+                             const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
+                             const double _td_i, const double _td_j, const double _row_i, const double _row_j)
+{
+    pts_i = _pts_i;
+    pts_j = _pts_j;
+    td_i = _td_i;
+    td_j = _td_j;
     velocity_i.x() = _velocity_i.x();
     velocity_i.y() = _velocity_i.y();
     velocity_i.z() = 0;
@@ -33,7 +42,6 @@ ProjectionTdFactor::ProjectionTdFactor(const Eigen::Vector3d &_pts_i, const Eige
 
 bool ProjectionTdFactor::Evaluate(double const *const *parameters, double *residuals, double **jacobians) const
 {
-    TicToc tic_toc;
     Eigen::Vector3d Pi(parameters[0][0], parameters[0][1], parameters[0][2]);
     Eigen::Quaterniond Qi(parameters[0][6], parameters[0][3], parameters[0][4], parameters[0][5]);
 
@@ -139,7 +147,6 @@ bool ProjectionTdFactor::Evaluate(double const *const *parameters, double *resid
                           sqrt_info * velocity_j.head(2);
         }
     }
-    sum_t += tic_toc.toc();
 
     return true;
 }
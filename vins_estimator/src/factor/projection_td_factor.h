@@ -13,6 +13,9 @@ class ProjectionTdFactor : public ceres::SizedCostFunction<2, 7, 7, 7, 1, 1>
     ProjectionTdFactor(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
     				   const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
     				   const double _td_i, const double _td_j, const double _row_i, const double _row_j);
+    void set(const Eigen::Vector3d &_pts_i, const Eigen::Vector3d &_pts_j,
+             const Eigen::Vector2d &_velocity_i, const Eigen::Vector2d &_velocity_j,
+             const double _td_i, const double _td_j, const double _row_i, const double _row_j);
     virtual bool Evaluate(double const *const *parameters, double *residuals, double **jacobians) const;
     void check(double **parameters);
 
@@ -22,5 +25,4 @@ class ProjectionTdFactor : public ceres::SizedCostFunction<2, 7, 7, 7, 1, 1>
     Eigen::Matrix<double, 2, 3> tangent_base;
     double row_i, row_j;
     static Eigen::Matrix2d sqrt_info;
-    static double sum_t;
 };
@@ -16,6 +16,15 @@ struct VPProjectionFactor
     VPProjectionFactor(Matrix3d _ric, Vector3d _tic, Vector3d _sp, Vector3d _ep, Vector3d _vp)
         : ric(_ric), tic(_tic), sp(_sp), ep(_ep), vp(_vp){}
 
+    void set(const Matrix3d &_ric, const Vector3d &_tic, const Vector3d &_sp, const Vector3d &_ep, const Vector3d &_vp)
+    {
+        ric = _ric;
+        tic = _tic;
+        sp = _sp;
+        ep = _ep;
+        vp = _vp;
+    }
+
     template <typename T>
     bool operator()(const T* const pose,
                     const T* const line,
@@ -73,4 +82,24 @@ private:
     Vector3d vp;
 };
 
+// AutoDiff wrapper which keeps a handle on its functor, so a pooled
+// cost function can be re-targeted without reallocating
+class VPProjectionCostFunction : public ceres::AutoDiffCostFunction<VPProjectionFactor, 2, 7, 4>
+{
+  public:
+    VPProjectionCostFunction(const Matrix3d &_ric, const Vector3d &_tic, const Vector3d &_sp, const Vector3d &_ep, const Vector3d &_vp)
+        : VPProjectionCostFunction(new VPProjectionFactor(_ric, _tic, _sp, _ep, _vp)) {}
+
+    void set(const Matrix3d &_ric, const Vector3d &_tic, const Vector3d &_sp, const Vector3d &_ep, const Vector3d &_vp)
+    {
+        functor->set(_ric, _tic, _sp, _ep, _vp);
+    }
+
+  private:
+    explicit VPProjectionCostFunction(VPProjectionFactor *_functor)
+        : ceres::AutoDiffCostFunction<VPProjectionFactor, 2, 7, 4>(_functor), functor(_functor) {}
+
+    VPProjectionFactor *functor;
+};
+
 #endif // STRUCTURAL_FACTOR_H
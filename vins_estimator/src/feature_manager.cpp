@@ -2,16 +2,16 @@
 
 int LineFeaturePerId::endFrame()
 {
-    return start_frame + line_feature_per_frame.size() - 1;
+    return startFrame() + line_feature_per_frame.size() - 1;
 }
 
 int FeaturePerId::endFrame()
 {
-    return start_frame + feature_per_frame.size() - 1;
+    return startFrame() + feature_per_frame.size() - 1;
 }
 
-FeatureManager::FeatureManager(Matrix3d _Rs[])
-    : Rs(_Rs)
+FeatureManager::FeatureManager(const WindowBuffer<Matrix3d> &_Rs)
+    : window_base(0), Rs(_Rs), line_tri_pool(NUM_OF_LINE_TRI_THREADS - 1)
 {
     for (int i = 0; i < NUM_OF_CAM; i++)
         ric[i].setIdentity();
@@ -29,6 +29,13 @@ void FeatureManager::clearState()
 {
     feature.clear();
     line_feature.clear();
+    window_base = 0;
+}
+
+// slot 0 was marginalized; every handle now maps one slot lower
+void FeatureManager::advanceWindow()
+{
+    window_base++;
 }
 
 int FeatureManager::getLineFeatureCount()
@@ -62,7 +69,7 @@ int FeatureManager::getFeatureCount()
 
         it.used_num = it.feature_per_frame.size();
 
-        if (it.used_num >= 2 && it.start_frame < WINDOW_SIZE - 2)
+        if (it.used_num >= 2 && it.startFrame() < WINDOW_SIZE - 2)
         {
             cnt++;
         }
@@ -94,7 +101,7 @@ bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vec
 
         if (it == feature.end())
         {
-            feature.push_back(FeaturePerId(feature_id, frame_count));
+            feature.push_back(FeaturePerId(feature_id, frame_count, &window_base));
             feature.back().feature_per_frame.push_back(f_per_fra);
         }
         else if (it->feature_id == feature_id)
@@ -120,7 +127,7 @@ bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vec
 
             if (it == line_feature.end())
             {
-                line_feature.push_back(LineFeaturePerId(line_id, frame_count));
+                line_feature.push_back(LineFeaturePerId(line_id, frame_count, &window_base));
                 line_feature.back().line_feature_per_frame.push_back(l_per_fra);
     //            cout << line_id << ", " << id_lines.second[0].first << endl;
             }
@@ -140,8 +147,8 @@ bool FeatureManager::addFeatureCheckParallax(int frame_count, const map<int, vec
 
     for (auto &it_per_id : feature)
     {
-        if (it_per_id.start_frame <= frame_count - 2 &&
-                it_per_id.start_frame + int(it_per_id.feature_per_frame.size()) - 1 >= frame_count - 1)
+        if (it_per_id.startFrame() <= frame_count - 2 &&
+                it_per_id.startFrame() + int(it_per_id.feature_per_frame.size()) - 1 >= frame_count - 1)
         {
             parallax_sum += compensatedParallax2(it_per_id, frame_count);
             parallax_num++;
@@ -166,10 +173,10 @@ void FeatureManager::debugShow()
     for (auto &it : feature)
     {
         ROS_ASSERT(it.feature_per_frame.size() != 0);
-        ROS_ASSERT(it.start_frame >= 0);
+        ROS_ASSERT(it.startFrame() >= 0);
         ROS_ASSERT(it.used_num >= 0);
 
-        ROS_DEBUG("%d,%d,%d ", it.feature_id, it.used_num, it.start_frame);
+        ROS_DEBUG("%d,%d,%d ", it.feature_id, it.used_num, it.startFrame());
         int sum = 0;
         for (auto &j : it.feature_per_frame)
         {
@@ -186,11 +193,11 @@ vector<pair<Vector3d, Vector3d>> FeatureManager::getCorresponding(int frame_coun
     vector<pair<Vector3d, Vector3d>> corres;
     for (auto &it : feature)
     {
-        if (it.start_frame <= frame_count_l && it.endFrame() >= frame_count_r)
+        if (it.startFrame() <= frame_count_l && it.endFrame() >= frame_count_r)
         {
             Vector3d a = Vector3d::Zero(), b = Vector3d::Zero();
-            int idx_l = frame_count_l - it.start_frame;
-            int idx_r = frame_count_r - it.start_frame;
+            int idx_l = frame_count_l - it.startFrame();
+            int idx_r = frame_count_r - it.startFrame();
 
             a = it.feature_per_frame[idx_l].point;
 
@@ -214,17 +221,17 @@ vector<pair<Vector3d, Vector3d>> FeatureManager::getLineCorresponding(int frame_
       //std::cout << "[getCorr]frame_count_l:" << frame_count_l << std::endl;
       //std::cout << "[getCorr]frame_count_r:" << frame_count_r << std::endl;
 
-        if (it.start_frame <= frame_count_l && it.endFrame() >= frame_count_r)
+        if (it.startFrame() <= frame_count_l && it.endFrame() >= frame_count_r)
         {
             Vector3d a = Vector3d::Zero(), b = Vector3d::Zero();
-            int idx_l = frame_count_l - it.start_frame;
-            int idx_r = frame_count_r - it.start_frame;
+            int idx_l = frame_count_l - it.startFrame();
+            int idx_r = frame_count_r - it.startFrame();
 
             a = it.line_feature_per_frame[idx_l].start_point;
 
             b = it.line_feature_per_frame[idx_r].start_point;
 
-//            std::cout << "[getCorr]it.start_frame:" << it.start_frame << std::endl;
+//            std::cout << "[getCorr]it.startFrame():" << it.startFrame() << std::endl;
 //            std::cout << "[getCorr]it.endFrame:" << it.endFrame() << std::endl;
 //            std::cout << "[getCorr]point a: \n" << a << std::endl;
 //            std::cout << "[getCorr]point b: \n" << b << std::endl;
@@ -241,7 +248,7 @@ void FeatureManager::setDepth(const VectorXd &x)
     for (auto &it_per_id : feature)
     {
         it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+        if (!(it_per_id.used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
             continue;
 
         it_per_id.estimated_depth = 1.0 / x(++feature_index);
@@ -287,7 +294,7 @@ void FeatureManager::clearDepth(const VectorXd &x)
     for (auto &it_per_id : feature)
     {
         it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+        if (!(it_per_id.used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
             continue;
         it_per_id.estimated_depth = 1.0 / x(++feature_index);
     }
@@ -300,7 +307,7 @@ VectorXd FeatureManager::getDepthVector()
     for (auto &it_per_id : feature)
     {
         it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+        if (!(it_per_id.used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
             continue;
 #if 1
         dep_vec(++feature_index) = 1. / it_per_id.estimated_depth;
@@ -342,7 +349,7 @@ vector<Vector4d> FeatureManager::getLineOrthonormal()
 
 
 
-void FeatureManager::setLineOrtho(vector<Vector4d> &get_lineOrtho, Vector3d Ps[], Matrix3d Rs[],Vector3d tic, Matrix3d ric)
+void FeatureManager::setLineOrtho(vector<Vector4d> &get_lineOrtho, const WindowBuffer<Vector3d> &Ps, const WindowBuffer<Matrix3d> &Rs, Vector3d tic, Matrix3d ric)
 {
     int line_feature_index =-1;
     for (auto &it_per_id : line_feature)
@@ -377,7 +384,7 @@ void FeatureManager::setLineOrtho(vector<Vector4d> &get_lineOrtho, Vector3d Ps[]
         Vector3d n_w = cos(pi) * Rotation_psi.block<3,1>(0,0);
         Vector3d d_w = sin(pi) * Rotation_psi.block<3,1>(0,1);
 
-        int imu_i = it_per_id.start_frame;
+        int imu_i = it_per_id.startFrame();
         Matrix3d R_wc = Rs[imu_i] * ric;
         Vector3d t_wc = Rs[imu_i] * tic + Ps[imu_i];
 
@@ -409,17 +416,17 @@ void FeatureManager::setLineOrtho(vector<Vector4d> &get_lineOrtho, Vector3d Ps[]
 
 
 
-void FeatureManager::triangulate(Vector3d Ps[], Vector3d tic[], Matrix3d ric[])
+void FeatureManager::triangulate(const WindowBuffer<Vector3d> &Ps, Vector3d tic[], Matrix3d ric[])
 {
     for (auto &it_per_id : feature)
     {
         it_per_id.used_num = it_per_id.feature_per_frame.size();
-        if (!(it_per_id.used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+        if (!(it_per_id.used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
             continue;
 
         if (it_per_id.estimated_depth > 0)
             continue;
-        int imu_i = it_per_id.start_frame, imu_j = imu_i - 1;
+        int imu_i = it_per_id.startFrame(), imu_j = imu_i - 1;
 
         ROS_ASSERT(NUM_OF_CAM == 1);
         Eigen::MatrixXd svd_A(2 * it_per_id.feature_per_frame.size(), 4);
@@ -486,63 +493,113 @@ bool DoesFileExist (const std::string& name) {
     }
 }
 
-void FeatureManager::triangulateLine(Vector3d Ps[], Matrix3d Rs_estimate[], Vector3d tic[], Matrix3d ric[], Mat img)
+void FeatureManager::triangulateLine(const WindowBuffer<Vector3d> &Ps, const WindowBuffer<Matrix3d> &Rs_estimate, Vector3d tic[], Matrix3d ric[], Mat img)
 {
-    Vector4d left_plane, right_plane;
-    Vector3d left_plane_3d, right_plane_3d;
+    TicToc t_line_tri;
 
-    Vector3d direction_l;
-    Vector3d normal_l;
-    Eigen::Matrix<double, 3, 3, Eigen::RowMajor> Rotation_psi;
-
-    Vector3d sp_3d;
-    Vector3d ep_3d;
-
-    int index = -1;
+    // camera poses of the whole window, shared by every line
+    vector<Matrix3d> R_wc(WINDOW_SIZE + 1);
+    vector<Vector3d> t_wc(WINDOW_SIZE + 1);
+    for (int i = 0; i <= WINDOW_SIZE; i++)
+    {
+        R_wc[i] = Rs[i] * ric[0];
+        t_wc[i] = Rs[i] * tic[0] + Ps[i];
+    }
 
-//    cvtColor(img, img, CV_GRAY2BGR);
-    for(auto &it_per_id : line_feature)
+    // pack the observations of every uninitialized line into one contiguous array
+    vector<LineFeaturePerId *> lines;
+    vector<LineTriangulationObs> obs;
+    vector<int> obs_offset;
+    lines.reserve(line_feature.size());
+    obs_offset.reserve(line_feature.size() + 1);
+    for (auto &it_per_id : line_feature)
     {
         it_per_id.used_num = it_per_id.line_feature_per_frame.size();
-        if(it_per_id.orthonormal_vec[3] != 0 || it_per_id.line_feature_per_frame.size() < 2)
+        if (it_per_id.orthonormal_vec[3] != 0 || it_per_id.used_num < 2)
             continue;
 
-        int imu_i = it_per_id.start_frame;
-        int imu_j = it_per_id.start_frame + it_per_id.used_num - 1;
+        lines.push_back(&it_per_id);
+        obs_offset.push_back(obs.size());
+        int imu_j = it_per_id.startFrame() - 1;
+        for (auto &it_per_frame : it_per_id.line_feature_per_frame)
+        {
+            imu_j++;
+            LineTriangulationObs o;
+            o.frame = imu_j;
+            o.sp = it_per_frame.start_point;
+            o.ep = it_per_frame.end_point;
+            obs.push_back(o);
+        }
+    }
+    obs_offset.push_back(obs.size());
+
+    // a few chunks per thread, as the lines differ in their number of observations;
+    // too few lines for two per thread run on this thread alone
+    int line_num = lines.size();
+    int chunk = line_num < 2 * NUM_OF_LINE_TRI_THREADS ? line_num : std::max(2, line_num / (4 * NUM_OF_LINE_TRI_THREADS));
+    line_tri_pool.parallelFor(line_num, chunk, [&](int begin, int end)
+                              { triangulateLineRange(lines, obs, obs_offset, R_wc.data(), t_wc.data(), begin, end); });
 
-        Matrix3d R_left = Rs[imu_i] * ric[0];
-        Quaterniond q_left(R_left);
-        Vector3d t_left = Rs[imu_i] * tic[0] + Ps[imu_i] ;
+    line_triangulation_cost = t_line_tri.toc();
+    ROS_DEBUG("line triangulation %d lines costs %f ms", line_num, line_triangulation_cost);
+}
 
-        Matrix3d R_right = Rs[imu_j] * ric[0];
-        Quaterniond q_right(R_right);
-        Vector3d t_right = Rs[imu_j] * tic[0] + Ps[imu_j] ;
+void FeatureManager::triangulateLineRange(const vector<LineFeaturePerId *> &lines,
+                                          const vector<LineTriangulationObs> &obs,
+                                          const vector<int> &obs_offset,
+                                          const Matrix3d R_wc[], const Vector3d t_wc[],
+                                          int begin, int end)
+{
+    Vector4d left_plane, right_plane;
+    Vector3d direction_l, normal_l;
+    Eigen::Matrix<double, 3, 3, Eigen::RowMajor> Rotation_psi;
 
-        Quaterniond relative_q = q_left.inverse() * q_right;
-        Vector3d relative_t = q_left.inverse().toRotationMatrix() * (t_right - t_left);
+    for (int k = begin; k < end; k++)
+    {
+        const int obs_begin = obs_offset[k], obs_end = obs_offset[k + 1];
 
-        Vector3d left_sp = it_per_id.line_feature_per_frame[0].start_point;
-        Vector3d left_ep = it_per_id.line_feature_per_frame[0].end_point;
+        // pick the observation pair with the widest baseline whose back-projected
+        // planes are far from parallel, instead of always the first and last frame
+        int best_a = obs_begin, best_b = obs_end - 1;
+        double best_score = -1;
+        for (int a = obs_begin; a < obs_end; a++)
+        {
+            Vector3d n_a = R_wc[obs[a].frame] * obs[a].sp.cross(obs[a].ep);
+            n_a.normalize();
+            for (int b = a + 1; b < obs_end; b++)
+            {
+                Vector3d n_b = R_wc[obs[b].frame] * obs[b].sp.cross(obs[b].ep);
+                n_b.normalize();
+                double baseline = (t_wc[obs[b].frame] - t_wc[obs[a].frame]).norm();
+                double score = baseline * n_a.cross(n_b).norm();
+                if (score > best_score)
+                {
+                    best_score = score;
+                    best_a = a;
+                    best_b = b;
+                }
+            }
+        }
 
-        Vector3d right_sp = it_per_id.line_feature_per_frame[it_per_id.used_num - 1].start_point;
-        Vector3d right_ep = it_per_id.line_feature_per_frame[it_per_id.used_num - 1].end_point;
+        // no pair with a baseline (a static start): retried on the next frames
+        if (best_score < MIN_LINE_TRIANGULATION_SCORE)
+            continue;
 
-        Vector3d right_sp_l = relative_q * right_sp;
-        Vector3d right_ep_l = relative_q * right_ep;
+        const LineTriangulationObs &left = obs[best_a];
+        const LineTriangulationObs &right = obs[best_b];
+        const Matrix3d &R_left = R_wc[left.frame];
+        const Vector3d &t_left = t_wc[left.frame];
 
-        Vector3d t_cj_ci = q_right.inverse().toRotationMatrix() * (t_left - t_right);
-        t_cj_ci = t_cj_ci/t_cj_ci(2);
+        Matrix3d relative_R = R_left.transpose() * R_wc[right.frame];
+        Vector3d relative_t = R_left.transpose() * (t_wc[right.frame] - t_left);
 
-//        if(it_per_id.solve_flag == 0)
-//        {
+        Vector3d right_sp_l = relative_R * right.sp;
+        Vector3d right_ep_l = relative_R * right.ep;
 
-        calcPluckerLine(left_sp, left_ep, right_sp_l, right_ep_l,
+        calcPluckerLine(left.sp, left.ep, right_sp_l, right_ep_l,
                         Vector3d(0, 0, 0), relative_t, direction_l, normal_l,
                         left_plane, right_plane);
 
-        Vector3d left_plane_3d(left_plane(0), left_plane(1), left_plane(2));
-        Vector3d right_plane_3d(right_plane(0), right_plane(1), right_plane(2));
-
         Matrix<double, 6, 1> line_w, line_l;
         line_l.block<3,1>(0,0) = normal_l;
         line_l.block<3,1>(3,0) = direction_l;
@@ -555,21 +612,15 @@ void FeatureManager::triangulateLine(Vector3d Ps[], Matrix3d Rs_estimate[], Vect
 
         line_w = T_wl * line_l;
 
-        Vector3d n_w, d_w;
-        n_w = line_w.block<3,1>(0,0);
-        d_w = line_w.block<3,1>(3,0);
+        Vector3d n_w = line_w.block<3,1>(0,0);
+        Vector3d d_w = line_w.block<3,1>(3,0);
 
         Rotation_psi.block<3,1>(0,0) = n_w/(n_w.norm());
         Rotation_psi.block<3,1>(0,1) = d_w/(d_w.norm());
         Rotation_psi.block<3,1>(0,2) = n_w.cross(d_w)/(n_w.cross(d_w).norm());
 
-//        if(n_w.norm()/d_w.norm() < 1.0)
-//            continue;
-
-        it_per_id.orthonormal_vec.head(3) = Rotation_psi.eulerAngles(0,1,2);
-        it_per_id.orthonormal_vec(3) = atan2(d_w.norm(), n_w.norm());
-
-        index++;
+        lines[k]->orthonormal_vec.head(3) = Rotation_psi.eulerAngles(0,1,2);
+        lines[k]->orthonormal_vec(3) = atan2(d_w.norm(), n_w.norm());
     }
 }
 
@@ -596,10 +647,9 @@ void FeatureManager::removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3
     {
         it_next++;
 
-        if (it->start_frame != 0)
-            it->start_frame--;
-        else
+        if (it->startFrame() == 0)
         {
+            it->start_handle++;
             Eigen::Vector3d uv_i = it->feature_per_frame[0].point;
             it->feature_per_frame.erase(it->feature_per_frame.begin());
             if (it->feature_per_frame.size() < 2)
@@ -636,10 +686,9 @@ void FeatureManager::removeBack()
     {
         it_next++;
 
-        if (it->start_frame != 0)
-            it->start_frame--;
-        else
+        if (it->startFrame() == 0)
         {
+            it->start_handle++;
             it->feature_per_frame.erase(it->feature_per_frame.begin());
             if (it->feature_per_frame.size() == 0)
                 feature.erase(it);
@@ -653,13 +702,13 @@ void FeatureManager::removeFront(int frame_count)
     {
         it_next++;
 
-        if (it->start_frame == frame_count)
+        if (it->startFrame() == frame_count)
         {
-            it->start_frame--;
+            it->start_handle--;
         }
         else
         {
-            int j = WINDOW_SIZE - 1 - it->start_frame;
+            int j = WINDOW_SIZE - 1 - it->startFrame();
             if (it->endFrame() < frame_count - 1)
                 continue;
             it->feature_per_frame.erase(it->feature_per_frame.begin() + j);
@@ -676,10 +725,9 @@ void FeatureManager::removeLineBack()
     {
         it_next++;
 
-        if (it->start_frame != 0)
-            it->start_frame--;
-        else
+        if (it->startFrame() == 0)
         {
+            it->start_handle++;
             it->line_feature_per_frame.erase(it->line_feature_per_frame.begin());
             if (it->line_feature_per_frame.size() == 0)
                 line_feature.erase(it);
@@ -693,13 +741,13 @@ void FeatureManager::removeLineFront(int frame_count)
     {
         it_next++;
 
-        if (it->start_frame == frame_count)
+        if (it->startFrame() == frame_count)
         {
-            it->start_frame--;
+            it->start_handle--;
         }
         else
         {
-            int j = WINDOW_SIZE - 1 - it->start_frame;
+            int j = WINDOW_SIZE - 1 - it->startFrame();
             if (it->endFrame() < frame_count - 1)
                 continue;
             it->line_feature_per_frame.erase(it->line_feature_per_frame.begin() + j);
@@ -713,8 +761,8 @@ double FeatureManager::compensatedParallax2(const FeaturePerId &it_per_id, int f
 {
     //check the second last frame is keyframe or not
     //parallax betwwen seconde last frame and third last frame
-    const FeaturePerFrame &frame_i = it_per_id.feature_per_frame[frame_count - 2 - it_per_id.start_frame];
-    const FeaturePerFrame &frame_j = it_per_id.feature_per_frame[frame_count - 1 - it_per_id.start_frame];
+    const FeaturePerFrame &frame_i = it_per_id.feature_per_frame[frame_count - 2 - it_per_id.startFrame()];
+    const FeaturePerFrame &frame_j = it_per_id.feature_per_frame[frame_count - 1 - it_per_id.startFrame()];
 
     double ans = 0;
     Vector3d p_j = frame_j.point;
@@ -744,7 +792,7 @@ double FeatureManager::compensatedParallax2(const FeaturePerId &it_per_id, int f
     return ans;
 }
 
-void FeatureManager::calcOrthonormalRepresent(const Vector3d _direction_vec, const Vector3d _normal_vec, Vector3d &_out_psi, double &_out_phi)
+void FeatureManager::calcOrthonormalRepresent(const Vector3d &_direction_vec, const Vector3d &_normal_vec, Vector3d &_out_psi, double &_out_phi)
 {
     Matrix3d U_mat;
 
@@ -809,9 +857,9 @@ void FeatureManager::calcOrthonormalRepresent(const Vector3d _direction_vec, con
 }
 
 
-void FeatureManager::calcPluckerLine(const Vector3d _prev_sp, const Vector3d _prev_ep,
-                                     const Vector3d _curr_sp, const Vector3d _curr_ep,
-                                     const Vector3d _origin_prev, const Vector3d _origin_curr,
+void FeatureManager::calcPluckerLine(const Vector3d &_prev_sp, const Vector3d &_prev_ep,
+                                     const Vector3d &_curr_sp, const Vector3d &_curr_ep,
+                                     const Vector3d &_origin_prev, const Vector3d &_origin_curr,
                                      Vector3d &_out_direction_vec, Vector3d &_out_normal_vec,
                                      Vector4d &prev_plane, Vector4d &curr_plane)
 {
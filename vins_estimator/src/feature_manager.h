@@ -6,6 +6,7 @@
 #include <vector>
 #include <numeric>
 #include <random>
+#include <thread>
 using namespace std;
 
 #include <eigen3/Eigen/Dense>
@@ -25,6 +26,8 @@ using namespace line_descriptor;
 
 
 #include "utility/tic_toc.h"
+#include "utility/window_buffer.h"
+#include "utility/worker_pool.h"
 #include "parameters.h"
 
 class LineFeaturePerFrame
@@ -72,7 +75,8 @@ class LineFeaturePerId
 {
   public:
     const int feature_id;
-    int start_frame;
+    int start_handle; // frame handle of the first observation, stable while the window slides
+    const int *window_base;
     vector<LineFeaturePerFrame> line_feature_per_frame;
 
     int used_num;
@@ -120,8 +124,8 @@ class LineFeaturePerId
 
     int vp_id;
 
-    LineFeaturePerId(int _feature_id, int _start_frame)
-        : feature_id(_feature_id), start_frame(_start_frame), orthonormal_vec(0,0,0,0),
+    LineFeaturePerId(int _feature_id, int _start_frame, const int *_window_base)
+        : feature_id(_feature_id), start_handle(*_window_base + _start_frame), window_base(_window_base), orthonormal_vec(0,0,0,0),
           used_num(0), psi(0, 0, 0),pi(0), solve_flag(0), updated_pose(0), direction_vec(0,0,0), normal_vec(0,0,0),
           sp_3d_c0(0,0,0), ep_3d_c0(0,0,0), sp_3d_c1(0,0,0), ep_3d_c1(0,0,0),
           sp_2d_c0(0,0,0), ep_2d_c0(0,0,0), sp_2d_c1(0,0,0), ep_2d_c1(0,0,0),
@@ -130,6 +134,11 @@ class LineFeaturePerId
         R = Matrix3d::Zero();
     }
 
+    // window slot of the first observation
+    int startFrame() const
+    {
+        return start_handle - *window_base;
+    }
     int endFrame();
 };
 
@@ -163,7 +172,8 @@ class FeaturePerId
 {
   public:
     const int feature_id;
-    int start_frame;
+    int start_handle; // frame handle of the first observation, stable while the window slides
+    const int *window_base;
     vector<FeaturePerFrame> feature_per_frame;
 
     int used_num;
@@ -174,19 +184,35 @@ class FeaturePerId
 
     Vector3d gt_p;
 
-    FeaturePerId(int _feature_id, int _start_frame)
-        : feature_id(_feature_id), start_frame(_start_frame),
+    FeaturePerId(int _feature_id, int _start_frame, const int *_window_base)
+        : feature_id(_feature_id), start_handle(*_window_base + _start_frame), window_base(_window_base),
           used_num(0), estimated_depth(-1.0), solve_flag(0)
     {
     }
 
+    // window slot of the first observation
+    int startFrame() const
+    {
+        return start_handle - *window_base;
+    }
     int endFrame();
 };
 
+const int NUM_OF_LINE_TRI_THREADS = 4;
+const double MIN_LINE_TRIANGULATION_SCORE = 1e-4; // baseline (m) x sine of the angle between the planes
+
+// one line observation packed for the batched triangulation
+struct LineTriangulationObs
+{
+    int frame;
+    Vector3d sp;
+    Vector3d ep;
+};
+
 class FeatureManager
 {
   public:
-    FeatureManager(Matrix3d _Rs[]);
+    FeatureManager(const WindowBuffer<Matrix3d> &_Rs);
 
     void setRic(Matrix3d _ric[]);
 
@@ -209,21 +235,22 @@ class FeatureManager
     void removeLineFailures();
     void clearDepth(const VectorXd &x);
     VectorXd getDepthVector();
-    void triangulate(Vector3d Ps[], Vector3d tic[], Matrix3d ric[]);
-    void triangulateLine(Vector3d Ps[], Matrix3d Rs[],Vector3d tic[], Matrix3d ric[], Mat img);
+    void triangulate(const WindowBuffer<Vector3d> &Ps, Vector3d tic[], Matrix3d ric[]);
+    void triangulateLine(const WindowBuffer<Vector3d> &Ps, const WindowBuffer<Matrix3d> &Rs, Vector3d tic[], Matrix3d ric[], Mat img);
     void removeBackShiftDepth(Eigen::Matrix3d marg_R, Eigen::Vector3d marg_P, Eigen::Matrix3d new_R, Eigen::Vector3d new_P);
     void removeBack();
     void removeFront(int frame_count);
     void removeLineBack();
     void removeLineFront(int frame_count);
+    void advanceWindow();
     void removeOutlier();
-    void calcPluckerLine(const Vector3d _prev_sp, const Vector3d _prev_ep,
-                         const Vector3d _curr_sp, const Vector3d _curr_ep,
-                         const Vector3d _origin_prev, const Vector3d _origin_curr,
+    void calcPluckerLine(const Vector3d &_prev_sp, const Vector3d &_prev_ep,
+                         const Vector3d &_curr_sp, const Vector3d &_curr_ep,
+                         const Vector3d &_origin_prev, const Vector3d &_origin_curr,
                          Vector3d &_out_direction_vec, Vector3d &_out_normal_vec,
                          Vector4d &prev_plane, Vector4d &curr_plane);
     void skewMatFromVector3d(const Vector3d &_in_pt, Matrix3d &_out_skew_mat);
-    void calcOrthonormalRepresent(const Vector3d _direction_vec, const Vector3d _normal_vec, Vector3d &_out_psi, double &_out_phi);
+    void calcOrthonormalRepresent(const Vector3d &_direction_vec, const Vector3d &_normal_vec, Vector3d &_out_psi, double &_out_phi);
 
     Matrix<double, 6, 1> plk_from_pose( Matrix<double, 6, 1> plk_c, Eigen::Matrix3d Rcw, Eigen::Vector3d tcw );
     Matrix<double, 6, 1> plk_to_pose( Matrix<double, 6, 1> plk_w, Eigen::Matrix3d Rcw, Eigen::Vector3d tcw );
@@ -231,7 +258,7 @@ class FeatureManager
 
     vector<Vector4d> getLineOrthonormal();
     void setOrthoPlucker(const vector<Vector4d> &get_lineOrtho);
-    void setLineOrtho(vector<Vector4d> &get_lineOrtho, Vector3d Ps[], Matrix3d Rs[],Vector3d tic, Matrix3d ric);
+    void setLineOrtho(vector<Vector4d> &get_lineOrtho, const WindowBuffer<Vector3d> &Ps, const WindowBuffer<Matrix3d> &Rs, Vector3d tic, Matrix3d ric);
     void getHSVColor(float h, float& red, float & green, float & blue);
 
 
@@ -242,10 +269,18 @@ class FeatureManager
     vector<viz::WLine> lines_prev_prev;
 
     int frame_diff_for_line = 4;
+    double line_triangulation_cost = 0;
 
   private:
+    void triangulateLineRange(const vector<LineFeaturePerId *> &lines,
+                              const vector<LineTriangulationObs> &obs,
+                              const vector<int> &obs_offset,
+                              const Matrix3d R_wc[], const Vector3d t_wc[],
+                              int begin, int end);
     double compensatedParallax2(const FeaturePerId &it_per_id, int frame_count);
-    const Matrix3d *Rs;
+    int window_base; // handle of window slot 0
+    const WindowBuffer<Matrix3d> &Rs;
+    WorkerPool line_tri_pool; // the calling thread is the NUM_OF_LINE_TRI_THREADS-th
     Matrix3d ric[NUM_OF_CAM];
 
 };
@@ -0,0 +1,111 @@
+#include "frame_budget.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "parameters.h"
+
+// per level: lines go first, then the vanishing points, points last
+static const double POINT_FRACTION[BudgetController::MAX_LEVEL + 1] = {1.0, 1.0, 0.75, 0.6, 0.5};
+static const double LINE_FRACTION[BudgetController::MAX_LEVEL + 1] = {1.0, 0.75, 0.5, 0.35, 0.25};
+static const bool VP_FACTORS[BudgetController::MAX_LEVEL + 1] = {true, true, true, false, false};
+static const double ITERATION_FRACTION[BudgetController::MAX_LEVEL + 1] = {1.0, 0.75, 0.6, 0.5, 0.4};
+
+static const double SMOOTHING = 0.2;     // weight of the newest frame in the averages
+static const size_t QUEUE_DEPTH = 2;     // queued frames that count as falling behind
+static const double RECOVER_RATIO = 0.7; // of the deadline, to step a level down
+static const int RECOVER_FRAMES = 20;
+static const int HOLD_FRAMES = 5;        // after a change, for the averages to follow
+static const int MIN_TRACKER_LINES = 20;
+static const double MIN_SOLVER_SHARE = 0.25; // of the deadline, whatever the rest costs
+
+BudgetController::BudgetController() : deadline_ms(0)
+{
+    reset();
+}
+
+void BudgetController::setDeadline(double _deadline_ms)
+{
+    deadline_ms = std::max(0.0, _deadline_ms);
+    apply();
+}
+
+void BudgetController::reset()
+{
+    current.level = 0;
+    frame_ms_avg = other_ms_avg = lines_avg = 0;
+    frames = calm_frames = hold_frames = 0;
+    apply();
+}
+
+void BudgetController::update(double frame_ms, double solve_ms, int lines, size_t queue_depth)
+{
+    double weight = frames == 0 ? 1.0 : SMOOTHING;
+    frames++;
+    frame_ms_avg += weight * (frame_ms - frame_ms_avg);
+    other_ms_avg += weight * (std::max(0.0, frame_ms - solve_ms) - other_ms_avg);
+    // the tracker's line budget is relative to what it sent undegraded
+    if (current.level == 0)
+        lines_avg += weight * (lines - lines_avg);
+    if (!active())
+        return;
+
+    int previous = current.level;
+    if (hold_frames > 0)
+        hold_frames--;
+    else if (frame_ms_avg > deadline_ms || queue_depth > QUEUE_DEPTH)
+    {
+        calm_frames = 0;
+        if (current.level < MAX_LEVEL)
+        {
+            current.level++;
+            hold_frames = HOLD_FRAMES;
+        }
+    }
+    else if (frame_ms_avg < RECOVER_RATIO * deadline_ms && queue_depth == 0)
+    {
+        if (++calm_frames >= RECOVER_FRAMES && current.level > 0)
+        {
+            current.level--;
+            calm_frames = 0;
+            hold_frames = HOLD_FRAMES;
+        }
+    }
+    else
+        calm_frames = 0;
+    // the solver time follows the other stages on every frame, not only on a level change
+    apply();
+    if (current.level > previous)
+        ROS_WARN("frame %.1f ms over the %.1f ms deadline, %zu queued: %s", frame_ms_avg, deadline_ms, queue_depth,
+                 describe().c_str());
+    else if (current.level < previous)
+        ROS_INFO("frame %.1f ms within the %.1f ms deadline: %s", frame_ms_avg, deadline_ms, describe().c_str());
+}
+
+void BudgetController::apply()
+{
+    int level = current.level;
+    current.point_fraction = POINT_FRACTION[level];
+    current.line_fraction = LINE_FRACTION[level];
+    current.vp_factors = VP_FACTORS[level];
+    current.num_iterations = std::max(1, (int)std::lround(NUM_ITERATIONS * ITERATION_FRACTION[level]));
+    current.solver_time = SOLVER_TIME;
+    if (active() && frames > 0)
+        current.solver_time = std::min(SOLVER_TIME,
+                                       std::max(MIN_SOLVER_SHARE * deadline_ms, deadline_ms - other_ms_avg) * 1e-3);
+    current.tracker_lines = 0;
+    if (level > 0)
+        current.tracker_lines = std::max(MIN_TRACKER_LINES, (int)std::lround(lines_avg * LINE_FRACTION[level]));
+}
+
+std::string BudgetController::describe() const
+{
+    char text[192];
+    snprintf(text, sizeof(text), "level %d, %.0f%% points, %.0f%% lines, vp %s, %d iterations, %.1f ms solver, %s",
+             current.level, 100 * current.point_fraction, 100 * current.line_fraction,
+             current.vp_factors ? "on" : "off", current.num_iterations, current.solver_time * 1e3,
+             current.tracker_lines ? (std::to_string(current.tracker_lines) + " tracker lines").c_str()
+                                   : "all tracker lines");
+    return text;
+}
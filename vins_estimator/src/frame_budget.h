@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+// What one solve may spend, set by BudgetController before processImage().
+// The fractions apply to the landmarks eligible for the solve; the longest
+// tracked ones are kept.
+struct FrameBudget
+{
+    int level;             // 0: everything, BudgetController::MAX_LEVEL: most degraded
+    double point_fraction; // point landmarks with residuals
+    double line_fraction;  // line landmarks with residuals
+    bool vp_factors;       // vanishing point residuals of the kept lines
+    int num_iterations;
+    double solver_time;    // s
+    int tracker_lines;     // lines the feature tracker keeps per image, 0: all
+};
+
+// Holds the per-frame time of the estimator under frame_deadline. After every
+// frame it compares the smoothed frame time and the feature_buf backlog with
+// the deadline and steps the degradation level: one level up as soon as the
+// deadline is missed or frames queue up, one level down after a run of
+// frames well within it. Each level trims the line and point residuals, the
+// vanishing point factors, the solver iterations and the line budget of the
+// tracker; the solver time follows what the rest of the frame leaves of the
+// deadline.
+class BudgetController
+{
+  public:
+    static const int MAX_LEVEL = 4;
+
+    BudgetController();
+
+    // deadline_ms 0 keeps the configured limits and never degrades
+    void setDeadline(double deadline_ms);
+    bool active() const { return deadline_ms > 0; }
+
+    // process thread, after each frame: its time including the solve, the
+    // solve alone, the lines it carried and the frames still queued
+    void update(double frame_ms, double solve_ms, int lines, size_t queue_depth);
+    void reset();
+
+    const FrameBudget &budget() const { return current; }
+    double frameMs() const { return frame_ms_avg; }
+    std::string describe() const;
+
+  private:
+    void apply();
+
+    double deadline_ms;
+    FrameBudget current;
+    double frame_ms_avg, other_ms_avg; // exponential averages
+    double lines_avg;                  // lines per frame at level 0
+    int frames, calm_frames, hold_frames;
+};
@@ -0,0 +1,171 @@
+#include "imu_propagator.h"
+#include "parameters.h"
+#include "utility/utility.h"
+#include "utility/visualization.h"
+#include <uvslam/trace.h>
+
+// imu samples older than this behind the newest one are never re-integrated
+const double IMU_HISTORY_SPAN = 2.0;
+// of imu_rate the propagator thread may fall behind the imu callback
+const double IMU_INPUT_SECONDS = 2.0;
+const int LATENCY_REPORT_CNT = 200;
+
+ImuPropagator::ImuPropagator()
+    : imu_in(4096), imu_dropped(0), state_seq(0), seen_seq(0), latest_time(0), running(false),
+      latency_sum(0), latency_max(0), latency_cnt(0)
+{
+    cur.valid = false;
+    state_buf.valid = false;
+}
+
+ImuPropagator::~ImuPropagator()
+{
+    stop();
+}
+
+void ImuPropagator::start(ros::NodeHandle &n)
+{
+    pub_latency = n.advertise<std_msgs::Float32>("imu_propagate_latency", 100);
+    // before the imu callback runs
+    imu_in.resize((size_t)std::max(1.0, IMU_RATE * IMU_INPUT_SECONDS));
+    running = true;
+    worker = std::thread(&ImuPropagator::process, this);
+}
+
+void ImuPropagator::stop()
+{
+    if (!running)
+        return;
+    running = false;
+    con.notify_one();
+    worker.join();
+}
+
+void ImuPropagator::inputImu(const sensor_msgs::ImuConstPtr &imu_msg)
+{
+    ImuSample sample;
+    sample.msg = imu_msg;
+    sample.arrival_us = Tracer::nowUs();
+    if (!imu_in.push(sample))
+    {
+        unsigned long dropped = ++imu_dropped;
+        ROS_WARN_THROTTLE(1.0, "imu propagator buffer full (%zu samples), %lu imu messages dropped so far",
+                          imu_in.capacity(), dropped);
+    }
+    con.notify_one();
+}
+
+// one copy per solve under the mutex; the propagator holds it only while
+// copying the state out, never while integrating
+void ImuPropagator::setState(const PropagatorState &state)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_state);
+        state_buf = state;
+        state_seq.store(state_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    con.notify_one();
+}
+
+bool ImuPropagator::fetchState(PropagatorState &state)
+{
+    if (state_seq.load(std::memory_order_acquire) == seen_seq)
+        return false;
+    std::lock_guard<std::mutex> lock(m_state);
+    state = state_buf;
+    seen_seq = state_seq.load(std::memory_order_relaxed);
+    return true;
+}
+
+void ImuPropagator::predict(const sensor_msgs::ImuConstPtr &imu_msg)
+{
+    double t = imu_msg->header.stamp.toSec();
+    double dt = t - latest_time;
+    latest_time = t;
+
+    Eigen::Vector3d linear_acceleration{imu_msg->linear_acceleration.x,
+                                        imu_msg->linear_acceleration.y,
+                                        imu_msg->linear_acceleration.z};
+    Eigen::Vector3d angular_velocity{imu_msg->angular_velocity.x,
+                                     imu_msg->angular_velocity.y,
+                                     imu_msg->angular_velocity.z};
+
+    Eigen::Vector3d un_acc_0 = cur.Q * (cur.acc_0 - cur.Ba) - cur.g;
+    Eigen::Vector3d un_gyr = 0.5 * (cur.gyr_0 + angular_velocity) - cur.Bg;
+    cur.Q = cur.Q * Utility::deltaQ(un_gyr * dt);
+    Eigen::Vector3d un_acc_1 = cur.Q * (linear_acceleration - cur.Ba) - cur.g;
+    Eigen::Vector3d un_acc = 0.5 * (un_acc_0 + un_acc_1);
+
+    cur.P = cur.P + dt * cur.V + 0.5 * dt * dt * un_acc;
+    cur.V = cur.V + dt * un_acc;
+
+    cur.acc_0 = linear_acceleration;
+    cur.gyr_0 = angular_velocity;
+}
+
+// arrival to publish of one imu sample; also a trace span, so the tracer's
+// /diagnostics percentiles cover it
+void ImuPropagator::recordLatency(int64_t arrival_us)
+{
+    int64_t now_us = Tracer::nowUs();
+    Tracer::instance().record("imu_propagate", 0, arrival_us, now_us);
+    double latency = (now_us - arrival_us) * 1e-3;
+    latency_sum += latency;
+    latency_max = std::max(latency_max, latency);
+    if (++latency_cnt == LATENCY_REPORT_CNT)
+    {
+        std_msgs::Float32 msg;
+        msg.data = latency_sum / latency_cnt;
+        pub_latency.publish(msg);
+        ROS_DEBUG("imu propagate latency mean %f ms, max %f ms", msg.data, latency_max);
+        latency_sum = 0;
+        latency_max = 0;
+        latency_cnt = 0;
+    }
+}
+
+// thread: imu-rate propagation
+void ImuPropagator::process()
+{
+    while (running)
+    {
+        {
+            std::unique_lock<std::mutex> lk(m_wait);
+            con.wait_for(lk, std::chrono::milliseconds(1), [&]
+                         { return !imu_in.empty() || state_seq.load() != seen_seq || !running; });
+        }
+
+        PropagatorState state;
+        if (fetchState(state))
+        {
+            cur = state;
+            latest_time = state.t;
+            while (!imu_history.empty() && imu_history.front()->header.stamp.toSec() <= state.t)
+                imu_history.pop_front();
+            if (cur.valid)
+            {
+                for (auto &imu_msg : imu_history)
+                    predict(imu_msg);
+            }
+        }
+
+        while (!imu_in.empty())
+        {
+            ImuSample &sample = imu_in.front();
+            double t = sample.msg->header.stamp.toSec();
+            imu_history.push_back(sample.msg);
+            while (t - imu_history.front()->header.stamp.toSec() > IMU_HISTORY_SPAN)
+                imu_history.pop_front();
+
+            if (cur.valid && t > latest_time)
+            {
+                predict(sample.msg);
+                std_msgs::Header header = sample.msg->header;
+                header.frame_id = "world";
+                pubLatestOdometry(cur.P, cur.Q, cur.V, header);
+                recordLatency(sample.arrival_us);
+            }
+            imu_in.pop();
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <ros/ros.h>
+#include <sensor_msgs/Imu.h>
+#include <std_msgs/Float32.h>
+#include <eigen3/Eigen/Dense>
+
+#include "utility/spsc_queue.h"
+
+// estimator state handed to the propagator after every solve
+struct PropagatorState
+{
+    bool valid;
+    double t; // time of the last imu sample integrated by the estimator
+    Eigen::Vector3d P;
+    Eigen::Quaterniond Q;
+    Eigen::Vector3d V;
+    Eigen::Vector3d Ba;
+    Eigen::Vector3d Bg;
+    Eigen::Vector3d acc_0;
+    Eigen::Vector3d gyr_0;
+    Eigen::Vector3d g;
+};
+
+// IMU-rate pose output running on its own thread. It owns a copy of the
+// latest estimator state (handed over under a mutex by the process thread)
+// and re-integrates its buffered imu samples past the solve timestamp, so
+// publishing never waits on the optimizer.
+class ImuPropagator
+{
+  public:
+    ImuPropagator();
+    ~ImuPropagator();
+
+    void start(ros::NodeHandle &n);
+    void stop();
+
+    // imu callback thread
+    void inputImu(const sensor_msgs::ImuConstPtr &imu_msg);
+    // imu messages lost to a full input ring
+    unsigned long droppedImu() const { return imu_dropped.load(); }
+
+    // process thread
+    void setState(const PropagatorState &state);
+
+  private:
+    struct ImuSample
+    {
+        sensor_msgs::ImuConstPtr msg;
+        int64_t arrival_us; // Tracer::nowUs()
+    };
+
+    void process();
+    bool fetchState(PropagatorState &state);
+    void predict(const sensor_msgs::ImuConstPtr &imu_msg);
+    void recordLatency(int64_t arrival_us);
+
+    SPSCQueue<ImuSample> imu_in;
+    std::atomic<unsigned long> imu_dropped;
+    std::deque<sensor_msgs::ImuConstPtr> imu_history;
+
+    // the latest state; state_seq counts the setState() calls and wakes the
+    // thread, the copy itself is under m_state
+    std::mutex m_state;
+    PropagatorState state_buf;
+    std::atomic<unsigned> state_seq;
+    unsigned seen_seq;
+
+    PropagatorState cur;
+    double latest_time;
+
+    std::thread worker;
+    std::atomic<bool> running;
+    std::mutex m_wait;
+    std::condition_variable con;
+
+    ros::Publisher pub_latency;
+    double latency_sum, latency_max;
+    int latency_cnt;
+};
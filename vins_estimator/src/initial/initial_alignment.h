@@ -5,23 +5,33 @@
 #include "../utility/utility.h"
 #include <ros/ros.h>
 #include <map>
+#include <memory>
 #include "../feature_manager.h"
 
 using namespace Eigen;
 using namespace std;
 
+typedef map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> ImagePoints;
+typedef map<int, vector<Eigen::Matrix<double, 15, 1>>> ImageLines;
+
 class ImageFrame
 {
     public:
         ImageFrame(){};
-        ImageFrame(const map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>>& _points,
-                   const map<int, vector<Eigen::Matrix<double, 15, 1>>>& _lines, double _t):t{_t},is_key_frame{false}
+        // the observation maps are shared with the caller, never copied
+        ImageFrame(const shared_ptr<const ImagePoints> &_points,
+                   const shared_ptr<const ImageLines> &_lines, double _t):points{_points},lines{_lines},t{_t},is_key_frame{false}
         {
-            points = _points;
-            lines = _lines;
         };
-        map<int, vector<pair<int, Eigen::Matrix<double, 7, 1>>>> points;
-        map<int, vector<Eigen::Matrix<double, 15, 1>>> lines;
+        // only the initializer reads the observations; afterwards a frame is
+        // just its timestamp, pose and pre-integration
+        void releaseFeatures()
+        {
+            points.reset();
+            lines.reset();
+        }
+        shared_ptr<const ImagePoints> points;
+        shared_ptr<const ImageLines> lines;
         double t;
         Matrix3d R;
         Vector3d T;
@@ -29,4 +39,5 @@ class ImageFrame
         bool is_key_frame;
 };
 
-bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, Vector3d* Bgs, Vector3d &g, VectorXd &x);
+void solveGyroscopeBias(map<double, ImageFrame> &all_image_frame, WindowBuffer<Vector3d> &Bgs);
+bool VisualIMUAlignment(map<double, ImageFrame> &all_image_frame, WindowBuffer<Vector3d> &Bgs, Vector3d &g, VectorXd &x);
@@ -53,6 +53,24 @@ struct ReprojectionError3D
 	double observed_v;
 };
 
+// Structure of the last successful SFM, kept across initialization
+// attempts. Poses are camera-to-world, keyed by frame stamp, and share the
+// gauge of the SFM that produced the points.
+struct SFMCache
+{
+	SFMCache() : reuse(0) {}
+	void clear()
+	{
+		poses.clear();
+		points.clear();
+		reuse = 0;
+	}
+
+	map<double, pair<Matrix3d, Vector3d>> poses;
+	map<int, Vector3d> points;
+	int reuse;	// attempts served from the cache since the last full SFM
+};
+
 class GlobalSFM
 {
 public:
@@ -5,7 +5,13 @@ int POINT_ONLY;
 int ENABLE_DEPTH;
 int SAVE;
 
+int WINDOW_SIZE = 10;
+int NUM_OF_F = 1000;
+int NUM_OF_LF = 1000;
+
 double INIT_DEPTH;
+int INIT_CACHE_REUSE = 5;
+int INIT_IMU_FALLBACK = 0;
 double MIN_PARALLAX;
 double ACC_N, ACC_W;
 double GYR_N, GYR_W;
@@ -24,6 +30,9 @@ double BIAS_ACC_THRESHOLD;
 double BIAS_GYR_THRESHOLD;
 double SOLVER_TIME;
 int NUM_ITERATIONS;
+double FRAME_DEADLINE = 0;
+int MAX_SELECTED_POINTS = 0;
+int MAX_SELECTED_LINES = 0;
 int ESTIMATE_EXTRINSIC;
 int ESTIMATE_TD;
 int ROLLING_SHUTTER;
@@ -36,10 +45,16 @@ std::string VALIDITY_RESULT_PATH;
 std::string POSE_RESULT_PATH;
 std::string FEATURE_RESULT_PATH;
 std::string MESH_RESULT_PATH;
+std::string SOLVE_TIME_PATH;
+std::string TRACK_LOG_PATH;
+int TRACE_ENABLE = 0;
+std::string TRACE_PATH;
+double TRACE_SUMMARY_PERIOD = 1.0;
 
 std::string EX_CALIB_RESULT_PATH;
 std::string VINS_RESULT_PATH;
 std::string IMU_TOPIC;
+double IMU_RATE = 1000;
 double ROW, COL;
 double TD, TR;
 
@@ -68,6 +83,11 @@ void readParameters(ros::NodeHandle &n)
 {
     std::string config_file;
     config_file = readParam<std::string>(n, "config_file");
+    readParameters(config_file);
+}
+
+void readParameters(const std::string &config_file)
+{
     cv::FileStorage fsSettings(config_file, cv::FileStorage::READ);
     if(!fsSettings.isOpened())
     {
@@ -81,12 +101,38 @@ void readParameters(ros::NodeHandle &n)
     PROJ_CX = PROJ["cx"];
     PROJ_CY = PROJ["cy"];
     fsSettings["imu_topic"] >> IMU_TOPIC;
+    if (!fsSettings["imu_rate"].empty())
+        IMU_RATE = fsSettings["imu_rate"];
 
 
     SOLVER_TIME = fsSettings["max_solver_time"];
     NUM_ITERATIONS = fsSettings["max_num_iterations"];
     MIN_PARALLAX = fsSettings["keyframe_parallax"];
     MIN_PARALLAX = MIN_PARALLAX / FOCAL_LENGTH;
+    if (!fsSettings["frame_deadline"].empty())
+        FRAME_DEADLINE = fsSettings["frame_deadline"];
+    if (!fsSettings["max_selected_points"].empty())
+        MAX_SELECTED_POINTS = fsSettings["max_selected_points"];
+    if (!fsSettings["max_selected_lines"].empty())
+        MAX_SELECTED_LINES = fsSettings["max_selected_lines"];
+
+    // optional, the defaults match the former compile time sizes
+    if (!fsSettings["window_size"].empty())
+        WINDOW_SIZE = fsSettings["window_size"];
+    if (!fsSettings["max_point_features"].empty())
+        NUM_OF_F = fsSettings["max_point_features"];
+    if (!fsSettings["max_line_features"].empty())
+        NUM_OF_LF = fsSettings["max_line_features"];
+    if (WINDOW_SIZE < 4)
+    {
+        ROS_WARN("window_size %d is too small, use 4", WINDOW_SIZE);
+        WINDOW_SIZE = 4;
+    }
+    ROS_INFO("window size: %d, max point features: %d, max line features: %d", WINDOW_SIZE, NUM_OF_F, NUM_OF_LF);
+    if (!fsSettings["init_cache_reuse"].empty())
+        INIT_CACHE_REUSE = fsSettings["init_cache_reuse"];
+    if (!fsSettings["init_imu_fallback"].empty())
+        INIT_IMU_FALLBACK = fsSettings["init_imu_fallback"];
 
 
     USE_EUROC    = fsSettings["use_euroc"];
@@ -115,6 +161,17 @@ void readParameters(ros::NodeHandle &n)
     std::cout << "result path " << VINS_RESULT_PATH << std::endl;
     std::ofstream fout(VINS_RESULT_PATH, std::ios::out);
     fout.close();
+    SOLVE_TIME_PATH = OUTPUT_PATH + "/solve_time.txt";
+    std::ofstream fout_time(SOLVE_TIME_PATH, std::ios::out);
+    fout_time.close();
+    if (!fsSettings["track_log_path"].empty())
+        fsSettings["track_log_path"] >> TRACK_LOG_PATH;
+    if (!fsSettings["trace_enable"].empty())
+        TRACE_ENABLE = fsSettings["trace_enable"];
+    if (!fsSettings["trace_path"].empty())
+        fsSettings["trace_path"] >> TRACE_PATH;
+    if (!fsSettings["trace_summary_period"].empty())
+        TRACE_SUMMARY_PERIOD = fsSettings["trace_summary_period"];
 
     ACC_N = fsSettings["acc_n"];
     ACC_W = fsSettings["acc_w"];
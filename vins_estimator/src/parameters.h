@@ -18,15 +18,16 @@ extern double PROJ_FX;
 extern double PROJ_FY;
 extern double PROJ_CX;
 extern double PROJ_CY;
-const int WINDOW_SIZE = 10;
+extern int WINDOW_SIZE; // keyframes in the sliding window, minus one
 const int NUM_OF_CAM = 1;
-const int NUM_OF_F = 1000;
-
-const int NUM_OF_LF = 1000; // TODO(Kwangyik):NEED TO BE SET
+extern int NUM_OF_F;    // point landmarks optimized per solve
+extern int NUM_OF_LF;   // line landmarks optimized per solve
 //#define UNIT_SPHERE_ERROR
 //#define UNIT_SPHERE_LOSS
 
 extern double INIT_DEPTH;
+extern int INIT_CACHE_REUSE;  // initialization retries that extend the last SFM
+extern int INIT_IMU_FALLBACK; // gravity-only initialization when holding still
 extern double MIN_PARALLAX;
 extern int ESTIMATE_EXTRINSIC;
 
@@ -46,16 +47,25 @@ extern std::string VALIDITY_RESULT_PATH;
 extern std::string POSE_RESULT_PATH;
 extern std::string FEATURE_RESULT_PATH;
 extern std::string MESH_RESULT_PATH;
+extern std::string SOLVE_TIME_PATH;
+extern std::string TRACK_LOG_PATH; // replay log for the offline tools, empty: off
+extern int TRACE_ENABLE;           // record per-frame stage spans, see uvslam/trace.h
+extern std::string TRACE_PATH;     // directory of the <node>.json traces, empty: percentiles only
+extern double TRACE_SUMMARY_PERIOD; // seconds between /diagnostics percentile summaries
 
 
 extern double BIAS_ACC_THRESHOLD;
 extern double BIAS_GYR_THRESHOLD;
 extern double SOLVER_TIME;
 extern int NUM_ITERATIONS;
+extern double FRAME_DEADLINE; // ms, held by degrading the solve (frame_budget.h), 0: off
+extern int MAX_SELECTED_POINTS; // landmarks with residuals, picked by residual_selector.h; 0: all
+extern int MAX_SELECTED_LINES;
 extern std::string EX_CALIB_RESULT_PATH;
 extern std::string VINS_RESULT_PATH;
 extern std::string GT_RESULT_PATH;
 extern std::string IMU_TOPIC;
+extern double IMU_RATE; // Hz, sizes the IMU queue of the node
 extern double TD;
 extern double TR;
 extern int ESTIMATE_TD;
@@ -67,6 +77,8 @@ extern double LINE_FACTOR;
 extern double VP_FACTOR;
 
 void readParameters(ros::NodeHandle &n);
+// same, without a node; used by the offline tools
+void readParameters(const std::string &config_file);
 
 enum SIZE_PARAMETERIZATION
 {
@@ -0,0 +1,93 @@
+#include "residual_selector.h"
+
+#include <algorithm>
+
+static const int RESELECT_FRAMES = 5;
+static const double REUSE_RATIO = 0.7; // of the cached landmarks, still eligible to keep the cache
+
+ResidualSelector::ResidualSelector(int _grid_cols, int _grid_rows)
+    : grid_cols(_grid_cols), grid_rows(_grid_rows), cell_candidates(_grid_cols * _grid_rows)
+{
+    reset();
+}
+
+void ResidualSelector::reset()
+{
+    cached.clear();
+    frames_since_full = RESELECT_FRAMES;
+    last_reused = 0;
+}
+
+int ResidualSelector::cell(double u, double v, double width, double height) const
+{
+    int col = std::min(std::max((int)(u / width * grid_cols), 0), grid_cols - 1);
+    int row = std::min(std::max((int)(v / height * grid_rows), 0), grid_rows - 1);
+    return row * grid_cols + col;
+}
+
+void ResidualSelector::select(const std::vector<SelectionCandidate> &candidates, int target,
+                              std::vector<unsigned char> &keep)
+{
+    int n = candidates.size();
+    next_cached.clear();
+    last_reused = 0;
+    if (target >= n)
+    {
+        keep.assign(n, 1);
+        for (const SelectionCandidate &c : candidates)
+            next_cached.insert(c.id);
+        cached.swap(next_cached);
+        return;
+    }
+    keep.assign(n, 0);
+
+    int kept = 0;
+    bool full = frames_since_full >= RESELECT_FRAMES;
+    if (!full)
+    {
+        int survivors = 0;
+        for (const SelectionCandidate &c : candidates)
+            survivors += cached.count(c.id);
+        full = survivors < REUSE_RATIO * cached.size();
+    }
+    if (full)
+        frames_since_full = 0;
+    else
+    {
+        frames_since_full++;
+        for (int i = 0; i < n && kept < target; i++)
+            if (cached.count(candidates[i].id))
+            {
+                keep[i] = 1;
+                kept++;
+            }
+        last_reused = kept;
+    }
+
+    for (auto &list : cell_candidates)
+        list.clear();
+    for (int i = 0; i < n; i++)
+        if (!keep[i])
+            cell_candidates[candidates[i].cell].push_back(i);
+    for (auto &list : cell_candidates)
+        std::sort(list.begin(), list.end(), [&](int a, int b) { return candidates[a].score > candidates[b].score; });
+    for (size_t round = 0; kept < target; round++)
+    {
+        bool any = false;
+        for (auto &list : cell_candidates)
+        {
+            if (round >= list.size() || kept >= target)
+                continue;
+            keep[list[round]] = 1;
+            kept++;
+            any = true;
+        }
+        if (!any)
+            break;
+    }
+
+    for (int i = 0; i < n; i++)
+        if (keep[i])
+            next_cached.insert(candidates[i].id);
+    cached.swap(next_cached);
+}
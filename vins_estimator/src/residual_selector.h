@@ -0,0 +1,40 @@
+#pragma once
+
+#include <unordered_set>
+#include <vector>
+
+// one landmark eligible for the solve, in parameter block order
+struct SelectionCandidate
+{
+    int id;      // feature id
+    float score; // higher is more useful, see Estimator::optimization()
+    int cell;    // image grid cell of its latest observation
+};
+
+// Picks the landmarks that get residuals in the sliding-window solve. The
+// kept set is spread over an image grid: the cells take turns giving up their
+// best scored landmark, so a textured corner cannot crowd out the rest of the
+// image. The selection is cached between frames; landmarks kept last time
+// stay kept while they are eligible, and a full reselection happens every
+// RESELECT_FRAMES frames or when too few of them survive.
+class ResidualSelector
+{
+  public:
+    ResidualSelector(int grid_cols = 8, int grid_rows = 6);
+
+    // grid cell of pixel (u, v) in a width x height image
+    int cell(double u, double v, double width, double height) const;
+
+    // keep[i] for candidates[i]; at most target of them
+    void select(const std::vector<SelectionCandidate> &candidates, int target, std::vector<unsigned char> &keep);
+    void reset();
+
+    int reused() const { return last_reused; }
+
+  private:
+    int grid_cols, grid_rows;
+    std::unordered_set<int> cached, next_cached;
+    int frames_since_full;
+    int last_reused;
+    std::vector<std::vector<int>> cell_candidates; // candidate indices per cell, best first
+};
@@ -0,0 +1,66 @@
+#include "alloc_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef COUNT_ALLOCATIONS
+
+static std::atomic<long> alloc_count(0);
+
+void *operator new(std::size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+long AllocCounter::allocations()
+{
+    return alloc_count.load(std::memory_order_relaxed);
+}
+
+bool AllocCounter::enabled()
+{
+    return true;
+}
+
+#else
+
+long AllocCounter::allocations()
+{
+    return 0;
+}
+
+bool AllocCounter::enabled()
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+
+// Process-wide heap allocation counter. The counting operator new/delete
+// are only compiled in with -DCOUNT_ALLOCATIONS (cmake -DCOUNT_ALLOCATIONS=ON),
+// otherwise allocations() always returns 0.
+namespace AllocCounter
+{
+long allocations();
+bool enabled();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+// Contiguous storage for num_blocks ceres parameter blocks of BLOCK_SIZE
+// doubles; arena[i] is the block pointer handed to ceres, arena[i][j] one value.
+// Pointers stay valid until the next resize().
+template <int BLOCK_SIZE>
+class ParameterArena
+{
+  public:
+    void resize(int num_blocks)
+    {
+        data.assign(num_blocks * BLOCK_SIZE, 0.0);
+    }
+
+    double *operator[](int i)
+    {
+        return data.data() + i * BLOCK_SIZE;
+    }
+
+    const double *operator[](int i) const
+    {
+        return data.data() + i * BLOCK_SIZE;
+    }
+
+    int size() const
+    {
+        return data.size() / BLOCK_SIZE;
+    }
+
+  private:
+    std::vector<double> data;
+};
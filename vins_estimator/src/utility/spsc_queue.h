@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded single-producer / single-consumer ring buffer.
+// push() may only be called from the producer thread (the ROS callback
+// thread); every other member is for the consumer thread. The consumer may
+// read any queued element in place through operator[] without popping it.
+template <typename T>
+class SPSCQueue
+{
+  public:
+    explicit SPSCQueue(size_t capacity)
+        : buffer(roundUpPow2(capacity)), mask(buffer.size() - 1), head(0), tail(0)
+    {
+    }
+
+    // drops the queued elements; only before the producer and the consumer start
+    void resize(size_t capacity)
+    {
+        buffer.assign(roundUpPow2(capacity), T());
+        mask = buffer.size() - 1;
+        head.store(0);
+        tail.store(0);
+    }
+
+    SPSCQueue(const SPSCQueue &) = delete;
+    SPSCQueue &operator=(const SPSCQueue &) = delete;
+
+    // producer side, returns false when the ring is full
+    bool push(const T &value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == buffer.size())
+            return false;
+        buffer[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    bool empty() const
+    {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+
+    size_t size() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+        return buffer.size();
+    }
+
+    T &front()
+    {
+        return buffer[head.load(std::memory_order_relaxed) & mask];
+    }
+
+    T &back()
+    {
+        return buffer[(tail.load(std::memory_order_acquire) - 1) & mask];
+    }
+
+    T &operator[](size_t i)
+    {
+        return buffer[(head.load(std::memory_order_relaxed) + i) & mask];
+    }
+
+    void pop()
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        buffer[h & mask] = T();
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    void clear()
+    {
+        while (!empty())
+            pop();
+    }
+
+  private:
+    static size_t roundUpPow2(size_t n)
+    {
+        size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+
+    std::vector<T> buffer;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
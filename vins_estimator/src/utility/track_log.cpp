@@ -0,0 +1,113 @@
+#include "track_log.h"
+
+bool TrackLogWriter::open(const std::string &path)
+{
+    fout.open(path, std::ios::out);
+    fout.precision(9);
+    return fout.is_open();
+}
+
+void TrackLogWriter::imu(double t, double dt, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr)
+{
+    fout << "imu " << std::fixed << t << " " << dt << " "
+         << acc.x() << " " << acc.y() << " " << acc.z() << " "
+         << gyr.x() << " " << gyr.y() << " " << gyr.z() << "\n";
+}
+
+void TrackLogWriter::groundTruth(double t, const Eigen::Vector3d &p, const Eigen::Quaterniond &q)
+{
+    fout << "gt " << std::fixed << t << " "
+         << p.x() << " " << p.y() << " " << p.z() << " "
+         << q.w() << " " << q.x() << " " << q.y() << " " << q.z() << "\n";
+}
+
+void TrackLogWriter::frame(double t, const ImagePoints &points, const ImageLines &lines)
+{
+    int num_points = 0, num_lines = 0;
+    for (auto &id_pts : points)
+        num_points += id_pts.second.size();
+    for (auto &id_lines : lines)
+        num_lines += id_lines.second.size();
+
+    fout << "frame " << std::fixed << t << " " << num_points << " " << num_lines << "\n";
+    for (auto &id_pts : points)
+        for (auto &cam_pt : id_pts.second)
+        {
+            fout << "p " << id_pts.first << " " << cam_pt.first;
+            for (int k = 0; k < 7; k++)
+                fout << " " << cam_pt.second(k);
+            fout << "\n";
+        }
+    for (auto &id_lines : lines)
+        for (auto &line : id_lines.second)
+        {
+            fout << "l " << id_lines.first;
+            for (int k = 0; k < 15; k++)
+                fout << " " << line(k);
+            fout << "\n";
+        }
+}
+
+bool TrackLogReader::open(const std::string &path)
+{
+    fin.open(path, std::ios::in);
+    return fin.is_open();
+}
+
+bool TrackLogReader::next(TrackLogRecord &record)
+{
+    std::string tag;
+    if (!(fin >> tag))
+        return false;
+
+    if (tag == "imu")
+    {
+        record.type = TrackLogRecord::IMU;
+        fin >> record.t >> record.dt
+            >> record.acc.x() >> record.acc.y() >> record.acc.z()
+            >> record.gyr.x() >> record.gyr.y() >> record.gyr.z();
+    }
+    else if (tag == "gt")
+    {
+        record.type = TrackLogRecord::GT;
+        double qw, qx, qy, qz;
+        fin >> record.t >> record.p.x() >> record.p.y() >> record.p.z() >> qw >> qx >> qy >> qz;
+        record.q = Eigen::Quaterniond(qw, qx, qy, qz).normalized();
+    }
+    else if (tag == "frame")
+    {
+        record.type = TrackLogRecord::FRAME;
+        int num_points = 0, num_lines = 0;
+        fin >> record.t >> num_points >> num_lines;
+        record.points = std::make_shared<ImagePoints>();
+        record.lines = std::make_shared<ImageLines>();
+        for (int i = 0; i < num_points && fin; i++)
+        {
+            std::string p;
+            int id, camera;
+            Eigen::Matrix<double, 7, 1> pt;
+            fin >> p >> id >> camera;
+            for (int k = 0; k < 7; k++)
+                fin >> pt(k);
+            if (p != "p")
+                return false;
+            (*record.points)[id].emplace_back(camera, pt);
+        }
+        for (int i = 0; i < num_lines && fin; i++)
+        {
+            std::string l;
+            int id;
+            Eigen::Matrix<double, 15, 1> line;
+            fin >> l >> id;
+            for (int k = 0; k < 15; k++)
+                fin >> line(k);
+            if (l != "l")
+                return false;
+            (*record.lines)[id].emplace_back(line);
+        }
+    }
+    else
+        return false;
+
+    return !fin.fail();
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <eigen3/Eigen/Dense>
+#include "../initial/initial_alignment.h"
+
+// Plain-text log of exactly what the estimator consumes: every processIMU()
+// call and every frame's point and line tracks, plus the ground-truth pose
+// when the node has one. The offline tools replay it without ROS.
+//
+//   imu <t> <dt> <ax> <ay> <az> <gx> <gy> <gz>
+//   gt  <t> <px> <py> <pz> <qw> <qx> <qy> <qz>
+//   frame <t> <points> <lines>
+//   p <id> <camera> <7 values>      (points lines follow their frame)
+//   l <id> <15 values>
+struct TrackLogRecord
+{
+    enum Type
+    {
+        IMU,
+        GT,
+        FRAME
+    };
+
+    Type type;
+    double t;
+    double dt;
+    Eigen::Vector3d acc, gyr;
+    Eigen::Vector3d p;
+    Eigen::Quaterniond q;
+    std::shared_ptr<ImagePoints> points;
+    std::shared_ptr<ImageLines> lines;
+};
+
+class TrackLogWriter
+{
+  public:
+    bool open(const std::string &path);
+    bool isOpen() const { return fout.is_open(); }
+
+    void imu(double t, double dt, const Eigen::Vector3d &acc, const Eigen::Vector3d &gyr);
+    void groundTruth(double t, const Eigen::Vector3d &p, const Eigen::Quaterniond &q);
+    void frame(double t, const ImagePoints &points, const ImageLines &lines);
+
+  private:
+    std::ofstream fout;
+};
+
+class TrackLogReader
+{
+  public:
+    bool open(const std::string &path);
+    // false at the end of the log or on a malformed record
+    bool next(TrackLogRecord &record);
+
+  private:
+    std::ifstream fin;
+};
@@ -302,6 +302,14 @@ void pubOdometry(const Estimator &estimator, const std_msgs::Header &header)
               << tmp_Q.z() << " "
               << tmp_Q.w() << endl;
         foutC.close();
+
+        ofstream fout_time(SOLVE_TIME_PATH, ios::app);
+        fout_time.setf(ios::fixed, ios::floatfield);
+        fout_time.precision(9);
+        fout_time << header.stamp.toSec() << " ";
+        fout_time.precision(3);
+        fout_time << estimator.solve_cost << endl;
+        fout_time.close();
     }
 }
 
@@ -383,11 +391,11 @@ void pubPointCloud(const Estimator &estimator, const std_msgs::Header &header)
     {
         int used_num;
         used_num = it_per_id.feature_per_frame.size();
-        if (!(used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+        if (!(used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
             continue;
-        if (it_per_id.start_frame > WINDOW_SIZE * 3.0 / 4.0 || it_per_id.solve_flag != 1)
+        if (it_per_id.startFrame() > WINDOW_SIZE * 3.0 / 4.0 || it_per_id.solve_flag != 1)
             continue;
-        int imu_i = it_per_id.start_frame;
+        int imu_i = it_per_id.startFrame();
         Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
         Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0]) + estimator.Ps[imu_i];
 
@@ -408,15 +416,15 @@ void pubPointCloud(const Estimator &estimator, const std_msgs::Header &header)
     {
         int used_num;
         used_num = it_per_id.feature_per_frame.size();
-        if (!(used_num >= 2 && it_per_id.start_frame < WINDOW_SIZE - 2))
+        if (!(used_num >= 2 && it_per_id.startFrame() < WINDOW_SIZE - 2))
             continue;
-        //if (it_per_id->start_frame > WINDOW_SIZE * 3.0 / 4.0 || it_per_id->solve_flag != 1)
+        //if (it_per_id->startFrame() > WINDOW_SIZE * 3.0 / 4.0 || it_per_id->solve_flag != 1)
         //        continue;
 
-        if (it_per_id.start_frame == 0 && it_per_id.feature_per_frame.size() <= 2
+        if (it_per_id.startFrame() == 0 && it_per_id.feature_per_frame.size() <= 2
                 && it_per_id.solve_flag == 1 )
         {
-            int imu_i = it_per_id.start_frame;
+            int imu_i = it_per_id.startFrame();
             Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
             Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0]) + estimator.Ps[imu_i];
 
@@ -495,7 +503,7 @@ void pubLineCloud(const Estimator &estimator, std_msgs::Header &header)
     {
         if(it_per_id.solve_flag == 1)
         {
-            int imu_i = it_per_id.start_frame;
+            int imu_i = it_per_id.startFrame();
 
             // transformation (coord): world  -> camera (= camera w.r.t. world)
             //                (point): camera -> camera (= camera w.r.t. world)
@@ -630,12 +638,12 @@ void pubLineCloud(const Estimator &estimator, std_msgs::Header &header)
     for(auto &it_per_id : estimator.f_manager.line_feature)
     {
         int used_num = it_per_id.line_feature_per_frame.size();
-        if(it_per_id.solve_flag == 1 && used_num == 1 && it_per_id.start_frame == 0)
+        if(it_per_id.solve_flag == 1 && used_num == 1 && it_per_id.startFrame() == 0)
         {
 //            if(it_per_id.line_feature_per_frame[0].vp(2) == 0)
 //                continue;
 
-            int imu_i = it_per_id.start_frame;
+            int imu_i = it_per_id.startFrame();
             Matrix3d R_wc = estimator.Rs[imu_i] * estimator.ric[0];
             Vector3d t_wc = estimator.Rs[imu_i] * estimator.tic[0] + estimator.Ps[imu_i];
 
@@ -855,10 +863,10 @@ void pubKeyframe(const Estimator &estimator)
         for (auto &it_per_id : estimator.f_manager.feature)
         {
             int frame_size = it_per_id.feature_per_frame.size();
-            if(it_per_id.start_frame < WINDOW_SIZE - 2 && it_per_id.start_frame + frame_size - 1 >= WINDOW_SIZE - 2 && it_per_id.solve_flag == 1)
+            if(it_per_id.startFrame() < WINDOW_SIZE - 2 && it_per_id.startFrame() + frame_size - 1 >= WINDOW_SIZE - 2 && it_per_id.solve_flag == 1)
             {
 
-                int imu_i = it_per_id.start_frame;
+                int imu_i = it_per_id.startFrame();
                 Vector3d pts_i = it_per_id.feature_per_frame[0].point * it_per_id.estimated_depth;
                 Vector3d w_pts_i = estimator.Rs[imu_i] * (estimator.ric[0] * pts_i + estimator.tic[0])
                         + estimator.Ps[imu_i];
@@ -868,7 +876,7 @@ void pubKeyframe(const Estimator &estimator)
                 p.z = w_pts_i(2);
                 point_cloud.points.push_back(p);
 
-                int imu_j = WINDOW_SIZE - 2 - it_per_id.start_frame;
+                int imu_j = WINDOW_SIZE - 2 - it_per_id.startFrame();
                 sensor_msgs::ChannelFloat32 p_2d;
                 p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].point.x());
                 p_2d.values.push_back(it_per_id.feature_per_frame[imu_j].point.y());
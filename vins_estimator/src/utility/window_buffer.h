@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+// Per-frame storage of the sliding window, addressed by logical slot
+// (0 = oldest frame, size() - 1 = newest). rotate() retires the oldest slot
+// to the back by moving the head index, so marginalizing the oldest frame
+// never copies frame data.
+template <typename T>
+class WindowBuffer
+{
+  public:
+    explicit WindowBuffer(int n)
+        : slot(n), head(0)
+    {
+    }
+
+    T &operator[](int i)
+    {
+        return slot[physical(i)];
+    }
+
+    const T &operator[](int i) const
+    {
+        return slot[physical(i)];
+    }
+
+    // drops the content, slots are value initialized
+    void resize(int n)
+    {
+        slot.assign(n, T());
+        head = 0;
+    }
+
+    // the former slot 0 becomes slot size() - 1, its content is left as is
+    void rotate()
+    {
+        head = physical(1);
+    }
+
+    int size() const
+    {
+        return slot.size();
+    }
+
+  private:
+    int physical(int i) const
+    {
+        int k = head + i;
+        return k >= static_cast<int>(slot.size()) ? k - static_cast<int>(slot.size()) : k;
+    }
+
+    std::vector<T> slot;
+    int head;
+};
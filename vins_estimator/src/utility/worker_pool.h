@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads kept alive between calls, so a short parallel loop on the process
+// thread does not pay for creating and joining them every frame.
+// parallelFor() hands out [0, n) in chunks of grain indices, first come first
+// served, to the workers and the calling thread, and returns once every
+// chunk is done. One parallelFor() at a time; call it from a single thread.
+class WorkerPool
+{
+  public:
+    explicit WorkerPool(int num_workers) : job(nullptr), count(0), grain(1), next(0), busy(0), generation(0), stop(false)
+    {
+        for (int i = 0; i < num_workers; i++)
+            workers.emplace_back(&WorkerPool::work, this);
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        work_cv.notify_all();
+        for (std::thread &t : workers)
+            t.join();
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    int size() const
+    {
+        return workers.size();
+    }
+
+    // job(begin, end) for consecutive ranges covering [0, n)
+    void parallelFor(int n, int _grain, const std::function<void(int, int)> &_job)
+    {
+        _grain = std::max(1, _grain);
+        if (workers.empty() || n <= _grain)
+        {
+            if (n > 0)
+                _job(0, n);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &_job;
+            count = n;
+            grain = _grain;
+            next = 0;
+            busy = workers.size();
+            generation++;
+        }
+        work_cv.notify_all();
+        runChunks();
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this] { return busy == 0; });
+        job = nullptr;
+    }
+
+  private:
+    void work()
+    {
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            work_cv.wait(lock, [&] { return stop || generation != seen; });
+            if (stop)
+                return;
+            seen = generation;
+            lock.unlock();
+            runChunks();
+            lock.lock();
+            if (--busy == 0)
+                done_cv.notify_one();
+        }
+    }
+
+    void runChunks()
+    {
+        while (true)
+        {
+            int begin = next.fetch_add(grain);
+            if (begin >= count)
+                return;
+            (*job)(begin, std::min(begin + grain, count));
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_cv, done_cv;
+
+    // the current parallelFor(), set under the mutex before the workers wake
+    const std::function<void(int, int)> *job;
+    int count, grain;
+    std::atomic<int> next;
+    int busy;
+    size_t generation;
+    bool stop;
+};